@@ -0,0 +1,342 @@
+#include <AK/Benchmarks/Benchmark.h>
+#include <AK/Format.h>
+#include <AK/JsonArraySerializer.h>
+#include <AK/JsonObjectSerializer.h>
+#include <AK/JsonValue.h>
+#include <AK/QuickSort.h>
+#include <AK/StringBuilder.h>
+#include <AK/StringView.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Counting allocations works by replacing malloc() and friends, which is also where
+// kmalloc() and operator new end up outside the kernel. That needs glibc's internal
+// entry points, and doesn't mix with the sanitizers, which replace malloc() themselves.
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#    if defined(__has_feature)
+#        if !__has_feature(address_sanitizer) && !__has_feature(memory_sanitizer)
+#            define AK_BENCHMARK_COUNT_ALLOCATIONS
+#        endif
+#    else
+#        define AK_BENCHMARK_COUNT_ALLOCATIONS
+#    endif
+#endif
+
+namespace AK::Benchmark {
+
+struct AllocationCounts {
+    u64 allocations { 0 };
+    u64 bytes { 0 };
+    u64 frees { 0 };
+};
+
+static bool s_counting_allocations;
+static AllocationCounts s_allocation_counts;
+
+}
+
+#ifdef AK_BENCHMARK_COUNT_ALLOCATIONS
+extern "C" {
+
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void* __libc_memalign(size_t, size_t);
+void __libc_free(void*);
+
+void* malloc(size_t size) noexcept
+{
+    if (AK::Benchmark::s_counting_allocations) {
+        ++AK::Benchmark::s_allocation_counts.allocations;
+        AK::Benchmark::s_allocation_counts.bytes += size;
+    }
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) noexcept
+{
+    if (AK::Benchmark::s_counting_allocations) {
+        ++AK::Benchmark::s_allocation_counts.allocations;
+        AK::Benchmark::s_allocation_counts.bytes += count * size;
+    }
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) noexcept
+{
+    if (AK::Benchmark::s_counting_allocations) {
+        ++AK::Benchmark::s_allocation_counts.allocations;
+        AK::Benchmark::s_allocation_counts.bytes += size;
+        if (ptr)
+            ++AK::Benchmark::s_allocation_counts.frees;
+    }
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size) noexcept
+{
+    if (AK::Benchmark::s_counting_allocations) {
+        ++AK::Benchmark::s_allocation_counts.allocations;
+        AK::Benchmark::s_allocation_counts.bytes += size;
+    }
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept
+{
+    return memalign(alignment, size);
+}
+
+// glibc has no __libc_ entry point for this one, so check the arguments like it would
+// and go through memalign().
+int posix_memalign(void** memptr, size_t alignment, size_t size) noexcept
+{
+    if (!alignment || alignment % sizeof(void*) || (alignment & (alignment - 1)))
+        return EINVAL;
+    void* ptr = memalign(alignment, size);
+    if (!ptr)
+        return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+void free(void* ptr) noexcept
+{
+    if (ptr && AK::Benchmark::s_counting_allocations)
+        ++AK::Benchmark::s_allocation_counts.frees;
+    __libc_free(ptr);
+}
+}
+#endif
+
+namespace AK::Benchmark {
+
+struct Case {
+    const char* name;
+    Function function;
+};
+
+struct Result {
+    const char* name;
+    size_t iterations;
+    // Nanoseconds per iteration, one entry per repetition.
+    Vector<double> times;
+    AllocationCounts allocations;
+};
+
+struct Options {
+    size_t warmup { 1 };
+    size_t repetitions { 5 };
+    u64 min_time_ns { 50'000'000 };
+    StringView filter;
+    bool json { false };
+    bool list { false };
+};
+
+static Vector<Case>& cases()
+{
+    static Vector<Case> cases;
+    return cases;
+}
+
+void register_case(const char* name, Function function)
+{
+    cases().append({ name, function });
+}
+
+static u64 now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1'000'000'000 + ts.tv_nsec;
+}
+
+static u64 run_iterations(Function function, size_t iterations)
+{
+    u64 start = now_ns();
+    for (size_t i = 0; i < iterations; ++i)
+        function();
+    return now_ns() - start;
+}
+
+static Result run_case(const Case& benchmark_case, const Options& options)
+{
+    // Pick the iteration count so a repetition takes at least min_time_ns.
+    size_t iterations = 1;
+    for (;;) {
+        u64 elapsed = run_iterations(benchmark_case.function, iterations);
+        if (elapsed >= options.min_time_ns)
+            break;
+        size_t next = elapsed ? (size_t)((double)iterations * options.min_time_ns / elapsed * 1.2) : iterations * 10;
+        iterations = clamp(next, iterations + 1, iterations * 10);
+    }
+
+    for (size_t i = 0; i < options.warmup; ++i)
+        run_iterations(benchmark_case.function, iterations);
+
+    Result result { benchmark_case.name, iterations, {}, {} };
+    s_allocation_counts = {};
+    for (size_t i = 0; i < options.repetitions; ++i) {
+        s_counting_allocations = true;
+        u64 elapsed = run_iterations(benchmark_case.function, iterations);
+        s_counting_allocations = false;
+        result.times.append((double)elapsed / iterations);
+    }
+    result.allocations = s_allocation_counts;
+    return result;
+}
+
+static double per_iteration(const Result& result, u64 total)
+{
+    return (double)total / (result.iterations * result.times.size());
+}
+
+struct Summary {
+    double min;
+    double median;
+    double mean;
+    double max;
+};
+
+static Summary summarize(const Result& result)
+{
+    auto times = result.times;
+    quick_sort(times);
+    double sum = 0;
+    for (auto time : times)
+        sum += time;
+    size_t middle = times.size() / 2;
+    double median = times.size() % 2 ? times[middle] : (times[middle - 1] + times[middle]) / 2;
+    return { times.first(), median, sum / times.size(), times.last() };
+}
+
+static void print_text(const Vector<Result>& results)
+{
+    outln("{:<44} {:>10} {:>14} {:>14} {:>14} {:>12} {:>14}", "benchmark", "iterations", "min (ns)", "median (ns)", "max (ns)", "allocs/iter", "bytes/iter");
+    for (auto& result : results) {
+        auto summary = summarize(result);
+        outln("{:<44} {:>10} {:>14} {:>14} {:>14} {:>12.1} {:>14.1}",
+            result.name, result.iterations, (u64)summary.min, (u64)summary.median, (u64)summary.max,
+            per_iteration(result, result.allocations.allocations), per_iteration(result, result.allocations.bytes));
+    }
+#ifndef AK_BENCHMARK_COUNT_ALLOCATIONS
+    outln("Allocations were not counted in this build.");
+#endif
+}
+
+static void print_json(const Vector<Result>& results, const Options& options)
+{
+    StringBuilder builder;
+    {
+        JsonObjectSerializer<StringBuilder> json { builder };
+        json.add("warmup", options.warmup);
+        json.add("repetitions", options.repetitions);
+#ifdef AK_BENCHMARK_COUNT_ALLOCATIONS
+        json.add("counts_allocations", true);
+#else
+        json.add("counts_allocations", false);
+#endif
+        auto benchmarks = json.add_array("benchmarks");
+        for (auto& result : results) {
+            auto summary = summarize(result);
+            auto object = benchmarks.add_object();
+            object.add("name", result.name);
+            object.add("iterations", result.iterations);
+            object.add("min_ns", summary.min);
+            object.add("median_ns", summary.median);
+            object.add("mean_ns", summary.mean);
+            object.add("max_ns", summary.max);
+            auto times = object.add_array("times_ns");
+            for (auto time : result.times)
+                times.add(JsonValue(time));
+            times.finish();
+            object.add("allocations_per_iteration", per_iteration(result, result.allocations.allocations));
+            object.add("bytes_per_iteration", per_iteration(result, result.allocations.bytes));
+            object.add("frees_per_iteration", per_iteration(result, result.allocations.frees));
+        }
+    }
+    outln("{}", builder.string_view());
+}
+
+static void print_usage(const char* program)
+{
+    warnln("usage: {} [--json] [--list] [--filter SUBSTRING] [--warmup N] [--repetitions N] [--min-time-ms N]", program);
+}
+
+static bool parse_options(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; ++i) {
+        StringView argument = argv[i];
+        auto next_number = [&]() -> Optional<unsigned> {
+            if (i + 1 >= argc)
+                return {};
+            return StringView(argv[++i]).to_uint();
+        };
+        if (argument == "--json") {
+            options.json = true;
+        } else if (argument == "--list") {
+            options.list = true;
+        } else if (argument == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (argument == "--warmup") {
+            auto value = next_number();
+            if (!value.has_value())
+                return false;
+            options.warmup = value.value();
+        } else if (argument == "--repetitions") {
+            auto value = next_number();
+            if (!value.has_value() || !value.value())
+                return false;
+            options.repetitions = value.value();
+        } else if (argument == "--min-time-ms") {
+            auto value = next_number();
+            if (!value.has_value())
+                return false;
+            options.min_time_ns = (u64)value.value() * 1'000'000;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int run(int argc, char** argv)
+{
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Registration order depends on link order, so sort to keep runs comparable.
+    quick_sort(cases(), [](auto& a, auto& b) { return StringView(a.name) < StringView(b.name); });
+
+    Vector<Result> results;
+    for (auto& benchmark_case : cases()) {
+        if (!options.filter.is_empty() && !StringView(benchmark_case.name).contains(options.filter))
+            continue;
+        if (options.list) {
+            outln("{}", benchmark_case.name);
+            continue;
+        }
+        if (!options.json)
+            warnln("Running {}...", benchmark_case.name);
+        results.append(run_case(benchmark_case, options));
+    }
+    if (options.list)
+        return 0;
+
+    if (options.json)
+        print_json(results, options);
+    else
+        print_text(results);
+    return 0;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    return AK::Benchmark::run(argc, argv);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <AK/Types.h>
+#include <AK/Vector.h>
+
+namespace AK::Benchmark {
+
+using Function = void (*)();
+
+// Registers a benchmark to be run by the harness in Benchmark.cpp. Every call to
+// the function is one iteration; the harness picks how many iterations make up
+// a repetition, so keep a single call small enough to be repeated.
+void register_case(const char* name, Function);
+
+struct Registration {
+    Registration(const char* name, Function function)
+    {
+        register_case(name, function);
+    }
+};
+
+// Keeps the compiler from dropping a value that is computed but never used.
+template<typename T>
+ALWAYS_INLINE void do_not_optimize(const T& value)
+{
+    asm volatile(""
+                 :
+                 : "g"(&value)
+                 : "memory");
+}
+
+// The same values on every run, so results can be compared between runs.
+inline Vector<u32> deterministic_random(size_t count, u32 seed = 1)
+{
+    Vector<u32> values;
+    values.ensure_capacity(count);
+    u32 state = seed ? seed : 1;
+    for (size_t i = 0; i < count; ++i) {
+        // xorshift32
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        values.unchecked_append(state);
+    }
+    return values;
+}
+
+}
+
+using AK::Benchmark::do_not_optimize;
+
+#define BENCHMARK(name)                                                                     \
+    static void __benchmark_##name();                                                       \
+    static AK::Benchmark::Registration __benchmark_registration_##name(#name, __benchmark_##name); \
+    static void __benchmark_##name()
@@ -0,0 +1,78 @@
+#include <AK/Benchmarks/Benchmark.h>
+#include <AK/Bitmap.h>
+
+static constexpr size_t bit_count = 1024 * 1024;
+
+// Mostly full, with a single free bit near the end.
+static const Bitmap& almost_full()
+{
+    static Bitmap bitmap = [] {
+        Bitmap bitmap(bit_count, true);
+        bitmap.set(bit_count - 100, false);
+        return bitmap;
+    }();
+    return bitmap;
+}
+
+// Free runs of 1 to 64 bits scattered between allocated runs, like a well used physical page allocator.
+static const Bitmap& fragmented()
+{
+    static Bitmap bitmap = [] {
+        Bitmap bitmap(bit_count, true);
+        auto values = AK::Benchmark::deterministic_random(bit_count / 64);
+        size_t index = 0;
+        for (auto value : values) {
+            size_t free_length = value % 64 + 1;
+            size_t used_length = (value >> 8) % 128 + 1;
+            if (index + free_length > bit_count)
+                break;
+            bitmap.set_range(index, free_length, false);
+            index += free_length + used_length;
+            if (index >= bit_count)
+                break;
+        }
+        return bitmap;
+    }();
+    return bitmap;
+}
+
+BENCHMARK(bitmap_find_first_unset_1m)
+{
+    do_not_optimize(almost_full().find_first_unset());
+}
+
+BENCHMARK(bitmap_find_one_anywhere_unset_1m)
+{
+    do_not_optimize(almost_full().find_one_anywhere_unset(bit_count / 2));
+}
+
+BENCHMARK(bitmap_find_next_range_of_unset_bits_1m)
+{
+    size_t ranges = 0;
+    size_t from = 0;
+    for (;;) {
+        auto length = fragmented().find_next_range_of_unset_bits(from, 32, 32);
+        if (!length.has_value())
+            break;
+        from += length.value();
+        ++ranges;
+    }
+    do_not_optimize(ranges);
+}
+
+BENCHMARK(bitmap_find_longest_range_of_unset_bits_1m)
+{
+    size_t found_range_size = 0;
+    do_not_optimize(fragmented().find_longest_range_of_unset_bits(bit_count, found_range_size));
+    do_not_optimize(found_range_size);
+}
+
+BENCHMARK(bitmap_find_first_fit_1m)
+{
+    do_not_optimize(fragmented().find_first_fit(64));
+}
+
+BENCHMARK(bitmap_find_best_fit_1m)
+{
+    do_not_optimize(fragmented().find_best_fit(48));
+}
@@ -0,0 +1,35 @@
+#include <AK/Benchmarks/Benchmark.h>
+#include <AK/String.h>
+#include <AK/StringBuilder.h>
+
+BENCHMARK(format_int_1e4)
+{
+    for (int i = 0; i < 10'000; ++i)
+        do_not_optimize(String::formatted("{}", i));
+}
+
+BENCHMARK(format_hex_padded_1e4)
+{
+    for (u32 i = 0; i < 10'000; ++i)
+        do_not_optimize(String::formatted("{:#08x}", i * 2654435761u));
+}
+
+BENCHMARK(format_string_aligned_1e4)
+{
+    for (int i = 0; i < 10'000; ++i)
+        do_not_optimize(String::formatted("{:>20}|{:<10}", "friends", "hello"));
+}
+
+BENCHMARK(format_double_1e4)
+{
+    for (int i = 0; i < 10'000; ++i)
+        do_not_optimize(String::formatted("{:.3}", i / 7.0));
+}
+
+BENCHMARK(format_mixed_appendff_1e4)
+{
+    StringBuilder builder;
+    for (int i = 0; i < 10'000; ++i)
+        builder.appendff("{} {:>6} {:#x} {}\n", "pid", i, i, i % 2 == 0);
+    do_not_optimize(builder.to_string());
+}
@@ -0,0 +1,95 @@
+#include <AK/Benchmarks/Benchmark.h>
+#include <AK/HashMap.h>
+#include <AK/String.h>
+
+static const Vector<u32>& keys()
+{
+    static auto keys = AK::Benchmark::deterministic_random(100'000);
+    return keys;
+}
+
+static const Vector<String>& string_keys()
+{
+    static Vector<String> string_keys = [] {
+        Vector<String> string_keys;
+        for (size_t i = 0; i < 10'000; ++i)
+            string_keys.append(String::formatted("/usr/lib/{:x}.so", keys()[i]));
+        return string_keys;
+    }();
+    return string_keys;
+}
+
+static const HashMap<u32, u32>& populated_map()
+{
+    static HashMap<u32, u32> map = [] {
+        HashMap<u32, u32> map;
+        for (auto key : keys())
+            map.set(key, key);
+        return map;
+    }();
+    return map;
+}
+
+BENCHMARK(hashmap_set_1e5)
+{
+    HashMap<u32, u32> map;
+    for (auto key : keys())
+        map.set(key, key);
+    do_not_optimize(map);
+}
+
+BENCHMARK(hashmap_set_with_capacity_1e5)
+{
+    HashMap<u32, u32> map;
+    map.ensure_capacity(keys().size());
+    for (auto key : keys())
+        map.set(key, key);
+    do_not_optimize(map);
+}
+
+BENCHMARK(hashmap_get_hit_1e5)
+{
+    auto& map = populated_map();
+    u32 sum = 0;
+    for (auto key : keys())
+        sum += map.get(key).value();
+    do_not_optimize(sum);
+}
+
+BENCHMARK(hashmap_get_miss_1e5)
+{
+    auto& map = populated_map();
+    size_t found = 0;
+    for (auto key : keys())
+        found += map.contains(~key);
+    do_not_optimize(found);
+}
+
+BENCHMARK(hashmap_set_remove_1e5)
+{
+    HashMap<u32, u32> map;
+    for (auto key : keys())
+        map.set(key, key);
+    for (auto key : keys())
+        map.remove(key);
+    do_not_optimize(map);
+}
+
+BENCHMARK(hashmap_iterate_1e5)
+{
+    u32 sum = 0;
+    for (auto& it : populated_map())
+        sum += it.value;
+    do_not_optimize(sum);
+}
+
+BENCHMARK(hashmap_string_set_get_1e4)
+{
+    HashMap<String, size_t> map;
+    for (size_t i = 0; i < string_keys().size(); ++i)
+        map.set(string_keys()[i], i);
+    size_t sum = 0;
+    for (auto& key : string_keys())
+        sum += map.get(key).value();
+    do_not_optimize(sum);
+}
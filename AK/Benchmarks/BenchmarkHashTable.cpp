@@ -0,0 +1,70 @@
+#include <AK/Benchmarks/Benchmark.h>
+#include <AK/HashTable.h>
+#include <AK/String.h>
+
+// Inserts, finds and removes `count` integers; half of the lookups miss.
+static void insert_find_remove(int count)
+{
+    HashTable<int> table;
+    for (int i = 0; i < count; ++i)
+        table.set(i);
+
+    size_t found = 0;
+    for (int i = 0; i < count * 2; ++i)
+        found += table.contains(i);
+    do_not_optimize(found);
+
+    for (int i = 0; i < count; ++i)
+        table.remove(i);
+    do_not_optimize(table);
+}
+
+BENCHMARK(hashtable_insert_find_remove_1e3)
+{
+    insert_find_remove(1'000);
+}
+
+BENCHMARK(hashtable_insert_find_remove_1e4)
+{
+    insert_find_remove(10'000);
+}
+
+BENCHMARK(hashtable_insert_find_remove_1e5)
+{
+    insert_find_remove(100'000);
+}
+
+BENCHMARK(hashtable_insert_find_remove_1e6)
+{
+    insert_find_remove(1'000'000);
+}
+
+BENCHMARK(hashtable_insert_find_remove_1e7)
+{
+    insert_find_remove(10'000'000);
+}
+
+static const Vector<String>& strings()
+{
+    static Vector<String> strings = [] {
+        Vector<String> strings;
+        for (int i = 0; i < 100'000; ++i)
+            strings.append(String::number(i));
+        return strings;
+    }();
+    return strings;
+}
+
+BENCHMARK(hashtable_string_insert_find_remove_1e5)
+{
+    HashTable<String> table;
+    for (auto& string : strings())
+        table.set(string);
+    size_t found = 0;
+    for (auto& string : strings())
+        found += table.contains(string);
+    do_not_optimize(found);
+    for (auto& string : strings())
+        table.remove(string);
+    do_not_optimize(table);
+}
@@ -0,0 +1,59 @@
+#include <AK/Benchmarks/Benchmark.h>
+#include <AK/JsonArray.h>
+#include <AK/JsonObject.h>
+#include <AK/JsonParser.h>
+#include <AK/JsonValue.h>
+#include <AK/String.h>
+
+// Looks like what /proc/all gives you: an array of flat objects.
+static const String& document()
+{
+    static String document = [] {
+        JsonArray array;
+        auto values = AK::Benchmark::deterministic_random(1000);
+        for (size_t i = 0; i < values.size(); ++i) {
+            JsonObject object;
+            object.set("pid", (unsigned)i);
+            object.set("name", String::formatted("process-{}", values[i] % 1000));
+            object.set("executable", String::formatted("/usr/bin/{:x}", values[i]));
+            object.set("amount_virtual", values[i]);
+            object.set("kernel", i % 7 == 0);
+            object.set("ratio", values[i] / 4294967296.0);
+            JsonArray threads;
+            for (size_t j = 0; j < i % 4 + 1; ++j)
+                threads.append(i * 4 + j);
+            object.set("threads", move(threads));
+            array.append(move(object));
+        }
+        return JsonValue(move(array)).to_string();
+    }();
+    return document;
+}
+
+static const JsonValue& parsed_document()
+{
+    static JsonValue value = JsonParser(document()).parse().value();
+    return value;
+}
+
+BENCHMARK(json_parse_1e3_objects)
+{
+    JsonParser parser(document());
+    auto value = parser.parse();
+    VERIFY(value.has_value());
+    do_not_optimize(value);
+}
+
+BENCHMARK(json_serialize_1e3_objects)
+{
+    do_not_optimize(parsed_document().to_string());
+}
+
+BENCHMARK(json_lookup_1e3_objects)
+{
+    size_t sum = 0;
+    parsed_document().as_array().for_each([&](auto& value) {
+        sum += value.as_object().get("pid").to_u32();
+    });
+    do_not_optimize(sum);
+}
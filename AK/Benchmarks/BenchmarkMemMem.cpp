@@ -0,0 +1,45 @@
+#include <AK/Benchmarks/Benchmark.h>
+#include <AK/MemMem.h>
+
+static constexpr size_t haystack_size = 1024 * 1024;
+
+// Random lowercase text, so partial matches of the needles keep happening.
+static const Vector<u8>& haystack()
+{
+    static Vector<u8> haystack = [] {
+        Vector<u8> haystack;
+        for (auto value : AK::Benchmark::deterministic_random(haystack_size))
+            haystack.append('a' + value % 26);
+        return haystack;
+    }();
+    return haystack;
+}
+
+static void find_at_end(size_t needle_length)
+{
+    auto& bytes = haystack();
+    auto* needle = bytes.data() + bytes.size() - needle_length;
+    auto offset = AK::memmem_optional(bytes.data(), bytes.size(), needle, needle_length);
+    do_not_optimize(offset);
+}
+
+BENCHMARK(memmem_bitap_4_byte_needle_1m)
+{
+    find_at_end(4);
+}
+
+BENCHMARK(memmem_bitap_16_byte_needle_1m)
+{
+    find_at_end(16);
+}
+
+BENCHMARK(memmem_kmp_64_byte_needle_1m)
+{
+    find_at_end(64);
+}
+
+BENCHMARK(memmem_not_found_1m)
+{
+    auto& bytes = haystack();
+    do_not_optimize(AK::memmem_optional(bytes.data(), bytes.size(), "ABCDEFGH", 8));
+}
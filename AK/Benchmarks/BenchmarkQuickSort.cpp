@@ -0,0 +1,71 @@
+#include <AK/Benchmarks/Benchmark.h>
+#include <AK/QuickSort.h>
+#include <AK/String.h>
+
+static constexpr size_t count = 100'000;
+
+static const Vector<u32>& random_values()
+{
+    static auto values = AK::Benchmark::deterministic_random(count);
+    return values;
+}
+
+static const Vector<String>& random_strings()
+{
+    static Vector<String> strings = [] {
+        Vector<String> strings;
+        for (size_t i = 0; i < count / 10; ++i)
+            strings.append(String::number(random_values()[i]));
+        return strings;
+    }();
+    return strings;
+}
+
+// Every benchmark copies its input first, which is included in the time.
+BENCHMARK(quick_sort_random_1e5)
+{
+    auto values = random_values();
+    quick_sort(values);
+    do_not_optimize(values);
+}
+
+BENCHMARK(quick_sort_sorted_1e5)
+{
+    Vector<u32> values;
+    for (size_t i = 0; i < count; ++i)
+        values.append(i);
+    quick_sort(values);
+    do_not_optimize(values);
+}
+
+BENCHMARK(quick_sort_reversed_1e5)
+{
+    Vector<u32> values;
+    for (size_t i = count; i > 0; --i)
+        values.append(i);
+    quick_sort(values);
+    do_not_optimize(values);
+}
+
+BENCHMARK(quick_sort_few_unique_1e5)
+{
+    auto values = random_values();
+    for (auto& value : values)
+        value %= 16;
+    quick_sort(values);
+    do_not_optimize(values);
+}
+
+BENCHMARK(quick_sort_iterators_random_1e5)
+{
+    auto values = random_values();
+    quick_sort(values.begin(), values.end());
+    do_not_optimize(values);
+}
+
+BENCHMARK(quick_sort_strings_1e4)
+{
+    auto strings = random_strings();
+    quick_sort(strings);
+    do_not_optimize(strings);
+}
@@ -0,0 +1,76 @@
+#include <AK/Benchmarks/Benchmark.h>
+#include <AK/String.h>
+#include <AK/StringBuilder.h>
+#include <AK/StringView.h>
+
+static const String& comma_separated()
+{
+    static String string = [] {
+        StringBuilder builder;
+        for (auto value : AK::Benchmark::deterministic_random(10'000)) {
+            builder.appendff("{}", value);
+            builder.append(',');
+        }
+        return builder.to_string();
+    }();
+    return string;
+}
+
+BENCHMARK(string_number_1e4)
+{
+    for (int i = 0; i < 10'000; ++i)
+        do_not_optimize(String::number(i));
+}
+
+BENCHMARK(string_to_int_1e4)
+{
+    int sum = 0;
+    for (auto part : comma_separated().split_view(','))
+        sum += part.to_uint().value();
+    do_not_optimize(sum);
+}
+
+BENCHMARK(string_split_view_1e4)
+{
+    do_not_optimize(comma_separated().split_view(','));
+}
+
+BENCHMARK(string_copy_substring_1e4)
+{
+    auto& string = comma_separated();
+    for (size_t i = 0; i < 10'000; ++i)
+        do_not_optimize(string.substring(i, 16));
+}
+
+BENCHMARK(string_equals_1e4)
+{
+    String a = comma_separated().substring(0, 64);
+    String b = comma_separated().substring(0, 64);
+    size_t equal = 0;
+    for (size_t i = 0; i < 10'000; ++i) {
+        do_not_optimize(a);
+        equal += a == b;
+    }
+    do_not_optimize(equal);
+}
+
+BENCHMARK(string_view_contains)
+{
+    do_not_optimize(comma_separated().view().contains("not in there"));
+}
+
+BENCHMARK(string_builder_append_char_1e5)
+{
+    StringBuilder builder;
+    for (size_t i = 0; i < 100'000; ++i)
+        builder.append('a' + i % 26);
+    do_not_optimize(builder.to_string());
+}
+
+BENCHMARK(string_builder_append_string_view_1e4)
+{
+    StringBuilder builder;
+    for (size_t i = 0; i < 10'000; ++i)
+        builder.append("well hello friends"sv);
+    do_not_optimize(builder.to_string());
+}
@@ -0,0 +1,67 @@
+#include <AK/Benchmarks/Benchmark.h>
+#include <AK/String.h>
+#include <AK/Vector.h>
+
+static const Vector<u32>& values()
+{
+    static auto values = AK::Benchmark::deterministic_random(100'000);
+    return values;
+}
+
+BENCHMARK(vector_append_1e5)
+{
+    Vector<u32> vector;
+    for (auto value : values())
+        vector.append(value);
+    do_not_optimize(vector);
+}
+
+BENCHMARK(vector_append_with_capacity_1e5)
+{
+    Vector<u32> vector;
+    vector.ensure_capacity(values().size());
+    for (auto value : values())
+        vector.unchecked_append(value);
+    do_not_optimize(vector);
+}
+
+BENCHMARK(vector_append_inline_capacity_16_1e3)
+{
+    for (size_t i = 0; i < 1000; ++i) {
+        Vector<u32, 16> vector;
+        for (size_t j = 0; j < 16; ++j)
+            vector.append(j);
+        do_not_optimize(vector);
+    }
+}
+
+BENCHMARK(vector_append_string_1e4)
+{
+    String string = "well hello friends";
+    Vector<String> vector;
+    for (size_t i = 0; i < 10'000; ++i)
+        vector.append(string);
+    do_not_optimize(vector);
+}
+
+BENCHMARK(vector_copy_1e5)
+{
+    Vector<u32> copy = values();
+    do_not_optimize(copy);
+}
+
+BENCHMARK(vector_prepend_1e3)
+{
+    Vector<u32> vector;
+    for (size_t i = 0; i < 1000; ++i)
+        vector.prepend(values()[i]);
+    do_not_optimize(vector);
+}
+
+BENCHMARK(vector_take_first_1e3)
+{
+    Vector<u32> vector;
+    vector.append(values().data(), 1000);
+    while (!vector.is_empty())
+        do_not_optimize(vector.take_first());
+}
@@ -1,7 +1,8 @@
-
 #pragma once
 
 #include <AK/HashFunctions.h>
+#include <AK/NumericLimits.h>
+#include <AK/SIMD.h>
 #include <AK/StdLibExtras.h>
 #include <AK/Types.h>
 #include <AK/kmalloc.h>
@@ -13,52 +14,105 @@ enum class HashSetResult {
     ReplacedExistingEntry
 };
 
-template<typename HashTableType, typename T, typename BucketType>
+namespace Detail {
+
+// One byte of metadata per slot. Empty slots are marked with the high bit, full ones
+// hold 7 bits of the hash of their value, so most mismatches never touch the value.
+static constexpr u8 hash_table_empty_control = 0x80;
+static constexpr u8 hash_table_end_control = 0xff;
+
+// The control bytes of 16 consecutive slots, compared all at once.
+struct HashTableControlGroup {
+    static constexpr size_t width = 16;
+
+    ALWAYS_INLINE static HashTableControlGroup load(const u8* control)
+    {
+        HashTableControlGroup group;
+        __builtin_memcpy(&group.bytes, control, width);
+        return group;
+    }
+
+    // Returns a bit for every slot in the group whose control byte is the given one.
+    ALWAYS_INLINE u32 match(u8 control) const
+    {
+        SIMD::u8x16 needle = {
+            control, control, control, control, control, control, control, control,
+            control, control, control, control, control, control, control, control
+        };
+        return to_bitmask(bytes == needle);
+    }
+
+    ALWAYS_INLINE u32 match_empty() const { return match(hash_table_empty_control); }
+
+    template<typename MaskType>
+    ALWAYS_INLINE static u32 to_bitmask(MaskType mask)
+    {
+#ifdef __SSE2__
+        return __builtin_ia32_pmovmskb128((char __attribute__((vector_size(16))))mask);
+#else
+        // Gather the high bit of every byte with a multiplication, eight bytes at a time.
+        u64 halves[2];
+        __builtin_memcpy(halves, &mask, sizeof(halves));
+        constexpr u64 high_bits = 0x8080808080808080ull;
+        constexpr u64 gather = 0x0002040810204081ull;
+        u32 low = ((halves[0] & high_bits) * gather) >> 56;
+        u32 high = ((halves[1] & high_bits) * gather) >> 56;
+        return low | (high << 8);
+#endif
+    }
+
+    SIMD::u8x16 bytes;
+};
+
+}
+
+template<typename HashTableType, typename T>
 class HashTableIterator {
     friend HashTableType;
 
 public:
-    bool operator==(const HashTableIterator& other) const { return m_bucket == other.m_bucket; }
-    bool operator!=(const HashTableIterator& other) const { return m_bucket != other.m_bucket; }
-    T& operator*() { return *m_bucket->slot(); }
-    T* operator->() { return m_bucket->slot(); }
+    bool operator==(const HashTableIterator& other) const { return m_slot == other.m_slot; }
+    bool operator!=(const HashTableIterator& other) const { return m_slot != other.m_slot; }
+    T& operator*() { return *m_slot; }
+    T* operator->() { return m_slot; }
     void operator++() { skip_to_next(); }
 
 private:
     void skip_to_next()
     {
-        if (!m_bucket)
+        if (!m_slot)
             return;
         do {
-            ++m_bucket;
-            if (m_bucket->used)
-                return;
-        } while (!m_bucket->end);
-        if (m_bucket->end)
-            m_bucket = nullptr;
+            ++m_control;
+            ++m_slot;
+        } while (*m_control == Detail::hash_table_empty_control);
+        if (*m_control == Detail::hash_table_end_control) {
+            m_control = nullptr;
+            m_slot = nullptr;
+        }
     }
 
-    explicit HashTableIterator(BucketType* bucket)
-        : m_bucket(bucket)
+    HashTableIterator(const u8* control, T* slot)
+        : m_control(control)
+        , m_slot(slot)
     {
     }
 
-    BucketType* m_bucket { nullptr };
+    const u8* m_control { nullptr };
+    T* m_slot { nullptr };
 };
 
+// An open addressing hash table with a power of two capacity. Slots are probed a group
+// of 16 at a time by comparing their control bytes, see Detail::HashTableControlGroup.
+// Removing a value moves later values of the same probe sequence back into the hole,
+// so there are no tombstones. This means removing a value may move other values and
+// invalidates all iterators into the table.
 template<typename T, typename TraitsForT>
 class HashTable {
-    static constexpr size_t load_factor_in_percent = 60;
-
-    struct Bucket {
-        bool used;
-        bool deleted;
-        bool end;
-        alignas(T) u8 storage[sizeof(T)];
+    static constexpr size_t load_factor_in_percent = 80;
+    static constexpr size_t group_width = Detail::HashTableControlGroup::width;
 
-        T* slot() { return reinterpret_cast<T*>(storage); }
-        const T* slot() const { return reinterpret_cast<const T*>(storage); }
-    };
+    static_assert(alignof(T) <= group_width);
 
 public:
     HashTable() = default;
@@ -66,15 +120,13 @@ public:
 
     ~HashTable()
     {
-        if (!m_buckets)
+        if (!m_control)
             return;
 
-        for (size_t i = 0; i < m_capacity; ++i) {
-            if (m_buckets[i].used)
-                m_buckets[i].slot()->~T();
-        }
+        for (auto& value : *this)
+            value.~T();
 
-        kfree(m_buckets);
+        kfree(m_control);
     }
 
     HashTable(const HashTable& other)
@@ -92,15 +144,15 @@ public:
     }
 
     HashTable(HashTable&& other) noexcept
-        : m_buckets(other.m_buckets)
+        : m_control(other.m_control)
+        , m_slots(other.m_slots)
         , m_size(other.m_size)
         , m_capacity(other.m_capacity)
-        , m_deleted_count(other.m_deleted_count)
     {
+        other.m_control = nullptr;
+        other.m_slots = nullptr;
         other.m_size = 0;
         other.m_capacity = 0;
-        other.m_deleted_count = 0;
-        other.m_buckets = nullptr;
     }
 
     HashTable& operator=(HashTable&& other) noexcept
@@ -111,10 +163,10 @@ public:
 
     friend void swap(HashTable& a, HashTable& b) noexcept
     {
-        swap(a.m_buckets, b.m_buckets);
+        swap(a.m_control, b.m_control);
+        swap(a.m_slots, b.m_slots);
         swap(a.m_size, b.m_size);
         swap(a.m_capacity, b.m_capacity);
-        swap(a.m_deleted_count, b.m_deleted_count);
     }
 
     [[nodiscard]] bool is_empty() const { return !m_size; }
@@ -129,10 +181,13 @@ public:
         }
     }
 
+    // Makes room for the given number of values without growing again.
     void ensure_capacity(size_t capacity)
     {
         VERIFY(capacity >= size());
-        rehash(capacity * 2);
+        if (capacity * 100 < m_capacity * load_factor_in_percent)
+            return;
+        rehash(capacity * 100 / load_factor_in_percent + 1);
     }
 
     bool contains(const T& value) const
@@ -140,36 +195,36 @@ public:
         return find(value) != end();
     }
 
-    using Iterator = HashTableIterator<HashTable, T, Bucket>;
+    using Iterator = HashTableIterator<HashTable, T>;
 
     Iterator begin()
     {
         for (size_t i = 0; i < m_capacity; ++i) {
-            if (m_buckets[i].used)
-                return Iterator(&m_buckets[i]);
+            if (is_full(m_control[i]))
+                return Iterator(&m_control[i], &m_slots[i]);
         }
         return end();
     }
 
     Iterator end()
     {
-        return Iterator(nullptr);
+        return Iterator(nullptr, nullptr);
     }
 
-    using ConstIterator = HashTableIterator<const HashTable, const T, const Bucket>;
+    using ConstIterator = HashTableIterator<const HashTable, const T>;
 
     ConstIterator begin() const
     {
         for (size_t i = 0; i < m_capacity; ++i) {
-            if (m_buckets[i].used)
-                return ConstIterator(&m_buckets[i]);
+            if (is_full(m_control[i]))
+                return ConstIterator(&m_control[i], &m_slots[i]);
         }
         return end();
     }
 
     ConstIterator end() const
     {
-        return ConstIterator(nullptr);
+        return ConstIterator(nullptr, nullptr);
     }
 
     void clear()
@@ -180,18 +235,19 @@ public:
     template<typename U = T>
     HashSetResult set(U&& value)
     {
-        auto& bucket = lookup_for_writing(value);
-        if (bucket.used) {
-            (*bucket.slot()) = forward<U>(value);
+        if (should_grow())
+            rehash(m_capacity * 2);
+
+        u32 hash = 0;
+        auto index = lookup_for_writing(value, hash);
+        if (index != not_found) {
+            m_slots[index] = forward<U>(value);
             return HashSetResult::ReplacedExistingEntry;
         }
 
-        new (bucket.slot()) T(forward<U>(value));
-        bucket.used = true;
-        if (bucket.deleted) {
-            bucket.deleted = false;
-            --m_deleted_count;
-        }
+        index = find_empty_index(hash);
+        new (&m_slots[index]) T(forward<U>(value));
+        m_control[index] = short_hash(hash);
         ++m_size;
         return HashSetResult::InsertedNewEntry;
     }
@@ -199,7 +255,7 @@ public:
     template<typename Finder>
     Iterator find(unsigned hash, Finder finder)
     {
-        return Iterator(lookup_with_hash(hash, move(finder)));
+        return iterator_at<Iterator>(find_index(mix_hash(hash), move(finder)));
     }
 
     Iterator find(const T& value)
@@ -210,7 +266,7 @@ public:
     template<typename Finder>
     ConstIterator find(unsigned hash, Finder finder) const
     {
-        return ConstIterator(lookup_with_hash(hash, move(finder)));
+        return iterator_at<ConstIterator>(find_index(mix_hash(hash), move(finder)));
     }
 
     ConstIterator find(const T& value) const
@@ -230,110 +286,166 @@ public:
 
     void remove(Iterator iterator)
     {
-        VERIFY(iterator.m_bucket);
-        auto& bucket = *iterator.m_bucket;
-        VERIFY(bucket.used);
-        VERIFY(!bucket.end);
-        VERIFY(!bucket.deleted);
-        bucket.slot()->~T();
-        bucket.used = false;
-        bucket.deleted = true;
+        VERIFY(iterator.m_slot);
+        size_t index = iterator.m_slot - m_slots;
+        VERIFY(index < m_capacity);
+        VERIFY(is_full(m_control[index]));
+        m_slots[index].~T();
+        m_control[index] = Detail::hash_table_empty_control;
         --m_size;
-        ++m_deleted_count;
+        fill_hole(index);
     }
 
 private:
-    void insert_during_rehash(T&& value)
-    {
-        auto& bucket = lookup_for_writing(value);
-        new (bucket.slot()) T(move(value));
-        bucket.used = true;
-    }
-
-    void rehash(size_t new_capacity)
-    {
-        new_capacity = max(new_capacity, static_cast<size_t>(4));
-
-        auto* old_buckets = m_buckets;
-        auto old_capacity = m_capacity;
+    static constexpr size_t not_found = NumericLimits<size_t>::max();
 
-        m_buckets = (Bucket*)kmalloc(sizeof(Bucket) * (new_capacity + 1));
-        __builtin_memset(m_buckets, 0, sizeof(Bucket) * (new_capacity + 1));
-        m_capacity = new_capacity;
-        m_deleted_count = 0;
+    static bool is_full(u8 control) { return !(control & Detail::hash_table_empty_control); }
 
-        m_buckets[m_capacity].end = true;
+    // Spreads the bits of hashes that are weak in some bits, like those of small integers.
+    static u32 mix_hash(u32 hash)
+    {
+        hash ^= hash >> 16;
+        hash *= 0x7feb352d;
+        hash ^= hash >> 15;
+        hash *= 0x846ca68b;
+        hash ^= hash >> 16;
+        return hash;
+    }
 
-        if (!old_buckets)
-            return;
+    static u8 short_hash(u32 mixed_hash) { return mixed_hash & 0x7f; }
+    size_t group_mask() const { return m_capacity / group_width - 1; }
+    size_t home_group(u32 mixed_hash) const { return (mixed_hash >> 7) & group_mask(); }
 
-        for (size_t i = 0; i < old_capacity; ++i) {
-            auto& old_bucket = old_buckets[i];
-            if (old_bucket.used) {
-                insert_during_rehash(move(*old_bucket.slot()));
-                old_bucket.slot()->~T();
-            }
-        }
+    Detail::HashTableControlGroup group_at(size_t group) const
+    {
+        return Detail::HashTableControlGroup::load(&m_control[group * group_width]);
+    }
 
-        kfree(old_buckets);
+    template<typename IteratorType>
+    IteratorType iterator_at(size_t index) const
+    {
+        if (index == not_found)
+            return IteratorType(nullptr, nullptr);
+        return IteratorType(&m_control[index], &m_slots[index]);
     }
 
+    // Every value lives in the first group that had an empty slot when it was inserted,
+    // starting from its home group. So a lookup can stop at the first group with an empty slot.
     template<typename Finder>
-    Bucket* lookup_with_hash(unsigned hash, Finder finder) const
+    size_t find_index(u32 mixed_hash, Finder finder) const
     {
         if (is_empty())
-            return nullptr;
+            return not_found;
 
+        auto control = short_hash(mixed_hash);
+        auto group = home_group(mixed_hash);
         for (;;) {
-            auto& bucket = m_buckets[hash % m_capacity];
-
-            if (bucket.used && finder(*bucket.slot()))
-                return &bucket;
-
-            if (!bucket.used && !bucket.deleted)
-                return nullptr;
-
-            hash = double_hash(hash);
+            auto group_control = group_at(group);
+            for (u32 matches = group_control.match(control); matches; matches &= matches - 1) {
+                size_t index = group * group_width + __builtin_ctz(matches);
+                if (finder(m_slots[index]))
+                    return index;
+            }
+            if (group_control.match_empty())
+                return not_found;
+            group = (group + 1) & group_mask();
         }
     }
 
-    const Bucket* lookup_for_reading(const T& value) const
+    size_t lookup_for_writing(const T& value, u32& mixed_hash) const
     {
-        return lookup_with_hash(TraitsForT::hash(value), [&value](auto& entry) { return TraitsForT::equals(entry, value); });
+        mixed_hash = mix_hash(TraitsForT::hash(value));
+        return find_index(mixed_hash, [&](auto& other) { return TraitsForT::equals(other, value); });
     }
 
-    Bucket& lookup_for_writing(const T& value)
+    size_t find_empty_index(u32 mixed_hash) const
     {
-        if (should_grow())
-            rehash(capacity() * 2);
+        auto group = home_group(mixed_hash);
+        for (;;) {
+            if (auto empty = group_at(group).match_empty())
+                return group * group_width + __builtin_ctz(empty);
+            group = (group + 1) & group_mask();
+        }
+    }
 
-        auto hash = TraitsForT::hash(value);
-        Bucket* first_empty_bucket = nullptr;
+    // A value that had to skip the hole's group when it was inserted must move back into
+    // the hole, or lookups would stop at the hole's group before reaching it. That leaves
+    // a new hole where the value was, so repeat until nothing skipped over the hole.
+    void fill_hole(size_t hole)
+    {
         for (;;) {
-            auto& bucket = m_buckets[hash % m_capacity];
+            size_t hole_group = hole / group_width;
+            // Only a full group is ever skipped.
+            if (__builtin_popcount(group_at(hole_group).match_empty()) > 1)
+                return;
+
+            size_t moved_from = not_found;
+            for (size_t distance = 1; distance <= group_mask() && moved_from == not_found; ++distance) {
+                size_t group = (hole_group + distance) & group_mask();
+                auto group_control = group_at(group);
+                u32 full = ~group_control.match_empty() & 0xffff;
+                for (; full; full &= full - 1) {
+                    size_t index = group * group_width + __builtin_ctz(full);
+                    auto home = home_group(mix_hash(TraitsForT::hash(m_slots[index])));
+                    if (((group - home) & group_mask()) < distance)
+                        continue;
+                    new (&m_slots[hole]) T(move(m_slots[index]));
+                    m_slots[index].~T();
+                    m_control[hole] = m_control[index];
+                    m_control[index] = Detail::hash_table_empty_control;
+                    moved_from = index;
+                    break;
+                }
+                // Nothing after a group with an empty slot skipped over the hole.
+                if (moved_from == not_found && group_control.match_empty())
+                    return;
+            }
+            if (moved_from == not_found)
+                return;
+            hole = moved_from;
+        }
+    }
 
-            if (bucket.used && TraitsForT::equals(*bucket.slot(), value))
-                return bucket;
+    void rehash(size_t new_capacity)
+    {
+        size_t capacity = group_width;
+        while (capacity < new_capacity)
+            capacity *= 2;
 
-            if (!bucket.used) {
-                if (!first_empty_bucket)
-                    first_empty_bucket = &bucket;
+        auto* old_control = m_control;
+        auto* old_slots = m_slots;
+        auto old_capacity = m_capacity;
 
-                if (!bucket.deleted)
-                    return *const_cast<Bucket*>(first_empty_bucket);
-            }
+        // The control bytes, with one more marking the end for iterators, followed by the slots.
+        size_t control_size = capacity + group_width;
+        m_control = (u8*)kmalloc(control_size + sizeof(T) * capacity);
+        __builtin_memset(m_control, Detail::hash_table_empty_control, capacity);
+        m_control[capacity] = Detail::hash_table_end_control;
+        m_slots = reinterpret_cast<T*>(m_control + control_size);
+        m_capacity = capacity;
 
-            hash = double_hash(hash);
+        if (!old_control)
+            return;
+
+        for (size_t i = 0; i < old_capacity; ++i) {
+            if (!is_full(old_control[i]))
+                continue;
+            auto hash = mix_hash(TraitsForT::hash(old_slots[i]));
+            auto index = find_empty_index(hash);
+            new (&m_slots[index]) T(move(old_slots[i]));
+            m_control[index] = short_hash(hash);
+            old_slots[i].~T();
         }
+
+        kfree(old_control);
     }
 
-    [[nodiscard]] size_t used_bucket_count() const { return m_size + m_deleted_count; }
-    [[nodiscard]] bool should_grow() const { return ((used_bucket_count() + 1) * 100) >= (m_capacity * load_factor_in_percent); }
+    [[nodiscard]] bool should_grow() const { return ((m_size + 1) * 100) >= (m_capacity * load_factor_in_percent); }
 
-    Bucket* m_buckets { nullptr };
+    u8* m_control { nullptr };
+    T* m_slots { nullptr };
     size_t m_size { 0 };
     size_t m_capacity { 0 };
-    size_t m_deleted_count { 0 };
 };
 
 }
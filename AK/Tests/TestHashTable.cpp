@@ -173,3 +173,28 @@ TEST_CASE(basic_contains)
     EXPECT_EQ(table.remove(1), true);
     EXPECT_EQ(table.contains(1), false);
 }
+
+TEST_CASE(remove_from_full_groups)
+{
+    struct FewBucketsTraits : public GenericTraits<int> {
+        static unsigned hash(int value) { return value % 3; }
+    };
+
+    // Removing values from the middle of long probe sequences has to keep
+    // the values after them reachable.
+    HashTable<int, FewBucketsTraits> table;
+    for (int i = 0; i < 200; ++i)
+        table.set(i);
+    for (int i = 0; i < 200; i += 2)
+        EXPECT_EQ(table.remove(i), true);
+    EXPECT_EQ(table.size(), 100u);
+    for (int i = 0; i < 200; ++i)
+        EXPECT_EQ(table.contains(i), i % 2 == 1);
+
+    size_t iterated = 0;
+    for (auto& value : table) {
+        EXPECT_EQ(value % 2, 1);
+        ++iterated;
+    }
+    EXPECT_EQ(iterated, 100u);
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+// includes
+#include <AK/Types.h>
+
+// Binary format of the per-CPU performance event rings, and of the perfcore files
+// and /proc profiles that are built from them.
+//
+// A ring starts with a PerformanceEventRingHeader in its own page. It's followed by a
+// page with the PerformanceEventRingConsumer at consumer_offset, and by data_size bytes
+// of records at data_offset. Positions only ever grow and are taken modulo data_size.
+// The kernel appends records at write_position. A consumer that mapped the ring with
+// profiling_map_buffer() processes [read_position, write_position) and then advances
+// read_position. If the consumer falls behind, new records are dropped and counted
+// in lost_records, nothing that wasn't consumed yet is ever overwritten.
+//
+// The consumer page is the only part of a mapped ring that the consumer can write to.
+// The kernel keeps its own copy of everything in the header, and checks read_position
+// every time it looks at it.
+//
+// Every record starts with a PerformanceRecordHeader, is a multiple of 8 bytes long
+// and never wraps around the end of the ring; the space up to the end is filled
+// with a Padding record instead.
+//
+// A perfcore file is a PerformanceFileHeader followed by one PerformanceFileCPUHeader
+// and its byte_count bytes of records for every CPU.
+
+static constexpr u32 performance_ring_magic = 0x474e4952;  // "RING"
+static constexpr u32 performance_file_magic = 0x46524550;  // "PERF"
+static constexpr u32 performance_file_version = 1;
+static constexpr size_t performance_record_alignment = 8;
+
+struct [[gnu::packed]] PerformanceEventRingHeader {
+    u32 magic;
+    u32 cpu;
+    u32 data_size;
+    u32 data_offset;
+    u32 consumer_offset;
+    volatile u32 write_position;
+    volatile u32 lost_records;
+};
+
+struct [[gnu::packed]] PerformanceEventRingConsumer {
+    volatile u32 read_position;
+};
+
+enum class PerformanceRecordType : u16 {
+    // The event types match the PERF_EVENT_* values.
+    Sample = 0,
+    Malloc = 1,
+    Free = 2,
+    ThreadCreate = 3,
+    ThreadExit = 4,
+    // Records describing the events above.
+    Stack = 0x100,
+    Process = 0x101,
+    Region = 0x102,
+    Padding = 0xffff,
+};
+
+struct [[gnu::packed]] PerformanceRecordHeader {
+    u16 size;
+    PerformanceRecordType type;
+};
+
+// Followed by arg_count u64 arguments and string_length bytes of an optional string.
+struct [[gnu::packed]] PerformanceEventRecord {
+    PerformanceRecordHeader header;
+    u32 pid;
+    u32 tid;
+    u32 stack_id;
+    // Monotonic time in nanoseconds.
+    u64 timestamp;
+    u16 arg_count;
+    u16 string_length;
+    u32 reserved;
+};
+
+// Defines a stack that event records refer to by stack_id. It always comes before
+// the first event referring to it in the same ring. Followed by frame_count u64 frames.
+struct [[gnu::packed]] PerformanceStackRecord {
+    PerformanceRecordHeader header;
+    u32 stack_id;
+    u32 frame_count;
+    u32 reserved;
+};
+
+enum class PerformanceProcessEventType : u32 {
+    Create,
+    Exec,
+};
+
+// Followed by executable_length bytes of the executable path.
+struct [[gnu::packed]] PerformanceProcessRecord {
+    PerformanceRecordHeader header;
+    u32 pid;
+    PerformanceProcessEventType event_type;
+    u32 executable_length;
+};
+
+// One memory region of the process named by the last Process record with the same pid.
+// Followed by name_length bytes of the region name.
+struct [[gnu::packed]] PerformanceRegionRecord {
+    PerformanceRecordHeader header;
+    u32 pid;
+    u64 base;
+    u64 size;
+    u32 name_length;
+};
+
+struct [[gnu::packed]] PerformanceFileHeader {
+    u32 magic;
+    u32 version;
+    u32 cpu_count;
+    u32 reserved;
+};
+
+struct [[gnu::packed]] PerformanceFileCPUHeader {
+    u32 cpu;
+    u32 byte_count;
+    u32 lost_records;
+    u32 reserved;
+};
@@ -10,6 +10,7 @@
 constexpr int syscall_vector = 0x82;
 
 extern "C" {
+struct epoll_event;
 struct pollfd;
 struct timeval;
 struct timespec;
@@ -169,7 +170,14 @@ namespace Kernel {
     S(anon_create)            \
     S(msyscall)               \
     S(readv)                  \
-    S(emuctl)
+    S(emuctl)                 \
+    S(epoll_create)           \
+    S(epoll_ctl)              \
+    S(epoll_wait)             \
+    S(sendfile)               \
+    S(profiling_map_buffer)   \
+    S(profiling_configure)    \
+    S(vfork)
 
 namespace Syscall {
 
@@ -254,6 +262,28 @@ struct SC_poll_params {
     const u32* sigmask;
 };
 
+struct SC_epoll_ctl_params {
+    int epoll_fd;
+    int op;
+    int fd;
+    const struct epoll_event* event;
+};
+
+struct SC_epoll_wait_params {
+    int epoll_fd;
+    struct epoll_event* events;
+    int max_events;
+    const struct timespec* timeout;
+    const u32* sigmask;
+};
+
+struct SC_sendfile_params {
+    int out_fd;
+    int in_fd;
+    i64* offset;
+    size_t count;
+};
+
 struct SC_clock_nanosleep_params {
     int clock_id;
     int flags;
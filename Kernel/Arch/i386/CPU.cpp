@@ -1841,6 +1841,14 @@ void Processor::check_invoke_scheduler()
 
 void Processor::flush_tlb_local(VirtualAddress vaddr, size_t page_count)
 {
+    // Past a point, reloading cr3 is cheaper than invalidating page by page. That drops every
+    // non-global entry, which is all of userspace, so it only works for user addresses.
+    static constexpr size_t max_pages_to_invalidate_individually = 64;
+    if (page_count > max_pages_to_invalidate_individually && is_user_address(vaddr)) {
+        write_cr3(read_cr3());
+        return;
+    }
+
     auto ptr = vaddr.as_ptr();
     while (page_count > 0) {
         // clang-format off
@@ -58,6 +58,8 @@ public:
         CacheDisabled = 1 << 4,
         Huge = 1 << 7,
         Global = 1 << 8,
+        // Ignored by the CPU, see MemoryManager::write_protect_user_page_tables().
+        CopyOnWrite = 1 << 9,
         NoExecute = 0x8000000000000000ULL,
     };
 
@@ -70,6 +72,9 @@ public:
     bool is_huge() const { return raw() & Huge; }
     void set_huge(bool b) { set_bit(Huge, b); }
 
+    bool is_copy_on_write() const { return raw() & CopyOnWrite; }
+    void set_copy_on_write(bool b) { set_bit(CopyOnWrite, b); }
+
     bool is_writable() const { return raw() & ReadWrite; }
     void set_writable(bool b) { set_bit(ReadWrite, b); }
 
@@ -75,6 +75,8 @@ public:
     }
     void* get_private() const { return m_private; }
 
+    Process& process() { return m_process; }
+
     template<typename... Args>
     [[nodiscard]] bool write_to_buffer(UserOrKernelBuffer& buffer, Args... args)
     {
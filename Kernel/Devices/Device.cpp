@@ -58,11 +58,20 @@ String Device::absolute_path(const FileDescription&) const
 void Device::process_next_queued_request(Badge<AsyncDeviceRequest>, const AsyncDeviceRequest& completed_request)
 {
     ScopedSpinLock lock(m_requests_lock);
-    VERIFY(!m_requests.is_empty());
-    VERIFY(m_requests.first().ptr() == &completed_request);
-    m_requests.remove(m_requests.begin());
-    if (!m_requests.is_empty()) {
-        auto* next_request = m_requests.first().ptr();
+    // Requests may complete in any order once the device works on several at a time.
+    auto it = m_in_flight_requests.begin();
+    while (it != m_in_flight_requests.end() && it->ptr() != &completed_request)
+        ++it;
+    VERIFY(it != m_in_flight_requests.end());
+    m_in_flight_requests.remove(it);
+    VERIFY(m_in_flight_requests_count > 0);
+    m_in_flight_requests_count--;
+
+    if (!m_requests.is_empty() && m_in_flight_requests_count < max_in_flight_requests()) {
+        auto next_request = m_requests.first();
+        m_requests.remove(m_requests.begin());
+        m_in_flight_requests.append(next_request);
+        m_in_flight_requests_count++;
         next_request->do_start(move(lock));
     }
 
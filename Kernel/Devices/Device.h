@@ -35,15 +35,22 @@ public:
 
     void process_next_queued_request(Badge<AsyncDeviceRequest>, const AsyncDeviceRequest&);
 
+    // How many requests the device can work on at the same time. Anything beyond
+    // that waits in the queue until one of the in-flight requests completes.
+    virtual size_t max_in_flight_requests() const { return 1; }
+
     template<typename AsyncRequestType, typename... Args>
     NonnullRefPtr<AsyncRequestType> make_request(Args&&... args)
     {
         auto request = adopt_ref(*new AsyncRequestType(*this, forward<Args>(args)...));
         ScopedSpinLock lock(m_requests_lock);
-        bool was_empty = m_requests.is_empty();
-        m_requests.append(request);
-        if (was_empty)
+        if (m_requests.is_empty() && m_in_flight_requests_count < max_in_flight_requests()) {
+            m_in_flight_requests.append(request);
+            m_in_flight_requests_count++;
             request->do_start(move(lock));
+        } else {
+            m_requests.append(request);
+        }
         return request;
     }
 
@@ -62,6 +69,8 @@ private:
 
     SpinLock<u8> m_requests_lock;
     DoublyLinkedList<RefPtr<AsyncDeviceRequest>> m_requests;
+    DoublyLinkedList<RefPtr<AsyncDeviceRequest>> m_in_flight_requests;
+    size_t m_in_flight_requests_count { 0 };
 };
 
 }
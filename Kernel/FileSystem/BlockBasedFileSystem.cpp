@@ -1,8 +1,15 @@
 // includes
 #include <AK/IntrusiveList.h>
+#include <AK/NonnullOwnPtrVector.h>
+#include <AK/QuickSort.h>
+#include <AK/ScopeGuard.h>
 #include <Kernel/Debug.h>
 #include <Kernel/FileSystem/BlockBasedFileSystem.h>
 #include <Kernel/Process.h>
+#include <Kernel/Tasks/SyncTask.h>
+#include <Kernel/VM/MemoryManager.h>
+#include <Kernel/WaitQueue.h>
+#include <Kernel/WorkQueue.h>
 
 namespace Kernel {
 
@@ -11,92 +18,348 @@ struct CacheEntry {
     BlockBasedFS::BlockIndex block_index { 0 };
     u8* data { nullptr };
     bool has_data { false };
+    bool is_dirty { false };
+    bool is_mapped { false };
+    bool is_read_ahead { false };
+    u32 dirty_generation { 0 };
 };
 
+// The cache grows and shrinks in segments of entries rather than one block at a time,
+// so that the block data can live in a single KBuffer per segment.
+struct CacheSegment {
+    static constexpr size_t entry_count = 64;
+
+    CacheSegment(NonnullOwnPtr<KBuffer>&& block_data, size_t block_size)
+        : block_data(move(block_data))
+    {
+        for (size_t i = 0; i < entry_count; ++i)
+            entries[i].data = this->block_data->data() + i * block_size;
+    }
+
+    NonnullOwnPtr<KBuffer> block_data;
+    CacheEntry entries[entry_count];
+};
+
+using CacheEntryList = IntrusiveList<CacheEntry, RawPtr<CacheEntry>, &CacheEntry::list_node>;
+
+// Each shard covers the blocks whose index maps to it, and has its own lock, lookup table
+// and LRU lists. Both lists are kept with the most recently used entry at the front.
+struct CacheShard {
+    Lock lock { "DiskCacheShard" };
+    HashMap<BlockBasedFS::BlockIndex, CacheEntry*> hash;
+    CacheEntryList clean_list;
+    CacheEntryList dirty_list;
+    NonnullOwnPtrVector<CacheSegment> segments;
+    size_t dirty_count { 0 };
+};
+
+static BlockBasedFS::ReadAheadStatistics s_read_ahead_statistics;
+
+BlockBasedFS::ReadAheadStatistics& BlockBasedFS::read_ahead_statistics()
+{
+    return s_read_ahead_statistics;
+}
+
+static void note_cache_hit(CacheEntry& entry)
+{
+    if (!entry.is_read_ahead)
+        return;
+    entry.is_read_ahead = false;
+    ++s_read_ahead_statistics.hits;
+}
+
 class DiskCache {
 public:
+    static constexpr size_t shard_count = 16;
+    static constexpr size_t writeback_batch_size = 16;
+    static constexpr u64 min_cache_size = 1 * MiB;
+    static constexpr u64 max_cache_size = 64 * MiB;
+    static constexpr size_t staging_buffer_size = 64 * KiB;
+    static constexpr size_t max_pooled_staging_buffers = 4;
+
     explicit DiskCache(BlockBasedFS& fs)
         : m_fs(fs)
-        , m_cached_block_data(KBuffer::create_with_size(m_entry_count * m_fs.block_size()))
-        , m_entries(KBuffer::create_with_size(m_entry_count * sizeof(CacheEntry)))
     {
-        for (size_t i = 0; i < m_entry_count; ++i) {
-            entries()[i].data = m_cached_block_data.data() + i * m_fs.block_size();
-            m_clean_list.append(entries()[i]);
+        // Size the cache as a fraction of physical memory, and divide it evenly between the shards.
+        auto cache_size = clamp(static_cast<u64>(MM.user_physical_pages()) * PAGE_SIZE / 16, min_cache_size, max_cache_size);
+        m_max_segments_per_shard = max(static_cast<size_t>(cache_size / m_fs.block_size() / CacheSegment::entry_count / shard_count), (size_t)1);
+
+        for (auto& shard : m_shards) {
+            Locker locker(shard.lock);
+            bool did_grow = grow(shard);
+            VERIFY(did_grow);
         }
+
+        m_staging_block_count = max(staging_buffer_size / m_fs.block_size(), (size_t)1);
     }
 
     ~DiskCache() = default;
 
-    bool is_dirty() const { return m_dirty; }
-    void set_dirty(bool b) { m_dirty = b; }
+    bool is_dirty() const { return m_dirty_count.load(AK::MemoryOrder::memory_order_relaxed) > 0; }
 
-    void mark_all_clean()
+    CacheShard& shard_for(BlockBasedFS::BlockIndex block_index) { return m_shards[block_index.value() % shard_count]; }
+
+    // A staging buffer holds a run of consecutive blocks that is read from or written to
+    // the device in one request. Every request takes a buffer of its own, so no lock is
+    // held across the device I/O; returned buffers are kept around for reuse.
+    OwnPtr<KBuffer> take_staging_buffer()
+    {
+        {
+            Locker locker(m_staging_pool_lock);
+            if (!m_staging_pool.is_empty())
+                return m_staging_pool.take_last();
+        }
+        return KBuffer::try_create_with_size(m_staging_block_count * m_fs.block_size(), Region::Access::Read | Region::Access::Write, "DiskCache staging");
+    }
+
+    void return_staging_buffer(NonnullOwnPtr<KBuffer> buffer)
+    {
+        Locker locker(m_staging_pool_lock);
+        if (m_staging_pool.size() < max_pooled_staging_buffers)
+            m_staging_pool.append(move(buffer));
+    }
+
+    size_t staging_block_count() const { return m_staging_block_count; }
+
+    // Queued read-ahead holds off while demand reads are waiting on the device,
+    // so that a reader never ends up queued behind prefetch I/O.
+    void begin_demand_read() { ++m_demand_reads_in_flight; }
+    void end_demand_read()
     {
-        while (auto* entry = m_dirty_list.first())
-            m_clean_list.prepend(*entry);
-        m_dirty = false;
+        if (--m_demand_reads_in_flight == 0)
+            m_demand_reads_done.wake_all();
+    }
+    void wait_for_demand_reads()
+    {
+        while (m_demand_reads_in_flight.load() > 0)
+            m_demand_reads_done.wait_forever("DiskCacheReadAhead");
     }
 
-    void mark_dirty(CacheEntry& entry)
+    void mark_dirty(CacheShard& shard, CacheEntry& entry)
     {
-        m_dirty_list.prepend(entry);
-        m_dirty = true;
+        VERIFY(shard.lock.is_locked());
+        if (!entry.is_dirty) {
+            entry.is_dirty = true;
+            ++shard.dirty_count;
+            m_dirty_count.fetch_add(1, AK::MemoryOrder::memory_order_relaxed);
+        }
+        ++entry.dirty_generation;
+        shard.dirty_list.prepend(entry);
+
+        // Let the sync task start writing back before this shard runs out of clean entries.
+        if (shard.dirty_count > max_entries_per_shard() / 2)
+            SyncTask::request_writeback();
     }
 
-    void mark_clean(CacheEntry& entry)
+    void mark_clean(CacheShard& shard, CacheEntry& entry)
     {
-        m_clean_list.prepend(entry);
+        VERIFY(shard.lock.is_locked());
+        if (entry.is_dirty) {
+            entry.is_dirty = false;
+            --shard.dirty_count;
+            m_dirty_count.fetch_sub(1, AK::MemoryOrder::memory_order_relaxed);
+        }
+        shard.clean_list.prepend(entry);
     }
 
-    CacheEntry& get(BlockBasedFS::BlockIndex block_index) const
+    CacheEntry* find(CacheShard& shard, BlockBasedFS::BlockIndex block_index)
     {
-        if (auto it = m_hash.find(block_index); it != m_hash.end()) {
-            auto& entry = const_cast<CacheEntry&>(*it->value);
-            VERIFY(entry.block_index == block_index);
-            return entry;
+        VERIFY(shard.lock.is_locked());
+        auto it = shard.hash.find(block_index);
+        if (it == shard.hash.end())
+            return nullptr;
+        VERIFY(it->value->block_index == block_index);
+        return it->value;
+    }
+
+    CacheEntry& get(CacheShard& shard, BlockBasedFS::BlockIndex block_index)
+    {
+        VERIFY(shard.lock.is_locked());
+        if (auto* entry = find(shard, block_index)) {
+            if (entry->is_dirty)
+                shard.dirty_list.prepend(*entry);
+            else
+                shard.clean_list.prepend(*entry);
+            return *entry;
         }
 
-        if (m_clean_list.is_empty()) {
-            // Not a single clean entry! Flush writes and try again.
-            // NOTE: We want to make sure we only call FileBackedFS flush here,
-            //       not some FileBackedFS subclass flush!
-            m_fs.flush_writes_impl();
-            return get(block_index);
+        if (shard.clean_list.is_empty() && !grow(shard)) {
+            // Not a single clean entry and no room to grow! Write back the oldest
+            // dirty entries of this shard, rather than flushing the whole cache.
+            write_back_oldest(shard, writeback_batch_size);
         }
 
-        VERIFY(m_clean_list.last());
-        auto& new_entry = *m_clean_list.last();
-        m_clean_list.prepend(new_entry);
+        VERIFY(shard.clean_list.last());
+        auto& new_entry = *shard.clean_list.last();
+        shard.clean_list.prepend(new_entry);
 
-        m_hash.remove(new_entry.block_index);
-        m_hash.set(block_index, &new_entry);
+        if (new_entry.is_mapped)
+            shard.hash.remove(new_entry.block_index);
+        shard.hash.set(block_index, &new_entry);
 
         new_entry.block_index = block_index;
+        new_entry.is_mapped = true;
         new_entry.has_data = false;
+        new_entry.is_read_ahead = false;
 
         return new_entry;
     }
 
-    const CacheEntry* entries() const { return (const CacheEntry*)m_entries.data(); }
-    CacheEntry* entries() { return (CacheEntry*)m_entries.data(); }
+    void write_back(CacheShard& shard, CacheEntry& entry)
+    {
+        auto entry_data_buffer = UserOrKernelBuffer::for_kernel_buffer(entry.data);
+        // FIXME: Should this error path be surfaced somehow?
+        auto result = m_fs.write_to_device(entry.block_index.value() * m_fs.block_size(), entry_data_buffer, m_fs.block_size());
+        if (result.is_error())
+            dbgln("{}: Failed to write back block {}: {}", m_fs.class_name(), entry.block_index, result.error());
+        mark_clean(shard, entry);
+    }
+
+    // Writes back every dirty entry, merging runs of adjacent blocks into single device writes.
+    size_t flush()
+    {
+        Vector<BlockBasedFS::BlockIndex> dirty_blocks;
+        for (auto& shard : m_shards) {
+            Locker locker(shard.lock);
+            for (auto& entry : shard.dirty_list)
+                dirty_blocks.append(entry.block_index);
+        }
+        quick_sort(dirty_blocks);
+
+        auto block_size = m_fs.block_size();
+        size_t flushed = 0;
+
+        auto staging = take_staging_buffer();
+        if (!staging) {
+            // Without a staging buffer, fall back to writing the blocks back one at a time.
+            for (auto block_index : dirty_blocks) {
+                auto& shard = shard_for(block_index);
+                Locker locker(shard.lock);
+                auto* entry = find(shard, block_index);
+                if (!entry || !entry->is_dirty)
+                    continue;
+                write_back(shard, *entry);
+                ++flushed;
+            }
+            return flushed;
+        }
+        ScopeGuard return_staging = [&] { return_staging_buffer(staging.release_nonnull()); };
+        u8* staging_data = staging->data();
+
+        BlockBasedFS::BlockIndex run_start { 0 };
+        Vector<u32, 64> staged_generations;
 
-    template<typename Callback>
-    void for_each_dirty_entry(Callback callback)
+        auto write_run = [&] {
+            if (staged_generations.is_empty())
+                return;
+            auto staging_buffer = UserOrKernelBuffer::for_kernel_buffer(staging_data);
+            // FIXME: Should this error path be surfaced somehow?
+            auto result = m_fs.write_to_device(run_start.value() * block_size, staging_buffer, staged_generations.size() * block_size);
+            if (result.is_error())
+                dbgln("{}: Failed to write back {} blocks at {}: {}", m_fs.class_name(), staged_generations.size(), run_start, result.error());
+            for (size_t i = 0; i < staged_generations.size(); ++i) {
+                BlockBasedFS::BlockIndex block_index { run_start.value() + i };
+                auto& shard = shard_for(block_index);
+                Locker locker(shard.lock);
+                // Leave the entry dirty if it was written to again after we staged it.
+                auto* entry = find(shard, block_index);
+                if (entry && entry->is_dirty && entry->dirty_generation == staged_generations[i])
+                    mark_clean(shard, *entry);
+            }
+            flushed += staged_generations.size();
+            staged_generations.clear();
+        };
+
+        for (auto block_index : dirty_blocks) {
+            if (!staged_generations.is_empty()) {
+                bool is_adjacent = block_index.value() == run_start.value() + staged_generations.size();
+                if (!is_adjacent || staged_generations.size() == m_staging_block_count)
+                    write_run();
+            }
+            auto& shard = shard_for(block_index);
+            Locker locker(shard.lock);
+            auto* entry = find(shard, block_index);
+            if (!entry || !entry->is_dirty)
+                continue;
+            if (staged_generations.is_empty())
+                run_start = block_index;
+            memcpy(staging_data + staged_generations.size() * block_size, entry->data, block_size);
+            staged_generations.append(entry->dirty_generation);
+        }
+        write_run();
+        return flushed;
+    }
+
+    // Releases up to half of the segments of each shard, keeping at least one.
+    size_t shrink()
     {
-        for (auto& entry : m_dirty_list)
-            callback(entry);
+        size_t released_segments = 0;
+        for (auto& shard : m_shards) {
+            Locker locker(shard.lock);
+            size_t segments_to_release = shard.segments.size() / 2;
+            for (size_t i = 0; i < segments_to_release; ++i) {
+                release_last_segment(shard);
+                ++released_segments;
+            }
+        }
+        return released_segments * CacheSegment::entry_count * m_fs.block_size();
     }
 
 private:
+    size_t max_entries_per_shard() const { return m_max_segments_per_shard * CacheSegment::entry_count; }
+
+    bool grow(CacheShard& shard)
+    {
+        if (shard.segments.size() >= m_max_segments_per_shard)
+            return false;
+        // Don't compete with everything else for memory once it's getting scarce.
+        if (!shard.segments.is_empty() && MM.is_under_memory_pressure())
+            return false;
+        auto block_data = KBuffer::try_create_with_size(CacheSegment::entry_count * m_fs.block_size(), Region::Access::Read | Region::Access::Write, "DiskCache");
+        if (!block_data)
+            return false;
+        auto segment = make<CacheSegment>(block_data.release_nonnull(), m_fs.block_size());
+        for (auto& entry : segment->entries)
+            shard.clean_list.append(entry);
+        shard.segments.append(move(segment));
+        return true;
+    }
+
+    void release_last_segment(CacheShard& shard)
+    {
+        auto& segment = shard.segments.last();
+        for (auto& entry : segment.entries) {
+            if (entry.is_dirty)
+                write_back(shard, entry);
+            if (entry.is_mapped)
+                shard.hash.remove(entry.block_index);
+            shard.clean_list.remove(entry);
+        }
+        shard.segments.take_last();
+    }
+
+    size_t write_back_oldest(CacheShard& shard, size_t count)
+    {
+        size_t written = 0;
+        while (written < count) {
+            auto* entry = shard.dirty_list.last();
+            if (!entry)
+                break;
+            write_back(shard, *entry);
+            ++written;
+        }
+        return written;
+    }
+
     BlockBasedFS& m_fs;
-    size_t m_entry_count { 10000 };
-    mutable HashMap<BlockBasedFS::BlockIndex, CacheEntry*> m_hash;
-    mutable IntrusiveList<CacheEntry, RawPtr<CacheEntry>, &CacheEntry::list_node> m_clean_list;
-    mutable IntrusiveList<CacheEntry, RawPtr<CacheEntry>, &CacheEntry::list_node> m_dirty_list;
-    KBuffer m_cached_block_data;
-    KBuffer m_entries;
-    bool m_dirty { false };
+    size_t m_max_segments_per_shard { 1 };
+    CacheShard m_shards[shard_count];
+    Lock m_staging_pool_lock { "DiskCacheStagingPool" };
+    NonnullOwnPtrVector<KBuffer> m_staging_pool;
+    size_t m_staging_block_count { 1 };
+    Atomic<size_t> m_dirty_count { 0 };
+    Atomic<u32> m_demand_reads_in_flight { 0 };
+    WaitQueue m_demand_reads_done;
 };
 
 BlockBasedFS::BlockBasedFS(FileDescription& file_description)
@@ -107,70 +370,93 @@ BlockBasedFS::BlockBasedFS(FileDescription& file_description)
 
 BlockBasedFS::~BlockBasedFS()
 {
+    delete m_cache.load(AK::MemoryOrder::memory_order_acquire);
+}
+
+KResult BlockBasedFS::read_from_device(u64 offset, UserOrKernelBuffer& buffer, size_t count) const
+{
+    // NOTE: Devices may split large transfers and return short counts, so keep going until we're done.
+    size_t nread = 0;
+    while (nread < count) {
+        auto out = buffer.offset(nread);
+        auto result = file_description().file().read(file_description(), offset + nread, out, count - nread);
+        if (result.is_error())
+            return result.error();
+        if (result.value() == 0)
+            return EIO;
+        nread += result.value();
+    }
+    return KSuccess;
+}
+
+KResult BlockBasedFS::write_to_device(u64 offset, const UserOrKernelBuffer& buffer, size_t count) const
+{
+    size_t nwritten = 0;
+    while (nwritten < count) {
+        auto result = file_description().file().write(file_description(), offset + nwritten, buffer.offset(nwritten), count - nwritten);
+        if (result.is_error())
+            return result.error();
+        if (result.value() == 0)
+            return EIO;
+        nwritten += result.value();
+    }
+    return KSuccess;
 }
 
 KResult BlockBasedFS::write_block(BlockIndex index, const UserOrKernelBuffer& data, size_t count, size_t offset, bool allow_cache)
 {
-    Locker locker(m_lock);
     VERIFY(m_logical_block_size);
     VERIFY(offset + count <= block_size());
     dbgln_if(BBFS_DEBUG, "BlockBasedFileSystem::write_block {}, size={}", index, count);
 
+    auto& shard = cache().shard_for(index);
+    Locker locker(shard.lock);
+
     if (!allow_cache) {
-        flush_specific_block_if_needed(index);
-        u32 base_offset = index.value() * block_size() + offset;
-        auto seek_result = file_description().seek(base_offset, SEEK_SET);
-        if (seek_result.is_error())
-            return seek_result.error();
-        auto nwritten = file_description().write(data, count);
-        if (nwritten.is_error())
-            return nwritten.error();
-        VERIFY(nwritten.value() == count);
+        auto* entry = cache().find(shard, index);
+        if (entry && entry->is_dirty)
+            cache().write_back(shard, *entry);
+        auto result = write_to_device(index.value() * block_size() + offset, data, count);
+        if (result.is_error())
+            return result;
+        // The cached copy no longer matches what is on disk.
+        if (entry)
+            entry->has_data = false;
         return KSuccess;
     }
 
-    auto& entry = cache().get(index);
-    if (count < block_size()) {
+    auto& entry = cache().get(shard, index);
+    if (count < block_size() && !entry.has_data) {
         // Fill the cache first.
-        auto result = read_block(index, nullptr, block_size());
+        auto entry_data_buffer = UserOrKernelBuffer::for_kernel_buffer(entry.data);
+        auto result = read_from_device(index.value() * block_size(), entry_data_buffer, block_size());
         if (result.is_error())
             return result;
     }
     if (!data.read(entry.data + offset, count))
         return EFAULT;
 
-    cache().mark_dirty(entry);
+    cache().mark_dirty(shard, entry);
     entry.has_data = true;
     return KSuccess;
 }
 
 bool BlockBasedFS::raw_read(BlockIndex index, UserOrKernelBuffer& buffer)
 {
-    Locker locker(m_lock);
-    u32 base_offset = index.value() * m_logical_block_size;
-    auto seek_result = file_description().seek(base_offset, SEEK_SET);
-    VERIFY(!seek_result.is_error());
-    auto nread = file_description().read(buffer, m_logical_block_size);
-    VERIFY(!nread.is_error());
-    VERIFY(nread.value() == m_logical_block_size);
+    auto result = read_from_device(index.value() * m_logical_block_size, buffer, m_logical_block_size);
+    VERIFY(!result.is_error());
     return true;
 }
 
 bool BlockBasedFS::raw_write(BlockIndex index, const UserOrKernelBuffer& buffer)
 {
-    Locker locker(m_lock);
-    size_t base_offset = index.value() * m_logical_block_size;
-    auto seek_result = file_description().seek(base_offset, SEEK_SET);
-    VERIFY(!seek_result.is_error());
-    auto nwritten = file_description().write(buffer, m_logical_block_size);
-    VERIFY(!nwritten.is_error());
-    VERIFY(nwritten.value() == m_logical_block_size);
+    auto result = write_to_device(index.value() * m_logical_block_size, buffer, m_logical_block_size);
+    VERIFY(!result.is_error());
     return true;
 }
 
 bool BlockBasedFS::raw_read_blocks(BlockIndex index, size_t count, UserOrKernelBuffer& buffer)
 {
-    Locker locker(m_lock);
     auto current = buffer;
     for (unsigned block = index.value(); block < (index.value() + count); block++) {
         if (!raw_read(BlockIndex { block }, current))
@@ -182,7 +468,6 @@ bool BlockBasedFS::raw_read_blocks(BlockIndex index, size_t count, UserOrKernelB
 
 bool BlockBasedFS::raw_write_blocks(BlockIndex index, size_t count, const UserOrKernelBuffer& buffer)
 {
-    Locker locker(m_lock);
     auto current = buffer;
     for (unsigned block = index.value(); block < (index.value() + count); block++) {
         if (!raw_write(block, current))
@@ -194,9 +479,18 @@ bool BlockBasedFS::raw_write_blocks(BlockIndex index, size_t count, const UserOr
 
 KResult BlockBasedFS::write_blocks(BlockIndex index, unsigned count, const UserOrKernelBuffer& data, bool allow_cache)
 {
-    Locker locker(m_lock);
     VERIFY(m_logical_block_size);
     dbgln_if(BBFS_DEBUG, "BlockBasedFileSystem::write_blocks {}, count={}", index, count);
+
+    if (!allow_cache && count > 1) {
+        for (unsigned i = 0; i < count; ++i)
+            flush_specific_block_if_needed(BlockIndex { index.value() + i });
+        auto result = write_to_device(index.value() * block_size(), data, count * block_size());
+        for (unsigned i = 0; i < count; ++i)
+            invalidate_cached_block(BlockIndex { index.value() + i });
+        return result;
+    }
+
     for (unsigned i = 0; i < count; ++i) {
         auto result = write_block(BlockIndex { index.value() + i }, data.offset(i * block_size()), block_size(), 0, allow_cache);
         if (result.is_error())
@@ -207,36 +501,28 @@ KResult BlockBasedFS::write_blocks(BlockIndex index, unsigned count, const UserO
 
 KResult BlockBasedFS::read_block(BlockIndex index, UserOrKernelBuffer* buffer, size_t count, size_t offset, bool allow_cache) const
 {
-    Locker locker(m_lock);
     VERIFY(m_logical_block_size);
     VERIFY(offset + count <= block_size());
     dbgln_if(BBFS_DEBUG, "BlockBasedFileSystem::read_block {}", index);
 
     if (!allow_cache) {
         const_cast<BlockBasedFS*>(this)->flush_specific_block_if_needed(index);
-        auto base_offset = index.value() * block_size() + offset;
-        auto seek_result = file_description().seek(base_offset, SEEK_SET);
-        if (seek_result.is_error())
-            return seek_result.error();
-        auto nread = file_description().read(*buffer, count);
-        if (nread.is_error())
-            return nread.error();
-        VERIFY(nread.value() == count);
-        return KSuccess;
+        return read_from_device(index.value() * block_size() + offset, *buffer, count);
     }
 
-    auto& entry = cache().get(index);
+    auto& shard = cache().shard_for(index);
+    Locker locker(shard.lock);
+    auto& entry = cache().get(shard, index);
     if (!entry.has_data) {
-        auto base_offset = index.value() * block_size();
-        auto seek_result = file_description().seek(base_offset, SEEK_SET);
-        if (seek_result.is_error())
-            return seek_result.error();
         auto entry_data_buffer = UserOrKernelBuffer::for_kernel_buffer(entry.data);
-        auto nread = file_description().read(entry_data_buffer, block_size());
-        if (nread.is_error())
-            return nread.error();
-        VERIFY(nread.value() == block_size());
+        cache().begin_demand_read();
+        auto result = read_from_device(index.value() * block_size(), entry_data_buffer, block_size());
+        cache().end_demand_read();
+        if (result.is_error())
+            return result;
         entry.has_data = true;
+    } else {
+        note_cache_hit(entry);
     }
     if (buffer && !buffer->write(entry.data + offset, count))
         return EFAULT;
@@ -245,62 +531,182 @@ KResult BlockBasedFS::read_block(BlockIndex index, UserOrKernelBuffer* buffer, s
 
 KResult BlockBasedFS::read_blocks(BlockIndex index, unsigned count, UserOrKernelBuffer& buffer, bool allow_cache) const
 {
-    Locker locker(m_lock);
     VERIFY(m_logical_block_size);
     if (!count)
         return EINVAL;
     if (count == 1)
         return read_block(index, &buffer, block_size(), 0, allow_cache);
-    auto out = buffer;
-    for (unsigned i = 0; i < count; ++i) {
-        auto result = read_block(BlockIndex { index.value() + i }, &out, block_size(), 0, allow_cache);
+
+    if (!allow_cache) {
+        for (unsigned i = 0; i < count; ++i)
+            const_cast<BlockBasedFS*>(this)->flush_specific_block_if_needed(BlockIndex { index.value() + i });
+        return read_from_device(index.value() * block_size(), buffer, count * block_size());
+    }
+
+    // Copy out whatever is already cached, and gather runs of consecutive misses
+    // so that each run is fetched from the device with a single request.
+    unsigned i = 0;
+    while (i < count) {
+        auto out = buffer.offset(i * block_size());
+        auto cached_or_error = read_block_if_cached(BlockIndex { index.value() + i }, out);
+        if (cached_or_error.is_error())
+            return cached_or_error.error();
+        if (cached_or_error.value()) {
+            ++i;
+            continue;
+        }
+
+        unsigned run_length = 1;
+        while (i + run_length < count && run_length < cache().staging_block_count() && !is_block_cached(BlockIndex { index.value() + i + run_length }))
+            ++run_length;
+
+        auto result = read_blocks_into_cache(BlockIndex { index.value() + i }, run_length, &out);
         if (result.is_error())
             return result;
-        out = out.offset(block_size());
+        i += run_length;
+    }
+
+    return KSuccess;
+}
+
+bool BlockBasedFS::is_block_cached(BlockIndex index) const
+{
+    auto& shard = cache().shard_for(index);
+    Locker locker(shard.lock);
+    auto* entry = cache().find(shard, index);
+    return entry && entry->has_data;
+}
+
+KResultOr<bool> BlockBasedFS::read_block_if_cached(BlockIndex index, UserOrKernelBuffer& buffer) const
+{
+    auto& shard = cache().shard_for(index);
+    Locker locker(shard.lock);
+    auto* entry = cache().find(shard, index);
+    if (!entry || !entry->has_data)
+        return false;
+    // Go through get() to bump the entry in the LRU lists.
+    cache().get(shard, index);
+    note_cache_hit(*entry);
+    if (!buffer.write(entry->data, block_size()))
+        return EFAULT;
+    return true;
+}
+
+KResult BlockBasedFS::read_blocks_into_cache(BlockIndex index, size_t count, UserOrKernelBuffer* buffer, IsReadAhead is_read_ahead) const
+{
+    auto& cache = this->cache();
+    VERIFY(count <= cache.staging_block_count());
+
+    if (is_read_ahead == IsReadAhead::Yes) {
+        cache.wait_for_demand_reads();
+        // Demand reads may have brought in the ends of this run since it was queued.
+        while (count && is_block_cached(index)) {
+            index = BlockIndex { index.value() + 1 };
+            --count;
+        }
+        while (count && is_block_cached(BlockIndex { index.value() + count - 1 }))
+            --count;
+        if (!count)
+            return KSuccess;
     }
 
+    // NOTE: The device layer wants one contiguous buffer per request, so the run is read
+    //       into a staging buffer and scattered from there into the cache entries.
+    auto staging = cache.take_staging_buffer();
+    if (!staging) {
+        // Out of memory for a staging buffer; read the blocks one at a time straight into their entries.
+        for (size_t i = 0; i < count; ++i) {
+            auto out = buffer ? buffer->offset(i * block_size()) : UserOrKernelBuffer::for_kernel_buffer(nullptr);
+            if (auto result = read_block(BlockIndex { index.value() + i }, buffer ? &out : nullptr, block_size()); result.is_error())
+                return result;
+        }
+        return KSuccess;
+    }
+    ScopeGuard return_staging = [&] { cache.return_staging_buffer(staging.release_nonnull()); };
+
+    auto staging_buffer = UserOrKernelBuffer::for_kernel_buffer(staging->data());
+    if (is_read_ahead == IsReadAhead::No)
+        cache.begin_demand_read();
+    auto result = read_from_device(index.value() * block_size(), staging_buffer, count * block_size());
+    if (is_read_ahead == IsReadAhead::No)
+        cache.end_demand_read();
+    if (result.is_error())
+        return result;
+
+    for (size_t i = 0; i < count; ++i) {
+        BlockIndex block_index { index.value() + i };
+        auto& shard = cache.shard_for(block_index);
+        Locker locker(shard.lock);
+        auto& entry = cache.get(shard, block_index);
+        // If someone cached this block while we were reading, theirs is at least as new as ours.
+        if (!entry.has_data) {
+            memcpy(entry.data, staging->data() + i * block_size(), block_size());
+            entry.has_data = true;
+            entry.is_read_ahead = is_read_ahead == IsReadAhead::Yes;
+            if (is_read_ahead == IsReadAhead::Yes)
+                ++s_read_ahead_statistics.blocks_read;
+        } else if (is_read_ahead == IsReadAhead::No) {
+            note_cache_hit(entry);
+        }
+        if (buffer && !buffer->write(entry.data, i * block_size(), block_size()))
+            return EFAULT;
+    }
     return KSuccess;
 }
 
+void BlockBasedFS::read_ahead(Span<const BlockIndex> blocks) const
+{
+    size_t i = 0;
+    while (i < blocks.size()) {
+        auto first_block = blocks[i];
+        if (first_block.value() == 0 || is_block_cached(first_block)) {
+            ++i;
+            continue;
+        }
+
+        size_t run_length = 1;
+        while (i + run_length < blocks.size()
+            && run_length < cache().staging_block_count()
+            && blocks[i + run_length].value() == first_block.value() + run_length
+            && !is_block_cached(blocks[i + run_length]))
+            ++run_length;
+
+        NonnullRefPtr<const BlockBasedFS> protector(*this);
+        g_read_ahead_work->queue([protector = move(protector), first_block, run_length] {
+            if (auto result = protector->read_blocks_into_cache(first_block, run_length, nullptr, IsReadAhead::Yes); result.is_error())
+                dbgln_if(BBFS_DEBUG, "BlockBasedFileSystem::read_ahead {}, count={} failed: {}", first_block, run_length, result.error());
+        });
+        i += run_length;
+    }
+}
+
+void BlockBasedFS::invalidate_cached_block(BlockIndex index)
+{
+    auto& shard = cache().shard_for(index);
+    Locker locker(shard.lock);
+    auto* entry = cache().find(shard, index);
+    if (entry && !entry->is_dirty)
+        entry->has_data = false;
+}
+
 void BlockBasedFS::flush_specific_block_if_needed(BlockIndex index)
 {
-    Locker locker(m_lock);
     if (!cache().is_dirty())
         return;
-    Vector<CacheEntry*, 32> cleaned_entries;
-    cache().for_each_dirty_entry([&](CacheEntry& entry) {
-        if (entry.block_index != index) {
-            size_t base_offset = entry.block_index.value() * block_size();
-            auto seek_result = file_description().seek(base_offset, SEEK_SET);
-            VERIFY(!seek_result.is_error());
-            // FIXME: Should this error path be surfaced somehow?
-            auto entry_data_buffer = UserOrKernelBuffer::for_kernel_buffer(entry.data);
-            [[maybe_unused]] auto rc = file_description().write(entry_data_buffer, block_size());
-            cleaned_entries.append(&entry);
-        }
-    });
-    // NOTE: We make a separate pass to mark entries clean since marking them clean
-    //       moves them out of the dirty list which would disturb the iteration above.
-    for (auto* entry : cleaned_entries)
-        cache().mark_clean(*entry);
+    auto& shard = cache().shard_for(index);
+    Locker locker(shard.lock);
+    auto* entry = cache().find(shard, index);
+    if (entry && entry->is_dirty)
+        cache().write_back(shard, *entry);
 }
 
 void BlockBasedFS::flush_writes_impl()
 {
-    Locker locker(m_lock);
     if (!cache().is_dirty())
         return;
-    u32 count = 0;
-    cache().for_each_dirty_entry([&](CacheEntry& entry) {
-        u32 base_offset = entry.block_index.value() * block_size();
-        auto seek_result = file_description().seek(base_offset, SEEK_SET);
-        VERIFY(!seek_result.is_error());
-        // FIXME: Should this error path be surfaced somehow?
-        auto entry_data_buffer = UserOrKernelBuffer::for_kernel_buffer(entry.data);
-        [[maybe_unused]] auto rc = file_description().write(entry_data_buffer, block_size());
-        ++count;
-    });
-    cache().mark_all_clean();
+    // NOTE: Only one shard is locked at a time, so lookups in the other shards
+    //       can carry on while we're writing back.
+    auto count = cache().flush();
     dbgln("{}: Flushed {} blocks to disk", class_name(), count);
 }
 
@@ -309,11 +715,26 @@ void BlockBasedFS::flush_writes()
     flush_writes_impl();
 }
 
+void BlockBasedFS::shrink_cache()
+{
+    if (!m_cache.load(AK::MemoryOrder::memory_order_acquire))
+        return;
+    auto released = cache().shrink();
+    if (released)
+        dbgln("{}: Released {} bytes of block cache", class_name(), released);
+}
+
 DiskCache& BlockBasedFS::cache() const
 {
-    if (!m_cache)
-        m_cache = make<DiskCache>(const_cast<BlockBasedFS&>(*this));
-    return *m_cache;
+    if (auto* cache = m_cache.load(AK::MemoryOrder::memory_order_acquire))
+        return *cache;
+    Locker locker(m_lock);
+    auto* cache = m_cache.load(AK::MemoryOrder::memory_order_relaxed);
+    if (!cache) {
+        cache = new DiskCache(const_cast<BlockBasedFS&>(*this));
+        m_cache.store(cache, AK::MemoryOrder::memory_order_release);
+    }
+    return *cache;
 }
 
 }
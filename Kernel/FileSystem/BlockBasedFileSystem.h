@@ -6,6 +6,8 @@
 namespace Kernel {
 
 class BlockBasedFS : public FileBackedFS {
+    friend class DiskCache;
+
 public:
     TYPEDEF_DISTINCT_ORDERED_ID(u64, BlockIndex);
 
@@ -16,6 +18,14 @@ public:
     virtual void flush_writes() override;
     void flush_writes_impl();
 
+    virtual void shrink_cache() override;
+
+    struct ReadAheadStatistics {
+        Atomic<u64, AK::MemoryOrder::memory_order_relaxed> blocks_read { 0 };
+        Atomic<u64, AK::MemoryOrder::memory_order_relaxed> hits { 0 };
+    };
+    static ReadAheadStatistics& read_ahead_statistics();
+
 protected:
     explicit BlockBasedFS(FileDescription&);
 
@@ -31,13 +41,32 @@ protected:
     KResult write_block(BlockIndex, const UserOrKernelBuffer&, size_t count, size_t offset = 0, bool allow_cache = true);
     KResult write_blocks(BlockIndex, unsigned count, const UserOrKernelBuffer&, bool allow_cache = true);
 
+    // Asynchronously pulls the given blocks into the cache. Zero entries (holes) are skipped.
+    void read_ahead(Span<const BlockIndex>) const;
+
     size_t m_logical_block_size { 512 };
 
 private:
     DiskCache& cache() const;
     void flush_specific_block_if_needed(BlockIndex index);
-
-    mutable OwnPtr<DiskCache> m_cache;
+    void invalidate_cached_block(BlockIndex index);
+
+    bool is_block_cached(BlockIndex) const;
+    KResultOr<bool> read_block_if_cached(BlockIndex, UserOrKernelBuffer&) const;
+    enum class IsReadAhead {
+        No,
+        Yes,
+    };
+    KResult read_blocks_into_cache(BlockIndex, size_t count, UserOrKernelBuffer*, IsReadAhead = IsReadAhead::No) const;
+
+    // These go straight to the underlying file at an absolute byte offset,
+    // so they don't touch the shared file description offset and can run concurrently.
+    KResult read_from_device(u64 offset, UserOrKernelBuffer&, size_t count) const;
+    KResult write_to_device(u64 offset, const UserOrKernelBuffer&, size_t count) const;
+
+    // Created on first use, once the subclass knows the block size. Published with release
+    // ordering, so anyone who sees the pointer also sees a fully constructed cache.
+    mutable Atomic<DiskCache*> m_cache { nullptr };
 };
 
 }
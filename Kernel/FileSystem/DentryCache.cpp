@@ -0,0 +1,143 @@
+// includes
+#include <AK/HashFunctions.h>
+#include <AK/JsonObjectSerializer.h>
+#include <AK/Singleton.h>
+#include <Kernel/FileSystem/DentryCache.h>
+#include <Kernel/FileSystem/Inode.h>
+#include <Kernel/KBufferBuilder.h>
+
+namespace Kernel {
+
+static AK::Singleton<DentryCache> s_the;
+
+DentryCache& DentryCache::the()
+{
+    return *s_the;
+}
+
+DentryCache::DentryCache()
+{
+}
+
+DentryCache::Set& DentryCache::set_for(InodeIdentifier parent, StringView name)
+{
+    auto hash = pair_int_hash(Traits<InodeIdentifier>::hash(parent), name.hash());
+    return m_sets[hash & (set_count - 1)];
+}
+
+bool DentryCache::is_cacheable(const Inode& parent, StringView name) const
+{
+    return parent.fs().supports_dentry_cache() && !name.is_empty() && name.length() <= max_name_length;
+}
+
+Optional<RefPtr<Inode>> DentryCache::lookup(Inode& parent, StringView name, u32& generation)
+{
+    if (!is_cacheable(parent, name))
+        return {};
+    auto parent_id = parent.identifier();
+    auto& set = set_for(parent_id, name);
+    ScopedSpinLock lock(set.lock);
+    for (auto& entry : set.entries) {
+        if (!entry.is_valid || entry.parent != parent_id || entry.name != name)
+            continue;
+        if (entry.inode)
+            m_hits++;
+        else
+            m_negative_hits++;
+        return entry.inode;
+    }
+    m_misses++;
+    generation = set.generation;
+    return {};
+}
+
+void DentryCache::add(Inode& parent, StringView name, Inode* child, u32 generation)
+{
+    if (!is_cacheable(parent, name))
+        return;
+    auto parent_id = parent.identifier();
+    Entry new_entry { parent_id, name, child, true };
+
+    auto& set = set_for(parent_id, name);
+    ScopedSpinLock lock(set.lock);
+    if (set.generation != generation)
+        return;
+    for (auto& entry : set.entries) {
+        if (entry.is_valid && entry.parent == parent_id && entry.name == name)
+            return;
+    }
+    Entry* victim = nullptr;
+    for (auto& entry : set.entries) {
+        if (!entry.is_valid) {
+            victim = &entry;
+            break;
+        }
+    }
+    if (!victim) {
+        victim = &set.entries[set.next_victim];
+        set.next_victim = (set.next_victim + 1) % ways;
+    }
+    // Swap rather than assign, so the evicted entry is destroyed after we unlock.
+    // Dropping the last reference to an inode may need to take sleeping locks.
+    swap(*victim, new_entry);
+    lock.unlock();
+}
+
+void DentryCache::invalidate(InodeIdentifier parent, StringView name)
+{
+    Entry removed_entry;
+    auto& set = set_for(parent, name);
+    ScopedSpinLock lock(set.lock);
+    ++set.generation;
+    for (auto& entry : set.entries) {
+        if (entry.is_valid && entry.parent == parent && entry.name == name) {
+            swap(entry, removed_entry);
+            m_invalidations++;
+            break;
+        }
+    }
+    lock.unlock();
+}
+
+void DentryCache::invalidate_fs(u32 fsid)
+{
+    for (auto& set : m_sets) {
+        Array<Entry, ways> removed_entries;
+        ScopedSpinLock lock(set.lock);
+        ++set.generation;
+        for (size_t i = 0; i < ways; ++i) {
+            if (set.entries[i].is_valid && set.entries[i].parent.fsid() == fsid)
+                swap(set.entries[i], removed_entries[i]);
+        }
+        lock.unlock();
+    }
+}
+
+bool DentryCache::to_json(KBufferBuilder& builder) const
+{
+    size_t entry_count = 0;
+    size_t negative_entry_count = 0;
+    for (auto& set : m_sets) {
+        ScopedSpinLock lock(set.lock);
+        for (auto& entry : set.entries) {
+            if (!entry.is_valid)
+                continue;
+            ++entry_count;
+            if (!entry.inode)
+                ++negative_entry_count;
+        }
+    }
+
+    JsonObjectSerializer<KBufferBuilder> json { builder };
+    json.add("capacity", set_count * ways);
+    json.add("entries", entry_count);
+    json.add("negative_entries", negative_entry_count);
+    json.add("hits", m_hits.load());
+    json.add("negative_hits", m_negative_hits.load());
+    json.add("misses", m_misses.load());
+    json.add("invalidations", m_invalidations.load());
+    json.finish();
+    return true;
+}
+
+}
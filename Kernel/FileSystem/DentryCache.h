@@ -0,0 +1,74 @@
+#pragma once
+
+// includes
+#include <AK/Array.h>
+#include <AK/Atomic.h>
+#include <AK/Optional.h>
+#include <AK/RefPtr.h>
+#include <AK/String.h>
+#include <Kernel/FileSystem/InodeIdentifier.h>
+#include <Kernel/SpinLock.h>
+
+namespace Kernel {
+
+class Inode;
+class KBufferBuilder;
+
+// Remembers the results of looking up names in directories, including names that
+// don't exist, so resolving a path doesn't need the directory inode's lock or a
+// trip into the file system. Only file systems that report every add_child() and
+// remove_child() through Inode::did_add_child() and Inode::did_remove_child()
+// take part, see FS::supports_dentry_cache().
+//
+// The cache is split into many small sets, each with its own spin lock, so
+// lookups of unrelated names never contend.
+class DentryCache {
+public:
+    static DentryCache& the();
+
+    DentryCache();
+
+    // An empty Optional means we don't know, a null inode means the name doesn't exist.
+    // Pass the generation to add() along with the result of the real lookup.
+    Optional<RefPtr<Inode>> lookup(Inode& parent, StringView name, u32& generation);
+
+    // Does nothing if the name was invalidated since the lookup() that returned the generation.
+    void add(Inode& parent, StringView name, Inode* child, u32 generation);
+
+    void invalidate(InodeIdentifier parent, StringView name);
+    void invalidate_fs(u32 fsid);
+
+    bool to_json(KBufferBuilder&) const;
+
+private:
+    static constexpr size_t set_count = 1024;
+    static constexpr size_t ways = 4;
+    static constexpr size_t max_name_length = 64;
+
+    struct Entry {
+        InodeIdentifier parent;
+        String name;
+        RefPtr<Inode> inode;
+        bool is_valid { false };
+    };
+
+    struct Set {
+        mutable SpinLock<u8> lock;
+        // Bumped by every invalidation, so a lookup racing with one doesn't add stale results.
+        u32 generation { 0 };
+        u8 next_victim { 0 };
+        Array<Entry, ways> entries;
+    };
+
+    Set& set_for(InodeIdentifier parent, StringView name);
+    bool is_cacheable(const Inode& parent, StringView name) const;
+
+    Array<Set, set_count> m_sets;
+
+    Atomic<u64, AK::MemoryOrder::memory_order_relaxed> m_hits { 0 };
+    Atomic<u64, AK::MemoryOrder::memory_order_relaxed> m_negative_hits { 0 };
+    Atomic<u64, AK::MemoryOrder::memory_order_relaxed> m_misses { 0 };
+    Atomic<u64, AK::MemoryOrder::memory_order_relaxed> m_invalidations { 0 };
+};
+
+}
@@ -0,0 +1,231 @@
+// includes
+#include <Kernel/FileSystem/EventPoll.h>
+#include <Kernel/FileSystem/FileDescription.h>
+
+namespace Kernel {
+
+NonnullRefPtr<EventPoll> EventPoll::create()
+{
+    return adopt_ref(*new EventPoll);
+}
+
+EventPoll::EventPoll()
+{
+}
+
+EventPoll::~EventPoll()
+{
+    // Unregister all interests before our ready list goes away.
+    m_interests.clear();
+}
+
+EventPoll::Interest::Interest(EventPoll& event_poll, int fd, FileDescription& description, u32 events, u64 data)
+    : m_event_poll(event_poll)
+    , m_fd(fd)
+    , m_description(description)
+    , m_events(events)
+    , m_data(data)
+{
+}
+
+EventPoll::Interest::~Interest()
+{
+    // Once we are off the block condition, nobody can put us on the ready list anymore.
+    m_description->block_condition().remove_blocker(*this, nullptr);
+    ScopedSpinLock lock(m_event_poll.m_ready_lock);
+    if (m_ready_list_node.is_in_list())
+        m_event_poll.m_ready_list.remove(*this);
+}
+
+bool EventPoll::Interest::is_stale() const
+{
+    // Every file descriptor referring to the description was closed, so nobody can
+    // be interested in it anymore. did_close_description() normally drops us before
+    // anyone gets to see that.
+    return m_description->open_fd_count() == 0;
+}
+
+auto EventPoll::Interest::block_flags() const -> BlockFlags
+{
+    auto events = m_events.load();
+    auto flags = BlockFlags::None;
+    if (events & EPOLLIN)
+        flags |= BlockFlags::Read;
+    if (events & EPOLLOUT)
+        flags |= BlockFlags::Write;
+    return flags;
+}
+
+bool EventPoll::Interest::unblock(bool, void*)
+{
+    // This is called whenever the File evaluates its block conditions. We never
+    // want to be removed from there, so always return false.
+    auto flags = block_flags();
+    if (flags != BlockFlags::None && m_description->should_unblock(flags) != BlockFlags::None)
+        m_event_poll.did_become_ready(*this);
+    return false;
+}
+
+void EventPoll::did_become_ready(Interest& interest)
+{
+    {
+        ScopedSpinLock lock(m_ready_lock);
+        if (!interest.m_enabled || interest.m_ready_list_node.is_in_list())
+            return;
+        m_ready_list.append(interest);
+    }
+    // Wake up anyone waiting for us, or selecting on us.
+    evaluate_block_conditions();
+}
+
+KResult EventPoll::add_interest(int fd, FileDescription& description, u32 events, u64 data)
+{
+    // FIXME: Support nesting, which needs loop detection.
+    if (description.file().is_event_poll())
+        return EINVAL;
+
+    Locker locker(m_lock);
+    if (auto it = m_interests.find(fd); it != m_interests.end()) {
+        if (&it->value->description() == &description && !it->value->is_stale())
+            return EEXIST;
+        // The file descriptor was closed and reused since it was added.
+        m_interests.remove(it);
+    }
+
+    // Get told when the last fd referring to the description is closed. If that already
+    // happened (another thread raced us to close it), there's nothing to be interested in.
+    description.add_event_poll(*this);
+    if (description.open_fd_count() == 0)
+        return EBADF;
+
+    auto interest = make<Interest>(*this, fd, description, events, data);
+    auto& new_interest = *interest;
+    m_interests.set(fd, move(interest));
+    // Adding the blocker evaluates the description once, so we pick up whatever is ready already.
+    description.block_condition().add_blocker(new_interest, nullptr);
+    return KSuccess;
+}
+
+KResult EventPoll::modify_interest(int fd, FileDescription& description, u32 events, u64 data)
+{
+    Locker locker(m_lock);
+    auto it = m_interests.find(fd);
+    if (it == m_interests.end() || &it->value->description() != &description)
+        return ENOENT;
+
+    auto& interest = *it->value;
+    {
+        ScopedSpinLock lock(m_ready_lock);
+        interest.m_events = events;
+        interest.m_data = data;
+        interest.m_enabled = true;
+    }
+    interest.unblock(false, nullptr);
+    return KSuccess;
+}
+
+KResult EventPoll::remove_interest(int fd, FileDescription& description)
+{
+    Locker locker(m_lock);
+    auto it = m_interests.find(fd);
+    if (it == m_interests.end() || &it->value->description() != &description)
+        return ENOENT;
+    m_interests.remove(it);
+    return KSuccess;
+}
+
+void EventPoll::did_close_description(FileDescription& description)
+{
+    Locker locker(m_lock);
+    Vector<int> fds_to_remove;
+    for (auto& it : m_interests) {
+        if (&it.value->description() == &description)
+            fds_to_remove.append(it.key);
+    }
+    for (auto fd : fds_to_remove)
+        m_interests.remove(fd);
+}
+
+KResult EventPoll::collect_ready_events(Vector<epoll_event>& events, size_t max_events)
+{
+    Locker locker(m_lock);
+    // Every interest is reported at most once per call.
+    if (!events.try_ensure_capacity(min(max_events, m_interests.size())))
+        return ENOMEM;
+
+    u64 generation;
+    {
+        ScopedSpinLock lock(m_ready_lock);
+        generation = ++m_generation;
+    }
+
+    Vector<Interest*, 32> interests_to_requeue;
+    Vector<int> stale_fds;
+    while (events.size() < max_events) {
+        Interest* interest;
+        {
+            ScopedSpinLock lock(m_ready_lock);
+            if (m_ready_list.is_empty())
+                break;
+            interest = m_ready_list.take_first();
+            if (interest->m_reported_generation == generation) {
+                // It became ready again after we reported it, leave it for the next call.
+                interests_to_requeue.append(interest);
+                continue;
+            }
+        }
+
+        if (interest->is_stale()) {
+            stale_fds.append(interest->m_fd);
+            continue;
+        }
+
+        // Check whether it is still ready, it may have been drained in the meantime.
+        // If it isn't, the next notification puts it back on the ready list.
+        auto flags = interest->block_flags();
+        auto ready_flags = flags != Thread::FileBlocker::BlockFlags::None ? interest->description().should_unblock(flags) : Thread::FileBlocker::BlockFlags::None;
+        if (ready_flags == Thread::FileBlocker::BlockFlags::None)
+            continue;
+
+        epoll_event event {};
+        if (has_flag(ready_flags, Thread::FileBlocker::BlockFlags::Read))
+            event.events |= EPOLLIN;
+        if (has_flag(ready_flags, Thread::FileBlocker::BlockFlags::Write))
+            event.events |= EPOLLOUT;
+
+        ScopedSpinLock lock(m_ready_lock);
+        if (!interest->m_enabled)
+            continue;
+        event.data = interest->m_data;
+        events.unchecked_append(event);
+        interest->m_reported_generation = generation;
+
+        auto interest_events = interest->m_events.load();
+        if (interest_events & EPOLLONESHOT) {
+            interest->m_enabled = false;
+        } else if (!(interest_events & EPOLLET)) {
+            // Level-triggered interests stay on the ready list until they are drained.
+            interests_to_requeue.append(interest);
+        }
+    }
+
+    if (!interests_to_requeue.is_empty()) {
+        ScopedSpinLock lock(m_ready_lock);
+        for (auto* interest : interests_to_requeue) {
+            if (interest->m_enabled && !interest->m_ready_list_node.is_in_list())
+                m_ready_list.append(*interest);
+        }
+    }
+
+    for (auto fd : stale_fds)
+        m_interests.remove(fd);
+    return KSuccess;
+}
+
+bool EventPoll::can_read(const FileDescription&, size_t) const
+{
+    ScopedSpinLock lock(m_ready_lock);
+    return !m_ready_list.is_empty();
+}
+
+}
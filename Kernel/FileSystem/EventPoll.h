@@ -0,0 +1,84 @@
+#pragma once
+
+// includes
+#include <AK/HashMap.h>
+#include <AK/IntrusiveList.h>
+#include <AK/NonnullOwnPtr.h>
+#include <AK/Vector.h>
+#include <Kernel/FileSystem/File.h>
+#include <Kernel/Lock.h>
+#include <Kernel/SpinLock.h>
+#include <Kernel/Thread.h>
+#include <Kernel/UnixTypes.h>
+
+namespace Kernel {
+
+// EventPoll keeps a persistent set of file descriptions a process is interested in.
+// Every interest stays registered with the block condition of its File, so readiness
+// changes put it on the ready list right away, and waiting only has to look at the
+// descriptions that actually became ready.
+class EventPoll final : public File {
+public:
+    static NonnullRefPtr<EventPoll> create();
+    virtual ~EventPoll() override;
+
+    KResult add_interest(int fd, FileDescription&, u32 events, u64 data);
+    KResult modify_interest(int fd, FileDescription&, u32 events, u64 data);
+    KResult remove_interest(int fd, FileDescription&);
+
+    // Called once the last file descriptor referring to the description has been closed.
+    void did_close_description(FileDescription&);
+
+    // Appends up to max_events events for ready descriptions to the given vector.
+    KResult collect_ready_events(Vector<epoll_event>&, size_t max_events);
+
+    virtual bool can_read(const FileDescription&, size_t) const override;
+    virtual bool can_write(const FileDescription&, size_t) const override { return false; }
+    virtual KResultOr<size_t> read(FileDescription&, u64, UserOrKernelBuffer&, size_t) override { return EINVAL; }
+    virtual KResultOr<size_t> write(FileDescription&, u64, const UserOrKernelBuffer&, size_t) override { return EINVAL; }
+    virtual String absolute_path(const FileDescription&) const override { return "epoll"; }
+    virtual const char* class_name() const override { return "EventPoll"; }
+    virtual bool is_event_poll() const override { return true; }
+
+private:
+    class Interest final : public Thread::FileBlocker {
+    public:
+        Interest(EventPoll&, int fd, FileDescription&, u32 events, u64 data);
+        virtual ~Interest() override;
+
+        FileDescription& description() { return m_description; }
+        bool is_stale() const;
+
+        virtual const char* state_string() const override { return "EventPoll"; }
+        virtual void not_blocking(bool) override { }
+        virtual bool unblock(bool, void*) override;
+
+    private:
+        friend class EventPoll;
+
+        BlockFlags block_flags() const;
+
+        EventPoll& m_event_poll;
+        const int m_fd;
+        NonnullRefPtr<FileDescription> m_description;
+        // The following are protected by the event poll's m_ready_lock.
+        Atomic<u32> m_events;
+        u64 m_data { 0 };
+        bool m_enabled { true };
+        u64 m_reported_generation { 0 };
+        IntrusiveListNode<Interest> m_ready_list_node;
+    };
+
+    EventPoll();
+
+    void did_become_ready(Interest&);
+
+    Lock m_lock { "EventPoll" };
+    HashMap<int, NonnullOwnPtr<Interest>> m_interests;
+
+    mutable SpinLock<u8> m_ready_lock;
+    IntrusiveList<Interest, RawPtr<Interest>, &Interest::m_ready_list_node> m_ready_list;
+    u64 m_generation { 0 };
+};
+
+}
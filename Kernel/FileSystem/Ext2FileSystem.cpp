@@ -1,4 +1,5 @@
 // includes
+#include <AK/BinarySearch.h>
 #include <AK/HashMap.h>
 #include <AK/MemoryStream.h>
 #include <AK/StdLibExtras.h>
@@ -203,32 +204,167 @@ Ext2FS::BlockListShape Ext2FS::compute_block_list_shape(unsigned blocks) const
     return shape;
 }
 
-KResult Ext2FSInode::write_indirect_block(BlockBasedFS::BlockIndex block, Span<BlockBasedFS::BlockIndex> blocks_indices)
+void Ext2FSBlockMap::reset(u32 block_count, u32 entries_per_block)
+{
+    m_extents.clear();
+    m_loaded_chunks = {};
+    m_block_count = block_count;
+    m_entries_per_block = entries_per_block;
+    m_initialized = true;
+}
+
+size_t Ext2FSBlockMap::chunk_index(u32 logical) const
+{
+    if (logical < EXT2_NDIR_BLOCKS)
+        return 0;
+    return 1 + (logical - EXT2_NDIR_BLOCKS) / m_entries_per_block;
+}
+
+u32 Ext2FSBlockMap::chunk_first_block(size_t chunk) const
+{
+    if (chunk == 0)
+        return 0;
+    return EXT2_NDIR_BLOCKS + (chunk - 1) * m_entries_per_block;
+}
+
+void Ext2FSBlockMap::set_chunk_loaded(size_t chunk, bool loaded)
+{
+    if (chunk >= m_loaded_chunks.size()) {
+        if (!loaded)
+            return;
+        // Keep the size a multiple of 64 so growing never has to patch up a partial byte.
+        m_loaded_chunks.grow(round_up_to_power_of_two(max(chunk + 1, m_loaded_chunks.size() * 2), 64), false);
+    }
+    m_loaded_chunks.set(chunk, loaded);
+}
+
+bool Ext2FSBlockMap::can_merge(const Extent& a, const Extent& b)
+{
+    if (a.logical_end() != b.logical_start)
+        return false;
+    if (a.is_hole() || b.is_hole())
+        return a.is_hole() && b.is_hole();
+    return a.physical_start + a.length == b.physical_start;
+}
+
+void Ext2FSBlockMap::merge_with_next(size_t index)
+{
+    if (index + 1 >= m_extents.size() || !can_merge(m_extents[index], m_extents[index + 1]))
+        return;
+    m_extents[index].length += m_extents[index + 1].length;
+    m_extents.remove(index + 1);
+}
+
+void Ext2FSBlockMap::insert_chunk(size_t chunk, Span<const u32> blocks)
+{
+    VERIFY(!is_chunk_loaded(chunk));
+    auto first_block = chunk_first_block(chunk);
+    VERIFY(first_block + blocks.size() <= m_block_count);
+
+    // Extents never overlap, so the insertion point is the first extent starting after this chunk.
+    size_t index = 0;
+    size_t high = m_extents.size();
+    while (index < high) {
+        size_t middle = index + (high - index) / 2;
+        if (m_extents[middle].logical_start < first_block)
+            index = middle + 1;
+        else
+            high = middle;
+    }
+
+    size_t first_inserted_index = index;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        Extent extent { first_block + static_cast<u32>(i), blocks[i], 1 };
+        if (index > first_inserted_index && can_merge(m_extents[index - 1], extent)) {
+            ++m_extents[index - 1].length;
+            continue;
+        }
+        m_extents.insert(index++, extent);
+    }
+
+    if (index > first_inserted_index) {
+        merge_with_next(index - 1);
+        if (first_inserted_index > 0)
+            merge_with_next(first_inserted_index - 1);
+    }
+    set_chunk_loaded(chunk, true);
+}
+
+const Ext2FSBlockMap::Extent* Ext2FSBlockMap::find(u32 logical) const
+{
+    return binary_search(m_extents, logical, nullptr, [](u32 needle, const Extent& extent) {
+        if (needle < extent.logical_start)
+            return -1;
+        if (needle >= extent.logical_end())
+            return 1;
+        return 0;
+    });
+}
+
+void Ext2FSBlockMap::append(BlockBasedFS::BlockIndex block)
+{
+    auto logical = m_block_count;
+    auto chunk = chunk_index(logical);
+    if (logical == chunk_first_block(chunk))
+        set_chunk_loaded(chunk, true);
+    // Appending to a chunk that is only partially in memory would leave a gap in the map.
+    VERIFY(is_chunk_loaded(chunk));
+
+    Extent extent { logical, static_cast<u32>(block.value()), 1 };
+    if (!m_extents.is_empty() && can_merge(m_extents.last(), extent))
+        ++m_extents.last().length;
+    else
+        m_extents.append(extent);
+    ++m_block_count;
+}
+
+void Ext2FSBlockMap::truncate(u32 block_count)
+{
+    VERIFY(block_count <= m_block_count);
+    while (!m_extents.is_empty() && m_extents.last().logical_start >= block_count)
+        m_extents.take_last();
+    if (!m_extents.is_empty() && m_extents.last().logical_end() > block_count)
+        m_extents.last().length = block_count - m_extents.last().logical_start;
+
+    auto first_unused_chunk = block_count ? chunk_index(block_count - 1) + 1 : 0;
+    for (size_t chunk = first_unused_chunk; chunk < m_loaded_chunks.size(); ++chunk)
+        set_chunk_loaded(chunk, false);
+    m_block_count = block_count;
+}
+
+KResult Ext2FSInode::write_indirect_block(BlockBasedFS::BlockIndex block, u32 first_logical_block, size_t count)
 {
     const auto entries_per_block = EXT2_ADDR_PER_BLOCK(&fs().super_block());
-    VERIFY(blocks_indices.size() <= entries_per_block);
+    VERIFY(count <= entries_per_block);
 
     auto block_contents = ByteBuffer::create_uninitialized(fs().block_size());
     OutputMemoryStream stream { block_contents };
     auto buffer = UserOrKernelBuffer::for_kernel_buffer(stream.data());
 
-    VERIFY(blocks_indices.size() <= EXT2_ADDR_PER_BLOCK(&fs().super_block()));
-    for (unsigned i = 0; i < blocks_indices.size(); ++i)
-        stream << static_cast<u32>(blocks_indices[i].value());
+    const u32 end_logical_block = first_logical_block + count;
+    for (u32 logical_block = first_logical_block; logical_block < end_logical_block;) {
+        auto extent_or_error = block_extent_at(logical_block);
+        if (extent_or_error.is_error())
+            return extent_or_error.error();
+        auto& extent = extent_or_error.value();
+        auto extent_end = min(extent.logical_end(), end_logical_block);
+        for (; logical_block < extent_end; ++logical_block)
+            stream << static_cast<u32>(extent.physical_block_at(logical_block).value());
+    }
     stream.fill_to_end(0);
 
     return fs().write_block(block, buffer, stream.size());
 }
 
-KResult Ext2FSInode::grow_doubly_indirect_block(BlockBasedFS::BlockIndex block, size_t old_blocks_length, Span<BlockBasedFS::BlockIndex> blocks_indices, Vector<Ext2FS::BlockIndex>& new_meta_blocks, unsigned& meta_blocks)
+KResult Ext2FSInode::grow_doubly_indirect_block(BlockBasedFS::BlockIndex block, size_t old_blocks_length, size_t new_blocks_length, u32 first_logical_block, Vector<Ext2FS::BlockIndex>& new_meta_blocks, unsigned& meta_blocks)
 {
     const auto entries_per_block = EXT2_ADDR_PER_BLOCK(&fs().super_block());
     const auto entries_per_doubly_indirect_block = entries_per_block * entries_per_block;
     const auto old_indirect_blocks_length = divide_rounded_up(old_blocks_length, entries_per_block);
-    const auto new_indirect_blocks_length = divide_rounded_up(blocks_indices.size(), entries_per_block);
-    VERIFY(blocks_indices.size() > 0);
-    VERIFY(blocks_indices.size() > old_blocks_length);
-    VERIFY(blocks_indices.size() <= entries_per_doubly_indirect_block);
+    const auto new_indirect_blocks_length = divide_rounded_up(new_blocks_length, entries_per_block);
+    VERIFY(new_blocks_length > 0);
+    VERIFY(new_blocks_length > old_blocks_length);
+    VERIFY(new_blocks_length <= entries_per_doubly_indirect_block);
 
     auto block_contents = ByteBuffer::create_uninitialized(fs().block_size());
     auto* block_as_pointers = (unsigned*)block_contents.data();
@@ -254,7 +390,7 @@ KResult Ext2FSInode::grow_doubly_indirect_block(BlockBasedFS::BlockIndex block,
     // Write out the indirect blocks.
     for (unsigned i = old_blocks_length / entries_per_block; i < new_indirect_blocks_length; i++) {
         const auto offset_block = i * entries_per_block;
-        if (auto result = write_indirect_block(block_as_pointers[i], blocks_indices.slice(offset_block, min(blocks_indices.size() - offset_block, entries_per_block))); result.is_error())
+        if (auto result = write_indirect_block(block_as_pointers[i], first_logical_block + offset_block, min(new_blocks_length - offset_block, entries_per_block)); result.is_error())
             return result;
     }
 
@@ -297,16 +433,16 @@ KResult Ext2FSInode::shrink_doubly_indirect_block(BlockBasedFS::BlockIndex block
     return KSuccess;
 }
 
-KResult Ext2FSInode::grow_triply_indirect_block(BlockBasedFS::BlockIndex block, size_t old_blocks_length, Span<BlockBasedFS::BlockIndex> blocks_indices, Vector<Ext2FS::BlockIndex>& new_meta_blocks, unsigned& meta_blocks)
+KResult Ext2FSInode::grow_triply_indirect_block(BlockBasedFS::BlockIndex block, size_t old_blocks_length, size_t new_blocks_length, u32 first_logical_block, Vector<Ext2FS::BlockIndex>& new_meta_blocks, unsigned& meta_blocks)
 {
     const auto entries_per_block = EXT2_ADDR_PER_BLOCK(&fs().super_block());
     const auto entries_per_doubly_indirect_block = entries_per_block * entries_per_block;
     const auto entries_per_triply_indirect_block = entries_per_block * entries_per_block;
     const auto old_doubly_indirect_blocks_length = divide_rounded_up(old_blocks_length, entries_per_doubly_indirect_block);
-    const auto new_doubly_indirect_blocks_length = divide_rounded_up(blocks_indices.size(), entries_per_doubly_indirect_block);
-    VERIFY(blocks_indices.size() > 0);
-    VERIFY(blocks_indices.size() > old_blocks_length);
-    VERIFY(blocks_indices.size() <= entries_per_triply_indirect_block);
+    const auto new_doubly_indirect_blocks_length = divide_rounded_up(new_blocks_length, entries_per_doubly_indirect_block);
+    VERIFY(new_blocks_length > 0);
+    VERIFY(new_blocks_length > old_blocks_length);
+    VERIFY(new_blocks_length <= entries_per_triply_indirect_block);
 
     auto block_contents = ByteBuffer::create_uninitialized(fs().block_size());
     auto* block_as_pointers = (unsigned*)block_contents.data();
@@ -333,8 +469,8 @@ KResult Ext2FSInode::grow_triply_indirect_block(BlockBasedFS::BlockIndex block,
     for (unsigned i = old_blocks_length / entries_per_doubly_indirect_block; i < new_doubly_indirect_blocks_length; i++) {
         const auto processed_blocks = i * entries_per_doubly_indirect_block;
         const auto old_doubly_indirect_blocks_length = min(old_blocks_length > processed_blocks ? old_blocks_length - processed_blocks : 0, entries_per_doubly_indirect_block);
-        const auto new_doubly_indirect_blocks_length = min(blocks_indices.size() > processed_blocks ? blocks_indices.size() - processed_blocks : 0, entries_per_doubly_indirect_block);
-        if (auto result = grow_doubly_indirect_block(block_as_pointers[i], old_doubly_indirect_blocks_length, blocks_indices.slice(processed_blocks, new_doubly_indirect_blocks_length), new_meta_blocks, meta_blocks); result.is_error())
+        const auto new_doubly_indirect_blocks_length = min(new_blocks_length > processed_blocks ? new_blocks_length - processed_blocks : 0, entries_per_doubly_indirect_block);
+        if (auto result = grow_doubly_indirect_block(block_as_pointers[i], old_doubly_indirect_blocks_length, new_doubly_indirect_blocks_length, first_logical_block + processed_blocks, new_meta_blocks, meta_blocks); result.is_error())
             return result;
     }
 
@@ -384,18 +520,20 @@ KResult Ext2FSInode::flush_block_list()
 {
     Locker locker(m_lock);
 
-    if (m_block_list.is_empty()) {
+    initialize_block_map_if_needed();
+    const auto new_block_count = m_block_map.block_count();
+    if (new_block_count == 0) {
         m_raw_inode.i_blocks = 0;
         memset(m_raw_inode.i_block, 0, sizeof(m_raw_inode.i_block));
         set_metadata_dirty(true);
         return KSuccess;
     }
 
-    // NOTE: There is a mismatch between i_blocks and blocks.size() since i_blocks includes meta blocks and blocks.size() does not.
+    // NOTE: There is a mismatch between i_blocks and the block count since i_blocks includes meta blocks and the block count does not.
     const auto old_block_count = ceil_div(size(), static_cast<u64>(fs().block_size()));
 
     auto old_shape = fs().compute_block_list_shape(old_block_count);
-    const auto new_shape = fs().compute_block_list_shape(m_block_list.size());
+    const auto new_shape = fs().compute_block_list_shape(new_block_count);
 
     Vector<Ext2FS::BlockIndex> new_meta_blocks;
     if (new_shape.meta_blocks > old_shape.meta_blocks) {
@@ -405,30 +543,36 @@ KResult Ext2FSInode::flush_block_list()
         new_meta_blocks = blocks_or_error.release_value();
     }
 
-    m_raw_inode.i_blocks = (m_block_list.size() + new_shape.meta_blocks) * (fs().block_size() / 512);
+    m_raw_inode.i_blocks = (new_block_count + new_shape.meta_blocks) * (fs().block_size() / 512);
     dbgln_if(EXT2_BLOCKLIST_DEBUG, "Ext2FSInode[{}]::flush_block_list(): Old shape=({};{};{};{}:{}), new shape=({};{};{};{}:{})", identifier(), old_shape.direct_blocks, old_shape.indirect_blocks, old_shape.doubly_indirect_blocks, old_shape.triply_indirect_blocks, old_shape.meta_blocks, new_shape.direct_blocks, new_shape.indirect_blocks, new_shape.doubly_indirect_blocks, new_shape.triply_indirect_blocks, new_shape.meta_blocks);
 
     unsigned output_block_index = 0;
-    unsigned remaining_blocks = m_block_list.size();
+    unsigned remaining_blocks = new_block_count;
 
-    // Deal with direct blocks.
-    bool inode_dirty = false;
+    // Deal with direct blocks. They only need to be looked at if the resize touched them.
     VERIFY(new_shape.direct_blocks <= EXT2_NDIR_BLOCKS);
-    for (unsigned i = 0; i < new_shape.direct_blocks; ++i) {
-        if (BlockBasedFS::BlockIndex(m_raw_inode.i_block[i]) != m_block_list[output_block_index])
-            inode_dirty = true;
-        m_raw_inode.i_block[i] = m_block_list[output_block_index].value();
-        ++output_block_index;
-        --remaining_blocks;
-    }
-    if (inode_dirty) {
-        if constexpr (EXT2_DEBUG) {
-            dbgln("Ext2FSInode[{}]::flush_block_list(): Writing {} direct block(s) to i_block array of inode {}", identifier(), min((size_t)EXT2_NDIR_BLOCKS, m_block_list.size()), index());
-            for (size_t i = 0; i < min((size_t)EXT2_NDIR_BLOCKS, m_block_list.size()); ++i)
-                dbgln("   + {}", m_block_list[i]);
+    if (min(old_block_count, static_cast<u64>(new_block_count)) < EXT2_NDIR_BLOCKS) {
+        bool inode_dirty = false;
+        for (unsigned i = 0; i < new_shape.direct_blocks; ++i) {
+            auto extent_or_error = block_extent_at(i);
+            if (extent_or_error.is_error())
+                return extent_or_error.error();
+            auto block_index = extent_or_error.value().physical_block_at(i);
+            if (BlockBasedFS::BlockIndex(m_raw_inode.i_block[i]) != block_index)
+                inode_dirty = true;
+            m_raw_inode.i_block[i] = block_index.value();
+        }
+        if (inode_dirty) {
+            if constexpr (EXT2_DEBUG) {
+                dbgln("Ext2FSInode[{}]::flush_block_list(): Writing {} direct block(s) to i_block array of inode {}", identifier(), new_shape.direct_blocks, index());
+                for (size_t i = 0; i < new_shape.direct_blocks; ++i)
+                    dbgln("   + {}", m_raw_inode.i_block[i]);
+            }
+            set_metadata_dirty(true);
         }
-        set_metadata_dirty(true);
     }
+    output_block_index += new_shape.direct_blocks;
+    remaining_blocks -= new_shape.direct_blocks;
 
     // Deal with indirect blocks.
     if (old_shape.indirect_blocks != new_shape.indirect_blocks) {
@@ -442,7 +586,7 @@ KResult Ext2FSInode::flush_block_list()
                 old_shape.meta_blocks++;
             }
 
-            if (auto result = write_indirect_block(m_raw_inode.i_block[EXT2_IND_BLOCK], m_block_list.span().slice(output_block_index, new_shape.indirect_blocks)); result.is_error())
+            if (auto result = write_indirect_block(m_raw_inode.i_block[EXT2_IND_BLOCK], output_block_index, new_shape.indirect_blocks); result.is_error())
                 return result;
         } else if ((new_shape.indirect_blocks == 0) && (old_shape.indirect_blocks != 0)) {
             dbgln_if(EXT2_BLOCKLIST_DEBUG, "Ext2FSInode[{}]::flush_block_list(): Freeing indirect block: {}", identifier(), m_raw_inode.i_block[EXT2_IND_BLOCK]);
@@ -465,7 +609,7 @@ KResult Ext2FSInode::flush_block_list()
                 set_metadata_dirty(true);
                 old_shape.meta_blocks++;
             }
-            if (auto result = grow_doubly_indirect_block(m_raw_inode.i_block[EXT2_DIND_BLOCK], old_shape.doubly_indirect_blocks, m_block_list.span().slice(output_block_index, new_shape.doubly_indirect_blocks), new_meta_blocks, old_shape.meta_blocks); result.is_error())
+            if (auto result = grow_doubly_indirect_block(m_raw_inode.i_block[EXT2_DIND_BLOCK], old_shape.doubly_indirect_blocks, new_shape.doubly_indirect_blocks, output_block_index, new_meta_blocks, old_shape.meta_blocks); result.is_error())
                 return result;
         } else {
             if (auto result = shrink_doubly_indirect_block(m_raw_inode.i_block[EXT2_DIND_BLOCK], old_shape.doubly_indirect_blocks, new_shape.doubly_indirect_blocks, old_shape.meta_blocks); result.is_error())
@@ -486,7 +630,7 @@ KResult Ext2FSInode::flush_block_list()
                 set_metadata_dirty(true);
                 old_shape.meta_blocks++;
             }
-            if (auto result = grow_triply_indirect_block(m_raw_inode.i_block[EXT2_TIND_BLOCK], old_shape.triply_indirect_blocks, m_block_list.span().slice(output_block_index, new_shape.triply_indirect_blocks), new_meta_blocks, old_shape.meta_blocks); result.is_error())
+            if (auto result = grow_triply_indirect_block(m_raw_inode.i_block[EXT2_TIND_BLOCK], old_shape.triply_indirect_blocks, new_shape.triply_indirect_blocks, output_block_index, new_meta_blocks, old_shape.meta_blocks); result.is_error())
                 return result;
         } else {
             if (auto result = shrink_triply_indirect_block(m_raw_inode.i_block[EXT2_TIND_BLOCK], old_shape.triply_indirect_blocks, new_shape.triply_indirect_blocks, old_shape.meta_blocks); result.is_error())
@@ -507,9 +651,93 @@ KResult Ext2FSInode::flush_block_list()
     VERIFY_NOT_REACHED();
 }
 
-Vector<Ext2FS::BlockIndex> Ext2FSInode::compute_block_list() const
+void Ext2FSInode::initialize_block_map_if_needed() const
+{
+    if (m_block_map.is_initialized())
+        return;
+
+    u32 block_count = ceil_div(size(), static_cast<u64>(fs().block_size()));
+    // Symbolic links shorter than 60 characters keep their path inline in the i_block array.
+    if (is_symlink() && m_raw_inode.i_blocks == 0)
+        block_count = 0;
+    m_block_map.reset(block_count, EXT2_ADDR_PER_BLOCK(&fs().super_block()));
+}
+
+KResultOr<BlockBasedFS::BlockIndex> Ext2FSInode::read_block_pointer(BlockBasedFS::BlockIndex block, unsigned index) const
+{
+    if (block.value() == 0)
+        return BlockBasedFS::BlockIndex(0);
+    u32 pointer = 0;
+    auto buffer = UserOrKernelBuffer::for_kernel_buffer(reinterpret_cast<u8*>(&pointer));
+    if (auto result = fs().read_block(block, &buffer, sizeof(pointer), index * sizeof(pointer)); result.is_error())
+        return result;
+    return BlockBasedFS::BlockIndex(pointer);
+}
+
+KResult Ext2FSInode::load_block_map_chunk(size_t chunk) const
+{
+    VERIFY(m_lock.is_locked());
+    const u32 entries_per_block = EXT2_ADDR_PER_BLOCK(&fs().super_block());
+    const u32 first_block = m_block_map.chunk_first_block(chunk);
+    VERIFY(first_block < m_block_map.block_count());
+
+    if (chunk == 0) {
+        auto count = min(m_block_map.block_count(), (u32)EXT2_NDIR_BLOCKS);
+        m_block_map.insert_chunk(0, { m_raw_inode.i_block, count });
+        return KSuccess;
+    }
+
+    // Walk down to the leaf indirect block that lists this chunk's blocks. Only the
+    // pointers on the way are read, not the rest of the indirect block tree.
+    BlockBasedFS::BlockIndex leaf_block;
+    u32 leaf_index = chunk - 1;
+    if (leaf_index == 0) {
+        leaf_block = m_raw_inode.i_block[EXT2_IND_BLOCK];
+    } else if (leaf_index - 1 < entries_per_block) {
+        auto block_or_error = read_block_pointer(m_raw_inode.i_block[EXT2_DIND_BLOCK], leaf_index - 1);
+        if (block_or_error.is_error())
+            return block_or_error.error();
+        leaf_block = block_or_error.value();
+    } else {
+        leaf_index -= 1 + entries_per_block;
+        VERIFY(leaf_index < entries_per_block * entries_per_block);
+        auto block_or_error = read_block_pointer(m_raw_inode.i_block[EXT2_TIND_BLOCK], leaf_index / entries_per_block);
+        if (block_or_error.is_error())
+            return block_or_error.error();
+        block_or_error = read_block_pointer(block_or_error.value(), leaf_index % entries_per_block);
+        if (block_or_error.is_error())
+            return block_or_error.error();
+        leaf_block = block_or_error.value();
+    }
+
+    auto count = min(m_block_map.block_count() - first_block, entries_per_block);
+    auto array_storage = ByteBuffer::create_zeroed(count * sizeof(u32));
+    auto* array = reinterpret_cast<u32*>(array_storage.data());
+    if (leaf_block.value() != 0) {
+        auto buffer = UserOrKernelBuffer::for_kernel_buffer(array_storage.data());
+        if (auto result = fs().read_block(leaf_block, &buffer, array_storage.size(), 0); result.is_error()) {
+            dbgln("Ext2FSInode[{}]::load_block_map_chunk(): Failed to read indirect block {}: {}", identifier(), leaf_block, result.error());
+            return result;
+        }
+    }
+
+    m_block_map.insert_chunk(chunk, { array, count });
+    dbgln_if(EXT2_BLOCKLIST_DEBUG, "Ext2FSInode[{}]::load_block_map_chunk(): Loaded chunk {} ({} blocks), map now has {} extents", identifier(), chunk, count, m_block_map.extent_count());
+    return KSuccess;
+}
+
+KResultOr<Ext2FSBlockMap::Extent> Ext2FSInode::block_extent_at(u32 logical_block) const
 {
-    return compute_block_list_impl(false);
+    initialize_block_map_if_needed();
+    VERIFY(logical_block < m_block_map.block_count());
+    auto chunk = m_block_map.chunk_index(logical_block);
+    if (!m_block_map.is_chunk_loaded(chunk)) {
+        if (auto result = load_block_map_chunk(chunk); result.is_error())
+            return result;
+    }
+    auto* extent = m_block_map.find(logical_block);
+    VERIFY(extent);
+    return *extent;
 }
 
 Vector<Ext2FS::BlockIndex> Ext2FSInode::compute_block_list_with_meta_blocks() const
@@ -822,10 +1050,8 @@ ssize_t Ext2FSInode::read_bytes(off_t offset, ssize_t count, UserOrKernelBuffer&
         return nread;
     }
 
-    if (m_block_list.is_empty())
-        m_block_list = compute_block_list();
-
-    if (m_block_list.is_empty()) {
+    initialize_block_map_if_needed();
+    if (m_block_map.block_count() == 0) {
         dmesgln("Ext2FSInode[{}]::read_bytes(): Empty block list", identifier());
         return -EIO;
     }
@@ -836,8 +1062,8 @@ ssize_t Ext2FSInode::read_bytes(off_t offset, ssize_t count, UserOrKernelBuffer&
 
     BlockBasedFS::BlockIndex first_block_logical_index = offset / block_size;
     BlockBasedFS::BlockIndex last_block_logical_index = (offset + count) / block_size;
-    if (last_block_logical_index >= m_block_list.size())
-        last_block_logical_index = m_block_list.size() - 1;
+    if (last_block_logical_index >= m_block_map.block_count())
+        last_block_logical_index = m_block_map.block_count() - 1;
 
     int offset_into_first_block = offset % block_size;
 
@@ -847,7 +1073,11 @@ ssize_t Ext2FSInode::read_bytes(off_t offset, ssize_t count, UserOrKernelBuffer&
     dbgln_if(EXT2_VERY_DEBUG, "Ext2FSInode[{}]::read_bytes(): Reading up to {} bytes, {} bytes into inode to {}", identifier(), count, offset, buffer.user_or_kernel_ptr());
 
     for (auto bi = first_block_logical_index; remaining_count && bi <= last_block_logical_index; bi = bi.value() + 1) {
-        auto block_index = m_block_list[bi.value()];
+        auto extent_or_error = block_extent_at(bi.value());
+        if (extent_or_error.is_error())
+            return extent_or_error.error();
+        auto& extent = extent_or_error.value();
+        auto block_index = extent.physical_block_at(bi.value());
         size_t offset_into_block = (bi == first_block_logical_index) ? offset_into_first_block : 0;
         size_t num_bytes_to_copy = min((off_t)block_size - offset_into_block, remaining_count);
         auto buffer_offset = buffer.offset(nread);
@@ -855,6 +1085,19 @@ ssize_t Ext2FSInode::read_bytes(off_t offset, ssize_t count, UserOrKernelBuffer&
             // This is a hole, act as if it's filled with zeroes.
             if (!buffer_offset.memset(0, num_bytes_to_copy))
                 return -EFAULT;
+        } else if (offset_into_block == 0 && num_bytes_to_copy == (size_t)block_size) {
+            // Whole blocks from the same extent are consecutive on disk and can be read with a single device request.
+            unsigned run_length = 1;
+            while (bi.value() + run_length <= last_block_logical_index.value()
+                && bi.value() + run_length < extent.logical_end()
+                && remaining_count >= (off_t)(run_length + 1) * block_size)
+                ++run_length;
+            if (auto result = fs().read_blocks(block_index, run_length, buffer_offset, allow_cache); result.is_error()) {
+                dmesgln("Ext2FSInode[{}]::read_bytes(): Failed to read {} blocks at {} (index {})", identifier(), run_length, block_index.value(), bi);
+                return result.error();
+            }
+            num_bytes_to_copy = run_length * block_size;
+            bi = bi.value() + run_length - 1;
         } else {
             if (auto result = fs().read_block(block_index, &buffer_offset, num_bytes_to_copy, offset_into_block, allow_cache); result.is_error()) {
                 dmesgln("Ext2FSInode[{}]::read_bytes(): Failed to read block {} (index {})", identifier(), block_index.value(), bi);
@@ -865,9 +1108,60 @@ ssize_t Ext2FSInode::read_bytes(off_t offset, ssize_t count, UserOrKernelBuffer&
         nread += num_bytes_to_copy;
     }
 
+    if (description && allow_cache)
+        read_ahead(*description, offset, nread);
+
     return nread;
 }
 
+void Ext2FSInode::read_ahead(FileDescription& description, off_t offset, size_t nread) const
+{
+    static constexpr u32 min_read_ahead_blocks = 4;
+    static constexpr u32 max_read_ahead_blocks = 128;
+
+    auto& state = description.read_ahead_state();
+    ScopedSpinLock lock(state.lock);
+    bool is_sequential = static_cast<u64>(offset) == state.next_offset;
+    state.next_offset = offset + nread;
+
+    if (!is_sequential) {
+        // Random access, so prefetching would most likely be wasted.
+        state.window_blocks = 0;
+        state.prefetched_until = 0;
+        return;
+    }
+
+    // The window doubles for as long as the reader keeps going sequentially.
+    state.window_blocks = clamp(state.window_blocks * 2, min_read_ahead_blocks, max_read_ahead_blocks);
+
+    u64 current_block = state.next_offset / fs().block_size();
+    // Don't refill until the reader has consumed half of what we prefetched last time,
+    // so that read-ahead goes out in large runs instead of one block per read.
+    if (state.prefetched_until > current_block + state.window_blocks / 2)
+        return;
+
+    u64 first_block = max(current_block, state.prefetched_until);
+    u64 end_block = min(current_block + state.window_blocks, static_cast<u64>(m_block_map.block_count()));
+    if (first_block >= end_block)
+        return;
+    // Claim the range before dropping the lock, so that a concurrent reader doesn't prefetch it too.
+    state.prefetched_until = end_block;
+    lock.unlock();
+
+    Vector<BlockBasedFS::BlockIndex, max_read_ahead_blocks> blocks;
+    for (u32 logical_block = first_block; logical_block < end_block;) {
+        auto extent_or_error = block_extent_at(logical_block);
+        if (extent_or_error.is_error())
+            return;
+        auto& extent = extent_or_error.value();
+        auto extent_end = min(static_cast<u64>(extent.logical_end()), end_block);
+        for (; logical_block < extent_end; ++logical_block)
+            blocks.unchecked_append(extent.physical_block_at(logical_block));
+    }
+
+    fs().read_ahead(blocks.span());
+}
+
 KResult Ext2FSInode::resize(u64 new_size)
 {
     auto old_size = size();
@@ -892,30 +1186,38 @@ KResult Ext2FSInode::resize(u64 new_size)
             return ENOSPC;
     }
 
-    if (m_block_list.is_empty())
-        m_block_list = this->compute_block_list();
+    initialize_block_map_if_needed();
+    auto block_count = m_block_map.block_count();
 
     if (blocks_needed_after > blocks_needed_before) {
+        // The new blocks extend the last chunk of the map, so it has to be in memory first.
+        if (block_count != 0) {
+            if (auto extent_or_error = block_extent_at(block_count - 1); extent_or_error.is_error())
+                return extent_or_error.error();
+        }
         auto blocks_or_error = fs().allocate_blocks(fs().group_index_from_inode(index()), blocks_needed_after - blocks_needed_before);
         if (blocks_or_error.is_error())
             return blocks_or_error.error();
-        m_block_list.append(blocks_or_error.release_value());
-    } else if (blocks_needed_after < blocks_needed_before) {
-        if constexpr (EXT2_VERY_DEBUG) {
-            dbgln("Ext2FSInode[{}]::resize(): Shrinking inode, old block list is {} entries:", identifier(), m_block_list.size());
-            for (auto block_index : m_block_list) {
-                dbgln("    # {}", block_index);
-            }
-        }
-        while (m_block_list.size() != blocks_needed_after) {
-            auto block_index = m_block_list.take_last();
-            if (block_index.value()) {
+        for (auto block_index : blocks_or_error.value())
+            m_block_map.append(block_index);
+    } else if (blocks_needed_after < blocks_needed_before && block_count > blocks_needed_after) {
+        dbgln_if(EXT2_VERY_DEBUG, "Ext2FSInode[{}]::resize(): Shrinking inode from {} to {} blocks", identifier(), block_count, blocks_needed_after);
+        for (u32 logical_block = blocks_needed_after; logical_block < block_count;) {
+            auto extent_or_error = block_extent_at(logical_block);
+            if (extent_or_error.is_error())
+                return extent_or_error.error();
+            auto& extent = extent_or_error.value();
+            for (; logical_block < extent.logical_end(); ++logical_block) {
+                auto block_index = extent.physical_block_at(logical_block);
+                if (!block_index.value())
+                    continue;
                 if (auto result = fs().set_block_allocation_state(block_index, false); result.is_error()) {
                     dbgln("Ext2FSInode[{}]::resize(): Failed to free block {}: {}", identifier(), block_index, result.error());
                     return result;
                 }
             }
         }
+        m_block_map.truncate(blocks_needed_after);
     }
 
     if (auto result = flush_block_list(); result.is_error())
@@ -977,18 +1279,15 @@ ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const UserOrKernel
     if (auto result = resize(new_size); result.is_error())
         return result;
 
-    if (m_block_list.is_empty())
-        m_block_list = compute_block_list();
-
-    if (m_block_list.is_empty()) {
+    if (m_block_map.block_count() == 0) {
         dbgln("Ext2FSInode[{}]::write_bytes(): Empty block list", identifier());
         return -EIO;
     }
 
     BlockBasedFS::BlockIndex first_block_logical_index = offset / block_size;
     BlockBasedFS::BlockIndex last_block_logical_index = (offset + count) / block_size;
-    if (last_block_logical_index >= m_block_list.size())
-        last_block_logical_index = m_block_list.size() - 1;
+    if (last_block_logical_index >= m_block_map.block_count())
+        last_block_logical_index = m_block_map.block_count() - 1;
 
     size_t offset_into_first_block = offset % block_size;
 
@@ -1000,16 +1299,20 @@ ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const UserOrKernel
     for (auto bi = first_block_logical_index; remaining_count && bi <= last_block_logical_index; bi = bi.value() + 1) {
         size_t offset_into_block = (bi == first_block_logical_index) ? offset_into_first_block : 0;
         size_t num_bytes_to_copy = min((off_t)block_size - offset_into_block, remaining_count);
-        dbgln_if(EXT2_DEBUG, "Ext2FSInode[{}]::write_bytes(): Writing block {} (offset_into_block: {})", identifier(), m_block_list[bi.value()], offset_into_block);
-        if (auto result = fs().write_block(m_block_list[bi.value()], data.offset(nwritten), num_bytes_to_copy, offset_into_block, allow_cache); result.is_error()) {
-            dbgln("Ext2FSInode[{}]::write_bytes(): Failed to write block {} (index {})", identifier(), m_block_list[bi.value()], bi);
+        auto extent_or_error = block_extent_at(bi.value());
+        if (extent_or_error.is_error())
+            return extent_or_error.error();
+        auto block_index = extent_or_error.value().physical_block_at(bi.value());
+        dbgln_if(EXT2_DEBUG, "Ext2FSInode[{}]::write_bytes(): Writing block {} (offset_into_block: {})", identifier(), block_index, offset_into_block);
+        if (auto result = fs().write_block(block_index, data.offset(nwritten), num_bytes_to_copy, offset_into_block, allow_cache); result.is_error()) {
+            dbgln("Ext2FSInode[{}]::write_bytes(): Failed to write block {} (index {})", identifier(), block_index, bi);
             return result;
         }
         remaining_count -= num_bytes_to_copy;
         nwritten += num_bytes_to_copy;
     }
 
-    dbgln_if(EXT2_VERY_DEBUG, "Ext2FSInode[{}]::write_bytes(): After write, i_size={}, i_blocks={} ({} blocks in list)", identifier(), size(), m_raw_inode.i_blocks, m_block_list.size());
+    dbgln_if(EXT2_VERY_DEBUG, "Ext2FSInode[{}]::write_bytes(): After write, i_size={}, i_blocks={} ({} blocks in map)", identifier(), size(), m_raw_inode.i_blocks, m_block_map.block_count());
     return nwritten;
 }
 
@@ -1162,7 +1465,7 @@ KResult Ext2FSInode::add_child(Inode& child, const StringView& name, mode_t mode
         return result;
 
     m_lookup_cache.set(name, child.index());
-    did_add_child(child.identifier());
+    did_add_child(child.identifier(), name);
     return KSuccess;
 }
 
@@ -1199,7 +1502,7 @@ KResult Ext2FSInode::remove_child(const StringView& name)
     if (result.is_error())
         return result;
 
-    did_remove_child(child_id);
+    did_remove_child(child_id, name);
     return KSuccess;
 }
 
@@ -1684,13 +1987,14 @@ KResultOr<int> Ext2FSInode::get_block_address(int index)
 {
     Locker locker(m_lock);
 
-    if (m_block_list.is_empty())
-        m_block_list = compute_block_list();
-
-    if (index < 0 || (size_t)index >= m_block_list.size())
+    initialize_block_map_if_needed();
+    if (index < 0 || (u32)index >= m_block_map.block_count())
         return 0;
 
-    return m_block_list[index].value();
+    auto extent_or_error = block_extent_at(index);
+    if (extent_or_error.is_error())
+        return extent_or_error.error();
+    return extent_or_error.value().physical_block_at(index).value();
 }
 
 unsigned Ext2FS::total_block_count() const
@@ -1,6 +1,7 @@
 #pragma once
 
 // includes
+#include <AK/Bitmap.h>
 #include <AK/BitmapView.h>
 #include <AK/HashMap.h>
 #include <Kernel/FileSystem/BlockBasedFileSystem.h>
@@ -18,6 +19,54 @@ namespace Kernel {
 class Ext2FS;
 struct Ext2FSDirectoryEntry;
 
+// Run-length map from an inode's logical blocks to the blocks backing them on disk.
+// It is populated lazily one chunk at a time: chunk 0 holds the direct blocks and every
+// further chunk holds the blocks listed by a single leaf indirect block.
+class Ext2FSBlockMap {
+public:
+    struct Extent {
+        u32 logical_start { 0 };
+        u32 physical_start { 0 };
+        u32 length { 0 };
+
+        u32 logical_end() const { return logical_start + length; }
+        bool is_hole() const { return physical_start == 0; }
+        BlockBasedFS::BlockIndex physical_block_at(u32 logical) const
+        {
+            VERIFY(logical >= logical_start && logical < logical_end());
+            if (is_hole())
+                return 0;
+            return physical_start + (logical - logical_start);
+        }
+    };
+
+    bool is_initialized() const { return m_initialized; }
+    void reset(u32 block_count, u32 entries_per_block);
+
+    u32 block_count() const { return m_block_count; }
+    size_t extent_count() const { return m_extents.size(); }
+
+    size_t chunk_index(u32 logical) const;
+    u32 chunk_first_block(size_t chunk) const;
+    bool is_chunk_loaded(size_t chunk) const { return chunk < m_loaded_chunks.size() && m_loaded_chunks.get(chunk); }
+    void insert_chunk(size_t chunk, Span<const u32> blocks);
+
+    const Extent* find(u32 logical) const;
+    void append(BlockBasedFS::BlockIndex);
+    void truncate(u32 block_count);
+
+private:
+    static bool can_merge(const Extent&, const Extent&);
+    void merge_with_next(size_t index);
+    void set_chunk_loaded(size_t chunk, bool);
+
+    Vector<Extent> m_extents;
+    Bitmap m_loaded_chunks;
+    u32 m_block_count { 0 };
+    u32 m_entries_per_block { 0 };
+    bool m_initialized { false };
+};
+
 class Ext2FSInode final : public Inode {
     friend class Ext2FS;
 
@@ -53,16 +102,20 @@ private:
     virtual KResult truncate(u64) override;
     virtual KResultOr<int> get_block_address(int) override;
 
+    void read_ahead(FileDescription&, off_t offset, size_t nread) const;
     KResult write_directory(const Vector<Ext2FSDirectoryEntry>&);
     bool populate_lookup_cache() const;
     KResult resize(u64);
-    KResult write_indirect_block(BlockBasedFS::BlockIndex, Span<BlockBasedFS::BlockIndex>);
-    KResult grow_doubly_indirect_block(BlockBasedFS::BlockIndex, size_t, Span<BlockBasedFS::BlockIndex>, Vector<BlockBasedFS::BlockIndex>&, unsigned&);
+    KResult write_indirect_block(BlockBasedFS::BlockIndex, u32 first_logical_block, size_t count);
+    KResult grow_doubly_indirect_block(BlockBasedFS::BlockIndex, size_t, size_t, u32, Vector<BlockBasedFS::BlockIndex>&, unsigned&);
     KResult shrink_doubly_indirect_block(BlockBasedFS::BlockIndex, size_t, size_t, unsigned&);
-    KResult grow_triply_indirect_block(BlockBasedFS::BlockIndex, size_t, Span<BlockBasedFS::BlockIndex>, Vector<BlockBasedFS::BlockIndex>&, unsigned&);
+    KResult grow_triply_indirect_block(BlockBasedFS::BlockIndex, size_t, size_t, u32, Vector<BlockBasedFS::BlockIndex>&, unsigned&);
     KResult shrink_triply_indirect_block(BlockBasedFS::BlockIndex, size_t, size_t, unsigned&);
     KResult flush_block_list();
-    Vector<BlockBasedFS::BlockIndex> compute_block_list() const;
+    void initialize_block_map_if_needed() const;
+    KResult load_block_map_chunk(size_t chunk) const;
+    KResultOr<Ext2FSBlockMap::Extent> block_extent_at(u32 logical_block) const;
+    KResultOr<BlockBasedFS::BlockIndex> read_block_pointer(BlockBasedFS::BlockIndex, unsigned index) const;
     Vector<BlockBasedFS::BlockIndex> compute_block_list_with_meta_blocks() const;
     Vector<BlockBasedFS::BlockIndex> compute_block_list_impl(bool include_block_list_blocks) const;
     Vector<BlockBasedFS::BlockIndex> compute_block_list_impl_internal(const ext2_inode& e2inode, bool include_block_list_blocks) const;
@@ -71,7 +124,7 @@ private:
     const Ext2FS& fs() const;
     Ext2FSInode(Ext2FS&, InodeIndex);
 
-    mutable Vector<BlockBasedFS::BlockIndex> m_block_list;
+    mutable Ext2FSBlockMap m_block_map;
     mutable HashMap<String, InodeIndex> m_lookup_cache;
     ext2_inode m_raw_inode;
 };
@@ -98,6 +151,7 @@ public:
     virtual KResult prepare_to_unmount() const override;
 
     virtual bool supports_watchers() const override { return true; }
+    virtual bool supports_dentry_cache() const override { return true; }
 
     virtual u8 internal_file_type_to_directory_entry_type(const DirectoryEntryView& entry) const override;
 
@@ -123,6 +123,7 @@ KResultOr<size_t> FIFO::read(FileDescription&, u64, UserOrKernelBuffer& buffer,
 {
     if (!m_writers && m_buffer.is_empty())
         return 0;
+    RingBuffer::SideLocker locker(m_read_side_lock);
     return m_buffer.read(buffer, size);
 }
 
@@ -133,9 +134,29 @@ KResultOr<size_t> FIFO::write(FileDescription&, u64, const UserOrKernelBuffer& b
         return EPIPE;
     }
 
+    RingBuffer::SideLocker locker(m_write_side_lock);
     return m_buffer.write(buffer, size);
 }
 
+KResultOr<size_t> FIFO::splice_from(FileDescription&, const SpliceSource& source, size_t size)
+{
+    if (!m_readers) {
+        Thread::current()->send_signal(SIGPIPE, Process::current());
+        return EPIPE;
+    }
+
+    RingBuffer::SideLocker locker(m_write_side_lock);
+    return m_buffer.write_from(source, size);
+}
+
+KResult FIFO::set_buffer_capacity(size_t capacity)
+{
+    // Resizing moves the data around, so neither side may touch the buffer meanwhile.
+    RingBuffer::SideLocker write_locker(m_write_side_lock);
+    RingBuffer::SideLocker read_locker(m_read_side_lock);
+    return m_buffer.try_resize(capacity);
+}
+
 String FIFO::absolute_path(const FileDescription&) const
 {
     return String::formatted("fifo:{}", m_fifo_id);
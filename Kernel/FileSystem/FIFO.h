@@ -1,9 +1,9 @@
 #pragma once
 
 // includes
-#include <Kernel/DoubleBuffer.h>
 #include <Kernel/FileSystem/File.h>
 #include <Kernel/Lock.h>
+#include <Kernel/RingBuffer.h>
 #include <Kernel/UnixTypes.h>
 #include <Kernel/WaitQueue.h>
 
@@ -30,10 +30,14 @@ public:
     void attach(Direction);
     void detach(Direction);
 
+    size_t buffer_capacity() const { return m_buffer.capacity(); }
+    KResult set_buffer_capacity(size_t capacity);
+
 private:
     // ^File
     virtual KResultOr<size_t> write(FileDescription&, u64, const UserOrKernelBuffer&, size_t) override;
     virtual KResultOr<size_t> read(FileDescription&, u64, UserOrKernelBuffer&, size_t) override;
+    virtual KResultOr<size_t> splice_from(FileDescription&, const SpliceSource&, size_t) override;
     virtual KResult stat(::stat&) const override;
     virtual bool can_read(const FileDescription&, size_t) const override;
     virtual bool can_write(const FileDescription&, size_t) const override;
@@ -45,7 +49,10 @@ private:
 
     unsigned m_writers { 0 };
     unsigned m_readers { 0 };
-    DoubleBuffer m_buffer;
+    RingBuffer m_buffer;
+    // A RingBuffer takes one writer and one reader at a time, but a FIFO can have many of each.
+    RingBuffer::SideLock m_write_side_lock { "FIFO write" };
+    RingBuffer::SideLock m_read_side_lock { "FIFO read" };
 
     uid_t m_uid { 0 };
 
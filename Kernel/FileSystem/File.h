@@ -1,6 +1,7 @@
 #pragma once
 
 // includes
+#include <AK/Function.h>
 #include <AK/NonnullRefPtr.h>
 #include <AK/RefCounted.h>
 #include <AK/String.h>
@@ -64,6 +65,15 @@ public:
 //   - Optional. If unimplemented, mmap() on this File will fail with -ENODEV.
 //   - Called by mmap() when userspace wants to memory-map this File somewhere.
 //   - Should create a Region in the Process and return it if successful.
+//
+// splice_from()
+//
+//   - Optional. If unimplemented, sendfile() copies through a bounce buffer instead.
+//   - Called by sendfile() to move data from another file straight into this File's buffer.
+//   - Should call the SpliceSource with kernel buffers to fill, and return how much was filled.
+
+// Fills the given kernel buffer with up to the given number of bytes, and returns how many it filled.
+using SpliceSource = Function<KResultOr<size_t>(UserOrKernelBuffer&, size_t)>;
 
 class File
     : public RefCounted<File>
@@ -82,6 +92,7 @@ public:
     virtual void did_seek(FileDescription&, off_t) { }
     virtual KResultOr<size_t> read(FileDescription&, u64, UserOrKernelBuffer&, size_t) = 0;
     virtual KResultOr<size_t> write(FileDescription&, u64, const UserOrKernelBuffer&, size_t) = 0;
+    virtual KResultOr<size_t> splice_from(FileDescription&, const SpliceSource&, size_t) { return ENOTSUP; }
     virtual int ioctl(FileDescription&, unsigned request, FlatPtr arg);
     virtual KResultOr<Region*> mmap(Process&, FileDescription&, const Range&, u64 offset, int prot, bool shared);
     virtual KResult stat(::stat&) const { return EBADF; }
@@ -104,6 +115,7 @@ public:
     virtual bool is_block_device() const { return false; }
     virtual bool is_character_device() const { return false; }
     virtual bool is_socket() const { return false; }
+    virtual bool is_event_poll() const { return false; }
 
     virtual FileBlockCondition& block_condition() { return m_block_condition; }
 
@@ -4,6 +4,7 @@
 #include <Kernel/Devices/BlockDevice.h>
 #include <Kernel/Devices/CharacterDevice.h>
 #include <Kernel/FileSystem/Custody.h>
+#include <Kernel/FileSystem/EventPoll.h>
 #include <Kernel/FileSystem/FIFO.h>
 #include <Kernel/FileSystem/FileDescription.h>
 #include <Kernel/FileSystem/FileSystem.h>
@@ -281,6 +282,34 @@ MasterPTY* FileDescription::master_pty()
     return static_cast<MasterPTY*>(m_file.ptr());
 }
 
+void FileDescription::did_close_fd()
+{
+    VERIFY(m_open_fd_count.load() > 0);
+    if (--m_open_fd_count != 0)
+        return;
+    Vector<WeakPtr<EventPoll>, 1> event_polls;
+    {
+        ScopedSpinLock lock(m_event_polls_lock);
+        event_polls = move(m_event_polls);
+    }
+    for (auto& weak_event_poll : event_polls) {
+        if (auto event_poll = weak_event_poll.strong_ref())
+            event_poll->did_close_description(*this);
+    }
+}
+
+void FileDescription::add_event_poll(EventPoll& event_poll)
+{
+    ScopedSpinLock lock(m_event_polls_lock);
+    for (auto& weak_event_poll : m_event_polls) {
+        if (weak_event_poll.unsafe_ptr() == &event_poll)
+            return;
+    }
+    // Forget about event polls that went away in the meantime while we're at it.
+    m_event_polls.remove_all_matching([](auto& weak_event_poll) { return weak_event_poll.is_null(); });
+    m_event_polls.append(event_poll.make_weak_ptr<EventPoll>());
+}
+
 KResult FileDescription::close()
 {
     if (m_file->attach_count() > 0)
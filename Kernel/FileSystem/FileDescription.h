@@ -4,11 +4,14 @@
 #include <AK/Badge.h>
 #include <AK/ByteBuffer.h>
 #include <AK/RefCounted.h>
+#include <AK/Vector.h>
+#include <AK/WeakPtr.h>
 #include <Kernel/FileSystem/FIFO.h>
 #include <Kernel/FileSystem/Inode.h>
 #include <Kernel/FileSystem/InodeMetadata.h>
 #include <Kernel/FileSystem/VirtualFileSystem.h>
 #include <Kernel/KBuffer.h>
+#include <Kernel/SpinLock.h>
 #include <Kernel/VirtualAddress.h>
 
 namespace Kernel {
@@ -110,10 +113,29 @@ public:
 
     off_t offset() const { return m_current_offset; }
 
+    // Tracks the access pattern of reads through this description, so that
+    // filesystems can prefetch ahead of sequential readers. Readers sharing the
+    // description update it concurrently, so it must only be touched under its lock.
+    struct ReadAheadState {
+        SpinLock<u8> lock;
+        u64 next_offset { 0 };
+        u32 window_blocks { 0 };
+        u64 prefetched_until { 0 };
+    };
+    ReadAheadState& read_ahead_state() { return m_read_ahead_state; }
+
     KResult chown(uid_t, gid_t);
 
     FileBlockCondition& block_condition();
 
+    // Counts the file descriptor table entries that refer to this description. Once the
+    // last of them is closed, event polls interested in it drop their interests, so that
+    // they don't keep it open.
+    void did_open_fd() { m_open_fd_count++; }
+    void did_close_fd();
+    u32 open_fd_count() const { return m_open_fd_count.load(); }
+    void add_event_poll(EventPoll&);
+
 private:
     friend class VFS;
     explicit FileDescription(File&);
@@ -133,6 +155,12 @@ private:
 
     OwnPtr<FileDescriptionData> m_data;
 
+    ReadAheadState m_read_ahead_state;
+
+    Atomic<u32> m_open_fd_count { 0 };
+    SpinLock<u8> m_event_polls_lock;
+    Vector<WeakPtr<EventPoll>, 1> m_event_polls;
+
     u32 m_file_flags { 0 };
 
     bool m_readable : 1 { false };
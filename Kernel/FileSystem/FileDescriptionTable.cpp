@@ -0,0 +1,201 @@
+// includes
+#include <Kernel/FileSystem/FileDescription.h>
+#include <Kernel/FileSystem/FileDescriptionTable.h>
+#include <LibC/errno_numbers.h>
+
+namespace Kernel {
+
+FileDescriptionTable::~FileDescriptionTable()
+{
+    for (size_t segment_index = 0; segment_index < segment_count; ++segment_index) {
+        auto* segment = m_segments[segment_index].load();
+        if (!segment)
+            continue;
+        for (size_t i = 0; i < (1u << segment_index); ++i)
+            delete segment[i].load();
+        delete[] segment;
+    }
+}
+
+FileDescriptionTable::Chunk* FileDescriptionTable::chunk(size_t chunk_index) const
+{
+    if (chunk_index >= max_chunk_count)
+        return nullptr;
+    size_t segment_index = this->segment_index(chunk_index);
+    auto* segment = m_segments[segment_index].load(AK::MemoryOrder::memory_order_acquire);
+    if (!segment)
+        return nullptr;
+    return segment[chunk_index - first_chunk_in_segment(segment_index)].load(AK::MemoryOrder::memory_order_acquire);
+}
+
+FileDescriptionTable::Entry* FileDescriptionTable::entry(int fd) const
+{
+    if (fd < 0 || fd >= max_size)
+        return nullptr;
+    auto* chunk = this->chunk(fd / chunk_size);
+    if (!chunk)
+        return nullptr;
+    return &chunk->entries[fd % chunk_size];
+}
+
+FileDescriptionTable::Entry& FileDescriptionTable::ensure_entry(int fd)
+{
+    VERIFY(m_lock.is_locked());
+    VERIFY(fd >= 0 && fd < max_size);
+    size_t chunk_index = fd / chunk_size;
+    size_t segment_index = this->segment_index(chunk_index);
+    auto& segment = m_segments[segment_index];
+    if (!segment.load(AK::MemoryOrder::memory_order_relaxed))
+        segment.store(new Atomic<Chunk*>[1u << segment_index] {}, AK::MemoryOrder::memory_order_release);
+    auto& chunk = segment.load(AK::MemoryOrder::memory_order_relaxed)[chunk_index - first_chunk_in_segment(segment_index)];
+    if (!chunk.load(AK::MemoryOrder::memory_order_relaxed))
+        chunk.store(new Chunk, AK::MemoryOrder::memory_order_release);
+    return chunk.load(AK::MemoryOrder::memory_order_relaxed)->entries[fd % chunk_size];
+}
+
+void FileDescriptionTable::mark_used(int fd)
+{
+    size_t chunk_index = fd / chunk_size;
+    auto& used = chunk(chunk_index)->used;
+    u32 word = used.load(AK::MemoryOrder::memory_order_relaxed);
+    u32 bit = 1u << (fd % chunk_size);
+    if (word & bit)
+        return;
+    word |= bit;
+    used.store(word, AK::MemoryOrder::memory_order_release);
+    if (word == 0xffffffff) {
+        while (chunk_index / 32 >= m_full_chunks.size())
+            m_full_chunks.append(0);
+        m_full_chunks[chunk_index / 32] |= 1u << (chunk_index % 32);
+    }
+    m_open_count++;
+}
+
+void FileDescriptionTable::mark_unused(int fd)
+{
+    size_t chunk_index = fd / chunk_size;
+    auto& used = chunk(chunk_index)->used;
+    u32 word = used.load(AK::MemoryOrder::memory_order_relaxed);
+    u32 bit = 1u << (fd % chunk_size);
+    if (!(word & bit))
+        return;
+    used.store(word & ~bit, AK::MemoryOrder::memory_order_release);
+    if (chunk_index / 32 < m_full_chunks.size())
+        m_full_chunks[chunk_index / 32] &= ~(1u << (chunk_index % 32));
+    m_open_count--;
+}
+
+RefPtr<FileDescription> FileDescriptionTable::description(int fd) const
+{
+    auto* entry = this->entry(fd);
+    if (!entry)
+        return nullptr;
+    return entry->description;
+}
+
+int FileDescriptionTable::flags(int fd) const
+{
+    auto* entry = this->entry(fd);
+    if (!entry || !entry->description)
+        return -1;
+    return entry->flags;
+}
+
+void FileDescriptionTable::set_flags(int fd, u32 flags)
+{
+    ScopedSpinLock lock(m_lock);
+    if (auto* entry = this->entry(fd))
+        entry->flags = flags;
+}
+
+void FileDescriptionTable::set(int fd, NonnullRefPtr<FileDescription>&& description, u32 flags)
+{
+    // Closing the previous description may close a file, so that has to wait until we've unlocked.
+    RefPtr<FileDescription> previous_description;
+    description->did_open_fd();
+    ScopedSpinLock lock(m_lock);
+    auto& entry = ensure_entry(fd);
+    previous_description = move(entry.description);
+    entry.description = move(description);
+    entry.flags = flags;
+    mark_used(fd);
+    lock.unlock();
+    if (previous_description)
+        previous_description->did_close_fd();
+}
+
+void FileDescriptionTable::clear(int fd)
+{
+    // See set().
+    RefPtr<FileDescription> previous_description;
+    ScopedSpinLock lock(m_lock);
+    auto* entry = this->entry(fd);
+    if (!entry)
+        return;
+    previous_description = move(entry->description);
+    entry->flags = 0;
+    mark_unused(fd);
+    lock.unlock();
+    if (previous_description)
+        previous_description->did_close_fd();
+}
+
+void FileDescriptionTable::clear_all()
+{
+    for_each_chunk([&](size_t chunk_index, const Chunk& chunk) {
+        u32 word = chunk.used.load(AK::MemoryOrder::memory_order_relaxed);
+        while (word) {
+            clear(chunk_index * chunk_size + __builtin_ctz(word));
+            word &= word - 1;
+        }
+        return IterationDecision::Continue;
+    });
+}
+
+void FileDescriptionTable::copy_from(const FileDescriptionTable& other)
+{
+    other.for_each([&](int fd, FileDescription& description) {
+        int flags = other.flags(fd);
+        set(fd, description, flags < 0 ? 0 : flags);
+        return IterationDecision::Continue;
+    });
+}
+
+size_t FileDescriptionTable::first_chunk_with_room(size_t first_candidate_chunk_index) const
+{
+    VERIFY(m_lock.is_locked());
+    for (size_t word_index = first_candidate_chunk_index / 32; word_index < m_full_chunks.size(); ++word_index) {
+        u32 candidate_chunks = ~m_full_chunks[word_index];
+        if (word_index == first_candidate_chunk_index / 32)
+            candidate_chunks &= 0xffffffff << (first_candidate_chunk_index % 32);
+        if (candidate_chunks)
+            return word_index * 32 + __builtin_ctz(candidate_chunks);
+    }
+    // None of the chunks past the end of the bitmap are full.
+    return max(first_candidate_chunk_index, m_full_chunks.size() * 32);
+}
+
+int FileDescriptionTable::allocate(int first_candidate_fd) const
+{
+    if (first_candidate_fd < 0 || first_candidate_fd >= max_size)
+        return -EMFILE;
+    ScopedSpinLock lock(m_lock);
+
+    size_t chunk_index = first_candidate_fd / chunk_size;
+    auto* chunk = this->chunk(chunk_index);
+    u32 used = chunk ? chunk->used.load(AK::MemoryOrder::memory_order_relaxed) : 0;
+    u32 free_bits = ~used & (0xffffffff << (first_candidate_fd % chunk_size));
+    if (!free_bits) {
+        chunk_index = first_chunk_with_room(chunk_index + 1);
+        if (chunk_index >= max_chunk_count)
+            return -EMFILE;
+        chunk = this->chunk(chunk_index);
+        free_bits = ~(chunk ? chunk->used.load(AK::MemoryOrder::memory_order_relaxed) : 0);
+    }
+    int fd = chunk_index * chunk_size + __builtin_ctz(free_bits);
+    if (fd >= max_size)
+        return -EMFILE;
+    return fd;
+}
+
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+// includes
+#include <AK/Array.h>
+#include <AK/Atomic.h>
+#include <AK/IterationDecision.h>
+#include <AK/NonnullRefPtr.h>
+#include <AK/RefPtr.h>
+#include <AK/Vector.h>
+#include <Kernel/Forward.h>
+#include <Kernel/SpinLock.h>
+
+namespace Kernel {
+
+// A process's open file descriptors.
+//
+// Entries live in chunks of 32 that are allocated the first time one of their fds
+// is used and stay put until the table goes away, so looking up a descriptor never
+// needs the lock: RefPtr already makes copying an entry that's being replaced safe.
+// Changes are serialized by the table's own lock.
+//
+// The chunks are reached through segments of chunk pointers that double in size,
+// so the table grows without moving anything a lookup may be looking at.
+//
+// Each chunk has a word with a bit for every open fd in it, and a growable bitmap
+// of the full chunks above that finds the lowest free fd without looking at the
+// entries. The number of open fds is kept up to date as they come and go.
+class FileDescriptionTable {
+    AK_MAKE_NONCOPYABLE(FileDescriptionTable);
+    AK_MAKE_NONMOVABLE(FileDescriptionTable);
+
+public:
+    // Only bounds how far the table may grow; select() still can't look past FD_SETSIZE.
+    static constexpr int max_size = 65536;
+
+    FileDescriptionTable() = default;
+    ~FileDescriptionTable();
+
+    RefPtr<FileDescription> description(int fd) const;
+    // Returns -1 if the fd isn't open.
+    int flags(int fd) const;
+    void set_flags(int fd, u32 flags);
+
+    void set(int fd, NonnullRefPtr<FileDescription>&&, u32 flags = 0);
+    void clear(int fd);
+    void clear_all();
+
+    // Copies every open fd from another table, e.g. for fork().
+    void copy_from(const FileDescriptionTable&);
+
+    // Returns the lowest fd that isn't open and is at least first_candidate_fd, or -EMFILE.
+    // The fd stays free until it's set().
+    int allocate(int first_candidate_fd = 0) const;
+
+    int open_count() const { return m_open_count.load(AK::MemoryOrder::memory_order_relaxed); }
+
+    template<typename Callback>
+    void for_each(Callback callback) const
+    {
+        for_each_chunk([&](size_t chunk_index, const Chunk& chunk) {
+            u32 word = chunk.used.load(AK::MemoryOrder::memory_order_acquire);
+            while (word) {
+                int fd = chunk_index * chunk_size + __builtin_ctz(word);
+                word &= word - 1;
+                // It may have been closed since we loaded the word.
+                auto description = this->description(fd);
+                if (!description)
+                    continue;
+                if (callback(fd, *description) == IterationDecision::Break)
+                    return IterationDecision::Break;
+            }
+            return IterationDecision::Continue;
+        });
+    }
+
+private:
+    static constexpr size_t chunk_size = 32;
+    static constexpr size_t max_chunk_count = (max_size + chunk_size - 1) / chunk_size;
+    // Segment n holds 2^n chunk pointers, for chunks 2^n - 1 up to 2^(n + 1) - 2.
+    static constexpr size_t segment_count = 32 - __builtin_clz(max_chunk_count);
+
+    struct Entry {
+        RefPtr<FileDescription> description;
+        Atomic<u32, AK::MemoryOrder::memory_order_relaxed> flags { 0 };
+    };
+
+    struct Chunk {
+        // A set bit means the fd is open.
+        Atomic<u32> used { 0 };
+        Array<Entry, chunk_size> entries;
+    };
+
+    static size_t segment_index(size_t chunk_index) { return 31 - __builtin_clz(chunk_index + 1); }
+    static size_t first_chunk_in_segment(size_t segment_index) { return (1u << segment_index) - 1; }
+
+    template<typename Callback>
+    void for_each_chunk(Callback callback) const
+    {
+        for (size_t segment_index = 0; segment_index < segment_count; ++segment_index) {
+            auto* segment = m_segments[segment_index].load(AK::MemoryOrder::memory_order_acquire);
+            if (!segment)
+                continue;
+            for (size_t i = 0; i < (1u << segment_index); ++i) {
+                auto* chunk = segment[i].load(AK::MemoryOrder::memory_order_acquire);
+                if (chunk && callback(first_chunk_in_segment(segment_index) + i, *chunk) == IterationDecision::Break)
+                    return;
+            }
+        }
+    }
+
+    Chunk* chunk(size_t chunk_index) const;
+    Entry* entry(int fd) const;
+    Entry& ensure_entry(int fd);
+    void mark_used(int fd);
+    void mark_unused(int fd);
+    size_t first_chunk_with_room(size_t first_candidate_chunk_index) const;
+
+    mutable SpinLock<u8> m_lock;
+    Array<Atomic<Atomic<Chunk*>*>, segment_count> m_segments {};
+    // A set bit means the corresponding chunk is full. Chunks past its end aren't.
+    Vector<u32> m_full_chunks;
+    Atomic<int> m_open_count { 0 };
+};
+
+}
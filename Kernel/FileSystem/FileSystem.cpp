@@ -61,6 +61,19 @@ void FS::sync()
         fs.flush_writes();
 }
 
+void FS::shrink_caches()
+{
+    NonnullRefPtrVector<FS, 32> fses;
+    {
+        InterruptDisabler disabler;
+        for (auto& it : all_fses())
+            fses.append(*it.value);
+    }
+
+    for (auto& fs : fses)
+        fs.shrink_cache();
+}
+
 void FS::lock_all()
 {
     for (auto& it : all_fses()) {
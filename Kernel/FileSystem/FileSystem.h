@@ -29,12 +29,16 @@ public:
     unsigned fsid() const { return m_fsid; }
     static FS* from_fsid(u32);
     static void sync();
+    static void shrink_caches();
     static void lock_all();
 
     virtual bool initialize() = 0;
     virtual const char* class_name() const = 0;
     virtual NonnullRefPtr<Inode> root_inode() const = 0;
     virtual bool supports_watchers() const { return false; }
+    // Whether lookups may be answered from the DentryCache. Requires reporting all
+    // directory changes through Inode::did_add_child() and Inode::did_remove_child().
+    virtual bool supports_dentry_cache() const { return false; }
 
     bool is_readonly() const { return m_readonly; }
 
@@ -54,6 +58,7 @@ public:
     };
 
     virtual void flush_writes() { }
+    virtual void shrink_cache() { }
 
     size_t block_size() const { return m_block_size; }
 
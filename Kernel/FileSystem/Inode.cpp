@@ -5,6 +5,7 @@
 #include <AK/StringView.h>
 #include <Kernel/API/InodeWatcherEvent.h>
 #include <Kernel/FileSystem/Custody.h>
+#include <Kernel/FileSystem/DentryCache.h>
 #include <Kernel/FileSystem/Inode.h>
 #include <Kernel/FileSystem/InodeWatcher.h>
 #include <Kernel/FileSystem/VirtualFileSystem.h>
@@ -210,16 +211,18 @@ void Inode::set_metadata_dirty(bool metadata_dirty)
     }
 }
 
-void Inode::did_add_child(const InodeIdentifier& child_id)
+void Inode::did_add_child(const InodeIdentifier& child_id, const StringView& name)
 {
+    DentryCache::the().invalidate(identifier(), name);
     Locker locker(m_lock);
     for (auto& watcher : m_watchers) {
         watcher->notify_child_added({}, child_id);
     }
 }
 
-void Inode::did_remove_child(const InodeIdentifier& child_id)
+void Inode::did_remove_child(const InodeIdentifier& child_id, const StringView& name)
 {
+    DentryCache::the().invalidate(identifier(), name);
     Locker locker(m_lock);
     for (auto& watcher : m_watchers) {
         watcher->notify_child_removed({}, child_id);
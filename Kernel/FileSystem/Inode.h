@@ -106,8 +106,8 @@ protected:
     void set_metadata_dirty(bool);
     KResult prepare_to_write_data();
 
-    void did_add_child(const InodeIdentifier&);
-    void did_remove_child(const InodeIdentifier&);
+    void did_add_child(const InodeIdentifier& child_id, const StringView& name);
+    void did_remove_child(const InodeIdentifier& child_id, const StringView& name);
 
     mutable Lock m_lock { "Inode" };
 
@@ -12,7 +12,9 @@
 #include <Kernel/Debug.h>
 #include <Kernel/Devices/BlockDevice.h>
 #include <Kernel/Devices/HID/HIDManagement.h>
+#include <Kernel/FileSystem/BlockBasedFileSystem.h>
 #include <Kernel/FileSystem/Custody.h>
+#include <Kernel/FileSystem/DentryCache.h>
 #include <Kernel/FileSystem/FileBackedFileSystem.h>
 #include <Kernel/FileSystem/FileDescription.h>
 #include <Kernel/FileSystem/ProcFS.h>
@@ -22,6 +24,7 @@
 #include <Kernel/Interrupts/InterruptManagement.h>
 #include <Kernel/KBufferBuilder.h>
 #include <Kernel/KSyms.h>
+#include <Kernel/LockStatistics.h>
 #include <Kernel/Module.h>
 #include <Kernel/Net/LocalSocket.h>
 #include <Kernel/Net/NetworkAdapter.h>
@@ -31,12 +34,14 @@
 #include <Kernel/PCI/Access.h>
 #include <Kernel/PerformanceEventBuffer.h>
 #include <Kernel/Process.h>
+#include <Kernel/SamplingProfiler.h>
 #include <Kernel/Scheduler.h>
 #include <Kernel/StdLib.h>
 #include <Kernel/TTY/TTY.h>
 #include <Kernel/UBSanitizer.h>
 #include <Kernel/VM/AnonymousVMObject.h>
 #include <Kernel/VM/MemoryManager.h>
+#include <Kernel/VM/PhysicalRegion.h>
 #include <LibC/errno_numbers.h>
 
 namespace Kernel {
@@ -73,6 +78,11 @@ enum ProcFileType {
     FI_Root_cmdline,
     FI_Root_modules,
     FI_Root_profile,
+    FI_Root_profiler,
+    FI_Root_lockstat,
+    FI_Root_dentry_cache,
+    FI_Root_readahead,
+    FI_Root_physfrag,
     FI_Root_self, // symlink
     FI_Root_sys,  // directory
     FI_Root_net,  // directory
@@ -253,23 +263,21 @@ static bool procfs$pid_fds(InodeIdentifier identifier, KBufferBuilder& builder)
         return true;
     }
 
-    for (int i = 0; i < process->max_open_file_descriptors(); ++i) {
-        auto description = process->file_description(i);
-        if (!description)
-            continue;
-        bool cloexec = process->fd_flags(i) & FD_CLOEXEC;
+    process->fds().for_each([&](int fd, FileDescription& description) {
+        bool cloexec = process->fd_flags(fd) & FD_CLOEXEC;
 
         auto description_object = array.add_object();
-        description_object.add("fd", i);
-        description_object.add("absolute_path", description->absolute_path());
-        description_object.add("seekable", description->file().is_seekable());
-        description_object.add("class", description->file().class_name());
-        description_object.add("offset", description->offset());
+        description_object.add("fd", fd);
+        description_object.add("absolute_path", description.absolute_path());
+        description_object.add("seekable", description.file().is_seekable());
+        description_object.add("class", description.file().class_name());
+        description_object.add("offset", description.offset());
         description_object.add("cloexec", cloexec);
-        description_object.add("blocking", description->is_blocking());
-        description_object.add("can_read", description->can_read());
-        description_object.add("can_write", description->can_write());
-    }
+        description_object.add("blocking", description.is_blocking());
+        description_object.add("can_read", description.can_read());
+        description_object.add("can_write", description.can_write());
+        return IterationDecision::Continue;
+    });
     array.finish();
     return true;
 }
@@ -456,7 +464,22 @@ static bool procfs$profile(InodeIdentifier, KBufferBuilder& builder)
     if (!g_global_perf_events)
         return false;
 
-    return g_global_perf_events->to_json(builder);
+    return g_global_perf_events->to_binary(builder);
+}
+
+static bool procfs$profiler(InodeIdentifier, KBufferBuilder& builder)
+{
+    return SamplingProfiler::to_json(builder);
+}
+
+static bool procfs$lockstat(InodeIdentifier, KBufferBuilder& builder)
+{
+    return LockStatistics::to_text(builder);
+}
+
+static bool procfs$dentry_cache(InodeIdentifier, KBufferBuilder& builder)
+{
+    return DentryCache::the().to_json(builder);
 }
 
 static bool procfs$pid_perf_events(InodeIdentifier identifier, KBufferBuilder& builder)
@@ -467,7 +490,7 @@ static bool procfs$pid_perf_events(InodeIdentifier identifier, KBufferBuilder& b
     InterruptDisabler disabler;
     if (!process->perf_events())
         return false;
-    return process->perf_events()->to_json(builder);
+    return process->perf_events()->to_binary(builder);
 }
 
 static bool procfs$net_adapters(InodeIdentifier, KBufferBuilder& builder)
@@ -488,6 +511,7 @@ static bool procfs$net_adapters(InodeIdentifier, KBufferBuilder& builder)
         obj.add("bytes_in", adapter.bytes_in());
         obj.add("packets_out", adapter.packets_out());
         obj.add("bytes_out", adapter.bytes_out());
+        obj.add("packets_dropped", adapter.packets_dropped());
         obj.add("link_up", adapter.link_up());
         obj.add("mtu", adapter.mtu());
     });
@@ -524,6 +548,15 @@ static bool procfs$net_tcp(InodeIdentifier, KBufferBuilder& builder)
         obj.add("bytes_in", socket.bytes_in());
         obj.add("packets_out", socket.packets_out());
         obj.add("bytes_out", socket.bytes_out());
+        obj.add("retransmissions", socket.retransmissions());
+        obj.add("mss", socket.send_mss());
+        obj.add("send_window", socket.send_window());
+        obj.add("bytes_in_flight", socket.bytes_in_flight());
+        obj.add("congestion_control", socket.congestion_control().name());
+        obj.add("congestion_window", socket.congestion_control().congestion_window());
+        obj.add("slow_start_threshold", socket.congestion_control().slow_start_threshold());
+        obj.add("rto_ms", socket.retransmission_timeout_ms());
+        obj.add("srtt_us", socket.smoothed_rtt_us().value_or(0));
     });
     array.finish();
     return true;
@@ -675,6 +708,20 @@ static bool procfs$df(InodeIdentifier, KBufferBuilder& builder)
     return true;
 }
 
+static bool procfs$readahead(InodeIdentifier, KBufferBuilder& builder)
+{
+    auto& statistics = BlockBasedFS::read_ahead_statistics();
+    u64 blocks_read = statistics.blocks_read;
+    u64 hits = statistics.hits;
+
+    JsonObjectSerializer<KBufferBuilder> json { builder };
+    json.add("blocks_read", blocks_read);
+    json.add("hits", hits);
+    json.add("hit_rate_percent", blocks_read ? hits * 100 / blocks_read : 0);
+    json.finish();
+    return true;
+}
+
 static bool procfs$cpuinfo(InodeIdentifier, KBufferBuilder& builder)
 {
     JsonArraySerializer array { builder };
@@ -716,6 +763,8 @@ static bool procfs$memstat(InodeIdentifier, KBufferBuilder& builder)
     auto super_physical_used = MM.super_physical_pages_used();
     mm_lock.unlock();
 
+    auto page_cache_state = MM.page_cache_state();
+
     JsonObjectSerializer<KBufferBuilder> json { builder };
     json.add("kmalloc_allocated", stats.bytes_allocated);
     json.add("kmalloc_available", stats.bytes_free);
@@ -726,6 +775,13 @@ static bool procfs$memstat(InodeIdentifier, KBufferBuilder& builder)
     json.add("user_physical_uncommitted", user_physical_pages_uncommitted);
     json.add("super_physical_allocated", super_physical_used);
     json.add("super_physical_available", super_physical_total - super_physical_used);
+    json.add("user_physical_cached", page_cache_state.cached_pages);
+    json.add("user_physical_zeroed", page_cache_state.zeroed_pages);
+    json.add("page_cache_hits", page_cache_state.hits);
+    json.add("page_cache_misses", page_cache_state.misses);
+    json.add("page_cache_drains", page_cache_state.drains);
+    json.add("zeroed_page_hits", page_cache_state.zeroed_hits);
+    json.add("zeroed_page_misses", page_cache_state.zeroed_misses);
     json.add("kmalloc_call_count", stats.kmalloc_call_count);
     json.add("kfree_call_count", stats.kfree_call_count);
     slab_alloc_stats([&json](size_t slab_size, size_t num_allocated, size_t num_free) {
@@ -737,6 +793,29 @@ static bool procfs$memstat(InodeIdentifier, KBufferBuilder& builder)
     return true;
 }
 
+static bool procfs$physfrag(InodeIdentifier, KBufferBuilder& builder)
+{
+    JsonArraySerializer array { builder };
+    ScopedSpinLock mm_lock(s_mm_lock);
+    MM.for_each_physical_region([&](const PhysicalRegion& region, bool supervisor) {
+        auto obj = array.add_object();
+        obj.add("lower", String::formatted("{}", region.lower()));
+        obj.add("upper", String::formatted("{}", region.upper()));
+        obj.add("supervisor", supervisor);
+        obj.add("pages", region.size());
+        obj.add("free_pages", region.free());
+        auto largest_free_order = region.largest_free_order();
+        obj.add("largest_free_order", largest_free_order.has_value() ? (i32)largest_free_order.value() : -1);
+        auto free_blocks = obj.add_array("free_blocks");
+        for (unsigned order = 0; order <= PhysicalRegion::max_order; ++order)
+            free_blocks.add(region.free_blocks_of_order(order));
+        free_blocks.finish();
+        obj.finish();
+    });
+    array.finish();
+    return true;
+}
+
 static bool procfs$all(InodeIdentifier, KBufferBuilder& builder)
 {
     JsonArraySerializer array { builder };
@@ -822,10 +901,11 @@ static bool procfs$all(InodeIdentifier, KBufferBuilder& builder)
     };
 
     ScopedSpinLock lock(g_scheduler_lock);
-    auto processes = Process::all_processes();
     build_process(*Scheduler::colonel());
-    for (auto& process : processes)
+    Process::for_each([&](Process& process) {
         build_process(process);
+        return IterationDecision::Continue;
+    });
     array.finish();
     return true;
 }
@@ -975,6 +1055,7 @@ bool ProcFS::initialize()
 {
     static Lockable<bool>* kmalloc_stack_helper;
     static Lockable<bool>* ubsan_deadly_helper;
+    static Lockable<bool>* lock_statistics_helper;
 
     if (kmalloc_stack_helper == nullptr) {
         kmalloc_stack_helper = new Lockable<bool>();
@@ -987,6 +1068,11 @@ bool ProcFS::initialize()
         ProcFS::add_sys_bool("ubsan_is_deadly", *ubsan_deadly_helper, [] {
             UBSanitizer::g_ubsan_is_deadly = ubsan_deadly_helper->resource();
         });
+        lock_statistics_helper = new Lockable<bool>();
+        lock_statistics_helper->resource() = g_lock_statistics_enabled;
+        ProcFS::add_sys_bool("lock_statistics", *lock_statistics_helper, [] {
+            LockStatistics::set_enabled(lock_statistics_helper->resource());
+        });
     }
     return true;
 }
@@ -1310,12 +1396,10 @@ KResult ProcFSInode::traverse_as_directory(Function<bool(const FS::DirectoryEntr
         auto process = Process::from_pid(pid);
         if (!process)
             return ENOENT;
-        for (int i = 0; i < process->max_open_file_descriptors(); ++i) {
-            auto description = process->file_description(i);
-            if (!description)
-                continue;
-            callback({ String::number(i), to_identifier_with_fd(fsid(), pid, i), 0 });
-        }
+        process->fds().for_each([&](int fd, FileDescription&) {
+            callback({ String::number(fd), to_identifier_with_fd(fsid(), pid, fd), 0 });
+            return IterationDecision::Continue;
+        });
     } break;
 
     case FI_PID_stacks: {
@@ -1693,6 +1777,11 @@ ProcFS::ProcFS()
     m_entries[FI_Root_cmdline] = { "cmdline", FI_Root_cmdline, true, procfs$cmdline };
     m_entries[FI_Root_modules] = { "modules", FI_Root_modules, true, procfs$modules };
     m_entries[FI_Root_profile] = { "profile", FI_Root_profile, true, procfs$profile };
+    m_entries[FI_Root_profiler] = { "profiler", FI_Root_profiler, true, procfs$profiler };
+    m_entries[FI_Root_lockstat] = { "lockstat", FI_Root_lockstat, true, procfs$lockstat };
+    m_entries[FI_Root_dentry_cache] = { "dentry_cache", FI_Root_dentry_cache, false, procfs$dentry_cache };
+    m_entries[FI_Root_readahead] = { "readahead", FI_Root_readahead, false, procfs$readahead };
+    m_entries[FI_Root_physfrag] = { "physfrag", FI_Root_physfrag, false, procfs$physfrag };
     m_entries[FI_Root_sys] = { "sys", FI_Root_sys, true };
     m_entries[FI_Root_net] = { "net", FI_Root_net, false };
 
@@ -5,6 +5,7 @@
 #include <Kernel/Debug.h>
 #include <Kernel/Devices/BlockDevice.h>
 #include <Kernel/FileSystem/Custody.h>
+#include <Kernel/FileSystem/DentryCache.h>
 #include <Kernel/FileSystem/FileBackedFileSystem.h>
 #include <Kernel/FileSystem/FileDescription.h>
 #include <Kernel/FileSystem/FileSystem.h>
@@ -92,6 +93,8 @@ KResult VFS::unmount(Inode& guest_inode)
     for (size_t i = 0; i < m_mounts.size(); ++i) {
         auto& mount = m_mounts.at(i);
         if (&mount.guest() == &guest_inode) {
+            // The cache holds on to inodes, which would keep the file system busy.
+            DentryCache::the().invalidate_fs(mount.guest_fs().fsid());
             if (auto result = mount.guest_fs().prepare_to_unmount(); result.is_error()) {
                 dbgln("VFS: Failed to unmount!");
                 return result;
@@ -959,7 +962,14 @@ KResultOr<NonnullRefPtr<Custody>> VFS::resolve_path_without_veil(StringView path
         }
 
         // Okay, let's look up this part.
-        auto child_inode = parent.inode().lookup(part);
+        u32 dentry_cache_generation = 0;
+        RefPtr<Inode> child_inode;
+        if (auto cached_inode = DentryCache::the().lookup(parent.inode(), part, dentry_cache_generation); cached_inode.has_value()) {
+            child_inode = cached_inode.release_value();
+        } else {
+            child_inode = parent.inode().lookup(part);
+            DentryCache::the().add(parent.inode(), part, child_inode, dentry_cache_generation);
+        }
         if (!child_inode) {
             if (out_parent) {
                 // ENOENT with a non-null parent custody signals to caller that
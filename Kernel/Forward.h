@@ -9,6 +9,7 @@ class Custody;
 class Device;
 class DiskCache;
 class DoubleBuffer;
+class EventPoll;
 class File;
 class FileDescription;
 class FutexQueue;
@@ -32,6 +33,7 @@ class ProcessGroup;
 class ThreadTracer;
 class Range;
 class RangeAllocator;
+class RingBuffer;
 class Region;
 class Scheduler;
 class SchedulerPerProcessorData;
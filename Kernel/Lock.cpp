@@ -22,6 +22,8 @@ void Lock::lock(Mode mode)
     VERIFY(!Processor::current().in_irq());
     VERIFY(mode != Mode::Unlocked);
     auto current_thread = Thread::current();
+    auto site = FlatPtr(__builtin_return_address(0));
+    LockStatistics::Wait wait;
     ScopedCritical critical; // in case we're not in a critical section already
     for (;;) {
         if (m_lock.exchange(true, AK::memory_order_acq_rel) != false) {
@@ -50,6 +52,8 @@ void Lock::lock(Mode mode)
             current_thread->holding_lock(*this, 1, file, line);
 #endif
             m_queue.should_block(true);
+            if (g_lock_statistics_enabled)
+                did_lock_with_statistics(site, wait);
             m_lock.store(false, AK::memory_order_release);
             return;
         }
@@ -72,6 +76,8 @@ void Lock::lock(Mode mode)
 #if LOCK_DEBUG
             current_thread->holding_lock(*this, 1, file, line);
 #endif
+            if (g_lock_statistics_enabled)
+                did_lock_with_statistics(site, wait);
             m_lock.store(false, AK::memory_order_release);
             return;
         }
@@ -93,12 +99,16 @@ void Lock::lock(Mode mode)
 #if LOCK_DEBUG
             current_thread->holding_lock(*this, 1, file, line);
 #endif
+            if (g_lock_statistics_enabled)
+                did_lock_with_statistics(site, wait);
             m_lock.store(false, AK::memory_order_release);
             return;
         }
         default:
             VERIFY_NOT_REACHED();
         }
+        if (g_lock_statistics_enabled)
+            wait.begin(m_statistics_site_id);
         m_lock.store(false, AK::memory_order_release);
         dbgln_if(LOCK_TRACE_DEBUG, "Lock::lock @ {} ({}) waiting...", this, m_name);
         m_queue.wait_forever(m_name);
@@ -156,6 +166,8 @@ void Lock::unlock()
                 VERIFY(current_mode == Mode::Exclusive ? !m_holder : m_shared_holders.is_empty());
                 m_mode = Mode::Unlocked;
                 m_queue.should_block(false);
+                if (m_statistics_site_id)
+                    did_unlock_with_statistics();
             }
 
 #if LOCK_DEBUG
@@ -203,6 +215,8 @@ auto Lock::force_unlock_if_locked(u32& lock_count_to_restore) -> Mode
                 m_times_locked = 0;
                 m_mode = Mode::Unlocked;
                 m_queue.should_block(false);
+                if (m_statistics_site_id)
+                    did_unlock_with_statistics();
                 m_lock.store(false, AK::memory_order_release);
                 previous_mode = Mode::Exclusive;
                 break;
@@ -231,6 +245,8 @@ auto Lock::force_unlock_if_locked(u32& lock_count_to_restore) -> Mode
                 if (m_times_locked == 0) {
                     m_mode = Mode::Unlocked;
                     m_queue.should_block(false);
+                    if (m_statistics_site_id)
+                        did_unlock_with_statistics();
                 }
                 m_lock.store(false, AK::memory_order_release);
                 previous_mode = Mode::Shared;
@@ -324,6 +340,22 @@ void Lock::restore_lock(Mode mode, u32 lock_count)
     }
 }
 
+void Lock::did_lock_with_statistics(FlatPtr site, const LockStatistics::Wait& wait)
+{
+    auto site_id = LockStatistics::did_acquire(this, m_name, site, wait);
+    // Hold times cover the whole time the lock isn't unlocked, whoever took it first.
+    if (m_times_locked == 1) {
+        m_statistics_site_id = site_id;
+        m_statistics_acquired_at = LockStatistics::timestamp();
+    }
+}
+
+void Lock::did_unlock_with_statistics()
+{
+    LockStatistics::did_release(m_statistics_site_id, m_statistics_acquired_at);
+    m_statistics_site_id = 0;
+}
+
 void Lock::clear_waiters()
 {
     VERIFY(m_mode != Mode::Shared);
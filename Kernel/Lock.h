@@ -7,6 +7,7 @@
 #include <Kernel/Arch/x86/CPU.h>
 #include <Kernel/Forward.h>
 #include <Kernel/LockMode.h>
+#include <Kernel/LockStatistics.h>
 #include <Kernel/WaitQueue.h>
 
 namespace Kernel {
@@ -52,6 +53,9 @@ public:
     }
 
 private:
+    void did_lock_with_statistics(FlatPtr site, const LockStatistics::Wait&);
+    void did_unlock_with_statistics();
+
     Atomic<bool> m_lock { false };
     const char* m_name { nullptr };
     WaitQueue m_queue;
@@ -68,6 +72,10 @@ private:
     // lock.
     RefPtr<Thread> m_holder;
     HashMap<Thread*, u32> m_shared_holders;
+
+    // Where and when this lock was taken while lock statistics are enabled, 0 otherwise.
+    u32 m_statistics_site_id { 0 };
+    u64 m_statistics_acquired_at { 0 };
 };
 
 class Locker {
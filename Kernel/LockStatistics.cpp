@@ -0,0 +1,314 @@
+// includes
+#include <AK/Array.h>
+#include <AK/Atomic.h>
+#include <AK/QuickSort.h>
+#include <AK/Vector.h>
+#include <Kernel/Arch/x86/CPU.h>
+#include <Kernel/KBufferBuilder.h>
+#include <Kernel/KSyms.h>
+#include <Kernel/LockStatistics.h>
+#include <Kernel/Thread.h>
+
+namespace Kernel {
+
+bool g_lock_statistics_enabled;
+
+static constexpr size_t max_sites = 1024;
+static constexpr size_t backtrace_depth = 6;
+static constexpr size_t max_held_spin_locks = 16;
+static constexpr size_t max_processors = sizeof(u32) * 8;
+
+using Counter = Atomic<u64, AK::MemoryOrder::memory_order_relaxed>;
+
+struct LockSite {
+    Atomic<FlatPtr> address { 0 };
+    // The lock most recently taken at this site.
+    Atomic<const void*, AK::MemoryOrder::memory_order_relaxed> lock { nullptr };
+    Atomic<const char*, AK::MemoryOrder::memory_order_relaxed> name { nullptr };
+
+    Counter acquisitions { 0 };
+    Counter contentions { 0 };
+    Counter total_wait { 0 };
+    Counter max_wait { 0 };
+    Counter total_hold { 0 };
+    Counter max_hold { 0 };
+
+    // Where the holder got the lock from during the longest wait so far.
+    Atomic<u32, AK::MemoryOrder::memory_order_relaxed> max_wait_holder_site_id { 0 };
+
+    // Captured by whoever added this site. The first frame is the site itself.
+    Array<FlatPtr, backtrace_depth> backtrace {};
+    Atomic<bool> backtrace_ready { false };
+
+    void reset()
+    {
+        acquisitions = 0;
+        contentions = 0;
+        total_wait = 0;
+        max_wait = 0;
+        total_hold = 0;
+        max_hold = 0;
+        max_wait_holder_site_id = 0;
+    }
+};
+
+struct HeldSpinLock {
+    const void* lock { nullptr };
+    u32 site_id { 0 };
+    u64 acquired_at { 0 };
+};
+
+struct HeldSpinLocks {
+    Array<HeldSpinLock, max_held_spin_locks> locks {};
+    Atomic<size_t, AK::MemoryOrder::memory_order_relaxed> count { 0 };
+};
+
+static Array<LockSite, max_sites>* s_sites;
+static Array<HeldSpinLocks, max_processors>* s_held_spin_locks;
+static Atomic<u64, AK::MemoryOrder::memory_order_relaxed> s_dropped_sites { 0 };
+static bool s_have_tsc;
+
+void LockStatistics::set_enabled(bool enabled)
+{
+    if (!enabled) {
+        g_lock_statistics_enabled = false;
+        return;
+    }
+    if (g_lock_statistics_enabled)
+        return;
+
+    if (!s_sites) {
+        s_sites = new Array<LockSite, max_sites>;
+        s_held_spin_locks = new Array<HeldSpinLocks, max_processors>;
+        s_have_tsc = Processor::current().has_feature(CPUFeature::TSC);
+    }
+    // Keep the sites we already know about, but start counting from scratch.
+    for (auto& site : *s_sites)
+        site.reset();
+    for (auto& held : *s_held_spin_locks)
+        held.count = 0;
+    s_dropped_sites = 0;
+    full_memory_barrier();
+    g_lock_statistics_enabled = true;
+}
+
+u64 LockStatistics::timestamp()
+{
+    return s_have_tsc ? read_tsc() : 0;
+}
+
+static void update_max(Counter& max, u64 value)
+{
+    u64 current = max.load();
+    while (value > current) {
+        if (max.compare_exchange_strong(current, value))
+            return;
+    }
+}
+
+static void capture_backtrace(LockSite& site, FlatPtr site_address)
+{
+    site.backtrace[0] = site_address;
+    auto* thread = Thread::current();
+    if (thread) {
+        // Skip the frames of the lock implementation, up to and including the site itself.
+        FlatPtr stack_base = thread->kernel_stack_base();
+        FlatPtr stack_top = thread->kernel_stack_top();
+        auto* frame = (FlatPtr*)__builtin_frame_address(0);
+        bool found_site = false;
+        size_t depth = 1;
+        while (depth < backtrace_depth && (FlatPtr)frame >= stack_base && (FlatPtr)(frame + 2) <= stack_top) {
+            FlatPtr return_address = frame[1];
+            if (!return_address)
+                break;
+            if (found_site)
+                site.backtrace[depth++] = return_address;
+            else if (return_address == site_address)
+                found_site = true;
+            auto* next_frame = (FlatPtr*)frame[0];
+            if (next_frame <= frame)
+                break;
+            frame = next_frame;
+        }
+    }
+    site.backtrace_ready.store(true, AK::MemoryOrder::memory_order_release);
+}
+
+static u32 find_or_add_site(FlatPtr address)
+{
+    if (!s_sites)
+        return 0;
+    auto& sites = *s_sites;
+    u32 hash = (u32)(address >> 2) * 2654435761u;
+    for (size_t probe = 0; probe < max_sites; ++probe) {
+        size_t index = (hash + probe) & (max_sites - 1);
+        auto& site = sites[index];
+        FlatPtr site_address = site.address.load(AK::MemoryOrder::memory_order_acquire);
+        if (site_address == address)
+            return index + 1;
+        if (site_address)
+            continue;
+        FlatPtr expected = 0;
+        if (site.address.compare_exchange_strong(expected, address, AK::MemoryOrder::memory_order_acq_rel)) {
+            capture_backtrace(site, address);
+            return index + 1;
+        }
+        if (expected == address)
+            return index + 1;
+    }
+    s_dropped_sites++;
+    return 0;
+}
+
+u32 LockStatistics::did_acquire(const void* lock, const char* name, FlatPtr address, const Wait& wait)
+{
+    auto site_id = find_or_add_site(address);
+    if (!site_id)
+        return 0;
+    auto& site = (*s_sites)[site_id - 1];
+    site.lock = lock;
+    site.name = name;
+    site.acquisitions++;
+    if (wait.contended) {
+        site.contentions++;
+        u64 now = timestamp();
+        u64 waited = now > wait.start ? now - wait.start : 0;
+        site.total_wait += waited;
+        if (waited > site.max_wait.load()) {
+            update_max(site.max_wait, waited);
+            site.max_wait_holder_site_id = wait.holder_site_id;
+        }
+    }
+    return site_id;
+}
+
+void LockStatistics::did_release(u32 site_id, u64 acquired_at)
+{
+    if (!site_id || !s_sites)
+        return;
+    auto& site = (*s_sites)[site_id - 1];
+    u64 now = timestamp();
+    u64 held = now > acquired_at ? now - acquired_at : 0;
+    site.total_hold += held;
+    update_max(site.max_hold, held);
+}
+
+void LockStatistics::did_acquire_spin_lock(const void* lock, FlatPtr address, const Wait& wait)
+{
+    auto site_id = did_acquire(lock, nullptr, address, wait);
+    // An interrupt handler could take a spin lock while we update the list.
+    InterruptDisabler disabler;
+    auto cpu = Processor::id();
+    if (!s_held_spin_locks || cpu >= max_processors)
+        return;
+    auto& held = (*s_held_spin_locks)[cpu];
+    size_t count = held.count;
+    if (count >= max_held_spin_locks)
+        return;
+    held.locks[count] = { lock, site_id, timestamp() };
+    held.count = count + 1;
+}
+
+void LockStatistics::did_release_spin_lock(const void* lock)
+{
+    InterruptDisabler disabler;
+    auto cpu = Processor::id();
+    if (!s_held_spin_locks || cpu >= max_processors)
+        return;
+    auto& held = (*s_held_spin_locks)[cpu];
+    size_t count = held.count;
+    // Spin locks are usually released in reverse order, so look from the top.
+    for (size_t i = count; i > 0; --i) {
+        if (held.locks[i - 1].lock != lock)
+            continue;
+        auto entry = held.locks[i - 1];
+        for (size_t j = i; j < count; ++j)
+            held.locks[j - 1] = held.locks[j];
+        held.count = count - 1;
+        did_release(entry.site_id, entry.acquired_at);
+        return;
+    }
+}
+
+u32 LockStatistics::spin_lock_holder_site_id(const void* lock)
+{
+    if (!s_held_spin_locks)
+        return 0;
+    // The holder keeps changing its list while we look, so this is a best guess.
+    for (auto& held : *s_held_spin_locks) {
+        size_t count = min(held.count.load(), max_held_spin_locks);
+        for (size_t i = 0; i < count; ++i) {
+            if (held.locks[i].lock == lock)
+                return held.locks[i].site_id;
+        }
+    }
+    return 0;
+}
+
+static void append_address(KBufferBuilder& builder, FlatPtr address)
+{
+    auto* symbol = g_kernel_symbols_available ? symbolicate_kernel_address(address) : nullptr;
+    if (symbol)
+        builder.appendff("{}+{:#x}", symbol->name, address - symbol->address);
+    else
+        builder.appendff("{:p}", address);
+}
+
+static void append_backtrace(KBufferBuilder& builder, const LockSite& site)
+{
+    if (!site.backtrace_ready.load(AK::MemoryOrder::memory_order_acquire))
+        return;
+    for (auto address : site.backtrace) {
+        if (!address)
+            break;
+        builder.append("        ");
+        append_address(builder, address);
+        builder.append('\n');
+    }
+}
+
+bool LockStatistics::to_text(KBufferBuilder& builder)
+{
+    builder.appendff("enabled: {}\n", g_lock_statistics_enabled);
+    if (!s_sites)
+        return true;
+    builder.appendff("dropped sites: {}\n", s_dropped_sites.load());
+    builder.append("All times are in TSC cycles.\n\n");
+
+    auto& sites = *s_sites;
+    Vector<u32> indices;
+    for (u32 i = 0; i < max_sites; ++i) {
+        if (sites[i].address.load() && sites[i].acquisitions.load())
+            indices.append(i);
+    }
+    quick_sort(indices, [&](u32 a, u32 b) {
+        if (sites[a].total_wait.load() != sites[b].total_wait.load())
+            return sites[a].total_wait.load() > sites[b].total_wait.load();
+        return sites[a].acquisitions.load() > sites[b].acquisitions.load();
+    });
+
+    builder.appendff("{:>12} {:>10} {:>14} {:>12} {:>14} {:>12}  site (lock)\n",
+        "acquired", "contended", "total wait", "max wait", "total hold", "max hold");
+    for (auto index : indices) {
+        auto& site = sites[index];
+        builder.appendff("{:>12} {:>10} {:>14} {:>12} {:>14} {:>12}  ",
+            site.acquisitions.load(), site.contentions.load(), site.total_wait.load(),
+            site.max_wait.load(), site.total_hold.load(), site.max_hold.load());
+        append_address(builder, site.address.load());
+        builder.append(" (");
+        if (auto* name = site.name.load())
+            builder.append(name);
+        else
+            append_address(builder, (FlatPtr)site.lock.load());
+        builder.append(")\n");
+
+        auto holder_site_id = site.max_wait_holder_site_id.load();
+        if (holder_site_id) {
+            builder.append("    longest wait was for the holder from:\n");
+            append_backtrace(builder, sites[holder_site_id - 1]);
+        }
+    }
+    return true;
+}
+
+}
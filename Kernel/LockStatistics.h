@@ -0,0 +1,55 @@
+#pragma once
+
+// includes
+#include <AK/Types.h>
+
+namespace Kernel {
+
+class KBufferBuilder;
+
+// Toggled through /proc/sys/lock_statistics. While it's false, taking a lock
+// costs one extra load and branch.
+extern bool g_lock_statistics_enabled;
+
+// Counts how often locks are taken at each call site, how often and how long
+// that had to wait for another holder, and how long the lock was held.
+// Times are in TSC cycles. Recording never takes a lock itself, so it's safe
+// to call from any lock implementation.
+class LockStatistics {
+public:
+    // Filled in by a lock that found itself held by someone else.
+    struct Wait {
+        bool contended { false };
+        u64 start { 0 };
+        u32 holder_site_id { 0 };
+
+        void begin(u32 current_holder_site_id)
+        {
+            if (contended)
+                return;
+            contended = true;
+            start = timestamp();
+            holder_site_id = current_holder_site_id;
+        }
+    };
+
+    static void set_enabled(bool);
+
+    static u64 timestamp();
+
+    // Records an acquisition of the given lock at the given call site, and returns the
+    // id of that site or 0 if no more sites fit.
+    static u32 did_acquire(const void* lock, const char* name, FlatPtr site, const Wait&);
+    static void did_release(u32 site_id, u64 acquired_at);
+
+    // Spin locks don't have room to remember who holds them, so every processor
+    // keeps a short list of the spin locks it is holding instead.
+    static void did_acquire_spin_lock(const void* lock, FlatPtr site, const Wait&);
+    static void did_release_spin_lock(const void* lock);
+    static u32 spin_lock_holder_site_id(const void* lock);
+
+    // Writes all sites that were seen, most waited for first.
+    static bool to_text(KBufferBuilder&);
+};
+
+}
@@ -24,6 +24,8 @@ static AK::Singleton<Lockable<HashTable<IPv4Socket*>>> s_table;
 
 using BlockFlags = Thread::FileDescriptionBlocker::BlockFlags;
 
+static constexpr size_t receive_queue_buffer_limit = 4 * MiB;
+
 Lockable<HashTable<IPv4Socket*>>& IPv4Socket::all_sockets()
 {
     return *s_table;
@@ -165,7 +167,7 @@ KResultOr<u16> IPv4Socket::allocate_local_port_if_needed()
     return port_or_error.value();
 }
 
-KResultOr<size_t> IPv4Socket::sendto(FileDescription&, const UserOrKernelBuffer& data, size_t data_length, [[maybe_unused]] int flags, Userspace<const sockaddr*> addr, socklen_t addr_length)
+KResultOr<size_t> IPv4Socket::sendto(FileDescription& description, const UserOrKernelBuffer& data, size_t data_length, [[maybe_unused]] int flags, Userspace<const sockaddr*> addr, socklen_t addr_length)
 {
     Locker locker(lock());
 
@@ -205,10 +207,37 @@ KResultOr<size_t> IPv4Socket::sendto(FileDescription&, const UserOrKernelBuffer&
         return data_length;
     }
 
-    auto nsent_or_error = protocol_send(data, data_length);
-    if (!nsent_or_error.is_error())
-        Thread::current()->did_ipv4_socket_write(nsent_or_error.value());
-    return nsent_or_error;
+    // Blocking writes don't return until all of the data has been queued, unless a signal
+    // interrupts them. The protocol may only take part of it at a time (e.g. when TCP's
+    // send buffer fills up), so keep waiting for room and sending the rest.
+    size_t total_sent = 0;
+    for (;;) {
+        auto remaining_data = data.offset(total_sent);
+        auto nsent_or_error = protocol_send(remaining_data, data_length - total_sent);
+        if (nsent_or_error.is_error()) {
+            if (nsent_or_error.error() != -EAGAIN || !description.is_blocking()) {
+                if (total_sent)
+                    break;
+                return nsent_or_error;
+            }
+        } else {
+            total_sent += nsent_or_error.value();
+            if (total_sent == data_length || !description.is_blocking())
+                break;
+        }
+
+        locker.unlock();
+        auto unblock_flags = BlockFlags::None;
+        if (Thread::current()->block<Thread::WriteBlocker>({}, description, unblock_flags).was_interrupted()) {
+            if (total_sent)
+                break;
+            return EINTR;
+        }
+        locker.lock();
+    }
+
+    Thread::current()->did_ipv4_socket_write(total_sent);
+    return total_sent;
 }
 
 KResultOr<size_t> IPv4Socket::receive_byte_buffered(FileDescription& description, UserOrKernelBuffer& buffer, size_t buffer_length, int flags, Userspace<sockaddr*>, Userspace<socklen_t*>)
@@ -246,6 +275,8 @@ KResultOr<size_t> IPv4Socket::receive_byte_buffered(FileDescription& description
         Thread::current()->did_ipv4_socket_read((size_t)nreceived);
 
     set_can_read(!m_receive_buffer.is_empty());
+    if (nreceived > 0 && !(flags & MSG_PEEK))
+        did_read_from_receive_buffer();
     return nreceived;
 }
 
@@ -267,17 +298,17 @@ KResultOr<size_t> IPv4Socket::receive_packet_buffered(FileDescription& descripti
             if (flags & MSG_PEEK)
                 packet = m_receive_queue.first();
             else
-                packet = m_receive_queue.take_first();
+                packet = take_first_received_packet();
 
             set_can_read(!m_receive_queue.is_empty());
 
             dbgln_if(IPV4_SOCKET_DEBUG, "IPv4Socket({}): recvfrom without blocking {} bytes, packets in queue: {}",
                 this,
-                packet.data.value().size(),
+                packet.data.size(),
                 m_receive_queue.size());
         }
     }
-    if (!packet.data.has_value()) {
+    if (!packet.frame.has_value()) {
         if (protocol_is_disconnected()) {
             dbgln("IPv4Socket({}) is protocol-disconnected, returning 0 in recvfrom!", this);
             return 0;
@@ -301,16 +332,16 @@ KResultOr<size_t> IPv4Socket::receive_packet_buffered(FileDescription& descripti
         if (flags & MSG_PEEK)
             packet = m_receive_queue.first();
         else
-            packet = m_receive_queue.take_first();
+            packet = take_first_received_packet();
 
         set_can_read(!m_receive_queue.is_empty());
 
         dbgln_if(IPV4_SOCKET_DEBUG, "IPv4Socket({}): recvfrom with blocking {} bytes, packets in queue: {}",
             this,
-            packet.data.value().size(),
+            packet.data.size(),
             m_receive_queue.size());
     }
-    VERIFY(packet.data.has_value());
+    VERIFY(packet.frame.has_value());
 
     packet_timestamp = packet.timestamp;
 
@@ -332,13 +363,20 @@ KResultOr<size_t> IPv4Socket::receive_packet_buffered(FileDescription& descripti
     }
 
     if (type() == SOCK_RAW) {
-        size_t bytes_written = min(packet.data.value().size(), buffer_length);
-        if (!buffer.write(packet.data.value().data(), bytes_written))
+        size_t bytes_written = min(packet.data.size(), buffer_length);
+        if (!buffer.write(packet.data.data(), bytes_written))
             return EFAULT;
         return bytes_written;
     }
 
-    return protocol_receive(ReadonlyBytes { packet.data.value().data(), packet.data.value().size() }, buffer, buffer_length, flags);
+    return protocol_receive(packet.data, buffer, buffer_length, flags);
+}
+
+IPv4Socket::ReceivedPacket IPv4Socket::take_first_received_packet()
+{
+    auto packet = m_receive_queue.take_first();
+    m_receive_queue_buffer_bytes -= packet.frame.value().capacity();
+    return packet;
 }
 
 KResultOr<size_t> IPv4Socket::recvfrom(FileDescription& description, UserOrKernelBuffer& buffer, size_t buffer_length, int flags, Userspace<sockaddr*> user_addr, Userspace<socklen_t*> user_addr_length, Time& packet_timestamp)
@@ -364,13 +402,14 @@ KResultOr<size_t> IPv4Socket::recvfrom(FileDescription& description, UserOrKerne
     return nreceived;
 }
 
-bool IPv4Socket::did_receive(const IPv4Address& source_address, u16 source_port, KBuffer&& packet, const Time& packet_timestamp)
+bool IPv4Socket::did_receive(const IPv4Address& source_address, u16 source_port, const KBuffer& frame, ReadonlyBytes packet, const Time& packet_timestamp)
 {
     Locker locker(lock());
 
     if (is_shut_down_for_reading())
         return false;
 
+    VERIFY(packet.data() >= frame.data() && packet.data() + packet.size() <= frame.data() + frame.size());
     auto packet_size = packet.size();
 
     if (buffer_mode() == BufferMode::Bytes) {
@@ -381,7 +420,7 @@ bool IPv4Socket::did_receive(const IPv4Address& source_address, u16 source_port,
             return false;
         }
         auto scratch_buffer = UserOrKernelBuffer::for_kernel_buffer(m_scratch_buffer.value().data());
-        auto nreceived_or_error = protocol_receive(ReadonlyBytes { packet.data(), packet.size() }, scratch_buffer, m_scratch_buffer.value().size(), 0);
+        auto nreceived_or_error = protocol_receive(packet, scratch_buffer, m_scratch_buffer.value().size(), 0);
         if (nreceived_or_error.is_error())
             return false;
         ssize_t nwritten = m_receive_buffer.write(scratch_buffer, nreceived_or_error.value());
@@ -389,11 +428,14 @@ bool IPv4Socket::did_receive(const IPv4Address& source_address, u16 source_port,
             return false;
         set_can_read(!m_receive_buffer.is_empty());
     } else {
-        if (m_receive_queue.size() > 2000) {
+        // Queued packets pin the whole frame buffer they arrived in, so account for that
+        // rather than just for the payload.
+        if (m_receive_queue.size() > 2000 || m_receive_queue_buffer_bytes + frame.capacity() > receive_queue_buffer_limit) {
             dbgln("IPv4Socket({}): did_receive refusing packet since queue is full.", this);
             return false;
         }
-        m_receive_queue.append({ source_address, source_port, packet_timestamp, move(packet) });
+        m_receive_queue.append({ source_address, source_port, packet_timestamp, frame, packet });
+        m_receive_queue_buffer_bytes += frame.capacity();
         set_can_read(true);
     }
     m_bytes_received += packet_size;
@@ -38,7 +38,7 @@ public:
 
     virtual int ioctl(FileDescription&, unsigned request, FlatPtr arg) override;
 
-    bool did_receive(const IPv4Address& peer_address, u16 peer_port, KBuffer&&, const Time&);
+    bool did_receive(const IPv4Address& peer_address, u16 peer_port, const KBuffer& frame, ReadonlyBytes ipv4_packet, const Time&);
 
     const IPv4Address& local_address() const { return m_local_address; }
     u16 local_port() const { return m_local_port; }
@@ -77,6 +77,11 @@ protected:
 
     virtual void shut_down_for_reading() override;
 
+    // Called with the socket lock held after a read drained bytes from the receive buffer.
+    virtual void did_read_from_receive_buffer() { }
+    size_t receive_buffer_space() const { return m_receive_buffer.space_for_writing(); }
+    size_t receive_buffer_capacity() const { return m_receive_buffer.capacity(); }
+
     void set_local_address(IPv4Address address) { m_local_address = address; }
     void set_peer_address(IPv4Address address) { m_peer_address = address; }
 
@@ -95,10 +100,15 @@ private:
         IPv4Address peer_address;
         u16 peer_port;
         Time timestamp;
-        Optional<KBuffer> data;
+        // The frame the packet arrived in; it's shared with the NetworkTask rather than copied.
+        Optional<KBuffer> frame;
+        ReadonlyBytes data;
     };
 
+    ReceivedPacket take_first_received_packet();
+
     SinglyLinkedListWithCount<ReceivedPacket> m_receive_queue;
+    size_t m_receive_queue_buffer_bytes { 0 };
 
     DoubleBuffer m_receive_buffer;
 
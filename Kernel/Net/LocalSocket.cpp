@@ -281,13 +281,28 @@ KResultOr<size_t> LocalSocket::sendto(FileDescription& description, const UserOr
     auto* socket_buffer = send_buffer_for(description);
     if (!socket_buffer)
         return EINVAL;
+    RingBuffer::SideLocker locker(write_lock_for(*socket_buffer));
     ssize_t nwritten = socket_buffer->write(data, data_size);
     if (nwritten > 0)
         Thread::current()->did_unix_socket_write(nwritten);
     return nwritten;
 }
 
-DoubleBuffer* LocalSocket::receive_buffer_for(FileDescription& description)
+KResultOr<size_t> LocalSocket::splice_from(FileDescription& description, const SpliceSource& source, size_t size)
+{
+    if (is_shut_down_for_writing() || !has_attached_peer(description))
+        return EPIPE;
+    auto* socket_buffer = send_buffer_for(description);
+    if (!socket_buffer)
+        return EINVAL;
+    RingBuffer::SideLocker locker(write_lock_for(*socket_buffer));
+    auto nwritten_or_error = socket_buffer->write_from(source, size);
+    if (!nwritten_or_error.is_error() && nwritten_or_error.value() > 0)
+        Thread::current()->did_unix_socket_write(nwritten_or_error.value());
+    return nwritten_or_error;
+}
+
+RingBuffer* LocalSocket::receive_buffer_for(FileDescription& description)
 {
     auto role = this->role(description);
     if (role == Role::Accepted)
@@ -297,7 +312,7 @@ DoubleBuffer* LocalSocket::receive_buffer_for(FileDescription& description)
     return nullptr;
 }
 
-DoubleBuffer* LocalSocket::send_buffer_for(FileDescription& description)
+RingBuffer* LocalSocket::send_buffer_for(FileDescription& description)
 {
     auto role = this->role(description);
     if (role == Role::Connected)
@@ -323,6 +338,7 @@ KResultOr<size_t> LocalSocket::recvfrom(FileDescription& description, UserOrKern
         if (Thread::current()->block<Thread::ReadBlocker>({}, description, unblock_flags).was_interrupted())
             return EINTR;
     }
+    RingBuffer::SideLocker locker(read_lock_for(*socket_buffer));
     if (!has_attached_peer(description) && socket_buffer->is_empty())
         return 0;
     VERIFY(!socket_buffer->is_empty());
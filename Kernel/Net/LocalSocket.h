@@ -2,8 +2,8 @@
 
 // includes
 #include <AK/InlineLinkedList.h>
-#include <Kernel/DoubleBuffer.h>
 #include <Kernel/Net/Socket.h>
+#include <Kernel/RingBuffer.h>
 
 namespace Kernel {
 
@@ -43,6 +43,7 @@ public:
     virtual bool can_write(const FileDescription&, size_t) const override;
     virtual KResultOr<size_t> sendto(FileDescription&, const UserOrKernelBuffer&, size_t, int, Userspace<const sockaddr*>, socklen_t) override;
     virtual KResultOr<size_t> recvfrom(FileDescription&, UserOrKernelBuffer&, size_t, int flags, Userspace<sockaddr*>, Userspace<socklen_t*>, Time&) override;
+    virtual KResultOr<size_t> splice_from(FileDescription&, const SpliceSource&, size_t) override;
     virtual KResult getsockopt(FileDescription&, int level, int option, Userspace<void*>, Userspace<socklen_t*>) override;
     virtual KResult chown(FileDescription&, uid_t, gid_t) override;
     virtual KResult chmod(FileDescription&, mode_t) override;
@@ -53,8 +54,10 @@ private:
     virtual bool is_local() const override { return true; }
     bool has_attached_peer(const FileDescription&) const;
     static Lockable<InlineLinkedList<LocalSocket>>& all_sockets();
-    DoubleBuffer* receive_buffer_for(FileDescription&);
-    DoubleBuffer* send_buffer_for(FileDescription&);
+    RingBuffer* receive_buffer_for(FileDescription&);
+    RingBuffer* send_buffer_for(FileDescription&);
+    RingBuffer::SideLock& write_lock_for(const RingBuffer& buffer) { return &buffer == &m_for_client ? m_for_client_write_lock : m_for_server_write_lock; }
+    RingBuffer::SideLock& read_lock_for(const RingBuffer& buffer) { return &buffer == &m_for_client ? m_for_client_read_lock : m_for_server_read_lock; }
     NonnullRefPtrVector<FileDescription>& sendfd_queue_for(const FileDescription&);
     NonnullRefPtrVector<FileDescription>& recvfd_queue_for(const FileDescription&);
 
@@ -91,8 +94,14 @@ private:
     bool m_accept_side_fd_open { false };
     sockaddr_un m_address { 0, { 0 } };
 
-    DoubleBuffer m_for_client;
-    DoubleBuffer m_for_server;
+    RingBuffer m_for_client;
+    RingBuffer m_for_server;
+    // A RingBuffer takes one writer and one reader at a time, but a description can be
+    // shared by several threads (or processes, after fork()).
+    RingBuffer::SideLock m_for_client_write_lock { "LocalSocket client write" };
+    RingBuffer::SideLock m_for_client_read_lock { "LocalSocket client read" };
+    RingBuffer::SideLock m_for_server_write_lock { "LocalSocket server write" };
+    RingBuffer::SideLock m_for_server_read_lock { "LocalSocket server read" };
 
     NonnullRefPtrVector<FileDescription> m_fds_for_client;
     NonnullRefPtrVector<FileDescription> m_fds_for_server;
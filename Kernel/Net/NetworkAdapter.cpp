@@ -2,6 +2,7 @@
 #include <AK/HashTable.h>
 #include <AK/Singleton.h>
 #include <AK/StringBuilder.h>
+#include <Kernel/Debug.h>
 #include <Kernel/Heap/kmalloc.h>
 #include <Kernel/Lock.h>
 #include <Kernel/Net/EtherType.h>
@@ -147,49 +148,113 @@ KResult NetworkAdapter::send_ipv4_fragmented(const MACAddress& destination_mac,
     return KSuccess;
 }
 
-void NetworkAdapter::did_receive(ReadonlyBytes payload)
+size_t NetworkAdapter::packet_buffer_size() const
 {
-    InterruptDisabler disabler;
-    m_packets_in++;
-    m_bytes_in += payload.size();
+    return page_round_up(sizeof(EthernetFrameHeader) + mtu());
+}
 
-    Optional<KBuffer> buffer;
+Optional<KBuffer> NetworkAdapter::take_spare_packet_buffer()
+{
+    if (!m_spare_packet_buffers.is_empty())
+        return m_spare_packet_buffers.take_last();
+    auto impl = KBufferImpl::try_create_with_size(packet_buffer_size(), Region::Access::Read | Region::Access::Write, "Packet Buffer", AllocationStrategy::AllocateNow);
+    if (!impl)
+        return {};
+    return KBuffer(move(impl));
+}
 
-    if (m_unused_packet_buffers.is_empty()) {
-        buffer = KBuffer::copy(payload.data(), payload.size());
-    } else {
-        buffer = m_unused_packet_buffers.take_first();
-        --m_unused_packet_buffers_count;
-        if (payload.size() <= buffer.value().capacity()) {
-            memcpy(buffer.value().data(), payload.data(), payload.size());
-            buffer.value().set_size(payload.size());
-        } else {
-            buffer = KBuffer::copy(payload.data(), payload.size());
+bool NetworkAdapter::initialize_receive_ring()
+{
+    VERIFY(!m_receive_ring_ready.load(AK::memory_order_relaxed));
+    // The ring is indexed with free-running counters, so its size has to divide 2^32.
+    VERIFY(m_receive_ring_size && (m_receive_ring_size & (m_receive_ring_size - 1)) == 0);
+
+    m_receive_ring.ensure_capacity(m_receive_ring_size);
+    for (size_t i = 0; i < m_receive_ring_size; ++i) {
+        auto buffer = take_spare_packet_buffer();
+        if (!buffer.has_value()) {
+            m_receive_ring.clear();
+            return false;
         }
+        m_receive_ring.append({ buffer.release_value(), {} });
     }
+    m_receive_ring_ready.store(true, AK::memory_order_release);
+    return true;
+}
+
+void NetworkAdapter::did_receive(ReadonlyBytes payload)
+{
+    {
+        ScopedSpinLock lock(m_receive_ring_producer_lock);
+        m_packets_in++;
+        m_bytes_in += payload.size();
 
-    m_packet_queue.append({ buffer.value(), kgettimeofday() });
+        if (!m_receive_ring_ready.load(AK::memory_order_acquire)) {
+            m_packets_dropped++;
+            return;
+        }
+
+        auto head = m_receive_ring_head.load(AK::memory_order_relaxed);
+        auto tail = m_receive_ring_tail.load(AK::memory_order_acquire);
+        if (head - tail == m_receive_ring.size()) {
+            dbgln_if(NETWORK_TASK_DEBUG, "NetworkAdapter({}): Receive ring full, dropping {} byte frame", name(), payload.size());
+            m_packets_dropped++;
+            return;
+        }
+
+        auto& slot = m_receive_ring[head & (m_receive_ring.size() - 1)];
+        auto& buffer = slot.buffer.value();
+        if (payload.size() > buffer.capacity()) {
+            dbgln("NetworkAdapter({}): Dropping {} byte frame that exceeds the packet buffer size", name(), payload.size());
+            m_packets_dropped++;
+            return;
+        }
+        memcpy(buffer.data(), payload.data(), payload.size());
+        buffer.set_size(payload.size());
+        slot.timestamp = kgettimeofday();
+        m_receive_ring_head.store(head + 1, AK::memory_order_release);
+    }
 
     if (on_receive)
         on_receive();
 }
 
-size_t NetworkAdapter::dequeue_packet(u8* buffer, size_t buffer_size, Time& packet_timestamp)
-{
-    InterruptDisabler disabler;
-    if (m_packet_queue.is_empty())
-        return 0;
-    auto packet_with_timestamp = m_packet_queue.take_first();
-    packet_timestamp = packet_with_timestamp.timestamp;
-    auto packet = move(packet_with_timestamp.packet);
-    size_t packet_size = packet.size();
-    VERIFY(packet_size <= buffer_size);
-    memcpy(buffer, packet.data(), packet_size);
-    if (m_unused_packet_buffers_count < 100) {
-        m_unused_packet_buffers.append(packet);
-        ++m_unused_packet_buffers_count;
+Optional<NetworkAdapter::ReceivedFrame> NetworkAdapter::dequeue_packet()
+{
+    for (;;) {
+        auto tail = m_receive_ring_tail.load(AK::memory_order_relaxed);
+        if (tail == m_receive_ring_head.load(AK::memory_order_acquire))
+            return {};
+
+        auto& slot = m_receive_ring[tail & (m_receive_ring.size() - 1)];
+        Optional<ReceivedFrame> frame;
+        // The filled buffer leaves the ring, so the slot needs a fresh one before the
+        // producer may see it again. Without one we have to drop the frame instead.
+        if (auto replacement = take_spare_packet_buffer(); replacement.has_value()) {
+            frame = ReceivedFrame { slot.buffer.release_value(), slot.timestamp };
+            slot.buffer = replacement.release_value();
+        } else {
+            dbgln("NetworkAdapter({}): Out of packet buffers, dropping frame", name());
+            m_packets_dropped++;
+        }
+        m_receive_ring_tail.store(tail + 1, AK::memory_order_release);
+
+        if (frame.has_value())
+            return frame;
     }
-    return packet_size;
+}
+
+void NetworkAdapter::recycle_packet_buffer(KBuffer&& buffer)
+{
+    // Sockets that queued the frame keep a reference to it, so only buffers nobody
+    // else holds on to can go back into the ring.
+    if (buffer.is_null() || buffer.impl().ref_count() != 1)
+        return;
+    if (buffer.capacity() < packet_buffer_size())
+        return;
+    if (m_spare_packet_buffers.size() >= m_receive_ring_size)
+        return;
+    m_spare_packet_buffers.append(move(buffer));
 }
 
 void NetworkAdapter::set_ipv4_address(const IPv4Address& address)
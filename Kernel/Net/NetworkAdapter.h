@@ -1,17 +1,20 @@
 #pragma once
 
 // includes
+#include <AK/Atomic.h>
 #include <AK/ByteBuffer.h>
 #include <AK/Function.h>
 #include <AK/MACAddress.h>
-#include <AK/SinglyLinkedList.h>
+#include <AK/Optional.h>
 #include <AK/Types.h>
+#include <AK/Vector.h>
 #include <AK/WeakPtr.h>
 #include <AK/Weakable.h>
 #include <Kernel/KBuffer.h>
 #include <Kernel/Net/ARP.h>
 #include <Kernel/Net/ICMP.h>
 #include <Kernel/Net/IPv4.h>
+#include <Kernel/SpinLock.h>
 #include <Kernel/UserOrKernelBuffer.h>
 
 namespace Kernel {
@@ -43,9 +46,21 @@ public:
     KResult send_ipv4(const MACAddress&, const IPv4Address&, IPv4Protocol, const UserOrKernelBuffer& payload, size_t payload_size, u8 ttl);
     KResult send_ipv4_fragmented(const MACAddress&, const IPv4Address&, IPv4Protocol, const UserOrKernelBuffer& payload, size_t payload_size, u8 ttl);
 
-    size_t dequeue_packet(u8* buffer, size_t buffer_size, Time& packet_timestamp);
+    struct ReceivedFrame {
+        KBuffer buffer;
+        Time timestamp;
+    };
+
+    static constexpr size_t default_receive_ring_size = 256;
+
+    // The receive ring is a single-producer/single-consumer queue of preallocated
+    // packet buffers: the driver fills slots from its interrupt handler, and the
+    // NetworkTask takes whole buffers out, swapping a spare buffer into the slot.
+    bool initialize_receive_ring();
+    Optional<ReceivedFrame> dequeue_packet();
+    void recycle_packet_buffer(KBuffer&&);
 
-    bool has_queued_packets() const { return !m_packet_queue.is_empty(); }
+    bool has_queued_packets() const { return m_receive_ring_head.load(AK::memory_order_acquire) != m_receive_ring_tail.load(AK::memory_order_relaxed); }
 
     u32 mtu() const { return m_mtu; }
     void set_mtu(u32 mtu) { m_mtu = mtu; }
@@ -54,6 +69,7 @@ public:
     u32 bytes_in() const { return m_bytes_in; }
     u32 packets_out() const { return m_packets_out; }
     u32 bytes_out() const { return m_bytes_out; }
+    u32 packets_dropped() const { return m_packets_dropped.load(AK::memory_order_relaxed); }
 
     Function<void()> on_receive;
 
@@ -61,6 +77,7 @@ protected:
     NetworkAdapter();
     void set_interface_name(const StringView& basename);
     void set_mac_address(const MACAddress& mac_address) { m_mac_address = mac_address; }
+    void set_receive_ring_size(size_t size) { m_receive_ring_size = size; }
     virtual void send_raw(ReadonlyBytes) = 0;
     void did_receive(ReadonlyBytes);
 
@@ -70,14 +87,25 @@ private:
     IPv4Address m_ipv4_netmask;
     IPv4Address m_ipv4_gateway;
 
-    struct PacketWithTimestamp {
-        KBuffer packet;
+    struct ReceiveRingSlot {
+        Optional<KBuffer> buffer;
         Time timestamp;
     };
 
-    SinglyLinkedList<PacketWithTimestamp> m_packet_queue;
-    SinglyLinkedList<KBuffer> m_unused_packet_buffers;
-    size_t m_unused_packet_buffers_count { 0 };
+    size_t packet_buffer_size() const;
+    Optional<KBuffer> take_spare_packet_buffer();
+
+    Vector<ReceiveRingSlot> m_receive_ring;
+    size_t m_receive_ring_size { default_receive_ring_size };
+    Atomic<bool> m_receive_ring_ready { false };
+    // The head is only advanced by the producer and the tail only by the NetworkTask.
+    Atomic<u32> m_receive_ring_head { 0 };
+    Atomic<u32> m_receive_ring_tail { 0 };
+    // Serializes producers; only the loopback adapter can actually have several.
+    SpinLock<u8> m_receive_ring_producer_lock;
+    // Buffers handed back by the NetworkTask once no socket holds on to them.
+    Vector<KBuffer> m_spare_packet_buffers;
+    Atomic<u32> m_packets_dropped { 0 };
     String m_name;
     u32 m_packets_in { 0 };
     u32 m_bytes_in { 0 };
@@ -15,14 +15,24 @@
 #include <Kernel/Net/UDP.h>
 #include <Kernel/Net/UDPSocket.h>
 #include <Kernel/Process.h>
+#include <Kernel/Time/TimeManagement.h>
 
 namespace Kernel {
 
+static void handle_frame(const KBuffer& frame, const Time& packet_timestamp);
 static void handle_arp(const EthernetFrameHeader&, size_t frame_size);
-static void handle_ipv4(const EthernetFrameHeader&, size_t frame_size, const Time& packet_timestamp);
-static void handle_icmp(const EthernetFrameHeader&, const IPv4Packet&, const Time& packet_timestamp);
-static void handle_udp(const IPv4Packet&, const Time& packet_timestamp);
-static void handle_tcp(const IPv4Packet&, const Time& packet_timestamp);
+static void handle_ipv4(const KBuffer& frame, const Time& packet_timestamp);
+static void handle_icmp(const KBuffer& frame, const EthernetFrameHeader&, const IPv4Packet&, const Time& packet_timestamp);
+static void handle_udp(const KBuffer& frame, const IPv4Packet&, const Time& packet_timestamp);
+static void handle_tcp(const KBuffer& frame, const IPv4Packet&, const Time& packet_timestamp);
+
+// How many frames we take from one adapter before looking at the next one.
+static constexpr size_t max_frames_per_adapter_batch = 32;
+
+static ReadonlyBytes ipv4_packet_bytes(const IPv4Packet& packet)
+{
+    return { reinterpret_cast<const u8*>(&packet), sizeof(IPv4Packet) + packet.payload_size() };
+}
 
 static Thread* network_task = nullptr;
 
@@ -43,7 +53,7 @@ bool NetworkTask::is_current()
 void NetworkTask_main(void*)
 {
     WaitQueue packet_wait_queue;
-    int pending_packets = 0;
+    NonnullRefPtrVector<NetworkAdapter> adapters;
     NetworkAdapter::for_each([&](auto& adapter) {
         dmesgln("NetworkTask: {} network adapter found: hw={}", adapter.class_name(), adapter.mac_address().to_string());
 
@@ -53,57 +63,68 @@ void NetworkTask_main(void*)
             adapter.set_ipv4_gateway({ 0, 0, 0, 0 });
         }
 
+        if (!adapter.initialize_receive_ring()) {
+            dmesgln("NetworkTask: Couldn't allocate receive ring for {}", adapter.name());
+            return;
+        }
+
         adapter.on_receive = [&]() {
-            pending_packets++;
-            packet_wait_queue.wake_all();
+            packet_wait_queue.wake_one();
         };
+        adapters.append(adapter);
     });
 
-    auto dequeue_packet = [&pending_packets](u8* buffer, size_t buffer_size, Time& packet_timestamp) -> size_t {
-        if (pending_packets == 0)
-            return 0;
-        size_t packet_size = 0;
-        NetworkAdapter::for_each([&](auto& adapter) {
-            if (packet_size || !adapter.has_queued_packets())
-                return;
-            packet_size = adapter.dequeue_packet(buffer, buffer_size, packet_timestamp);
-            pending_packets--;
-            dbgln_if(NETWORK_TASK_DEBUG, "NetworkTask: Dequeued packet from {} ({} bytes)", adapter.name(), packet_size);
-        });
-        return packet_size;
-    };
-
-    size_t buffer_size = 64 * KiB;
-    auto buffer_region = MM.allocate_kernel_region(buffer_size, "Kernel Packet Buffer", Region::Access::Read | Region::Access::Write);
-    auto buffer = (u8*)buffer_region->vaddr().get();
-    Time packet_timestamp;
+    auto tcp_timer_interval = Time::from_milliseconds(TCPSocket::retransmission_timer_interval_ms);
+    auto next_tcp_timer = TimeManagement::the().monotonic_time() + tcp_timer_interval;
 
     for (;;) {
-        size_t packet_size = dequeue_packet(buffer, buffer_size, packet_timestamp);
-        if (!packet_size) {
-            packet_wait_queue.wait_forever("NetworkTask");
-            continue;
-        }
-        if (packet_size < sizeof(EthernetFrameHeader)) {
-            dbgln("NetworkTask: Packet is too small to be an Ethernet packet! ({})", packet_size);
-            continue;
+        auto now = TimeManagement::the().monotonic_time();
+        if (!(now < next_tcp_timer)) {
+            TCPSocket::process_retransmission_timers();
+            next_tcp_timer = now + tcp_timer_interval;
         }
-        auto& eth = *(const EthernetFrameHeader*)buffer;
-        dbgln_if(ETHERNET_DEBUG, "NetworkTask: From {} to {}, ether_type={:#04x}, packet_size={}", eth.source().to_string(), eth.destination().to_string(), eth.ether_type(), packet_size);
-
-        switch (eth.ether_type()) {
-        case EtherType::ARP:
-            handle_arp(eth, packet_size);
-            break;
-        case EtherType::IPv4:
-            handle_ipv4(eth, packet_size, packet_timestamp);
-            break;
-        case EtherType::IPv6:
-            // ignore
-            break;
-        default:
-            dbgln_if(ETHERNET_DEBUG, "NetworkTask: Unknown ethernet type {:#04x}", eth.ether_type());
+
+        size_t frame_count = 0;
+        for (auto& adapter : adapters) {
+            for (size_t i = 0; i < max_frames_per_adapter_batch; ++i) {
+                auto frame = adapter.dequeue_packet();
+                if (!frame.has_value())
+                    break;
+                dbgln_if(NETWORK_TASK_DEBUG, "NetworkTask: Dequeued packet from {} ({} bytes)", adapter.name(), frame.value().buffer.size());
+                handle_frame(frame.value().buffer, frame.value().timestamp);
+                adapter.recycle_packet_buffer(move(frame.value().buffer));
+                ++frame_count;
+            }
         }
+
+        if (frame_count)
+            continue;
+        [[maybe_unused]] auto result = packet_wait_queue.wait_on(Thread::BlockTimeout(false, &tcp_timer_interval), "NetworkTask");
+    }
+}
+
+void handle_frame(const KBuffer& frame, const Time& packet_timestamp)
+{
+    size_t frame_size = frame.size();
+    if (frame_size < sizeof(EthernetFrameHeader)) {
+        dbgln("NetworkTask: Packet is too small to be an Ethernet packet! ({})", frame_size);
+        return;
+    }
+    auto& eth = *(const EthernetFrameHeader*)frame.data();
+    dbgln_if(ETHERNET_DEBUG, "NetworkTask: From {} to {}, ether_type={:#04x}, packet_size={}", eth.source().to_string(), eth.destination().to_string(), eth.ether_type(), frame_size);
+
+    switch (eth.ether_type()) {
+    case EtherType::ARP:
+        handle_arp(eth, frame_size);
+        break;
+    case EtherType::IPv4:
+        handle_ipv4(frame, packet_timestamp);
+        break;
+    case EtherType::IPv6:
+        // ignore
+        break;
+    default:
+        dbgln_if(ETHERNET_DEBUG, "NetworkTask: Unknown ethernet type {:#04x}", eth.ether_type());
     }
 }
 
@@ -156,8 +177,10 @@ void handle_arp(const EthernetFrameHeader& eth, size_t frame_size)
     }
 }
 
-void handle_ipv4(const EthernetFrameHeader& eth, size_t frame_size, const Time& packet_timestamp)
+void handle_ipv4(const KBuffer& frame, const Time& packet_timestamp)
 {
+    auto& eth = *(const EthernetFrameHeader*)frame.data();
+    size_t frame_size = frame.size();
     constexpr size_t minimum_ipv4_frame_size = sizeof(EthernetFrameHeader) + sizeof(IPv4Packet);
     if (frame_size < minimum_ipv4_frame_size) {
         dbgln("handle_ipv4: Frame too small ({}, need {})", frame_size, minimum_ipv4_frame_size);
@@ -189,18 +212,18 @@ void handle_ipv4(const EthernetFrameHeader& eth, size_t frame_size, const Time&
 
     switch ((IPv4Protocol)packet.protocol()) {
     case IPv4Protocol::ICMP:
-        return handle_icmp(eth, packet, packet_timestamp);
+        return handle_icmp(frame, eth, packet, packet_timestamp);
     case IPv4Protocol::UDP:
-        return handle_udp(packet, packet_timestamp);
+        return handle_udp(frame, packet, packet_timestamp);
     case IPv4Protocol::TCP:
-        return handle_tcp(packet, packet_timestamp);
+        return handle_tcp(frame, packet, packet_timestamp);
     default:
         dbgln_if(IPV4_DEBUG, "handle_ipv4: Unhandled protocol {:#02x}", packet.protocol());
         break;
     }
 }
 
-void handle_icmp(const EthernetFrameHeader& eth, const IPv4Packet& ipv4_packet, const Time& packet_timestamp)
+void handle_icmp(const KBuffer& frame, const EthernetFrameHeader& eth, const IPv4Packet& ipv4_packet, const Time& packet_timestamp)
 {
     auto& icmp_header = *static_cast<const ICMPHeader*>(ipv4_packet.payload());
     dbgln_if(ICMP_DEBUG, "handle_icmp: source={}, destination={}, type={:#02x}, code={:#02x}", ipv4_packet.source().to_string(), ipv4_packet.destination().to_string(), icmp_header.type(), icmp_header.code());
@@ -216,7 +239,7 @@ void handle_icmp(const EthernetFrameHeader& eth, const IPv4Packet& ipv4_packet,
             }
         }
         for (auto& socket : icmp_sockets)
-            socket.did_receive(ipv4_packet.source(), 0, KBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()), packet_timestamp);
+            socket.did_receive(ipv4_packet.source(), 0, frame, ipv4_packet_bytes(ipv4_packet), packet_timestamp);
     }
 
     auto adapter = NetworkAdapter::from_ipv4_address(ipv4_packet.destination());
@@ -246,7 +269,7 @@ void handle_icmp(const EthernetFrameHeader& eth, const IPv4Packet& ipv4_packet,
     }
 }
 
-void handle_udp(const IPv4Packet& ipv4_packet, const Time& packet_timestamp)
+void handle_udp(const KBuffer& frame, const IPv4Packet& ipv4_packet, const Time& packet_timestamp)
 {
     if (ipv4_packet.payload_size() < sizeof(UDPPacket)) {
         dbgln("handle_udp: Packet too small ({}, need {})", ipv4_packet.payload_size(), sizeof(UDPPacket));
@@ -273,10 +296,10 @@ void handle_udp(const IPv4Packet& ipv4_packet, const Time& packet_timestamp)
 
     VERIFY(socket->type() == SOCK_DGRAM);
     VERIFY(socket->local_port() == udp_packet.destination_port());
-    socket->did_receive(ipv4_packet.source(), udp_packet.source_port(), KBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()), packet_timestamp);
+    socket->did_receive(ipv4_packet.source(), udp_packet.source_port(), frame, ipv4_packet_bytes(ipv4_packet), packet_timestamp);
 }
 
-void handle_tcp(const IPv4Packet& ipv4_packet, const Time& packet_timestamp)
+void handle_tcp(const KBuffer& frame, const IPv4Packet& ipv4_packet, const Time& packet_timestamp)
 {
     if (ipv4_packet.payload_size() < sizeof(TCPPacket)) {
         dbgln("handle_tcp: IPv4 payload is too small to be a TCP packet ({}, need {})", ipv4_packet.payload_size(), sizeof(TCPPacket));
@@ -289,6 +312,7 @@ void handle_tcp(const IPv4Packet& ipv4_packet, const Time& packet_timestamp)
     size_t maximum_tcp_header_size = 15 * sizeof(u32);
     if (tcp_packet.header_size() < minimum_tcp_header_size || tcp_packet.header_size() > maximum_tcp_header_size) {
         dbgln("handle_tcp: TCP packet header has invalid size {}", tcp_packet.header_size());
+        return;
     }
 
     if (ipv4_packet.payload_size() < tcp_packet.header_size()) {
@@ -377,6 +401,7 @@ void handle_tcp(const IPv4Packet& ipv4_packet, const Time& packet_timestamp)
             dbgln_if(TCP_DEBUG, "handle_tcp: created new client socket with tuple {}", client->tuple().to_string());
             client->set_sequence_number(1000);
             client->set_ack_number(tcp_packet.sequence_number() + payload_size + 1);
+            client->parse_syn_options(tcp_packet);
             [[maybe_unused]] auto rc2 = client->send_tcp_packet(TCPFlags::SYN | TCPFlags::ACK);
             client->set_state(TCPSocket::State::SynReceived);
             return;
@@ -528,9 +553,18 @@ void handle_tcp(const IPv4Packet& ipv4_packet, const Time& packet_timestamp)
             return;
         }
 
+        if (tcp_packet.sequence_number() != socket->ack_number()) {
+            // We don't keep out-of-order segments around. Repeat our ACK so the sender
+            // sees a duplicate and can retransmit what's missing.
+            dbgln_if(TCP_DEBUG, "handle_tcp: got seq_no={} but expected {}, dropping", tcp_packet.sequence_number(), socket->ack_number());
+            if (payload_size || tcp_packet.has_fin())
+                unused_rc = socket->send_tcp_packet(TCPFlags::ACK);
+            return;
+        }
+
         if (tcp_packet.has_fin()) {
             if (payload_size != 0)
-                socket->did_receive(ipv4_packet.source(), tcp_packet.source_port(), KBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()), packet_timestamp);
+                socket->did_receive(ipv4_packet.source(), tcp_packet.source_port(), frame, ipv4_packet_bytes(ipv4_packet), packet_timestamp);
 
             socket->set_ack_number(tcp_packet.sequence_number() + payload_size + 1);
             unused_rc = socket->send_tcp_packet(TCPFlags::ACK);
@@ -539,15 +573,16 @@ void handle_tcp(const IPv4Packet& ipv4_packet, const Time& packet_timestamp)
             return;
         }
 
-        socket->set_ack_number(tcp_packet.sequence_number() + payload_size);
+        if (payload_size) {
+            // Only acknowledge what actually fit into the receive buffer; the ACK goes out
+            // either way so the sender learns about the current window.
+            if (socket->did_receive(ipv4_packet.source(), tcp_packet.source_port(), frame, ipv4_packet_bytes(ipv4_packet), packet_timestamp))
+                socket->set_ack_number(tcp_packet.sequence_number() + payload_size);
+            unused_rc = socket->send_tcp_packet(TCPFlags::ACK);
+        }
 
         dbgln_if(TCP_DEBUG, "Got packet with ack_no={}, seq_no={}, payload_size={}, acking it with new ack_no={}, seq_no={}",
             tcp_packet.ack_number(), tcp_packet.sequence_number(), payload_size, socket->ack_number(), socket->sequence_number());
-
-        if (payload_size) {
-            if (socket->did_receive(ipv4_packet.source(), tcp_packet.source_port(), KBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()), packet_timestamp))
-                unused_rc = socket->send_tcp_packet(TCPFlags::ACK);
-        }
     }
 }
 
@@ -16,6 +16,21 @@ struct TCPFlags {
     };
 };
 
+struct TCPOptionKind {
+    enum : u8 {
+        End = 0,
+        NoOperation = 1,
+        MaximumSegmentSize = 2,
+        WindowScale = 3,
+    };
+};
+
+// Sequence numbers wrap around, so compare them by their signed distance.
+inline bool tcp_sequence_number_is_before(u32 a, u32 b)
+{
+    return static_cast<i32>(a - b) < 0;
+}
+
 class [[gnu::packed]] TCPPacket {
 public:
     TCPPacket() = default;
@@ -55,6 +70,10 @@ public:
     u16 urgent() const { return m_urgent; }
     void set_urgent(u16 urgent) { m_urgent = urgent; }
 
+    const u8* options() const { return ((const u8*)this) + sizeof(TCPPacket); }
+    u8* options() { return ((u8*)this) + sizeof(TCPPacket); }
+    size_t options_size() const { return header_size() - sizeof(TCPPacket); }
+
     const void* payload() const { return ((const u8*)this) + header_size(); }
     void* payload() { return ((u8*)this) + header_size(); }
 
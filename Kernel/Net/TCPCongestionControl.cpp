@@ -0,0 +1,89 @@
+// includes
+#include <Kernel/Net/TCP.h>
+#include <Kernel/Net/TCPCongestionControl.h>
+
+namespace Kernel {
+
+NonnullOwnPtr<TCPCongestionControl> TCPCongestionControl::create_default(size_t mss)
+{
+    return make<NewRenoCongestionControl>(mss);
+}
+
+NewRenoCongestionControl::NewRenoCongestionControl(size_t mss)
+    : m_mss(mss)
+{
+    m_congestion_window = initial_window();
+}
+
+size_t NewRenoCongestionControl::initial_window() const
+{
+    // RFC 3390
+    return min(4 * m_mss, max(2 * m_mss, static_cast<size_t>(4380)));
+}
+
+void NewRenoCongestionControl::set_mss(size_t mss)
+{
+    VERIFY(mss);
+    // The MSS is only negotiated during the handshake, before anything has been
+    // sent, so the window can simply start over.
+    m_mss = mss;
+    m_congestion_window = initial_window();
+}
+
+void NewRenoCongestionControl::enter_loss_state(size_t bytes_in_flight)
+{
+    m_slow_start_threshold = max(bytes_in_flight / 2, 2 * m_mss);
+}
+
+bool NewRenoCongestionControl::on_ack(u32 ack_number, size_t acked_bytes)
+{
+    m_duplicate_acks = 0;
+
+    if (m_in_recovery) {
+        if (!tcp_sequence_number_is_before(ack_number, m_recover)) {
+            // Full acknowledgement: everything outstanding when we entered recovery made it.
+            m_in_recovery = false;
+            m_congestion_window = m_slow_start_threshold;
+            return false;
+        }
+        // Partial acknowledgement: the next hole is lost as well. Deflate the window by
+        // the amount acknowledged and retransmit straight away.
+        m_congestion_window -= min(acked_bytes, m_congestion_window);
+        m_congestion_window += m_mss;
+        return true;
+    }
+
+    if (m_congestion_window < m_slow_start_threshold)
+        m_congestion_window += min(acked_bytes, m_mss);
+    else
+        m_congestion_window += max(m_mss * m_mss / m_congestion_window, static_cast<size_t>(1));
+    return false;
+}
+
+bool NewRenoCongestionControl::on_duplicate_ack(u32 highest_sequence_sent, size_t bytes_in_flight)
+{
+    if (m_in_recovery) {
+        // Every duplicate ACK means another segment has left the network.
+        m_congestion_window += m_mss;
+        return false;
+    }
+
+    if (++m_duplicate_acks < duplicate_ack_threshold)
+        return false;
+
+    enter_loss_state(bytes_in_flight);
+    m_congestion_window = m_slow_start_threshold + duplicate_ack_threshold * m_mss;
+    m_recover = highest_sequence_sent;
+    m_in_recovery = true;
+    return true;
+}
+
+void NewRenoCongestionControl::on_retransmission_timeout(size_t bytes_in_flight)
+{
+    enter_loss_state(bytes_in_flight);
+    m_congestion_window = m_mss;
+    m_duplicate_acks = 0;
+    m_in_recovery = false;
+}
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+// includes
+#include <AK/NonnullOwnPtr.h>
+#include <AK/NumericLimits.h>
+#include <AK/Types.h>
+
+namespace Kernel {
+
+// The part of a TCP sender that decides how much unacknowledged data may be in flight.
+// TCPSocket reports ACKs, duplicate ACKs and retransmission timeouts; the algorithm
+// answers with a congestion window and tells it when to retransmit.
+class TCPCongestionControl {
+public:
+    static NonnullOwnPtr<TCPCongestionControl> create_default(size_t mss);
+
+    virtual ~TCPCongestionControl() = default;
+
+    virtual const char* name() const = 0;
+
+    virtual void set_mss(size_t) = 0;
+    virtual size_t congestion_window() const = 0;
+    virtual size_t slow_start_threshold() const = 0;
+    virtual bool is_in_recovery() const = 0;
+
+    // New data up to ack_number has been acknowledged. Returns true if the first
+    // unacknowledged segment should be retransmitted right away.
+    virtual bool on_ack(u32 ack_number, size_t acked_bytes) = 0;
+
+    // An ACK that acknowledged nothing new arrived while data was outstanding.
+    // Returns true if the first unacknowledged segment should be retransmitted.
+    virtual bool on_duplicate_ack(u32 highest_sequence_sent, size_t bytes_in_flight) = 0;
+
+    virtual void on_retransmission_timeout(size_t bytes_in_flight) = 0;
+
+protected:
+    TCPCongestionControl() = default;
+};
+
+// RFC 5681 slow start and congestion avoidance with the RFC 6582 fast recovery.
+class NewRenoCongestionControl final : public TCPCongestionControl {
+public:
+    explicit NewRenoCongestionControl(size_t mss);
+
+    virtual const char* name() const override { return "NewReno"; }
+
+    virtual void set_mss(size_t) override;
+    virtual size_t congestion_window() const override { return m_congestion_window; }
+    virtual size_t slow_start_threshold() const override { return m_slow_start_threshold; }
+    virtual bool is_in_recovery() const override { return m_in_recovery; }
+
+    virtual bool on_ack(u32 ack_number, size_t acked_bytes) override;
+    virtual bool on_duplicate_ack(u32 highest_sequence_sent, size_t bytes_in_flight) override;
+    virtual void on_retransmission_timeout(size_t bytes_in_flight) override;
+
+private:
+    static constexpr size_t duplicate_ack_threshold = 3;
+
+    size_t initial_window() const;
+    void enter_loss_state(size_t bytes_in_flight);
+
+    size_t m_mss { 0 };
+    size_t m_congestion_window { 0 };
+    size_t m_slow_start_threshold { NumericLimits<u32>::max() };
+    size_t m_duplicate_acks { 0 };
+    u32 m_recover { 0 };
+    bool m_in_recovery { false };
+};
+
+}
@@ -10,6 +10,7 @@
 #include <Kernel/Net/TCPSocket.h>
 #include <Kernel/Process.h>
 #include <Kernel/Random.h>
+#include <Kernel/Time/TimeManagement.h>
 
 namespace Kernel {
 
@@ -125,7 +126,11 @@ void TCPSocket::release_for_accept(RefPtr<TCPSocket> socket)
 
 TCPSocket::TCPSocket(int protocol)
     : IPv4Socket(SOCK_STREAM, protocol)
+    , m_congestion_control(TCPCongestionControl::create_default(default_mss))
 {
+    // Pick the smallest shift that lets us advertise the whole receive buffer.
+    while ((receive_buffer_capacity() >> m_receive_window_scale) > NumericLimits<u16>::max())
+        ++m_receive_window_scale;
 }
 
 TCPSocket::~TCPSocket()
@@ -155,42 +160,135 @@ KResultOr<size_t> TCPSocket::protocol_receive(ReadonlyBytes raw_ipv4_packet, Use
 
 KResultOr<size_t> TCPSocket::protocol_send(const UserOrKernelBuffer& data, size_t data_length)
 {
-    int err = send_tcp_packet(TCPFlags::PUSH | TCPFlags::ACK, &data, data_length);
-    if (err < 0)
-        return KResult((ErrnoCode)-err);
-    return data_length;
+    size_t space = send_buffer_space();
+    if (!space)
+        return EAGAIN;
+
+    // Cut the data into segments the peer can take; send_outgoing_packets() decides
+    // when each of them may actually go out.
+    size_t length_to_send = min(data_length, space);
+    size_t offset = 0;
+    while (offset < length_to_send) {
+        size_t segment_size = min(static_cast<size_t>(m_send_mss), length_to_send - offset);
+        auto segment = data.offset(offset);
+        auto result = send_tcp_packet(TCPFlags::PUSH | TCPFlags::ACK, &segment, segment_size);
+        if (result.is_error()) {
+            if (offset)
+                break;
+            return result;
+        }
+        offset += segment_size;
+    }
+    return offset;
+}
+
+bool TCPSocket::can_write(const FileDescription& description, size_t size) const
+{
+    return IPv4Socket::can_write(description, size) && send_buffer_space() > 0;
+}
+
+u16 TCPSocket::local_mss() const
+{
+    auto routing_decision = route_to(peer_address(), local_address(), bound_interface());
+    if (routing_decision.is_zero())
+        return default_mss;
+    size_t mss = routing_decision.adapter->mtu() - sizeof(IPv4Packet) - sizeof(TCPPacket);
+    return min(mss, static_cast<size_t>(NumericLimits<u16>::max()));
+}
+
+u16 TCPSocket::advertised_window(bool is_syn)
+{
+    size_t window = receive_buffer_space();
+    m_last_advertised_window = window;
+    // The window in a SYN is never scaled.
+    if (!is_syn && is_window_scaling_enabled())
+        window >>= m_receive_window_scale;
+    return min(window, static_cast<size_t>(NumericLimits<u16>::max()));
+}
+
+void TCPSocket::parse_syn_options(const TCPPacket& packet)
+{
+    u16 peer_mss = default_mss;
+    auto* options = packet.options();
+    size_t options_size = packet.options_size();
+    for (size_t i = 0; i < options_size;) {
+        u8 kind = options[i];
+        if (kind == TCPOptionKind::End)
+            break;
+        if (kind == TCPOptionKind::NoOperation) {
+            ++i;
+            continue;
+        }
+        if (i + 1 >= options_size)
+            break;
+        u8 length = options[i + 1];
+        if (length < 2 || i + length > options_size)
+            break;
+        if (kind == TCPOptionKind::MaximumSegmentSize && length == 4)
+            peer_mss = (options[i + 2] << 8) | options[i + 3];
+        else if (kind == TCPOptionKind::WindowScale && length == 3)
+            m_peer_window_scale = min(options[i + 2], static_cast<u8>(14));
+        i += length;
+    }
+
+    m_send_mss = max(min(peer_mss, local_mss()), static_cast<u16>(64));
+    m_congestion_control->set_mss(m_send_mss);
+    dbgln_if(TCP_SOCKET_DEBUG, "TCPSocket({}) peer mss={}, using mss={}, peer window scale={}", this, peer_mss, m_send_mss, m_peer_window_scale);
 }
 
 KResult TCPSocket::send_tcp_packet(u16 flags, const UserOrKernelBuffer* payload, size_t payload_size)
 {
-    const size_t buffer_size = sizeof(TCPPacket) + payload_size;
+    bool is_syn = flags & TCPFlags::SYN;
+    // An active open always offers window scaling, a SYN-ACK may only answer an offer.
+    bool include_window_scale = is_syn && (!(flags & TCPFlags::ACK) || m_peer_window_scale.has_value());
+    size_t options_size = 0;
+    if (is_syn)
+        options_size = include_window_scale ? 8 : 4;
+
+    const size_t header_size = sizeof(TCPPacket) + options_size;
+    const size_t buffer_size = header_size + payload_size;
     auto buffer = ByteBuffer::create_zeroed(buffer_size);
     auto& tcp_packet = *(TCPPacket*)(buffer.data());
     VERIFY(local_port());
     tcp_packet.set_source_port(local_port());
     tcp_packet.set_destination_port(peer_port());
-    tcp_packet.set_window_size(1024);
     tcp_packet.set_sequence_number(m_sequence_number);
-    tcp_packet.set_data_offset(sizeof(TCPPacket) / sizeof(u32));
+    tcp_packet.set_data_offset(header_size / sizeof(u32));
     tcp_packet.set_flags(flags);
 
-    if (flags & TCPFlags::ACK)
-        tcp_packet.set_ack_number(m_ack_number);
+    if (is_syn) {
+        auto* options = tcp_packet.options();
+        u16 mss = local_mss();
+        options[0] = TCPOptionKind::MaximumSegmentSize;
+        options[1] = 4;
+        options[2] = mss >> 8;
+        options[3] = mss & 0xff;
+        if (include_window_scale) {
+            options[4] = TCPOptionKind::NoOperation;
+            options[5] = TCPOptionKind::WindowScale;
+            options[6] = 3;
+            options[7] = m_receive_window_scale;
+            m_sent_window_scale = true;
+        }
+        m_send_unacknowledged = m_sequence_number;
+        m_highest_sequence_sent = m_sequence_number;
+    }
 
     if (payload && !payload->read(tcp_packet.payload(), payload_size))
         return EFAULT;
 
-    if (flags & TCPFlags::SYN) {
+    // SYN and FIN each occupy one sequence number, so they have to be acknowledged too.
+    if (flags & (TCPFlags::SYN | TCPFlags::FIN)) {
         ++m_sequence_number;
     } else {
         m_sequence_number += payload_size;
     }
 
-    tcp_packet.set_checksum(compute_tcp_checksum(local_address(), peer_address(), tcp_packet, payload_size));
-
-    if (tcp_packet.has_syn() || payload_size > 0) {
+    if (flags & (TCPFlags::SYN | TCPFlags::FIN) || payload_size > 0) {
         Locker locker(m_not_acked_lock);
-        m_not_acked.append({ m_sequence_number, move(buffer) });
+        OutgoingPacket packet { m_sequence_number, move(buffer) };
+        m_bytes_queued += packet.sequence_length();
+        m_not_acked.append(move(packet));
         send_outgoing_packets();
         return KSuccess;
     }
@@ -199,6 +297,7 @@ KResult TCPSocket::send_tcp_packet(u16 flags, const UserOrKernelBuffer* payload,
     if (routing_decision.is_zero())
         return EHOSTUNREACH;
 
+    prepare_packet_for_transmission(buffer);
     auto packet_buffer = UserOrKernelBuffer::for_kernel_buffer(buffer.data());
     auto result = routing_decision.adapter->send_ipv4(
         routing_decision.next_hop, peer_address(), IPv4Protocol::TCP,
@@ -211,91 +310,248 @@ KResult TCPSocket::send_tcp_packet(u16 flags, const UserOrKernelBuffer* payload,
     return KSuccess;
 }
 
+u32 TCPSocket::OutgoingPacket::sequence_length() const
+{
+    auto& tcp_packet = *(const TCPPacket*)(buffer.data());
+    return ack_number - tcp_packet.sequence_number();
+}
+
+void TCPSocket::prepare_packet_for_transmission(ByteBuffer& buffer)
+{
+    // Queued segments may go out (again) long after they were built, so they always
+    // carry our current acknowledgement number and receive window.
+    auto& tcp_packet = *(TCPPacket*)(buffer.data());
+    if (tcp_packet.has_ack())
+        tcp_packet.set_ack_number(m_ack_number);
+    tcp_packet.set_window_size(advertised_window(tcp_packet.has_syn()));
+    tcp_packet.set_checksum(0);
+    tcp_packet.set_checksum(compute_tcp_checksum(local_address(), peer_address(), tcp_packet, buffer.size() - tcp_packet.header_size()));
+}
+
+void TCPSocket::transmit_packet(RoutingDecision& routing_decision, OutgoingPacket& packet, const Time& now)
+{
+    prepare_packet_for_transmission(packet.buffer);
+    if (!packet.in_flight) {
+        packet.in_flight = true;
+        m_bytes_in_flight += packet.sequence_length();
+    }
+    packet.tx_time = now;
+    if (packet.tx_counter++)
+        m_retransmissions++;
+    if (tcp_sequence_number_is_before(m_highest_sequence_sent, packet.ack_number))
+        m_highest_sequence_sent = packet.ack_number;
+
+    if constexpr (TCP_SOCKET_DEBUG) {
+        auto& tcp_packet = *(const TCPPacket*)(packet.buffer.data());
+        dbgln("Sending TCP packet from {}:{} to {}:{} with ({}{}{}{}) seq_no={}, ack_no={}, tx_counter={}",
+            local_address(), local_port(),
+            peer_address(), peer_port(),
+            (tcp_packet.has_syn() ? "SYN " : ""),
+            (tcp_packet.has_ack() ? "ACK " : ""),
+            (tcp_packet.has_fin() ? "FIN " : ""),
+            (tcp_packet.has_rst() ? "RST " : ""),
+            tcp_packet.sequence_number(),
+            tcp_packet.ack_number(),
+            packet.tx_counter);
+    }
+
+    auto packet_buffer = UserOrKernelBuffer::for_kernel_buffer(packet.buffer.data());
+    int err = routing_decision.adapter->send_ipv4(
+        routing_decision.next_hop, peer_address(), IPv4Protocol::TCP,
+        packet_buffer, packet.buffer.size(), ttl());
+    if (err < 0) {
+        auto& tcp_packet = *(const TCPPacket*)(packet.buffer.data());
+        dmesgln("Error ({}) sending TCP packet from {}:{} to {}:{} with ({}{}{}{}) seq_no={}, ack_no={}, tx_counter={}",
+            err,
+            local_address(),
+            local_port(),
+            peer_address(),
+            peer_port(),
+            (tcp_packet.has_syn() ? "SYN " : ""),
+            (tcp_packet.has_ack() ? "ACK " : ""),
+            (tcp_packet.has_fin() ? "FIN " : ""),
+            (tcp_packet.has_rst() ? "RST " : ""),
+            tcp_packet.sequence_number(),
+            tcp_packet.ack_number(),
+            packet.tx_counter);
+    } else {
+        m_packets_out++;
+        m_bytes_out += packet.buffer.size();
+    }
+}
+
 void TCPSocket::send_outgoing_packets()
 {
     auto routing_decision = route_to(peer_address(), local_address(), bound_interface());
     if (routing_decision.is_zero())
         return;
 
-    auto now = kgettimeofday();
+    auto now = TimeManagement::the().monotonic_time();
+    size_t window = min(m_congestion_control->congestion_window(), m_send_window);
 
-    Locker locker(m_not_acked_lock, Lock::Mode::Shared);
+    Locker locker(m_not_acked_lock);
     for (auto& packet : m_not_acked) {
-        auto diff = now - packet.tx_time;
-        if (diff <= Time::from_nanoseconds(500'000'000))
+        if (packet.in_flight)
             continue;
-        packet.tx_time = now;
-        packet.tx_counter++;
-
-        if constexpr (TCP_SOCKET_DEBUG) {
-            auto& tcp_packet = *(const TCPPacket*)(packet.buffer.data());
-            dbgln("Sending TCP packet from {}:{} to {}:{} with ({}{}{}{}) seq_no={}, ack_no={}, tx_counter={}",
-                local_address(), local_port(),
-                peer_address(), peer_port(),
-                (tcp_packet.has_syn() ? "SYN " : ""),
-                (tcp_packet.has_ack() ? "ACK " : ""),
-                (tcp_packet.has_fin() ? "FIN " : ""),
-                (tcp_packet.has_rst() ? "RST " : ""),
-                tcp_packet.sequence_number(),
-                tcp_packet.ack_number(),
-                packet.tx_counter);
-        }
+        // One segment may always go out while nothing is in flight, which doubles as
+        // a probe of a closed window.
+        if (m_bytes_in_flight && m_bytes_in_flight + packet.sequence_length() > window)
+            break;
+        transmit_packet(routing_decision, packet, now);
+    }
+}
 
-        auto packet_buffer = UserOrKernelBuffer::for_kernel_buffer(packet.buffer.data());
-        int err = routing_decision.adapter->send_ipv4(
-            routing_decision.next_hop, peer_address(), IPv4Protocol::TCP,
-            packet_buffer, packet.buffer.size(), ttl());
-        if (err < 0) {
-            auto& tcp_packet = *(const TCPPacket*)(packet.buffer.data());
-            dmesgln("Error ({}) sending TCP packet from {}:{} to {}:{} with ({}{}{}{}) seq_no={}, ack_no={}, tx_counter={}",
-                err,
-                local_address(),
-                local_port(),
-                peer_address(),
-                peer_port(),
-                (tcp_packet.has_syn() ? "SYN " : ""),
-                (tcp_packet.has_ack() ? "ACK " : ""),
-                (tcp_packet.has_fin() ? "FIN " : ""),
-                (tcp_packet.has_rst() ? "RST " : ""),
-                tcp_packet.sequence_number(),
-                tcp_packet.ack_number(),
-                packet.tx_counter);
-        } else {
-            m_packets_out++;
-            m_bytes_out += packet.buffer.size();
-        }
+void TCPSocket::retransmit_first_unacked_packet()
+{
+    if (m_not_acked.is_empty())
+        return;
+    auto routing_decision = route_to(peer_address(), local_address(), bound_interface());
+    if (routing_decision.is_zero())
+        return;
+    transmit_packet(routing_decision, m_not_acked.first(), TimeManagement::the().monotonic_time());
+}
+
+void TCPSocket::update_retransmission_timeout(const Time& round_trip_time)
+{
+    // RFC 6298, section 2
+    i64 rtt_us = round_trip_time.to_microseconds();
+    if (!m_smoothed_rtt_us.has_value()) {
+        m_smoothed_rtt_us = rtt_us;
+        m_rtt_variance_us = rtt_us / 2;
+    } else {
+        i64 smoothed_rtt_us = m_smoothed_rtt_us.value();
+        i64 delta_us = smoothed_rtt_us > rtt_us ? smoothed_rtt_us - rtt_us : rtt_us - smoothed_rtt_us;
+        m_rtt_variance_us = (3 * m_rtt_variance_us + delta_us) / 4;
+        m_smoothed_rtt_us = (7 * smoothed_rtt_us + rtt_us) / 8;
     }
 }
 
-void TCPSocket::receive_tcp_packet(const TCPPacket& packet, u16 size)
+void TCPSocket::process_ack(const TCPPacket& packet, size_t payload_size)
 {
-    if (packet.has_ack()) {
-        u32 ack_number = packet.ack_number();
+    u32 ack_number = packet.ack_number();
+    if (tcp_sequence_number_is_before(m_sequence_number, ack_number)) {
+        dbgln_if(TCP_SOCKET_DEBUG, "TCPSocket: ignoring ack_no={} for data we haven't sent yet", ack_number);
+        return;
+    }
+
+    size_t previous_send_window = m_send_window;
+    m_send_window = packet.window_size();
+    if (!packet.has_syn() && is_window_scaling_enabled())
+        m_send_window <<= m_peer_window_scale.value();
 
-        dbgln_if(TCP_SOCKET_DEBUG, "TCPSocket: receive_tcp_packet: {}", ack_number);
+    if (tcp_sequence_number_is_before(m_send_unacknowledged, ack_number)) {
+        size_t acked_bytes = ack_number - m_send_unacknowledged;
+        m_send_unacknowledged = ack_number;
 
+        Optional<Time> round_trip_time;
+        auto now = TimeManagement::the().monotonic_time();
         int removed = 0;
-        Locker locker(m_not_acked_lock);
         while (!m_not_acked.is_empty()) {
-            auto& packet = m_not_acked.first();
-
-            dbgln_if(TCP_SOCKET_DEBUG, "TCPSocket: iterate: {}", packet.ack_number);
-
-            if (packet.ack_number <= ack_number) {
-                m_not_acked.take_first();
-                removed++;
-            } else {
+            auto& unacked_packet = m_not_acked.first();
+            dbgln_if(TCP_SOCKET_DEBUG, "TCPSocket: iterate: {}", unacked_packet.ack_number);
+            if (tcp_sequence_number_is_before(ack_number, unacked_packet.ack_number))
                 break;
-            }
+            auto length = unacked_packet.sequence_length();
+            if (unacked_packet.in_flight)
+                m_bytes_in_flight -= length;
+            m_bytes_queued -= length;
+            // Karn's algorithm: only segments that were sent exactly once give a usable sample.
+            if (unacked_packet.tx_counter == 1)
+                round_trip_time = now - unacked_packet.tx_time;
+            m_not_acked.take_first();
+            removed++;
         }
-
         dbgln_if(TCP_SOCKET_DEBUG, "TCPSocket: receive_tcp_packet acknowledged {} packets", removed);
+
+        if (round_trip_time.has_value())
+            update_retransmission_timeout(round_trip_time.value());
+        // New data got through, so any backoff is over.
+        if (m_smoothed_rtt_us.has_value()) {
+            auto rto_us = m_smoothed_rtt_us.value() + max(retransmission_timer_interval_ms * 1000, 4 * m_rtt_variance_us);
+            m_rto = Time::from_microseconds(clamp(rto_us, minimum_rto_ms * 1000, maximum_rto_ms * 1000));
+        }
+
+        if (m_congestion_control->on_ack(ack_number, acked_bytes))
+            retransmit_first_unacked_packet();
+        send_outgoing_packets();
+        evaluate_block_conditions();
+        return;
+    }
+
+    bool is_duplicate = ack_number == m_send_unacknowledged && payload_size == 0
+        && !packet.has_syn() && !packet.has_fin() && m_send_window == previous_send_window && m_bytes_in_flight;
+    if (is_duplicate && m_congestion_control->on_duplicate_ack(m_highest_sequence_sent, m_bytes_in_flight)) {
+        dbgln_if(TCP_SOCKET_DEBUG, "TCPSocket: fast retransmit of {}", m_send_unacknowledged);
+        retransmit_first_unacked_packet();
+    }
+    send_outgoing_packets();
+}
+
+void TCPSocket::receive_tcp_packet(const TCPPacket& packet, u16 size)
+{
+    if (packet.has_syn() && state() == State::SynSent)
+        parse_syn_options(packet);
+
+    if (packet.has_ack()) {
+        dbgln_if(TCP_SOCKET_DEBUG, "TCPSocket: receive_tcp_packet: {}", packet.ack_number());
+        Locker locker(m_not_acked_lock);
+        process_ack(packet, size - packet.header_size());
     }
 
     m_packets_in++;
     m_bytes_in += packet.header_size() + size;
 }
 
+void TCPSocket::retransmit_if_timed_out()
+{
+    Locker locker(m_not_acked_lock);
+    if (m_not_acked.is_empty())
+        return;
+
+    auto& packet = m_not_acked.first();
+    if (packet.in_flight && TimeManagement::the().monotonic_time() - packet.tx_time < m_rto)
+        return;
+
+    if (packet.in_flight) {
+        dbgln_if(TCP_SOCKET_DEBUG, "TCPSocket({}) retransmission timeout after {} ms", this, m_rto.to_milliseconds());
+        m_congestion_control->on_retransmission_timeout(m_bytes_in_flight);
+        // Everything that was in flight is presumed lost and goes out again as the
+        // (now collapsed) window allows.
+        for (auto& unacked_packet : m_not_acked)
+            unacked_packet.in_flight = false;
+        m_bytes_in_flight = 0;
+        m_rto = Time::from_milliseconds(min(m_rto.to_milliseconds() * 2, maximum_rto_ms));
+    }
+    send_outgoing_packets();
+}
+
+void TCPSocket::process_retransmission_timers()
+{
+    NonnullRefPtrVector<TCPSocket> sockets;
+    {
+        Locker locker(sockets_by_tuple().lock(), Lock::Mode::Shared);
+        for (auto& it : sockets_by_tuple().resource())
+            sockets.append(*it.value);
+    }
+
+    for (auto& socket : sockets) {
+        Locker locker(socket.lock());
+        socket.retransmit_if_timed_out();
+    }
+}
+
+void TCPSocket::did_read_from_receive_buffer()
+{
+    // Tell the peer once a sizeable part of the window has opened up again, rather
+    // than leaving it to find out through its retransmission timer.
+    if (state() != State::Established)
+        return;
+    size_t space = receive_buffer_space();
+    if (space > m_last_advertised_window && space - m_last_advertised_window >= receive_buffer_capacity() / 4) {
+        [[maybe_unused]] auto rc = send_tcp_packet(TCPFlags::ACK);
+    }
+}
+
 NetworkOrdered<u16> TCPSocket::compute_tcp_checksum(const IPv4Address& source, const IPv4Address& destination, const TCPPacket& packet, u16 payload_size)
 {
     struct [[gnu::packed]] PseudoHeader {
@@ -306,7 +562,7 @@ NetworkOrdered<u16> TCPSocket::compute_tcp_checksum(const IPv4Address& source, c
         NetworkOrdered<u16> payload_size;
     };
 
-    PseudoHeader pseudo_header { source, destination, 0, (u8)IPv4Protocol::TCP, sizeof(TCPPacket) + payload_size };
+    PseudoHeader pseudo_header { source, destination, 0, (u8)IPv4Protocol::TCP, packet.header_size() + payload_size };
 
     u32 checksum = 0;
     auto* w = (const NetworkOrdered<u16>*)&pseudo_header;
@@ -316,12 +572,11 @@ NetworkOrdered<u16> TCPSocket::compute_tcp_checksum(const IPv4Address& source, c
             checksum = (checksum >> 16) + (checksum & 0xffff);
     }
     w = (const NetworkOrdered<u16>*)&packet;
-    for (size_t i = 0; i < sizeof(packet) / sizeof(u16); ++i) {
+    for (size_t i = 0; i < packet.header_size() / sizeof(u16); ++i) {
         checksum += w[i];
         if (checksum > 0xffff)
             checksum = (checksum >> 16) + (checksum & 0xffff);
     }
-    VERIFY(packet.data_offset() * 4 == sizeof(TCPPacket));
     w = (const NetworkOrdered<u16>*)packet.payload();
     for (size_t i = 0; i < payload_size / sizeof(u16); ++i) {
         checksum += w[i];
@@ -2,15 +2,30 @@
 
 // includes
 #include <AK/Function.h>
+#include <AK/NonnullRefPtrVector.h>
 #include <AK/HashMap.h>
 #include <AK/SinglyLinkedList.h>
 #include <AK/WeakPtr.h>
 #include <Kernel/Net/IPv4Socket.h>
+#include <Kernel/Net/TCPCongestionControl.h>
 
 namespace Kernel {
 
+struct RoutingDecision;
+
 class TCPSocket final : public IPv4Socket {
 public:
+    // RFC 879: what we may send when the peer doesn't announce a maximum segment size.
+    static constexpr u16 default_mss = 536;
+    // RFC 6298 bounds for the retransmission timeout.
+    static constexpr i64 initial_rto_ms = 1000;
+    static constexpr i64 minimum_rto_ms = 200;
+    static constexpr i64 maximum_rto_ms = 60000;
+    // How often NetworkTask checks for expired retransmission timers.
+    static constexpr i64 retransmission_timer_interval_ms = 100;
+    // Bytes that may be queued for sending before writers block.
+    static constexpr size_t send_buffer_size = 64 * KiB;
+
     static void for_each(Function<void(const TCPSocket&)>);
     static NonnullRefPtr<TCPSocket> create(int protocol);
     virtual ~TCPSocket() override;
@@ -122,10 +137,21 @@ public:
     u32 bytes_in() const { return m_bytes_in; }
     u32 packets_out() const { return m_packets_out; }
     u32 bytes_out() const { return m_bytes_out; }
+    u32 retransmissions() const { return m_retransmissions; }
+
+    u16 send_mss() const { return m_send_mss; }
+    size_t send_window() const { return m_send_window; }
+    size_t bytes_in_flight() const { return m_bytes_in_flight; }
+    i64 retransmission_timeout_ms() const { return m_rto.to_milliseconds(); }
+    Optional<i64> smoothed_rtt_us() const { return m_smoothed_rtt_us; }
+    const TCPCongestionControl& congestion_control() const { return *m_congestion_control; }
 
     KResult send_tcp_packet(u16 flags, const UserOrKernelBuffer* = nullptr, size_t = 0);
     void send_outgoing_packets();
     void receive_tcp_packet(const TCPPacket&, u16 size);
+    void parse_syn_options(const TCPPacket&);
+
+    static void process_retransmission_timers();
 
     static Lockable<HashMap<IPv4SocketTuple, TCPSocket*>>& sockets_by_tuple();
     static RefPtr<TCPSocket> from_tuple(const IPv4SocketTuple& tuple);
@@ -140,6 +166,7 @@ public:
     void release_for_accept(RefPtr<TCPSocket>);
 
     virtual KResult close() override;
+    virtual bool can_write(const FileDescription&, size_t) const override;
 
 protected:
     void set_direction(Direction direction) { m_direction = direction; }
@@ -151,6 +178,7 @@ private:
     static NetworkOrdered<u16> compute_tcp_checksum(const IPv4Address& source, const IPv4Address& destination, const TCPPacket&, u16 payload_size);
 
     virtual void shut_down_for_writing() override;
+    virtual void did_read_from_receive_buffer() override;
 
     virtual KResultOr<size_t> protocol_receive(ReadonlyBytes raw_ipv4_packet, UserOrKernelBuffer& buffer, size_t buffer_size, int flags) override;
     virtual KResultOr<size_t> protocol_send(const UserOrKernelBuffer&, size_t) override;
@@ -160,6 +188,28 @@ private:
     virtual KResult protocol_bind() override;
     virtual KResult protocol_listen() override;
 
+    struct OutgoingPacket {
+        u32 ack_number { 0 };
+        ByteBuffer buffer;
+        int tx_counter { 0 };
+        Time tx_time {};
+        bool in_flight { false };
+
+        u32 sequence_length() const;
+    };
+
+    u16 local_mss() const;
+    u16 advertised_window(bool is_syn);
+    bool is_window_scaling_enabled() const { return m_sent_window_scale && m_peer_window_scale.has_value(); }
+    size_t send_buffer_space() const { return m_bytes_queued < send_buffer_size ? send_buffer_size - m_bytes_queued : 0; }
+
+    void prepare_packet_for_transmission(ByteBuffer&);
+    void transmit_packet(RoutingDecision&, OutgoingPacket&, const Time& now);
+    void retransmit_first_unacked_packet();
+    void process_ack(const TCPPacket&, size_t payload_size);
+    void update_retransmission_timeout(const Time& round_trip_time);
+    void retransmit_if_timed_out();
+
     WeakPtr<TCPSocket> m_originator;
     HashMap<IPv4SocketTuple, NonnullRefPtr<TCPSocket>> m_pending_release_for_accept;
     Direction m_direction { Direction::Unspecified };
@@ -172,13 +222,28 @@ private:
     u32 m_bytes_in { 0 };
     u32 m_packets_out { 0 };
     u32 m_bytes_out { 0 };
-
-    struct OutgoingPacket {
-        u32 ack_number { 0 };
-        ByteBuffer buffer;
-        int tx_counter { 0 };
-        Time tx_time {};
-    };
+    u32 m_retransmissions { 0 };
+
+    // Send side: the oldest unacknowledged and the highest transmitted sequence number,
+    // the peer's receive window and what we have queued or in flight.
+    u32 m_send_unacknowledged { 0 };
+    u32 m_highest_sequence_sent { 0 };
+    u16 m_send_mss { default_mss };
+    size_t m_send_window { default_mss };
+    size_t m_bytes_queued { 0 };
+    size_t m_bytes_in_flight { 0 };
+
+    // Window scaling is only used when both SYNs carried the option.
+    Optional<u8> m_peer_window_scale;
+    u8 m_receive_window_scale { 0 };
+    bool m_sent_window_scale { false };
+    size_t m_last_advertised_window { 0 };
+
+    Optional<i64> m_smoothed_rtt_us;
+    i64 m_rtt_variance_us { 0 };
+    Time m_rto { Time::from_milliseconds(initial_rto_ms) };
+
+    NonnullOwnPtr<TCPCongestionControl> m_congestion_control;
 
     Lock m_not_acked_lock { "TCPSocket unacked packets" };
     SinglyLinkedList<OutgoingPacket> m_not_acked;
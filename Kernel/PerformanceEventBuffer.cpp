@@ -1,34 +1,42 @@
 // includes
-#include <AK/JsonArraySerializer.h>
-#include <AK/JsonObject.h>
-#include <AK/JsonObjectSerializer.h>
 #include <Kernel/Arch/x86/SmapDisabler.h>
 #include <Kernel/FileSystem/Custody.h>
 #include <Kernel/KBufferBuilder.h>
 #include <Kernel/PerformanceEventBuffer.h>
 #include <Kernel/Process.h>
+#include <Kernel/VM/MemoryManager.h>
 
 namespace Kernel {
 
-PerformanceEventBuffer::PerformanceEventBuffer(NonnullOwnPtr<KBuffer> buffer)
-    : m_buffer(move(buffer))
+static constexpr size_t max_string_length_in_record = 1024;
+static constexpr size_t min_ring_data_size = 64 * KiB;
+
+static Atomic<u32> s_next_generation { 1 };
+
+PerformanceEventBuffer::PerformanceEventBuffer(NonnullOwnPtrVector<Ring>&& rings)
+    : m_rings(move(rings))
+    , m_generation(s_next_generation.fetch_add(1, AK::MemoryOrder::memory_order_relaxed))
 {
 }
 
-KResult PerformanceEventBuffer::append(int type, FlatPtr arg1, FlatPtr arg2)
+KResult PerformanceEventBuffer::append(int type, FlatPtr arg1, FlatPtr arg2, const StringView* arg3)
 {
     FlatPtr ebp;
     asm volatile("movl %%ebp, %%eax"
                  : "=a"(ebp));
     auto current_thread = Thread::current();
     auto eip = current_thread->get_register_dump_from_stack().eip;
-    return append_with_eip_and_ebp(eip, ebp, type, arg1, arg2);
+    return append_with_eip_and_ebp(eip, ebp, type, arg1, arg2, arg3);
 }
 
-static Vector<FlatPtr, PerformanceEvent::max_stack_frame_count> raw_backtrace(FlatPtr ebp, FlatPtr eip)
+static constexpr size_t max_stack_frame_count = 32;
+
+static Vector<FlatPtr, max_stack_frame_count> raw_backtrace(FlatPtr ebp, FlatPtr eip)
 {
-    Vector<FlatPtr, PerformanceEvent::max_stack_frame_count> backtrace;
+    Vector<FlatPtr, max_stack_frame_count> backtrace;
     backtrace.append(eip);
+    if (!eip)
+        return backtrace;
     FlatPtr stack_ptr_copy;
     FlatPtr stack_ptr = (FlatPtr)ebp;
     // FIXME: Figure out how to remove this SmapDisabler without breaking profile stacks.
@@ -41,121 +49,342 @@ static Vector<FlatPtr, PerformanceEvent::max_stack_frame_count> raw_backtrace(Fl
         if (!safe_memcpy(&retaddr, (void*)(stack_ptr + sizeof(FlatPtr)), sizeof(FlatPtr), fault_at))
             break;
         backtrace.append(retaddr);
-        if (backtrace.size() == PerformanceEvent::max_stack_frame_count)
+        if (backtrace.size() == max_stack_frame_count)
             break;
         stack_ptr = stack_ptr_copy;
     }
     return backtrace;
 }
 
-KResult PerformanceEventBuffer::append_with_eip_and_ebp(u32 eip, u32 ebp, int type, FlatPtr arg1, FlatPtr arg2)
+auto PerformanceEventBuffer::current_ring() -> Ring&
 {
-    if (count() >= capacity())
-        return ENOBUFS;
+    VERIFY_INTERRUPTS_DISABLED();
+    auto cpu = Processor::id();
+    VERIFY(cpu < m_rings.size());
+    return m_rings[cpu];
+}
+
+Optional<u32> PerformanceEventBuffer::Ring::read_position() const
+{
+    // The read position comes from the consumer, so don't trust it to be sensible.
+    auto& consumer = const_cast<Ring&>(*this).consumer();
+    u32 read_position = AK::atomic_load(&consumer.read_position, AK::MemoryOrder::memory_order_acquire);
+    u32 write_position = AK::atomic_load(&this->write_position, AK::MemoryOrder::memory_order_acquire);
+    if (write_position - read_position > data_size)
+        return {};
+    return read_position;
+}
+
+void PerformanceEventBuffer::Ring::set_read_position(u32 read_position)
+{
+    AK::atomic_store(&consumer().read_position, read_position, AK::MemoryOrder::memory_order_release);
+}
+
+void PerformanceEventBuffer::Ring::publish_write_position(u32 new_write_position)
+{
+    AK::atomic_store(&write_position, new_write_position, AK::MemoryOrder::memory_order_release);
+    AK::atomic_store(&header().write_position, new_write_position, AK::MemoryOrder::memory_order_release);
+}
+
+void PerformanceEventBuffer::Ring::note_lost_record()
+{
+    ++lost_records;
+    header().lost_records = lost_records;
+}
+
+u8* PerformanceEventBuffer::reserve(Ring& ring, size_t& size)
+{
+    VERIFY_INTERRUPTS_DISABLED();
+    size = round_up_to_power_of_two(size, performance_record_alignment);
+    if (size > NumericLimits<u16>::max()) {
+        ring.note_lost_record();
+        return nullptr;
+    }
+
+    u32 data_size = ring.data_size;
+    u32 write_position = ring.write_position;
+    auto read_position = ring.read_position();
+    if (!read_position.has_value()) {
+        ring.note_lost_record();
+        return nullptr;
+    }
+    u32 used = write_position - read_position.value();
+    u32 offset = write_position & (data_size - 1);
+    u32 padding = offset + size > data_size ? data_size - offset : 0;
+    if (data_size - used < padding + size) {
+        ring.note_lost_record();
+        return nullptr;
+    }
+
+    if (padding) {
+        // Records never wrap around, fill up the rest of the ring instead.
+        auto& padding_header = *reinterpret_cast<PerformanceRecordHeader*>(ring.data() + offset);
+        padding_header.size = padding;
+        padding_header.type = PerformanceRecordType::Padding;
+        write_position += padding;
+        ring.publish_write_position(write_position);
+    }
+    return ring.data() + (write_position & (data_size - 1));
+}
+
+void PerformanceEventBuffer::commit(Ring& ring, size_t size)
+{
+    // Publish the record only once it was written completely.
+    ring.publish_write_position(static_cast<u32>(ring.write_position + size));
+}
+
+u32 PerformanceEventBuffer::stack_id_for(Ring& ring, const FlatPtr* frames, size_t frame_count)
+{
+    if (!frame_count)
+        return 0;
+
+    // FNV-1a. We trust a 64-bit hash to tell stacks apart, as comparing the frames would
+    // mean keeping them around in the cache too.
+    u64 hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < frame_count; ++i) {
+        hash ^= frames[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    auto& cached_stack = ring.stack_cache[hash % ring.stack_cache.size()];
+    if (cached_stack.id && cached_stack.hash == hash)
+        return cached_stack.id;
+
+    size_t size = sizeof(PerformanceStackRecord) + frame_count * sizeof(u64);
+    auto* record_data = reserve(ring, size);
+    if (!record_data)
+        return 0;
+    auto& record = *reinterpret_cast<PerformanceStackRecord*>(record_data);
+    record.header.size = size;
+    record.header.type = PerformanceRecordType::Stack;
+    record.stack_id = m_next_stack_id.fetch_add(1, AK::MemoryOrder::memory_order_relaxed);
+    record.frame_count = frame_count;
+    record.reserved = 0;
+    auto* record_frames = reinterpret_cast<u64*>(record_data + sizeof(PerformanceStackRecord));
+    for (size_t i = 0; i < frame_count; ++i)
+        record_frames[i] = frames[i];
+    commit(ring, size);
+
+    cached_stack.hash = hash;
+    cached_stack.id = record.stack_id;
+    return cached_stack.id;
+}
 
-    PerformanceEvent event;
-    event.type = type;
+KResult PerformanceEventBuffer::append_with_eip_and_ebp(u32 eip, u32 ebp, int type, FlatPtr arg1, FlatPtr arg2, const StringView* arg3)
+{
+    auto backtrace = raw_backtrace(ebp, eip);
+    return append_with_stack(*Thread::current(), type, arg1, arg2, arg3, backtrace.data(), backtrace.size());
+}
+
+KResult PerformanceEventBuffer::append_sample(Thread& thread, const RegisterState& regs)
+{
+    Vector<FlatPtr, max_stack_frame_count * 2> frames;
+    for (auto frame : raw_backtrace(regs.ebp, regs.eip))
+        frames.append(frame);
 
+    bool interrupted_in_kernel = (regs.cs & 3) == 0;
+    if (interrupted_in_kernel && thread.process().is_user_process()) {
+        // The registers userspace entered the kernel with are at the top of the kernel stack.
+        auto& user_regs = thread.get_register_dump_from_stack();
+        if ((user_regs.cs & 3) != 0) {
+            for (auto frame : raw_backtrace(user_regs.ebp, user_regs.eip))
+                frames.append(frame);
+        }
+    }
+    return append_with_stack(thread, PERF_EVENT_SAMPLE, 0, 0, nullptr, frames.data(), frames.size());
+}
+
+KResult PerformanceEventBuffer::append_with_stack(Thread& thread, int type, FlatPtr arg1, FlatPtr arg2, const StringView* arg3, const FlatPtr* frames, size_t frame_count)
+{
+    u16 arg_count = 0;
     switch (type) {
     case PERF_EVENT_SAMPLE:
-        break;
-    case PERF_EVENT_MALLOC:
-        event.data.malloc.size = arg1;
-        event.data.malloc.ptr = arg2;
+    case PERF_EVENT_THREAD_EXIT:
         break;
     case PERF_EVENT_FREE:
-        event.data.free.ptr = arg1;
+    case PERF_EVENT_THREAD_CREATE:
+        arg_count = 1;
+        break;
+    case PERF_EVENT_MALLOC:
+        arg_count = 2;
         break;
     default:
         return EINVAL;
     }
 
-    auto backtrace = raw_backtrace(ebp, eip);
-    event.stack_size = min(sizeof(event.stack) / sizeof(FlatPtr), static_cast<size_t>(backtrace.size()));
-    memcpy(event.stack, backtrace.data(), event.stack_size * sizeof(FlatPtr));
+    size_t string_length = arg3 ? min(arg3->length(), max_string_length_in_record) : 0;
+
+    InterruptDisabler disabler;
+    auto& ring = current_ring();
+    auto stack_id = stack_id_for(ring, frames, frame_count);
+
+    size_t size = sizeof(PerformanceEventRecord) + arg_count * sizeof(u64) + string_length;
+    auto* record_data = reserve(ring, size);
+    if (!record_data)
+        return ENOBUFS;
+    auto& record = *reinterpret_cast<PerformanceEventRecord*>(record_data);
+    record.header.size = size;
+    record.header.type = static_cast<PerformanceRecordType>(type);
+    record.pid = thread.pid().value();
+    record.tid = thread.tid().value();
+    record.stack_id = stack_id;
+    record.timestamp = TimeManagement::the().monotonic_time().to_nanoseconds();
+    record.arg_count = arg_count;
+    record.string_length = string_length;
+    record.reserved = 0;
+
+    auto* args = reinterpret_cast<u64*>(record_data + sizeof(PerformanceEventRecord));
+    FlatPtr arg_values[] = { arg1, arg2 };
+    for (size_t i = 0; i < arg_count; ++i)
+        args[i] = arg_values[i];
+    if (string_length)
+        memcpy(args + arg_count, arg3->characters_without_null_termination(), string_length);
 
-    event.tid = Thread::current()->tid().value();
-    event.timestamp = TimeManagement::the().uptime_ms();
-    at(m_count++) = event;
+    commit(ring, size);
     return KSuccess;
 }
 
-PerformanceEvent& PerformanceEventBuffer::at(size_t index)
+void PerformanceEventBuffer::clear()
 {
-    VERIFY(index < capacity());
-    auto* events = reinterpret_cast<PerformanceEvent*>(m_buffer->data());
-    return events[index];
+    InterruptDisabler disabler;
+    for (auto& ring : m_rings) {
+        ring.set_read_position(ring.write_position);
+        ring.lost_records = 0;
+        ring.header().lost_records = 0;
+        ring.stack_cache.fill({});
+    }
+    m_generation = s_next_generation.fetch_add(1, AK::MemoryOrder::memory_order_relaxed);
 }
 
-template<typename Serializer>
-bool PerformanceEventBuffer::to_json_impl(Serializer& object) const
+bool PerformanceEventBuffer::to_binary(KBufferBuilder& builder) const
 {
-    auto array = object.add_array("events");
-    for (size_t i = 0; i < m_count; ++i) {
-        auto& event = at(i);
-        auto event_object = array.add_object();
-        switch (event.type) {
-        case PERF_EVENT_SAMPLE:
-            event_object.add("type", "sample");
-            break;
-        case PERF_EVENT_MALLOC:
-            event_object.add("type", "malloc");
-            event_object.add("ptr", static_cast<u64>(event.data.malloc.ptr));
-            event_object.add("size", static_cast<u64>(event.data.malloc.size));
-            break;
-        case PERF_EVENT_FREE:
-            event_object.add("type", "free");
-            event_object.add("ptr", static_cast<u64>(event.data.free.ptr));
-            break;
-        }
-        event_object.add("tid", event.tid);
-        event_object.add("timestamp", event.timestamp);
-        auto stack_array = event_object.add_array("stack");
-        for (size_t j = 0; j < event.stack_size; ++j) {
-            stack_array.add(event.stack[j]);
-        }
-        stack_array.finish();
-        event_object.finish();
+    PerformanceFileHeader file_header {
+        .magic = performance_file_magic,
+        .version = performance_file_version,
+        .cpu_count = static_cast<u32>(m_rings.size()),
+        .reserved = 0,
+    };
+    builder.append_bytes({ &file_header, sizeof(file_header) });
+
+    for (size_t cpu = 0; cpu < m_rings.size(); ++cpu) {
+        auto& ring = m_rings[cpu];
+        u32 data_size = ring.data_size;
+        u32 write_position = AK::atomic_load(&ring.write_position, AK::MemoryOrder::memory_order_acquire);
+        // If the consumer messed up its read position, there is nothing sensible we can dump.
+        u32 read_position = ring.read_position().value_or(write_position);
+        u32 byte_count = write_position - read_position;
+
+        PerformanceFileCPUHeader cpu_header {
+            .cpu = static_cast<u32>(cpu),
+            .byte_count = byte_count,
+            .lost_records = ring.lost_records,
+            .reserved = 0,
+        };
+        builder.append_bytes({ &cpu_header, sizeof(cpu_header) });
+
+        u32 offset = read_position & (data_size - 1);
+        u32 first_chunk_size = min(byte_count, data_size - offset);
+        builder.append_bytes({ ring.data() + offset, first_chunk_size });
+        if (first_chunk_size < byte_count)
+            builder.append_bytes({ ring.data(), byte_count - first_chunk_size });
     }
-    array.finish();
-    object.finish();
     return true;
 }
 
-bool PerformanceEventBuffer::to_json(KBufferBuilder& builder) const
+RefPtr<AnonymousVMObject> PerformanceEventBuffer::ring_vmobject(u32 cpu) const
 {
-    JsonObjectSerializer object(builder);
+    if (cpu >= m_rings.size())
+        return nullptr;
+    return m_rings[cpu].vmobject;
+}
 
-    auto processes_array = object.add_array("processes");
-    for (auto& it : m_processes) {
-        auto& process = *it.value;
-        auto process_object = processes_array.add_object();
-        process_object.add("pid", process.pid.value());
-        process_object.add("executable", process.executable);
+KResultOr<Region*> PerformanceEventBuffer::map_ring(Process& process, NonnullRefPtr<AnonymousVMObject> vmobject)
+{
+    auto& space = process.space();
 
-        auto regions_array = process_object.add_array("regions");
-        for (auto& region : process.regions) {
-            auto region_object = regions_array.add_object();
-            region_object.add("name", region.name);
-            region_object.add("base", region.range.base().get());
-            region_object.add("size", region.range.size());
+    // The regions aren't mmap regions, so they can't be unmapped. Hand out the same
+    // mapping every time instead of using up more address space.
+    {
+        ScopedSpinLock lock(space.get_lock());
+        for (auto& region : space.regions()) {
+            if (&region->vmobject() == vmobject.ptr() && region->offset_in_vmobject() == 0)
+                return region.ptr();
         }
     }
 
-    processes_array.finish();
+    auto range = space.allocate_range({}, vmobject->size());
+    if (!range.has_value())
+        return ENOMEM;
+
+    // Only the consumer page is writable. Since these aren't mmap regions, their
+    // protection can't be changed with mprotect() afterwards either.
+    struct Part {
+        size_t offset;
+        size_t size;
+        int prot;
+    };
+    Part parts[] = {
+        { 0, ring_consumer_offset, PROT_READ },
+        { ring_consumer_offset, ring_data_offset - ring_consumer_offset, PROT_READ | PROT_WRITE },
+        { ring_data_offset, vmobject->size() - ring_data_offset, PROT_READ },
+    };
+    auto part_range = [&](const Part& part) {
+        return Range { range.value().base().offset(part.offset), part.size };
+    };
 
-    return to_json_impl(object);
+    Region* header_region = nullptr;
+    for (auto& part : parts) {
+        auto region_or_error = space.allocate_region_with_vmobject(part_range(part), vmobject, part.offset, "Performance events", part.prot, true);
+        if (region_or_error.is_error()) {
+            // A region gives its range back when it goes away, even if it couldn't be
+            // mapped. The ranges of the parts we didn't get to have to be released here.
+            for (auto& part_to_release : parts) {
+                if (auto* region = space.find_region_from_range(part_range(part_to_release)))
+                    space.deallocate_region(*region);
+                else
+                    space.page_directory().range_allocator().deallocate(part_range(part_to_release));
+            }
+            return region_or_error.error();
+        }
+        if (!header_region)
+            header_region = region_or_error.value();
+    }
+    return header_region;
 }
 
 OwnPtr<PerformanceEventBuffer> PerformanceEventBuffer::try_create_with_size(size_t buffer_size)
 {
-    auto buffer = KBuffer::try_create_with_size(buffer_size, Region::Access::Read | Region::Access::Write, "Performance events", AllocationStrategy::AllocateNow);
-    if (!buffer)
-        return {};
-    return adopt_own(*new PerformanceEventBuffer(buffer.release_nonnull()));
+    size_t cpu_count = max(Processor::count(), 1u);
+    // Positions are taken modulo the data size, so it has to be a power of two.
+    size_t data_size = min_ring_data_size;
+    while (data_size * 2 <= buffer_size / cpu_count)
+        data_size *= 2;
+
+    NonnullOwnPtrVector<Ring> rings;
+    for (size_t cpu = 0; cpu < cpu_count; ++cpu) {
+        auto vmobject = AnonymousVMObject::create_with_size(ring_data_offset + data_size, AllocationStrategy::AllocateNow);
+        if (!vmobject)
+            return {};
+        auto region = MM.allocate_kernel_region_with_vmobject(*vmobject, vmobject->size(), "Performance events", Region::Access::Read | Region::Access::Write);
+        if (!region)
+            return {};
+        auto ring = adopt_own(*new Ring { vmobject.release_nonnull(), region.release_nonnull() });
+        ring->data_size = data_size;
+        auto& header = ring->header();
+        header.magic = performance_ring_magic;
+        header.cpu = cpu;
+        header.data_size = data_size;
+        header.data_offset = ring_data_offset;
+        header.consumer_offset = ring_consumer_offset;
+        header.write_position = 0;
+        header.lost_records = 0;
+        ring->set_read_position(0);
+        rings.append(move(ring));
+    }
+    return adopt_own(*new PerformanceEventBuffer(move(rings)));
 }
 
-void PerformanceEventBuffer::add_process(const Process& process)
+void PerformanceEventBuffer::add_process(const Process& process, ProcessEventType event_type)
 {
     // FIXME: What about threads that have died?
 
@@ -165,25 +394,40 @@ void PerformanceEventBuffer::add_process(const Process& process)
     if (process.executable())
         executable = process.executable()->absolute_path();
 
-    auto sampled_process = adopt_own(*new SampledProcess {
-        .pid = process.pid().value(),
-        .executable = executable,
-        .threads = {},
-        .regions = {},
-    });
-    process.for_each_thread([&](auto& thread) {
-        sampled_process->threads.set(thread.tid());
-        return IterationDecision::Continue;
-    });
+    auto& ring = current_ring();
+
+    size_t executable_length = min(executable.length(), max_string_length_in_record);
+    size_t size = sizeof(PerformanceProcessRecord) + executable_length;
+    auto* record_data = reserve(ring, size);
+    if (!record_data)
+        return;
+    auto& record = *reinterpret_cast<PerformanceProcessRecord*>(record_data);
+    record.header.size = size;
+    record.header.type = PerformanceRecordType::Process;
+    record.pid = process.pid().value();
+    record.event_type = event_type;
+    record.executable_length = executable_length;
+    if (executable_length)
+        memcpy(record_data + sizeof(PerformanceProcessRecord), executable.characters(), executable_length);
+    commit(ring, size);
 
     for (auto& region : process.space().regions()) {
-        sampled_process->regions.append(SampledProcess::Region {
-            .name = region.name(),
-            .range = region.range(),
-        });
+        size_t name_length = min(region->name().length(), max_string_length_in_record);
+        size_t region_record_size = sizeof(PerformanceRegionRecord) + name_length;
+        auto* region_record_data = reserve(ring, region_record_size);
+        if (!region_record_data)
+            return;
+        auto& region_record = *reinterpret_cast<PerformanceRegionRecord*>(region_record_data);
+        region_record.header.size = region_record_size;
+        region_record.header.type = PerformanceRecordType::Region;
+        region_record.pid = process.pid().value();
+        region_record.base = region->vaddr().get();
+        region_record.size = region->size();
+        region_record.name_length = name_length;
+        if (name_length)
+            memcpy(region_record_data + sizeof(PerformanceRegionRecord), region->name().characters(), name_length);
+        commit(ring, region_record_size);
     }
-
-    m_processes.set(process.pid(), move(sampled_process));
 }
 
 }
@@ -1,82 +1,99 @@
 #pragma once
 
-#include <Kernel/KBuffer.h>
+#include <AK/Array.h>
+#include <AK/Atomic.h>
+#include <AK/NonnullOwnPtrVector.h>
+#include <AK/Optional.h>
+#include <Kernel/API/PerformanceEventRecord.h>
 #include <Kernel/KResult.h>
+#include <Kernel/VM/AnonymousVMObject.h>
+#include <Kernel/VM/Region.h>
 
 namespace Kernel {
 
 class KBufferBuilder;
 
-struct [[gnu::packed]] MallocPerformanceEvent {
-    size_t size;
-    FlatPtr ptr;
-};
-
-struct [[gnu::packed]] FreePerformanceEvent {
-    size_t size;
-    FlatPtr ptr;
-};
-
-struct [[gnu::packed]] PerformanceEvent {
-    u8 type { 0 };
-    u8 stack_size { 0 };
-    u32 tid { 0 };
-    u64 timestamp;
-    union {
-        MallocPerformanceEvent malloc;
-        FreePerformanceEvent free;
-    } data;
-    static constexpr size_t max_stack_frame_count = 32;
-    FlatPtr stack[max_stack_frame_count];
-};
+using ProcessEventType = PerformanceProcessEventType;
 
+// Collects performance events as variable-length records, see API/PerformanceEventRecord.h.
+// There is one ring per CPU, and a ring is only ever appended to by its own CPU with
+// interrupts disabled, so appending doesn't take any locks. Stacks are written out once
+// per ring and then referred to by id. The rings can be mapped into a process, which can
+// then drain them while profiling is still running.
 class PerformanceEventBuffer {
 public:
     static OwnPtr<PerformanceEventBuffer> try_create_with_size(size_t buffer_size);
 
-    KResult append(int type, FlatPtr arg1, FlatPtr arg2);
-    KResult append_with_eip_and_ebp(u32 eip, u32 ebp, int type, FlatPtr arg1, FlatPtr arg2);
+    KResult append(int type, FlatPtr arg1, FlatPtr arg2, const StringView* arg3);
+    KResult append_with_eip_and_ebp(u32 eip, u32 ebp, int type, FlatPtr arg1, FlatPtr arg2, const StringView* arg3);
+    // Records a sample of the given thread, which was interrupted with the given registers.
+    // If it was interrupted in the kernel on behalf of userspace, the user stack is recorded as well.
+    KResult append_sample(Thread&, const RegisterState&);
 
-    void clear()
-    {
-        m_count = 0;
-    }
+    void clear();
 
-    size_t capacity() const { return m_buffer->size() / sizeof(PerformanceEvent); }
-    size_t count() const { return m_count; }
-    const PerformanceEvent& at(size_t index) const
-    {
-        return const_cast<PerformanceEventBuffer&>(*this).at(index);
-    }
+    // Changes whenever the buffer is cleared, so the process layouts have to be added again.
+    u32 generation() const { return m_generation; }
 
-    bool to_json(KBufferBuilder&) const;
+    bool to_binary(KBufferBuilder&) const;
 
-    void add_process(const Process&);
+    void add_process(const Process&, ProcessEventType);
 
-private:
-    explicit PerformanceEventBuffer(NonnullOwnPtr<KBuffer>);
-
-    struct SampledProcess {
-        ProcessID pid;
-        String executable;
-        HashTable<ThreadID> threads;
+    size_t ring_count() const { return m_rings.size(); }
+    // Returns the memory behind the given CPU's ring, or nullptr if there is no such CPU.
+    // It outlives the buffer as long as someone holds on to it.
+    RefPtr<AnonymousVMObject> ring_vmobject(u32 cpu) const;
+    // Maps a ring into the process, and returns the region of its header. If the ring is
+    // already mapped there, the existing mapping is returned. This doesn't need the buffer,
+    // so it's safe to call after the buffer has been freed.
+    static KResultOr<Region*> map_ring(Process&, NonnullRefPtr<AnonymousVMObject>);
 
-        struct Region {
-            String name;
-            Range range;
+private:
+    static constexpr size_t ring_consumer_offset = PAGE_SIZE;
+    static constexpr size_t ring_data_offset = 2 * PAGE_SIZE;
+
+    struct Ring {
+        NonnullRefPtr<AnonymousVMObject> vmobject;
+        NonnullOwnPtr<Region> region;
+
+        // The kernel's own copies of what the header shows to consumers. Consumers can't
+        // write to the header, but all we trust from them is the checked read position.
+        u32 data_size { 0 };
+        u32 write_position { 0 };
+        u32 lost_records { 0 };
+
+        struct CachedStack {
+            u64 hash { 0 };
+            u32 id { 0 };
         };
-        Vector<Region> regions;
+        // Stacks that were already written to this ring, indexed by their hash.
+        Array<CachedStack, 256> stack_cache {};
+
+        PerformanceEventRingHeader& header() { return *reinterpret_cast<PerformanceEventRingHeader*>(region->vaddr().as_ptr()); }
+        PerformanceEventRingConsumer& consumer() { return *reinterpret_cast<PerformanceEventRingConsumer*>(region->vaddr().offset(ring_consumer_offset).as_ptr()); }
+        u8* data() { return region->vaddr().offset(ring_data_offset).as_ptr(); }
+        const u8* data() const { return const_cast<Ring&>(*this).data(); }
+
+        // Returns the consumer's read position, or an empty Optional if it doesn't
+        // point into the records that are currently in the ring.
+        Optional<u32> read_position() const;
+        void set_read_position(u32);
+        void publish_write_position(u32);
+        void note_lost_record();
     };
 
-    template<typename Serializer>
-    bool to_json_impl(Serializer&) const;
-
-    PerformanceEvent& at(size_t index);
+    PerformanceEventBuffer(NonnullOwnPtrVector<Ring>&&);
 
-    size_t m_count { 0 };
-    NonnullOwnPtr<KBuffer> m_buffer;
+    Ring& current_ring();
+    // Returns space for a record of the given size, or nullptr if the ring is full.
+    u8* reserve(Ring&, size_t& size);
+    void commit(Ring&, size_t size);
+    u32 stack_id_for(Ring&, const FlatPtr* frames, size_t frame_count);
+    KResult append_with_stack(Thread&, int type, FlatPtr arg1, FlatPtr arg2, const StringView* arg3, const FlatPtr* frames, size_t frame_count);
 
-    HashMap<ProcessID, NonnullOwnPtr<SampledProcess>> m_processes;
+    NonnullOwnPtrVector<Ring> m_rings;
+    Atomic<u32> m_next_stack_id { 1 };
+    u32 m_generation { 0 };
 };
 
 }
@@ -35,6 +35,7 @@ static void create_signal_trampoline();
 RecursiveSpinLock g_processes_lock;
 static Atomic<pid_t> next_pid;
 READONLY_AFTER_INIT InlineLinkedList<Process>* g_processes;
+READONLY_AFTER_INIT static HashMap<ProcessID, Process*>* s_pid_map;
 READONLY_AFTER_INIT String* g_hostname;
 READONLY_AFTER_INIT Lock* g_hostname_lock;
 READONLY_AFTER_INIT HashMap<String, OwnPtr<Module>>* g_modules;
@@ -56,7 +57,8 @@ UNMAP_AFTER_INIT void Process::initialize()
 
     next_pid.store(0, AK::MemoryOrder::memory_order_release);
     g_processes = new InlineLinkedList<Process>;
-    g_process_groups = new InlineLinkedList<ProcessGroup>;
+    s_pid_map = new HashMap<ProcessID, Process*>;
+    g_process_groups = new HashMap<ProcessGroupID, ProcessGroup*>;
     g_hostname = new String("courage");
     g_hostname_lock = new Lock;
 
@@ -67,20 +69,44 @@ Vector<ProcessID> Process::all_pids()
 {
     Vector<ProcessID> pids;
     ScopedSpinLock lock(g_processes_lock);
-    pids.ensure_capacity((int)g_processes->size_slow());
-    for (auto& process : *g_processes)
-        pids.append(process.pid());
+    pids.ensure_capacity(s_pid_map->size());
+    for (auto& it : *s_pid_map)
+        pids.append(it.key);
     return pids;
 }
 
-NonnullRefPtrVector<Process> Process::all_processes()
+void Process::register_new(Process& process)
 {
-    NonnullRefPtrVector<Process> processes;
     ScopedSpinLock lock(g_processes_lock);
-    processes.ensure_capacity((int)g_processes->size_slow());
-    for (auto& process : *g_processes)
-        processes.append(NonnullRefPtr<Process>(process));
-    return processes;
+    g_processes->prepend(&process);
+    s_pid_map->set(process.pid(), &process);
+    if (auto parent = s_pid_map->get(process.ppid()); parent.has_value())
+        parent.value()->m_children.append(process);
+}
+
+void Process::set_process_group(RefPtr<ProcessGroup> process_group)
+{
+    // Declared before the lock, so we let go of the previous group after unlocking.
+    RefPtr<ProcessGroup> previous_process_group;
+    ScopedSpinLock lock(g_processes_lock);
+    if (m_pg)
+        m_pg->remove_member(m_process_group_member);
+    previous_process_group = move(m_pg);
+    m_pg = move(process_group);
+    if (m_pg)
+        m_pg->add_member(m_process_group_member);
+}
+
+void Process::reparent(Process* new_parent)
+{
+    // Unprotecting our data goes through the MM, so do it before taking g_processes_lock.
+    ProtectedDataMutationScope scope(*this);
+    ScopedSpinLock lock(g_processes_lock);
+    if (m_child_list_node.is_in_list())
+        m_child_list_node.remove();
+    m_ppid = new_parent ? new_parent->pid() : 0;
+    if (new_parent)
+        new_parent->m_children.append(*this);
 }
 
 bool Process::in_group(gid_t gid) const
@@ -141,12 +167,11 @@ RefPtr<Process> Process::create_user_process(RefPtr<Thread>& first_thread, const
     auto process = adopt(*new Process(first_thread, parts.take_last(), uid, gid, parent_pid, false, move(cwd), nullptr, tty));
     if (!first_thread)
         return {};
-    process->m_fds.resize(m_max_open_file_descriptors);
     auto& device_to_use_as_tty = tty ? (CharacterDevice&)*tty : NullDevice::the();
     auto description = device_to_use_as_tty.open(O_RDWR).value();
-    process->m_fds[0].set(*description);
-    process->m_fds[1].set(*description);
-    process->m_fds[2].set(*description);
+    process->m_fds.set(0, *description);
+    process->m_fds.set(1, *description);
+    process->m_fds.set(2, *description);
 
     error = process->exec(path, move(arguments), move(environment));
     if (error != 0) {
@@ -155,11 +180,8 @@ RefPtr<Process> Process::create_user_process(RefPtr<Thread>& first_thread, const
         return {};
     }
 
-    {
-        ScopedSpinLock lock(g_processes_lock);
-        g_processes->prepend(process);
-        process->ref();
-    }
+    register_new(*process);
+    process->ref();
     error = 0;
     return process;
 }
@@ -173,8 +195,7 @@ RefPtr<Process> Process::create_kernel_process(RefPtr<Thread>& first_thread, Str
     first_thread->tss().esp = FlatPtr(entry_data); // entry function argument is expected to be in tss.esp
 
     if (process->pid() != 0) {
-        ScopedSpinLock lock(g_processes_lock);
-        g_processes->prepend(process);
+        register_new(*process);
         process->ref();
     }
 
@@ -239,8 +260,19 @@ Process::~Process()
 
     {
         ScopedSpinLock processses_lock(g_processes_lock);
-        if (prev() || next())
+        if (prev() || next() || g_processes->head() == this)
             g_processes->remove(this);
+        if (auto it = s_pid_map->find(pid()); it != s_pid_map->end() && it->value == this)
+            s_pid_map->remove(it);
+        if (m_child_list_node.is_in_list())
+            m_child_list_node.remove();
+        if (m_tracee_list_node.is_in_list())
+            m_tracee_list_node.remove();
+        // Our children and tracees outlive us as orphans.
+        m_children.clear();
+        m_tracees.clear();
+        if (m_pg)
+            m_pg->remove_member(m_process_group_member);
     }
 }
 
@@ -329,49 +361,30 @@ void Process::crash(int signal, u32 eip, bool out_of_memory)
 RefPtr<Process> Process::from_pid(ProcessID pid)
 {
     ScopedSpinLock lock(g_processes_lock);
-    for (auto& process : *g_processes) {
-        process.pid();
-        if (process.pid() == pid)
-            return &process;
-    }
-    return {};
+    auto process = s_pid_map->get(pid);
+    if (!process.has_value())
+        return {};
+    return process.value();
 }
 
 RefPtr<FileDescription> Process::file_description(int fd) const
 {
-    if (fd < 0)
-        return nullptr;
-    if (static_cast<size_t>(fd) < m_fds.size())
-        return m_fds[fd].description();
-    return nullptr;
+    return m_fds.description(fd);
 }
 
 int Process::fd_flags(int fd) const
 {
-    if (fd < 0)
-        return -1;
-    if (static_cast<size_t>(fd) < m_fds.size())
-        return m_fds[fd].flags();
-    return -1;
+    return m_fds.flags(fd);
 }
 
 int Process::number_of_open_file_descriptors() const
 {
-    int count = 0;
-    for (auto& description : m_fds) {
-        if (description)
-            ++count;
-    }
-    return count;
+    return m_fds.open_count();
 }
 
 int Process::alloc_fd(int first_candidate_fd)
 {
-    for (int i = first_candidate_fd; i < (int)m_max_open_file_descriptors; ++i) {
-        if (!m_fds[i])
-            return i;
-    }
-    return -EMFILE;
+    return m_fds.allocate(first_candidate_fd);
 }
 
 Time kgettimeofday()
@@ -442,14 +455,14 @@ bool Process::dump_perfcore()
         return false;
     auto& description = description_or_error.value();
     KBufferBuilder builder;
-    if (!m_perf_event_buffer->to_json(builder))
+    if (!m_perf_event_buffer->to_binary(builder))
         return false;
 
-    auto json = builder.build();
-    if (!json)
+    auto perfcore = builder.build();
+    if (!perfcore)
         return false;
-    auto json_buffer = UserOrKernelBuffer::for_kernel_buffer(json->data());
-    return !description->write(json_buffer, json->size()).is_error();
+    auto perfcore_buffer = UserOrKernelBuffer::for_kernel_buffer(perfcore->data());
+    return !description->write(perfcore_buffer, perfcore->size()).is_error();
 }
 
 void Process::finalize()
@@ -466,10 +479,11 @@ void Process::finalize()
     }
 
     m_threads_for_coredump.clear();
+    release_vfork_parent();
 
     if (m_alarm_timer)
         TimerQueue::the().cancel_timer(m_alarm_timer.release_nonnull());
-    m_fds.clear();
+    m_fds.clear_all();
     m_tty = nullptr;
     m_executable = nullptr;
     m_cwd = nullptr;
@@ -523,6 +537,9 @@ void Process::unblock_waiters(Thread::WaitBlocker::UnblockFlags flags, u8 signal
 
 void Process::die()
 {
+    // A parent waiting in vfork() can have its memory back; we won't run on it anymore.
+    release_vfork_parent();
+
     // Let go of the TTY, otherwise a slave PTY may keep the master PTY from
     // getting an EOF when the last process using the slave PTY dies.
     // If the master PTY owner relies on an EOF to know when to wait() on a
@@ -536,17 +553,13 @@ void Process::die()
 
     {
         ScopedSpinLock lock(g_processes_lock);
-        for (auto* process = g_processes->head(); process;) {
-            auto* next_process = process->next();
-            if (process->has_tracee_thread(pid())) {
-                dbgln_if(PROCESS_DEBUG, "Process {} ({}) is attached by {} ({}) which will exit", process->name(), process->pid(), name(), pid());
-                process->stop_tracing();
-                auto err = process->send_signal(SIGSTOP, this);
-                if (err.is_error())
-                    dbgln("Failed to send the SIGSTOP signal to {} ({})", process->name(), process->pid());
-            }
-
-            process = next_process;
+        // stop_tracing() takes the process off our list of tracees.
+        while (auto* process = m_tracees.first()) {
+            dbgln_if(PROCESS_DEBUG, "Process {} ({}) is attached by {} ({}) which will exit", process->name(), process->pid(), name(), pid());
+            process->stop_tracing();
+            auto err = process->send_signal(SIGSTOP, this);
+            if (err.is_error())
+                dbgln("Failed to send the SIGSTOP signal to {} ({})", process->name(), process->pid());
         }
     }
 
@@ -613,18 +626,6 @@ RefPtr<Thread> Process::create_kernel_thread(void (*entry)(void*), void* entry_d
     return thread;
 }
 
-void Process::FileDescriptionAndFlags::clear()
-{
-    m_description = nullptr;
-    m_flags = 0;
-}
-
-void Process::FileDescriptionAndFlags::set(NonnullRefPtr<FileDescription>&& description, u32 flags)
-{
-    m_description = move(description);
-    m_flags = flags;
-}
-
 Custody& Process::root_directory()
 {
     if (!m_root_directory)
@@ -651,11 +652,17 @@ void Process::set_tty(TTY* tty)
 
 void Process::start_tracing_from(ProcessID tracer)
 {
+    ScopedSpinLock lock(g_processes_lock);
     m_tracer = ThreadTracer::create(tracer);
+    if (auto tracer_process = s_pid_map->get(tracer); tracer_process.has_value())
+        tracer_process.value()->m_tracees.append(*this);
 }
 
 void Process::stop_tracing()
 {
+    ScopedSpinLock lock(g_processes_lock);
+    if (m_tracee_list_node.is_in_list())
+        m_tracee_list_node.remove();
     m_tracer = nullptr;
 }
 
@@ -670,11 +677,28 @@ bool Process::create_perf_events_buffer_if_needed()
 {
     if (!m_perf_event_buffer) {
         m_perf_event_buffer = PerformanceEventBuffer::try_create_with_size(4 * MiB);
-        m_perf_event_buffer->add_process(*this);
+        if (m_perf_event_buffer)
+            m_perf_event_buffer->add_process(*this, ProcessEventType::Create);
     }
     return !!m_perf_event_buffer;
 }
 
+void Process::delete_perf_events_buffer()
+{
+    m_perf_event_buffer = nullptr;
+}
+
+PerformanceEventBuffer* Process::current_perf_events_buffer()
+{
+    extern bool g_profiling_all_threads;
+    extern PerformanceEventBuffer* g_global_perf_events;
+    if (g_profiling_all_threads)
+        return g_global_perf_events;
+    if (is_profiling())
+        return m_perf_event_buffer;
+    return nullptr;
+}
+
 bool Process::remove_thread(Thread& thread)
 {
     ProtectedDataMutationScope scope { *this };
@@ -4,6 +4,7 @@
 #include <AK/Checked.h>
 #include <AK/HashMap.h>
 #include <AK/InlineLinkedList.h>
+#include <AK/IntrusiveList.h>
 #include <AK/NonnullOwnPtrVector.h>
 #include <AK/NonnullRefPtrVector.h>
 #include <AK/String.h>
@@ -11,6 +12,7 @@
 #include <AK/WeakPtr.h>
 #include <AK/Weakable.h>
 #include <Kernel/API/Syscall.h>
+#include <Kernel/FileSystem/FileDescriptionTable.h>
 #include <Kernel/FileSystem/InodeMetadata.h>
 #include <Kernel/Forward.h>
 #include <Kernel/FutexQueue.h>
@@ -24,6 +26,7 @@
 #include <Kernel/VM/AllocationStrategy.h>
 #include <Kernel/VM/RangeAllocator.h>
 #include <Kernel/VM/Space.h>
+#include <Kernel/WaitQueue.h>
 #include <LibC/signal_numbers.h>
 #include <LibELF/exec_elf.h>
 
@@ -162,7 +165,6 @@ public:
     ~Process();
 
     static Vector<ProcessID> all_pids();
-    static NonnullRefPtrVector<Process> all_processes();
 
     template<typename EntryFunction>
     RefPtr<Thread> create_kernel_thread(EntryFunction entry, u32 priority, const String& name, u32 affinity = THREAD_AFFINITY_DEFAULT, bool joinable = true)
@@ -217,6 +219,7 @@ public:
 
     RefPtr<FileDescription> file_description(int fd) const;
     int fd_flags(int fd) const;
+    const FileDescriptionTable& fds() const { return m_fds; }
 
     template<typename Callback>
     static void for_each(Callback);
@@ -289,6 +292,10 @@ public:
     KResultOr<int> sys$purge(int mode);
     KResultOr<int> sys$select(Userspace<const Syscall::SC_select_params*>);
     KResultOr<int> sys$poll(Userspace<const Syscall::SC_poll_params*>);
+    KResultOr<int> sys$epoll_create(int flags);
+    KResultOr<int> sys$epoll_ctl(Userspace<const Syscall::SC_epoll_ctl_params*>);
+    KResultOr<int> sys$epoll_wait(Userspace<const Syscall::SC_epoll_wait_params*>);
+    KResultOr<ssize_t> sys$sendfile(Userspace<const Syscall::SC_sendfile_params*>);
     KResultOr<ssize_t> sys$get_dir_entries(int fd, Userspace<void*>, ssize_t);
     KResultOr<int> sys$getcwd(Userspace<char*>, size_t);
     KResultOr<int> sys$chdir(Userspace<const char*>, size_t);
@@ -305,6 +312,7 @@ public:
     KResultOr<int> sys$ttyname(int fd, Userspace<char*>, size_t);
     KResultOr<int> sys$ptsname(int fd, Userspace<char*>, size_t);
     KResultOr<pid_t> sys$fork(RegisterState&);
+    KResultOr<pid_t> sys$vfork(RegisterState&);
     KResultOr<int> sys$execve(Userspace<const Syscall::SC_execve_params*>);
     KResultOr<int> sys$dup2(int old_fd, int new_fd);
     KResultOr<int> sys$sigaction(int signum, Userspace<const sigaction*> act, Userspace<sigaction*> old_act);
@@ -369,6 +377,9 @@ public:
     KResultOr<int> sys$module_unload(Userspace<const char*> name, size_t name_length);
     KResultOr<int> sys$profiling_enable(pid_t);
     KResultOr<int> sys$profiling_disable(pid_t);
+    KResultOr<int> sys$profiling_free_buffer(pid_t);
+    KResultOr<FlatPtr> sys$profiling_map_buffer(pid_t, u32 cpu);
+    KResultOr<int> sys$profiling_configure(u32 sample_frequency, u32 flags);
     KResultOr<int> sys$futex(Userspace<const Syscall::SC_futex_params*>);
     KResultOr<int> sys$chroot(Userspace<const char*> path, size_t path_length, int mount_flags);
     KResultOr<int> sys$pledge(Userspace<const Syscall::SC_pledge_params*>);
@@ -474,6 +485,8 @@ public:
     const NonnullRefPtrVector<Thread>& threads_for_coredump(Badge<CoreDump>) const { return m_threads_for_coredump; }
 
     PerformanceEventBuffer* perf_events() { return m_perf_event_buffer; }
+    // The buffer events of this process should currently go to, if any.
+    PerformanceEventBuffer* current_perf_events_buffer();
 
     Space& space() { return *m_space; }
     const Space& space() const { return *m_space; }
@@ -482,6 +495,7 @@ public:
 
 private:
     friend class MemoryManager;
+    friend class SamplingProfiler;
     friend class Scheduler;
     friend class Region;
 
@@ -496,6 +510,15 @@ private:
     bool dump_core();
     bool dump_perfcore();
     bool create_perf_events_buffer_if_needed();
+    void delete_perf_events_buffer();
+
+    enum class ForkMode {
+        CopyAddressSpace,
+        // vfork(): the child runs on our memory until it execs or dies.
+        ShareAddressSpace,
+    };
+    KResultOr<NonnullRefPtr<Process>> do_fork(RegisterState&, ForkMode);
+    void release_vfork_parent();
 
     KResult do_exec(NonnullRefPtr<FileDescription> main_program_description, Vector<String> arguments, Vector<String> environment, RefPtr<FileDescription> interpreter_description, Thread*& new_main_thread, u32& prev_flags, const Elf32_Ehdr& main_program_header);
     KResultOr<ssize_t> do_write(FileDescription&, const UserOrKernelBuffer&, size_t);
@@ -522,6 +545,12 @@ private:
 
     void clear_futex_queues_on_exec();
 
+    // Makes a new process findable by from_pid(), for_each() and its parent.
+    static void register_new(Process&);
+    void set_process_group(RefPtr<ProcessGroup>);
+    // Takes us off our parent's list of children and onto new_parent's, if any.
+    void reparent(Process* new_parent);
+
     Process* m_prev { nullptr };
     Process* m_next { nullptr };
 
@@ -531,31 +560,21 @@ private:
 
     RefPtr<ProcessGroup> m_pg;
 
+    // These are protected by g_processes_lock.
+    ProcessGroupMember m_process_group_member { *this };
+    IntrusiveListNode<Process> m_child_list_node;
+    IntrusiveListNode<Process> m_tracee_list_node;
+    IntrusiveList<Process, RawPtr<Process>, &Process::m_child_list_node> m_children;
+    IntrusiveList<Process, RawPtr<Process>, &Process::m_tracee_list_node> m_tracees;
+
     void protect_data();
     void unprotect_data();
 
     OwnPtr<ThreadTracer> m_tracer;
 
-    static const int m_max_open_file_descriptors { FD_SETSIZE };
-
-    class FileDescriptionAndFlags {
-    public:
-        operator bool() const { return !!m_description; }
+    static const int m_max_open_file_descriptors { FileDescriptionTable::max_size };
 
-        FileDescription* description() { return m_description; }
-        const FileDescription* description() const { return m_description; }
-
-        u32 flags() const { return m_flags; }
-        void set_flags(u32 flags) { m_flags = flags; }
-
-        void clear();
-        void set(NonnullRefPtr<FileDescription>&&, u32 flags = 0);
-
-    private:
-        RefPtr<FileDescription> m_description;
-        u32 m_flags { 0 };
-    };
-    Vector<FileDescriptionAndFlags> m_fds;
+    FileDescriptionTable m_fds;
 
     mutable RecursiveSpinLock m_thread_list_lock;
 
@@ -565,6 +584,10 @@ private:
     Atomic<bool, AK::MemoryOrder::memory_order_relaxed> m_is_stopped { false };
     bool m_should_dump_core { false };
 
+    // Set while a parent that vfork()ed us waits for us to let go of its memory.
+    Atomic<bool> m_vfork_parent_waiting { false };
+    WaitQueue m_vfork_wait_queue;
+
     RefPtr<Custody> m_executable;
     RefPtr<Custody> m_cwd;
     RefPtr<Custody> m_root_directory;
@@ -588,6 +611,8 @@ private:
     UnveilNode m_unveiled_paths { "/", { .full_path = "/", .unveil_inherited_from_root = true } };
 
     OwnPtr<PerformanceEventBuffer> m_perf_event_buffer;
+    // Generation of the global profile that last got our memory layout.
+    u32 m_global_profile_layout_generation { 0 };
 
     FutexQueues m_futex_queues;
     SpinLock<u8> m_futex_lock;
@@ -626,13 +651,20 @@ inline void Process::for_each_child(Callback callback)
     VERIFY_INTERRUPTS_DISABLED();
     ProcessID my_pid = pid();
     ScopedSpinLock lock(g_processes_lock);
-    for (auto* process = g_processes->head(); process;) {
-        auto* next_process = process->next();
-        if (process->ppid() == my_pid || process->has_tracee_thread(pid())) {
-            if (callback(*process) == IterationDecision::Break)
-                break;
-        }
-        process = next_process;
+    for (auto it = m_children.begin(); it != m_children.end();) {
+        auto& child = *it;
+        ++it;
+        if (callback(child) == IterationDecision::Break)
+            return;
+    }
+    // Processes we're tracing count as our children too.
+    for (auto it = m_tracees.begin(); it != m_tracees.end();) {
+        auto& tracee = *it;
+        ++it;
+        if (tracee.ppid() == my_pid)
+            continue;
+        if (callback(tracee) == IterationDecision::Break)
+            return;
     }
 }
 
@@ -665,14 +697,14 @@ inline void Process::for_each_in_pgrp(ProcessGroupID pgid, Callback callback)
 {
     VERIFY_INTERRUPTS_DISABLED();
     ScopedSpinLock lock(g_processes_lock);
-    for (auto* process = g_processes->head(); process;) {
-        auto* next_process = process->next();
-        if (!process->is_dead() && process->pgid() == pgid) {
-            if (callback(*process) == IterationDecision::Break)
-                break;
-        }
-        process = next_process;
-    }
+    auto process_group = ProcessGroup::from_pgid(pgid);
+    if (!process_group)
+        return;
+    process_group->for_each_member([&](Process& process) {
+        if (process.is_dead())
+            return IterationDecision::Continue;
+        return callback(process);
+    });
 }
 
 inline bool InodeMetadata::may_read(const Process& process) const
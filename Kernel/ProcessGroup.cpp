@@ -3,12 +3,15 @@
 namespace Kernel {
 
 RecursiveSpinLock g_process_groups_lock;
-InlineLinkedList<ProcessGroup>* g_process_groups;
+HashMap<ProcessGroupID, ProcessGroup*>* g_process_groups;
 
 ProcessGroup::~ProcessGroup()
 {
     ScopedSpinLock lock(g_process_groups_lock);
-    g_process_groups->remove(this);
+    // A newer group with the same pgid may have taken our place.
+    auto it = g_process_groups->find(m_pgid);
+    if (it != g_process_groups->end() && it->value == this)
+        g_process_groups->remove(it);
 }
 
 NonnullRefPtr<ProcessGroup> ProcessGroup::create(ProcessGroupID pgid)
@@ -16,7 +19,7 @@ NonnullRefPtr<ProcessGroup> ProcessGroup::create(ProcessGroupID pgid)
     auto process_group = adopt(*new ProcessGroup(pgid));
     {
         ScopedSpinLock lock(g_process_groups_lock);
-        g_process_groups->prepend(process_group);
+        g_process_groups->set(pgid, process_group.ptr());
     }
 
     return process_group;
@@ -36,11 +39,10 @@ RefPtr<ProcessGroup> ProcessGroup::from_pgid(ProcessGroupID pgid)
 {
     ScopedSpinLock lock(g_process_groups_lock);
 
-    for (auto& group : *g_process_groups) {
-        if (group.pgid() == pgid)
-            return &group;
-    }
-    return nullptr;
+    auto it = g_process_groups->find(pgid);
+    if (it == g_process_groups->end())
+        return nullptr;
+    return it->value;
 }
 
 }
@@ -1,7 +1,9 @@
 #pragma once
 
 // includes
-#include <AK/InlineLinkedList.h>
+#include <AK/HashMap.h>
+#include <AK/IntrusiveList.h>
+#include <AK/IterationDecision.h>
 #include <AK/RefCounted.h>
 #include <AK/Weakable.h>
 #include <Kernel/Lock.h>
@@ -10,16 +12,36 @@
 
 namespace Kernel {
 
+class Process;
+
+// Every process has one of these, so the process group it's in can find it
+// without looking at every process in the system.
+class ProcessGroupMember {
+    AK_MAKE_NONCOPYABLE(ProcessGroupMember);
+    AK_MAKE_NONMOVABLE(ProcessGroupMember);
+
+public:
+    explicit ProcessGroupMember(Process& process)
+        : m_process(process)
+    {
+    }
+
+    Process& process() { return m_process; }
+
+private:
+    friend class ProcessGroup;
+
+    Process& m_process;
+    IntrusiveListNode<ProcessGroupMember> m_list_node;
+};
+
 class ProcessGroup
     : public RefCounted<ProcessGroup>
-    , public Weakable<ProcessGroup>
-    , public InlineLinkedListNode<ProcessGroup> {
+    , public Weakable<ProcessGroup> {
 
     AK_MAKE_NONMOVABLE(ProcessGroup);
     AK_MAKE_NONCOPYABLE(ProcessGroup);
 
-    friend InlineLinkedListNode<ProcessGroup>;
-
 public:
     ~ProcessGroup();
 
@@ -29,19 +51,32 @@ public:
 
     const ProcessGroupID& pgid() const { return m_pgid; }
 
+    // The member list is protected by g_processes_lock.
+    void add_member(ProcessGroupMember& member) { m_members.append(member); }
+    void remove_member(ProcessGroupMember& member) { m_members.remove(member); }
+
+    template<typename Callback>
+    void for_each_member(Callback callback)
+    {
+        for (auto it = m_members.begin(); it != m_members.end();) {
+            auto& member = *it;
+            ++it;
+            if (callback(member.process()) == IterationDecision::Break)
+                break;
+        }
+    }
+
 private:
     ProcessGroup(ProcessGroupID pgid)
         : m_pgid(pgid)
     {
     }
 
-    ProcessGroup* m_prev { nullptr };
-    ProcessGroup* m_next { nullptr };
-
     ProcessGroupID m_pgid;
+    IntrusiveList<ProcessGroupMember, RawPtr<ProcessGroupMember>, &ProcessGroupMember::m_list_node> m_members;
 };
 
-extern InlineLinkedList<ProcessGroup>* g_process_groups;
+extern HashMap<ProcessGroupID, ProcessGroup*>* g_process_groups;
 extern RecursiveSpinLock g_process_groups_lock;
 
 }
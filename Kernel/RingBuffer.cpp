@@ -0,0 +1,168 @@
+// includes
+#include <AK/StringView.h>
+#include <Kernel/RingBuffer.h>
+
+namespace Kernel {
+
+static size_t round_up_capacity(size_t capacity)
+{
+    size_t rounded = PAGE_SIZE;
+    while (rounded < capacity)
+        rounded *= 2;
+    return rounded;
+}
+
+RingBuffer::RingBuffer(size_t capacity)
+{
+    capacity = round_up_capacity(capacity);
+    m_storage = KBuffer::try_create_with_size(capacity, Region::Access::Read | Region::Access::Write, "RingBuffer");
+    if (m_storage)
+        m_capacity = capacity;
+}
+
+ssize_t RingBuffer::write(const UserOrKernelBuffer& data, size_t size)
+{
+    if (!size || !m_storage)
+        return 0;
+    auto write_position = m_write_position.load(AK::MemoryOrder::memory_order_relaxed);
+    // Acquire the read position so that the reader is done with the bytes we are about to overwrite.
+    auto read_position = m_read_position.load(AK::MemoryOrder::memory_order_acquire);
+    size_t bytes_to_write = min(size, capacity() - (write_position - read_position));
+    if (!bytes_to_write)
+        return 0;
+
+    auto offset = offset_of(write_position);
+    size_t first_chunk_size = min(bytes_to_write, capacity() - offset);
+    if (!data.read(m_storage->data() + offset, first_chunk_size))
+        return -EFAULT;
+    if (first_chunk_size < bytes_to_write && !data.read(m_storage->data(), first_chunk_size, bytes_to_write - first_chunk_size))
+        return -EFAULT;
+
+    publish_written_bytes(write_position, bytes_to_write);
+    return (ssize_t)bytes_to_write;
+}
+
+KResultOr<size_t> RingBuffer::write_from(const SpliceSource& source, size_t size)
+{
+    if (!size || !m_storage)
+        return 0;
+    auto write_position = m_write_position.load(AK::MemoryOrder::memory_order_relaxed);
+    auto read_position = m_read_position.load(AK::MemoryOrder::memory_order_acquire);
+    size_t bytes_to_write = min(size, capacity() - (write_position - read_position));
+
+    size_t nwritten = 0;
+    while (nwritten < bytes_to_write) {
+        auto offset = offset_of(write_position + nwritten);
+        size_t chunk_size = min(bytes_to_write - nwritten, capacity() - offset);
+        auto buffer = UserOrKernelBuffer::for_kernel_buffer(m_storage->data() + offset);
+        auto result = source(buffer, chunk_size);
+        if (result.is_error()) {
+            if (!nwritten)
+                return result.error();
+            break;
+        }
+        nwritten += result.value();
+        if (result.value() < chunk_size)
+            break;
+    }
+
+    if (nwritten)
+        publish_written_bytes(write_position, nwritten);
+    return nwritten;
+}
+
+void RingBuffer::publish_written_bytes(size_t write_position, size_t count)
+{
+    m_write_position.store(write_position + count);
+
+    // If the reader has consumed everything that was there before, it may be waiting for us.
+    // Both sides store their position (sequentially consistent, so the store can't move past
+    // the load that follows it) before loading the other one. So either the reader sees our
+    // data before going to sleep, or we see that it caught up and wake it up.
+    if (m_unblock_callback && m_read_position.load() == write_position)
+        m_unblock_callback();
+}
+
+ssize_t RingBuffer::read(UserOrKernelBuffer& data, size_t size)
+{
+    if (!size || !m_storage)
+        return 0;
+    auto read_position = m_read_position.load(AK::MemoryOrder::memory_order_relaxed);
+    // Acquire the write position so that we see the bytes the writer published with it.
+    auto write_position = m_write_position.load(AK::MemoryOrder::memory_order_acquire);
+    size_t nread = min(size, write_position - read_position);
+    if (!nread)
+        return 0;
+
+    auto offset = offset_of(read_position);
+    size_t first_chunk_size = min(nread, capacity() - offset);
+    if (!data.write(m_storage->data() + offset, first_chunk_size))
+        return -EFAULT;
+    if (first_chunk_size < nread && !data.write(m_storage->data(), first_chunk_size, nread - first_chunk_size))
+        return -EFAULT;
+
+    m_read_position.store(read_position + nread);
+
+    // Same as in write(): a writer can only be waiting if the ring was full before we made room.
+    if (m_unblock_callback && m_write_position.load() - read_position == capacity())
+        m_unblock_callback();
+    return (ssize_t)nread;
+}
+
+void RingBuffer::SideLock::lock()
+{
+    if (!m_is_busy.exchange(true, AK::MemoryOrder::memory_order_acquire))
+        return;
+    // Either unlock() sees us counted and wakes us, or we see the side idle again.
+    // A wake that comes before we wait isn't lost, the WaitQueue remembers it.
+    m_waiter_count++;
+    while (m_is_busy.exchange(true))
+        m_waiters.wait_forever(m_name);
+    m_waiter_count--;
+}
+
+void RingBuffer::SideLock::unlock()
+{
+    m_is_busy.store(false);
+    if (m_waiter_count.load())
+        m_waiters.wake_one();
+}
+
+KResult RingBuffer::try_resize(size_t new_capacity)
+{
+    if (!new_capacity || new_capacity > max_capacity)
+        return EINVAL;
+    new_capacity = round_up_capacity(new_capacity);
+
+    auto old_capacity = capacity();
+    if (new_capacity == old_capacity)
+        return KSuccess;
+    auto used = used_bytes();
+    if (used > new_capacity)
+        return EBUSY;
+
+    auto new_storage = KBuffer::try_create_with_size(new_capacity, Region::Access::Read | Region::Access::Write, "RingBuffer");
+    if (!new_storage)
+        return ENOMEM;
+
+    // The positions stay the same, only the offsets they map to change.
+    auto read_position = m_read_position.load();
+    size_t copied = 0;
+    while (copied < used) {
+        auto position = read_position + copied;
+        auto old_offset = position & (old_capacity - 1);
+        auto new_offset = position & (new_capacity - 1);
+        auto chunk_size = min(used - copied, min(old_capacity - old_offset, new_capacity - new_offset));
+        memcpy(new_storage->data() + new_offset, m_storage->data() + old_offset, chunk_size);
+        copied += chunk_size;
+    }
+
+    m_storage = move(new_storage);
+    m_capacity = new_capacity;
+
+    if (m_unblock_callback && used == old_capacity)
+        m_unblock_callback();
+    return KSuccess;
+}
+
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+// includes
+#include <AK/Atomic.h>
+#include <AK/Function.h>
+#include <AK/OwnPtr.h>
+#include <AK/Types.h>
+#include <Kernel/FileSystem/File.h>
+#include <Kernel/KBuffer.h>
+#include <Kernel/KResult.h>
+#include <Kernel/WaitQueue.h>
+#include <Kernel/UserOrKernelBuffer.h>
+
+namespace Kernel {
+
+// A single-producer, single-consumer byte ring, used for pipes and local sockets.
+// The read and write positions only ever grow and live on separate cache lines, and each
+// side publishes its position with a release store that the other side acquires. So a
+// reader and a writer never take a lock or bounce each other's cache lines while the ring
+// is neither empty nor full.
+//
+// The ring itself takes no locks at all: there must be at most one writer and one reader
+// at a time. Users that can have more serialize each side with a RingBuffer::SideLock.
+class RingBuffer {
+public:
+    static constexpr size_t default_capacity = 64 * KiB;
+    static constexpr size_t max_capacity = 1 * MiB;
+
+    explicit RingBuffer(size_t capacity = default_capacity);
+
+    [[nodiscard]] ssize_t write(const UserOrKernelBuffer&, size_t);
+    [[nodiscard]] ssize_t write(const u8* data, size_t size)
+    {
+        return write(UserOrKernelBuffer::for_kernel_buffer(const_cast<u8*>(data)), size);
+    }
+    // Lets source fill up to size bytes of free space directly, instead of copying from a caller buffer.
+    KResultOr<size_t> write_from(const SpliceSource& source, size_t size);
+    [[nodiscard]] ssize_t read(UserOrKernelBuffer&, size_t);
+    [[nodiscard]] ssize_t read(u8* data, size_t size)
+    {
+        auto buffer = UserOrKernelBuffer::for_kernel_buffer(data);
+        return read(buffer, size);
+    }
+
+    size_t used_bytes() const { return m_write_position.load() - m_read_position.load(); }
+    bool is_empty() const { return used_bytes() == 0; }
+    size_t space_for_writing() const { return capacity() - used_bytes(); }
+    size_t capacity() const { return m_capacity.load(AK::MemoryOrder::memory_order_relaxed); }
+
+    // Changes the capacity to new_capacity rounded up to a power of two, keeping
+    // the buffered data. Fails with EBUSY if that doesn't fit into the new capacity.
+    // The caller has to hold off both the writing and the reading side.
+    KResult try_resize(size_t new_capacity);
+
+    // The callback is invoked when the ring stops being empty or stops being full,
+    // which are the only transitions that can unblock a reader or a writer.
+    void set_unblock_callback(Function<void()> callback)
+    {
+        VERIFY(!m_unblock_callback);
+        m_unblock_callback = move(callback);
+    }
+
+    // Serializes the threads using one side of a ring. A thread that finds the side idle
+    // only pays for an atomic exchange; threads that find it busy sleep until it's
+    // released, since the holder may itself block, e.g. on a page fault or disk I/O.
+    class SideLock {
+    public:
+        explicit SideLock(const char* name)
+            : m_name(name)
+        {
+        }
+
+        void lock();
+        void unlock();
+
+    private:
+        const char* m_name { nullptr };
+        Atomic<bool> m_is_busy { false };
+        Atomic<u32> m_waiter_count { 0 };
+        WaitQueue m_waiters;
+    };
+
+    class SideLocker {
+        AK_MAKE_NONCOPYABLE(SideLocker);
+
+    public:
+        explicit SideLocker(SideLock& lock)
+            : m_lock(lock)
+        {
+            m_lock.lock();
+        }
+        ~SideLocker() { m_lock.unlock(); }
+
+    private:
+        SideLock& m_lock;
+    };
+
+private:
+    static constexpr size_t cache_line_size = 64;
+
+    size_t offset_of(size_t position) const { return position & (capacity() - 1); }
+    void publish_written_bytes(size_t write_position, size_t count);
+
+    // Written by the writing side only.
+    alignas(cache_line_size) Atomic<size_t> m_write_position { 0 };
+    // Written by the reading side only.
+    alignas(cache_line_size) Atomic<size_t> m_read_position { 0 };
+
+    alignas(cache_line_size) Atomic<size_t> m_capacity { 0 };
+    OwnPtr<KBuffer> m_storage;
+    Function<void()> m_unblock_callback;
+};
+
+}
@@ -0,0 +1,118 @@
+// includes
+#include <AK/JsonArraySerializer.h>
+#include <AK/JsonObjectSerializer.h>
+#include <Kernel/KBufferBuilder.h>
+#include <Kernel/PerformanceEventBuffer.h>
+#include <Kernel/Process.h>
+#include <Kernel/SamplingProfiler.h>
+#include <Kernel/Time/TimeManagement.h>
+
+namespace Kernel {
+
+extern bool g_profiling_all_threads;
+extern PerformanceEventBuffer* g_global_perf_events;
+
+Array<SamplingProfiler::ProcessorData, SamplingProfiler::max_processors> SamplingProfiler::s_processor_data;
+Atomic<u32> SamplingProfiler::s_ticks_per_sample { 1 };
+Atomic<u32> SamplingProfiler::s_flags { 0 };
+
+KResultOr<u32> SamplingProfiler::configure(u32 sample_frequency, u32 flags)
+{
+    if (flags & ~PROFILING_SAMPLE_IDLE)
+        return EINVAL;
+
+    // We can't take samples more often than the timer interrupts us.
+    u32 ticks_per_second = TimeManagement::the().system_timer_ticks_per_second();
+    VERIFY(ticks_per_second);
+    u32 ticks_per_sample = 1;
+    if (sample_frequency && sample_frequency < ticks_per_second)
+        ticks_per_sample = ticks_per_second / sample_frequency;
+
+    s_ticks_per_sample = ticks_per_sample;
+    s_flags = flags;
+    return ticks_per_second / ticks_per_sample;
+}
+
+void SamplingProfiler::reset_statistics()
+{
+    InterruptDisabler disabler;
+    for (auto& data : s_processor_data)
+        data = {};
+}
+
+void SamplingProfiler::timer_tick(const RegisterState& regs)
+{
+    VERIFY_INTERRUPTS_DISABLED();
+    auto* current_thread = Processor::current_thread();
+    auto& process = current_thread->process();
+
+    PerformanceEventBuffer* perf_events = nullptr;
+    if (g_profiling_all_threads) {
+        VERIFY(g_global_perf_events);
+        bool is_idle = current_thread == Processor::current().idle_thread();
+        if (!is_idle || (s_flags.load(AK::MemoryOrder::memory_order_relaxed) & PROFILING_SAMPLE_IDLE))
+            perf_events = g_global_perf_events;
+    } else if (process.is_profiling()) {
+        VERIFY(process.perf_events());
+        perf_events = process.perf_events();
+    }
+    if (!perf_events)
+        return;
+
+    auto cpu = Processor::id();
+    if (cpu >= max_processors)
+        return;
+    auto& data = s_processor_data[cpu];
+    if (data.ticks_until_sample) {
+        --data.ticks_until_sample;
+        return;
+    }
+    data.ticks_until_sample = s_ticks_per_sample.load(AK::MemoryOrder::memory_order_relaxed) - 1;
+
+    bool can_measure = Processor::current().has_feature(CPUFeature::TSC);
+    u64 start_tsc = can_measure ? read_tsc() : 0;
+
+    if (g_profiling_all_threads && process.space().enforces_syscall_regions() && process.m_global_profile_layout_generation != perf_events->generation()) {
+        // Once a process enforces syscall regions, its dynamic loader is done mapping
+        // libraries, so its layout is worth recording. Do that once per profile.
+        process.m_global_profile_layout_generation = perf_events->generation();
+        perf_events->add_process(process, ProcessEventType::Exec);
+    }
+    [[maybe_unused]] auto rc = perf_events->append_sample(*current_thread, regs);
+
+    ++data.sample_count;
+    if (can_measure) {
+        u64 end_tsc = read_tsc();
+        if (!data.first_sample_tsc)
+            data.first_sample_tsc = start_tsc;
+        data.last_sample_tsc = end_tsc;
+        data.sample_cycles += end_tsc - start_tsc;
+    }
+}
+
+bool SamplingProfiler::to_json(KBufferBuilder& builder)
+{
+    JsonObjectSerializer object(builder);
+    u32 ticks_per_second = TimeManagement::the().system_timer_ticks_per_second();
+    object.add("sample_frequency", ticks_per_second / s_ticks_per_sample.load());
+    object.add("sample_idle", (s_flags.load() & PROFILING_SAMPLE_IDLE) != 0);
+
+    auto processors_array = object.add_array("processors");
+    for (u32 cpu = 0; cpu < min(Processor::count(), (u32)max_processors); ++cpu) {
+        auto& data = s_processor_data[cpu];
+        auto processor_object = processors_array.add_object();
+        processor_object.add("cpu", cpu);
+        processor_object.add("samples", data.sample_count);
+        processor_object.add("sample_cycles", data.sample_cycles);
+        processor_object.add("cycles_per_sample", data.sample_count ? data.sample_cycles / data.sample_count : 0);
+        // Share of this processor's time that went into taking samples, in parts per million.
+        u64 elapsed_cycles = data.last_sample_tsc - data.first_sample_tsc;
+        processor_object.add("overhead_ppm", elapsed_cycles ? data.sample_cycles * 1'000'000 / elapsed_cycles : 0);
+        processor_object.finish();
+    }
+    processors_array.finish();
+    object.finish();
+    return true;
+}
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+// includes
+#include <AK/Array.h>
+#include <AK/Atomic.h>
+#include <AK/Types.h>
+#include <Kernel/KResult.h>
+
+namespace Kernel {
+
+class KBufferBuilder;
+struct RegisterState;
+
+// Takes samples of whatever runs on each processor, from that processor's timer interrupt.
+// Samples go to the global performance event buffer when profiling all threads, or
+// to the buffer of the interrupted thread's process if only that process is profiled.
+class SamplingProfiler {
+public:
+    // A sample_frequency of 0 samples on every timer tick, which is also the highest
+    // frequency we can do. Returns the frequency that is actually used.
+    static KResultOr<u32> configure(u32 sample_frequency, u32 flags);
+
+    static void timer_tick(const RegisterState&);
+
+    // Forgets the overhead measured so far, called whenever profiling starts.
+    static void reset_statistics();
+
+    static bool to_json(KBufferBuilder&);
+
+private:
+    static constexpr size_t max_processors = sizeof(u32) * 8;
+
+    struct ProcessorData {
+        u32 ticks_until_sample { 0 };
+        u64 sample_count { 0 };
+        // Time spent taking samples, and since the first sample, in TSC cycles.
+        u64 sample_cycles { 0 };
+        u64 first_sample_tsc { 0 };
+        u64 last_sample_tsc { 0 };
+    };
+
+    static Array<ProcessorData, max_processors> s_processor_data;
+    static Atomic<u32> s_ticks_per_sample;
+    static Atomic<u32> s_flags;
+};
+
+}
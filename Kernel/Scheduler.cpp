@@ -5,9 +5,9 @@
 #include <AK/Time.h>
 #include <Kernel/Debug.h>
 #include <Kernel/Panic.h>
-#include <Kernel/PerformanceEventBuffer.h>
 #include <Kernel/Process.h>
 #include <Kernel/RTC.h>
+#include <Kernel/SamplingProfiler.h>
 #include <Kernel/Scheduler.h>
 #include <Kernel/Time/TimeManagement.h>
 #include <Kernel/TimerQueue.h>
@@ -17,9 +17,6 @@
 
 namespace Kernel {
 
-extern bool g_profiling_all_threads;
-extern PerformanceEventBuffer* g_global_perf_events;
-
 class SchedulerPerProcessorData {
     AK_MAKE_NONCOPYABLE(SchedulerPerProcessorData);
     AK_MAKE_NONMOVABLE(SchedulerPerProcessorData);
@@ -50,15 +47,26 @@ READONLY_AFTER_INIT static Process* s_colonel_process;
 struct ThreadReadyQueue {
     IntrusiveList<Thread, &Thread::m_ready_queue_node> thread_list;
 };
-static SpinLock<u8> g_ready_queues_lock;
-static u32 g_ready_queues_mask;
-static constexpr u32 g_ready_queue_buckets = sizeof(g_ready_queues_mask) * 8;
-READONLY_AFTER_INIT static ThreadReadyQueue* g_ready_queues; // g_ready_queue_buckets entries
+static constexpr u32 g_ready_queue_buckets = sizeof(u32) * 8;
+
+// Every processor has its own set of priority buckets so that queueing and
+// picking threads on one processor doesn't contend with the others.
+struct ProcessorReadyQueues {
+    Thread* take_runnable_thread(u32 affinity_mask, u32 priority_mask);
+
+    SpinLock<u8> lock;
+    Atomic<u32, AK::MemoryOrder::memory_order_relaxed> mask { 0 };
+    ThreadReadyQueue buckets[g_ready_queue_buckets];
+};
+// Affinity masks are 32 bits wide, so there can't be more processors than that.
+static constexpr u32 g_max_ready_queue_processors = sizeof(u32) * 8;
+READONLY_AFTER_INIT static ProcessorReadyQueues* g_ready_queues; // g_max_ready_queue_processors entries
+static Atomic<u32> g_scheduling_processors_mask { 0 };
 
 static inline u32 thread_priority_to_priority_index(u32 thread_priority)
 {
     // Converts the priority in the range of THREAD_PRIORITY_MIN...THREAD_PRIORITY_MAX
-    // to a index into g_ready_queues where 0 is the highest priority bucket
+    // to a index into the ready queue buckets where 0 is the highest priority bucket
     VERIFY(thread_priority >= THREAD_PRIORITY_MIN && thread_priority <= THREAD_PRIORITY_MAX);
     constexpr u32 thread_priority_count = THREAD_PRIORITY_MAX - THREAD_PRIORITY_MIN + 1;
     static_assert(thread_priority_count > 0);
@@ -67,16 +75,13 @@ static inline u32 thread_priority_to_priority_index(u32 thread_priority)
     return priority_bucket;
 }
 
-Thread& Scheduler::pull_next_runnable_thread()
+Thread* ProcessorReadyQueues::take_runnable_thread(u32 affinity_mask, u32 priority_mask)
 {
-    auto affinity_mask = 1u << Processor::current().id();
-
-    ScopedSpinLock lock(g_ready_queues_lock);
-    auto priority_mask = g_ready_queues_mask;
+    VERIFY(lock.is_locked());
     while (priority_mask != 0) {
         auto priority = __builtin_ffsl(priority_mask);
         VERIFY(priority > 0);
-        auto& ready_queue = g_ready_queues[--priority];
+        auto& ready_queue = buckets[--priority];
         for (auto& thread : ready_queue.thread_list) {
             VERIFY(thread.m_runnable_priority == (int)priority);
             if (thread.is_active())
@@ -86,7 +91,7 @@ Thread& Scheduler::pull_next_runnable_thread()
             thread.m_runnable_priority = -1;
             ready_queue.thread_list.remove(thread);
             if (ready_queue.thread_list.is_empty())
-                g_ready_queues_mask &= ~(1u << priority);
+                mask &= ~(1u << priority);
             // Mark it as active because we are using this thread. This is similar
             // to comparing it with Processor::current_thread, but when there are
             // multiple processors there's no easy way to check whether the thread
@@ -98,10 +103,75 @@ Thread& Scheduler::pull_next_runnable_thread()
             // switching to it.
             // FIXME: Figure out a better way maybe?
             thread.set_active(true);
-            return thread;
+            return &thread;
         }
         priority_mask &= ~(1u << priority);
     }
+    return nullptr;
+}
+
+static u32 highest_priority_in(u32 priority_mask)
+{
+    // Bucket index of the most important runnable thread, or g_ready_queue_buckets if there is none.
+    if (priority_mask == 0)
+        return g_ready_queue_buckets;
+    return __builtin_ffsl(priority_mask) - 1;
+}
+
+Thread& Scheduler::pull_next_runnable_thread()
+{
+    auto cpu = Processor::current().id();
+    auto affinity_mask = 1u << cpu;
+
+    u32 local_priority;
+    {
+        auto& local_queues = g_ready_queues[cpu];
+        ScopedSpinLock lock(local_queues.lock);
+        local_priority = highest_priority_in(local_queues.mask);
+
+        // Only run a local thread if no other processor is sitting on something more important.
+        bool other_queue_has_higher_priority = false;
+        auto processors_mask = g_scheduling_processors_mask.load(AK::MemoryOrder::memory_order_relaxed) & ~affinity_mask;
+        while (processors_mask != 0 && !other_queue_has_higher_priority) {
+            auto other_cpu = __builtin_ffsl(processors_mask) - 1;
+            processors_mask &= ~(1u << other_cpu);
+            other_queue_has_higher_priority = highest_priority_in(g_ready_queues[other_cpu].mask) < local_priority;
+        }
+
+        if (!other_queue_has_higher_priority) {
+            if (auto* thread = local_queues.take_runnable_thread(affinity_mask, local_queues.mask))
+                return *thread;
+        }
+    }
+
+    // Our own queues are empty (or hold only less important work), so try to steal
+    // from the other processors. Start with the one after us so that stealing
+    // processors don't all pile onto the same victim.
+    auto processor_count = min(Processor::count(), g_max_ready_queue_processors);
+    for (u32 i = 1; i < processor_count; ++i) {
+        auto victim_cpu = (cpu + i) % processor_count;
+        auto& victim_queues = g_ready_queues[victim_cpu];
+        if (victim_queues.mask == 0)
+            continue;
+        ScopedSpinLock lock(victim_queues.lock);
+        // Don't steal anything we wouldn't have preferred over our own threads.
+        u32 priority_mask = victim_queues.mask;
+        if (local_priority < g_ready_queue_buckets)
+            priority_mask &= (1u << local_priority) - 1;
+        if (auto* thread = victim_queues.take_runnable_thread(affinity_mask, priority_mask)) {
+            dbgln_if(SCHEDULER_DEBUG, "Scheduler[{}]: Stole {} from processor {}", cpu, *thread, victim_cpu);
+            return *thread;
+        }
+    }
+
+    // Nothing better to steal, so fall back to whatever we have locally.
+    {
+        auto& local_queues = g_ready_queues[cpu];
+        ScopedSpinLock lock(local_queues.lock);
+        if (auto* thread = local_queues.take_runnable_thread(affinity_mask, local_queues.mask))
+            return *thread;
+    }
+
     return *Processor::current().idle_thread();
 }
 
@@ -109,9 +179,7 @@ bool Scheduler::dequeue_runnable_thread(Thread& thread, bool check_affinity)
 {
     if (&thread == Processor::current().idle_thread())
         return true;
-    ScopedSpinLock lock(g_ready_queues_lock);
-    auto priority = thread.m_runnable_priority;
-    if (priority < 0) {
+    if (thread.m_runnable_priority < 0) {
         VERIFY(!thread.m_ready_queue_node.is_in_list());
         return false;
     }
@@ -119,31 +187,66 @@ bool Scheduler::dequeue_runnable_thread(Thread& thread, bool check_affinity)
     if (check_affinity && !(thread.affinity() & (1 << Processor::current().id())))
         return false;
 
-    VERIFY(g_ready_queues_mask & (1u << priority));
-    auto& ready_queue = g_ready_queues[priority];
-    thread.m_runnable_priority = -1;
-    ready_queue.thread_list.remove(thread);
-    if (ready_queue.thread_list.is_empty())
-        g_ready_queues_mask &= ~(1u << priority);
-    return true;
+    for (;;) {
+        auto cpu = thread.m_runnable_cpu.load();
+        auto& ready_queues = g_ready_queues[cpu];
+        ScopedSpinLock lock(ready_queues.lock);
+        int priority = thread.m_runnable_priority;
+        if (priority < 0) {
+            // Someone else pulled the thread off its queue while we were waiting for the lock.
+            VERIFY(!thread.m_ready_queue_node.is_in_list());
+            return false;
+        }
+        if (thread.m_runnable_cpu.load() != cpu) {
+            // It was pulled off and queued on another processor in the meantime.
+            continue;
+        }
+
+        VERIFY(ready_queues.mask & (1u << priority));
+        auto& ready_queue = ready_queues.buckets[priority];
+        thread.m_runnable_priority = -1;
+        ready_queue.thread_list.remove(thread);
+        if (ready_queue.thread_list.is_empty())
+            ready_queues.mask &= ~(1u << priority);
+        return true;
+    }
+}
+
+static u32 pick_processor_for(const Thread& thread)
+{
+    auto allowed_mask = thread.affinity() & g_scheduling_processors_mask.load(AK::MemoryOrder::memory_order_relaxed);
+    if (allowed_mask == 0) {
+        // The thread can only run on processors that don't schedule (yet). Park it on
+        // the first one it's allowed on, it will be picked up once that processor does.
+        allowed_mask = thread.affinity();
+    }
+    VERIFY(allowed_mask != 0);
+
+    // Prefer the processor the thread last ran on, its caches are most likely still warm.
+    auto last_cpu = thread.cpu();
+    if (last_cpu < g_max_ready_queue_processors && (allowed_mask & (1u << last_cpu)))
+        return last_cpu;
+    return __builtin_ffsl(allowed_mask) - 1;
 }
 
 void Scheduler::queue_runnable_thread(Thread& thread)
 {
-    VERIFY(g_scheduler_lock.own_lock());
     if (&thread == Processor::current().idle_thread())
         return;
     auto priority = thread_priority_to_priority_index(thread.priority());
+    auto cpu = pick_processor_for(thread);
 
-    ScopedSpinLock lock(g_ready_queues_lock);
+    auto& ready_queues = g_ready_queues[cpu];
+    ScopedSpinLock lock(ready_queues.lock);
     VERIFY(thread.m_runnable_priority < 0);
     thread.m_runnable_priority = (int)priority;
+    thread.m_runnable_cpu = cpu;
     VERIFY(!thread.m_ready_queue_node.is_in_list());
-    auto& ready_queue = g_ready_queues[priority];
+    auto& ready_queue = ready_queues.buckets[priority];
     bool was_empty = ready_queue.thread_list.is_empty();
     ready_queue.thread_list.append(thread);
     if (was_empty)
-        g_ready_queues_mask |= (1u << priority);
+        ready_queues.mask |= (1u << priority);
 }
 
 UNMAP_AFTER_INIT void Scheduler::start()
@@ -157,6 +260,11 @@ UNMAP_AFTER_INIT void Scheduler::start()
     auto& processor = Processor::current();
     processor.set_scheduler_data(*new SchedulerPerProcessorData());
     VERIFY(processor.is_initialized());
+    VERIFY(processor.get_id() < g_max_ready_queue_processors);
+#if !SCHEDULE_ON_ALL_PROCESSORS
+    if (processor.get_id() == 0)
+#endif
+        g_scheduling_processors_mask.fetch_or(1u << processor.get_id());
     auto& idle_thread = *processor.idle_thread();
     VERIFY(processor.current_thread() == &idle_thread);
     VERIFY(processor.idle_thread() == &idle_thread);
@@ -191,6 +299,16 @@ bool Scheduler::pick_next()
             scheduler_data.m_in_scheduler = false;
         });
 
+    // The ready queues are guarded by their own per-processor locks, so the next thread is
+    // picked before taking g_scheduler_lock. That one is only needed for the thread state
+    // transitions and the context switch itself.
+    auto pending_beneficiary = scheduler_data.m_pending_beneficiary.strong_ref();
+    const char* pending_donate_reason = scheduler_data.m_pending_donate_reason;
+    scheduler_data.m_pending_beneficiary = nullptr;
+    scheduler_data.m_pending_donate_reason = nullptr;
+    bool should_donate = pending_beneficiary && dequeue_runnable_thread(*pending_beneficiary, true);
+    Thread* thread_to_schedule = should_donate ? nullptr : &pull_next_runnable_thread();
+
     ScopedSpinLock lock(g_scheduler_lock);
 
     if (current_thread->should_die() && current_thread->state() == Thread::Running) {
@@ -235,40 +353,37 @@ bool Scheduler::pick_next()
         });
     }
 
-    auto pending_beneficiary = scheduler_data.m_pending_beneficiary.strong_ref();
-    if (pending_beneficiary && dequeue_runnable_thread(*pending_beneficiary, true)) {
+    if (should_donate) {
         // The thread we're supposed to donate to still exists and we can
-        const char* reason = scheduler_data.m_pending_donate_reason;
-        scheduler_data.m_pending_beneficiary = nullptr;
-        scheduler_data.m_pending_donate_reason = nullptr;
 
         // We need to leave our first critical section before switching context,
         // but since we're still holding the scheduler lock we're still in a critical section
         critical.leave();
 
-        dbgln_if(SCHEDULER_DEBUG, "Processing pending donate to {} reason={}", *pending_beneficiary, reason);
-        return donate_to_and_switch(pending_beneficiary.ptr(), reason);
+        dbgln_if(SCHEDULER_DEBUG, "Processing pending donate to {} reason={}", *pending_beneficiary, pending_donate_reason);
+        return donate_to_and_switch(pending_beneficiary.ptr(), pending_donate_reason);
     }
 
-    // Either we're not donating or the beneficiary disappeared.
-    // Either way clear any pending information
-    scheduler_data.m_pending_beneficiary = nullptr;
-    scheduler_data.m_pending_donate_reason = nullptr;
+    // If the thread we pulled changed state while we were waiting for the lock, whoever
+    // changed it also queues it again once it becomes runnable, so just pick another one.
+    while (thread_to_schedule != Processor::current().idle_thread() && thread_to_schedule->state() != Thread::Runnable) {
+        thread_to_schedule->set_active(false);
+        thread_to_schedule = &pull_next_runnable_thread();
+    }
 
-    auto& thread_to_schedule = pull_next_runnable_thread();
     if constexpr (SCHEDULER_DEBUG) {
         dbgln("Scheduler[{}]: Switch to {} @ {:04x}:{:08x}",
             Processor::id(),
-            thread_to_schedule,
-            thread_to_schedule.tss().cs, thread_to_schedule.tss().eip);
+            *thread_to_schedule,
+            thread_to_schedule->tss().cs, thread_to_schedule->tss().eip);
     }
 
     // We need to leave our first critical section before switching context,
     // but since we're still holding the scheduler lock we're still in a critical section
     critical.leave();
 
-    thread_to_schedule.set_ticks_left(time_slice_for(thread_to_schedule));
-    return context_switch(&thread_to_schedule);
+    thread_to_schedule->set_ticks_left(time_slice_for(*thread_to_schedule));
+    return context_switch(thread_to_schedule);
 }
 
 bool Scheduler::yield()
@@ -472,7 +587,7 @@ UNMAP_AFTER_INIT void Scheduler::initialize()
 
     RefPtr<Thread> idle_thread;
     g_finalizer_wait_queue = new WaitQueue;
-    g_ready_queues = new ThreadReadyQueue[g_ready_queue_buckets];
+    g_ready_queues = new ProcessorReadyQueues[g_max_ready_queue_processors];
 
     g_finalizer_has_work.store(false, AK::MemoryOrder::memory_order_release);
     s_colonel_process = Process::create_kernel_process(idle_thread, "colonel", idle_loop, nullptr, 1).leak_ref();
@@ -515,36 +630,15 @@ void Scheduler::timer_tick(const RegisterState& regs)
     VERIFY(current_thread->current_trap());
     VERIFY(current_thread->current_trap()->regs == &regs);
 
+    // Every processor takes its own samples, even the ones we don't schedule on yet.
+    SamplingProfiler::timer_tick(regs);
+
 #if !SCHEDULE_ON_ALL_PROCESSORS
     bool is_bsp = Processor::id() == 0;
     if (!is_bsp)
         return; // TODO: This prevents scheduling on other CPUs!
 #endif
 
-    PerformanceEventBuffer* perf_events = nullptr;
-
-    if (g_profiling_all_threads) {
-        VERIFY(g_global_perf_events);
-        // FIXME: We currently don't collect samples while idle.
-        //        That will be an interesting mode to add in the future. :^)
-        if (current_thread != Processor::current().idle_thread()) {
-            perf_events = g_global_perf_events;
-            if (current_thread->process().space().enforces_syscall_regions()) {
-                // FIXME: This is very nasty! We dump the current process's address
-                //        space layout *every time* it's sampled. We should figure out
-                //        a way to do this less often.
-                perf_events->add_process(current_thread->process());
-            }
-        }
-    } else if (current_thread->process().is_profiling()) {
-        VERIFY(current_thread->process().perf_events());
-        perf_events = current_thread->process().perf_events();
-    }
-
-    if (perf_events) {
-        [[maybe_unused]] auto rc = perf_events->append_with_eip_and_ebp(regs.eip, regs.ebp, PERF_EVENT_SAMPLE, 0, 0);
-    }
-
     if (current_thread->tick())
         return;
 
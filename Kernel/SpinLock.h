@@ -5,6 +5,7 @@
 #include <AK/Types.h>
 #include <Kernel/Arch/x86/CPU.h>
 #include <Kernel/Forward.h>
+#include <Kernel/LockStatistics.h>
 
 namespace Kernel {
 
@@ -20,6 +21,10 @@ public:
     {
         u32 prev_flags;
         Processor::current().enter_critical(prev_flags);
+        if (g_lock_statistics_enabled) {
+            lock_with_statistics();
+            return prev_flags;
+        }
         while (m_lock.exchange(1, AK::memory_order_acquire) != 0) {
             Processor::wait_check();
         }
@@ -29,6 +34,8 @@ public:
     ALWAYS_INLINE void unlock(u32 prev_flags)
     {
         VERIFY(is_locked());
+        if (g_lock_statistics_enabled)
+            LockStatistics::did_release_spin_lock(this);
         m_lock.store(0, AK::memory_order_release);
         Processor::current().leave_critical(prev_flags);
     }
@@ -44,6 +51,18 @@ public:
     }
 
 private:
+    // Not inlined, so the return address is the place that takes the lock.
+    NEVER_INLINE void lock_with_statistics()
+    {
+        auto site = FlatPtr(__builtin_return_address(0));
+        LockStatistics::Wait wait;
+        while (m_lock.exchange(1, AK::memory_order_acquire) != 0) {
+            wait.begin(LockStatistics::spin_lock_holder_site_id(this));
+            Processor::wait_check();
+        }
+        LockStatistics::did_acquire_spin_lock(this, site, wait);
+    }
+
     Atomic<BaseType> m_lock { 0 };
 };
 
@@ -60,6 +79,11 @@ public:
         FlatPtr cpu = FlatPtr(&proc);
         u32 prev_flags;
         proc.enter_critical(prev_flags);
+        if (g_lock_statistics_enabled) {
+            lock_with_statistics(cpu);
+            m_recursions++;
+            return prev_flags;
+        }
         FlatPtr expected = 0;
         while (!m_lock.compare_exchange_strong(expected, cpu, AK::memory_order_acq_rel)) {
             if (expected == cpu)
@@ -75,8 +99,11 @@ public:
     {
         VERIFY(m_recursions > 0);
         VERIFY(m_lock.load(AK::memory_order_relaxed) == FlatPtr(&Processor::current()));
-        if (--m_recursions == 0)
+        if (--m_recursions == 0) {
+            if (g_lock_statistics_enabled)
+                LockStatistics::did_release_spin_lock(this);
             m_lock.store(0, AK::memory_order_release);
+        }
         Processor::current().leave_critical(prev_flags);
     }
 
@@ -96,6 +123,23 @@ public:
     }
 
 private:
+    // Not inlined, so the return address is the place that takes the lock.
+    NEVER_INLINE void lock_with_statistics(FlatPtr cpu)
+    {
+        auto site = FlatPtr(__builtin_return_address(0));
+        LockStatistics::Wait wait;
+        FlatPtr expected = 0;
+        while (!m_lock.compare_exchange_strong(expected, cpu, AK::memory_order_acq_rel)) {
+            // Taking the lock again doesn't count as an acquisition.
+            if (expected == cpu)
+                return;
+            wait.begin(LockStatistics::spin_lock_holder_site_id(this));
+            Processor::wait_check();
+            expected = 0;
+        }
+        LockStatistics::did_acquire_spin_lock(this, site, wait);
+    }
+
     Atomic<FlatPtr> m_lock { 0 };
     u32 m_recursions { 0 };
 };
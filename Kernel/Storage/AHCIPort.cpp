@@ -11,17 +11,6 @@
 
 namespace Kernel {
 
-NonnullRefPtr<AHCIPort::ScatterList> AHCIPort::ScatterList::create(AsyncBlockDeviceRequest& request, NonnullRefPtrVector<PhysicalPage> allocated_pages, size_t device_block_size)
-{
-    return adopt_ref(*new ScatterList(request, allocated_pages, device_block_size));
-}
-
-AHCIPort::ScatterList::ScatterList(AsyncBlockDeviceRequest& request, NonnullRefPtrVector<PhysicalPage> allocated_pages, size_t device_block_size)
-    : m_vm_object(AnonymousVMObject::create_with_physical_pages(allocated_pages))
-{
-    m_dma_region = MM.allocate_kernel_region_with_vmobject(m_vm_object, page_round_up((request.block_count() * device_block_size)), "AHCI Scattered DMA", Region::Access::Read | Region::Access::Write, Region::Cacheable::Yes);
-}
-
 NonnullRefPtr<AHCIPort> AHCIPort::create(const AHCIPortHandler& handler, volatile AHCI::PortRegisters& registers, u32 port_index)
 {
     return adopt_ref(*new AHCIPort(handler, registers, port_index));
@@ -47,12 +36,16 @@ AHCIPort::AHCIPort(const AHCIPortHandler& handler, volatile AHCI::PortRegisters&
     dbgln_if(AHCI_DEBUG, "AHCI Port {}: Command list page at {}", representative_port_index(), m_command_list_page->paddr());
     dbgln_if(AHCI_DEBUG, "AHCI Port {}: FIS receive page at {}", representative_port_index(), m_command_list_page->paddr());
 
-    for (size_t index = 0; index < 1; index++) {
+    // Every command slot gets its own command table and DMA buffer, so that requests
+    // can be queued up without waiting for each other. Both stay mapped for the lifetime
+    // of the port, so issuing a command doesn't have to map anything.
+    m_command_slots_count = min((size_t)AHCI::Limits::MaxCommands, handler.hba_capabilities().max_command_list_entries_count);
+    for (size_t index = 0; index < m_command_slots_count; index++) {
         m_dma_buffers.append(MM.allocate_supervisor_physical_page().release_nonnull());
-    }
-    for (size_t index = 0; index < 1; index++) {
         m_command_table_pages.append(MM.allocate_supervisor_physical_page().release_nonnull());
     }
+    m_dma_buffers_region = MM.allocate_kernel_region_with_vmobject(AnonymousVMObject::create_with_physical_pages(m_dma_buffers), m_command_slots_count * PAGE_SIZE, "AHCI Port DMA Buffers", Region::Access::Read | Region::Access::Write, Region::Cacheable::Yes);
+    m_command_tables_region = MM.allocate_kernel_region_with_vmobject(AnonymousVMObject::create_with_physical_pages(m_command_table_pages), m_command_slots_count * PAGE_SIZE, "AHCI Port Command Tables", Region::Access::Read | Region::Access::Write, Region::Cacheable::No);
     m_command_list_region = MM.allocate_kernel_region(m_command_list_page->paddr(), PAGE_SIZE, "AHCI Port Command List", Region::Access::Read | Region::Access::Write, Region::Cacheable::No);
     dbgln_if(AHCI_DEBUG, "AHCI Port {}: Command list region at {}", representative_port_index(), m_command_list_region->vaddr());
 
@@ -89,36 +82,81 @@ void AHCIPort::handle_interrupt()
         });
         return;
     }
-    if (m_interrupt_status.is_set(AHCI::PortInterruptFlag::DHR) || m_interrupt_status.is_set(AHCI::PortInterruptFlag::PS)) {
-        m_wait_for_completion = false;
+    // Non-queued commands finish with a D2H Register FIS (or a PIO Setup FIS for IDENTIFY),
+    // queued ones with a Set Device Bits FIS that clears their bits in PxSACT.
+    bool command_completed = m_interrupt_status.is_set(AHCI::PortInterruptFlag::DHR)
+        || m_interrupt_status.is_set(AHCI::PortInterruptFlag::PS)
+        || m_interrupt_status.is_set(AHCI::PortInterruptFlag::SDB);
+
+    // Clear the status before looking at which slots are done, so that a completion
+    // racing with us raises a new interrupt instead of getting lost.
+    m_interrupt_status.clear();
 
-        // Now schedule reading/writing the buffer as soon as we leave the irq handler.
-        // This is important so that we can safely access the buffers, which could
-        // trigger page faults
-        if (!m_current_request) {
-            dbgln_if(AHCI_DEBUG, "AHCI Port {}: Request handled, probably identify request", representative_port_index());
-        } else {
-            g_io_work->queue([this]() {
-                dbgln_if(AHCI_DEBUG, "AHCI Port {}: Request handled", representative_port_index());
-                Locker locker(m_lock);
-                VERIFY(m_current_request);
-                VERIFY(m_current_scatter_list);
-                if (m_current_request->request_type() == AsyncBlockDeviceRequest::Read) {
-                    if (!m_current_request->write_to_buffer(m_current_request->buffer(), m_current_scatter_list->dma_region().as_ptr(), m_connected_device->block_size() * m_current_request->block_count())) {
-                        dbgln_if(AHCI_DEBUG, "AHCI Port {}: Request failure, memory fault occurred when reading in data.", representative_port_index());
-                        m_current_scatter_list = nullptr;
-                        complete_current_request(AsyncDeviceRequest::MemoryFault);
-                        return;
-                    }
-                }
-                m_current_scatter_list = nullptr;
-                dbgln_if(AHCI_DEBUG, "AHCI Port {}: Request success", representative_port_index());
-                complete_current_request(AsyncDeviceRequest::Success);
-            });
-        }
+    if (!command_completed)
+        return;
+
+    m_wait_for_completion = false;
+
+    ScopedSpinLock lock(m_hard_lock);
+    u32 running_slots = m_port_registers.ci | m_port_registers.sact;
+    u32 completed_slots = m_active_command_slots & ~m_completing_command_slots & ~running_slots;
+    if (!completed_slots) {
+        dbgln_if(AHCI_DEBUG, "AHCI Port {}: Request handled, probably identify request", representative_port_index());
+        return;
     }
+    m_completing_command_slots |= completed_slots;
 
-    m_interrupt_status.clear();
+    // Now schedule reading/writing the buffers as soon as we leave the irq handler.
+    // This is important so that we can safely access the buffers, which could
+    // trigger page faults
+    g_io_work->queue([this, completed_slots]() {
+        process_completed_slots(completed_slots);
+    });
+}
+
+void AHCIPort::process_completed_slots(u32 completed_slots)
+{
+    Locker locker(m_lock);
+    for (u8 slot_index = 0; slot_index < m_command_slots_count; slot_index++) {
+        if (!(completed_slots & (1u << slot_index)))
+            continue;
+        {
+            // The request may have been failed in the meantime by recover_from_fatal_error().
+            ScopedSpinLock lock(m_hard_lock);
+            if (!(m_completing_command_slots & (1u << slot_index)))
+                continue;
+        }
+        auto& slot = m_command_slots[slot_index];
+        VERIFY(slot.request);
+        auto& request = *slot.request;
+        dbgln_if(AHCI_DEBUG, "AHCI Port {}: Request in slot {} handled", representative_port_index(), slot_index);
+        if (slot.uses_bounce_buffer && request.request_type() == AsyncBlockDeviceRequest::Read) {
+            size_t block_size = m_connected_device->block_size();
+            if (!request.write_to_buffer(request.buffer(), dma_buffer(slot_index), slot.completed_block_count * block_size, slot.command_block_count * block_size)) {
+                dbgln_if(AHCI_DEBUG, "AHCI Port {}: Request failure, memory fault occurred when reading in data.", representative_port_index());
+                complete_request(slot_index, AsyncDeviceRequest::MemoryFault);
+                continue;
+            }
+        }
+        release_pinned_pages(slot);
+        slot.completed_block_count += slot.command_block_count;
+        if (slot.completed_block_count < request.block_count()) {
+            // Keep the slot for the request, and go on with the next part of it.
+            {
+                ScopedSpinLock lock(m_hard_lock);
+                m_active_command_slots &= ~(1u << slot_index);
+                m_completing_command_slots &= ~(1u << slot_index);
+            }
+            auto result = issue_next_command(slot_index);
+            if (result.has_value()) {
+                dbgln_if(AHCI_DEBUG, "AHCI Port {}: Request failure.", representative_port_index());
+                complete_request(slot_index, result.value());
+            }
+            continue;
+        }
+        dbgln_if(AHCI_DEBUG, "AHCI Port {}: Request success", representative_port_index());
+        complete_request(slot_index, AsyncDeviceRequest::Success);
+    }
 }
 
 bool AHCIPort::is_interrupts_enabled() const
@@ -129,12 +167,20 @@ bool AHCIPort::is_interrupts_enabled() const
 void AHCIPort::recover_from_fatal_error()
 {
     Locker locker(m_lock);
-    ScopedSpinLock lock(m_hard_lock);
-    dmesgln("{}: AHCI Port {} fatal error, shutting down!", m_parent_handler->hba_controller()->pci_address(), representative_port_index());
-    dmesgln("{}: AHCI Port {} fatal error, SError {}", m_parent_handler->hba_controller()->pci_address(), representative_port_index(), (u32)m_port_registers.serr);
-    stop_command_list_processing();
-    stop_fis_receiving();
-    m_interrupt_enable.clear();
+    {
+        ScopedSpinLock lock(m_hard_lock);
+        dmesgln("{}: AHCI Port {} fatal error, shutting down!", m_parent_handler->hba_controller()->pci_address(), representative_port_index());
+        dmesgln("{}: AHCI Port {} fatal error, SError {}", m_parent_handler->hba_controller()->pci_address(), representative_port_index(), (u32)m_port_registers.serr);
+        stop_command_list_processing();
+        stop_fis_receiving();
+        m_interrupt_enable.clear();
+    }
+
+    // Nothing that is still queued on the port is ever going to complete now.
+    for (u8 slot_index = 0; slot_index < m_command_slots_count; slot_index++) {
+        if (m_command_slots[slot_index].request)
+            complete_request(slot_index, AsyncDeviceRequest::Failure);
+    }
 }
 
 void AHCIPort::eject()
@@ -164,8 +210,7 @@ void AHCIPort::eject()
     // handshake error bit in PxSERR register if CFL is incorrect.
     command_list_entries[unused_command_header.value()].attributes = (size_t)FIS::DwordCount::RegisterHostToDevice | AHCI::CommandHeaderAttributes::P | AHCI::CommandHeaderAttributes::C | AHCI::CommandHeaderAttributes::A;
 
-    auto command_table_region = MM.allocate_kernel_region(m_command_table_pages[unused_command_header.value()].paddr().page_base(), page_round_up(sizeof(AHCI::CommandTable)), "AHCI Command Table", Region::Access::Read | Region::Access::Write, Region::Cacheable::No);
-    auto& command_table = *(volatile AHCI::CommandTable*)command_table_region->vaddr().as_ptr();
+    auto& command_table = this->command_table(unused_command_header.value());
     memset(const_cast<u8*>(command_table.command_fis), 0, 64);
     auto& fis = *(volatile FIS::HostToDevice::Register*)command_table.command_fis;
     fis.header.fis_type = (u8)FIS::Type::RegisterHostToDevice;
@@ -290,6 +335,17 @@ bool AHCIPort::initialize(ScopedSpinLock<SpinLock<u8>>& main_lock)
             m_port_registers.cmd = m_port_registers.cmd | (1 << 24);
         }
 
+        // Word 76 bit 8 advertises NCQ support, and word 75 holds the device's maximum queue depth minus one.
+        bool device_supports_ncq = identify_block->serial_ata_capabilities & (1 << 8);
+        if (!is_atapi_attached() && device_supports_ncq && m_parent_handler->hba_capabilities().native_command_queuing_supported) {
+            m_native_command_queuing_enabled = true;
+            m_command_queue_depth = min(m_command_slots_count, (size_t)(identify_block->queue_depth & 0x1f) + 1);
+        } else {
+            m_native_command_queuing_enabled = false;
+            m_command_queue_depth = 1;
+        }
+        dbgln_if(AHCI_DEBUG, "AHCI Port {}: NCQ {}, queue depth {}", representative_port_index(), m_native_command_queuing_enabled ? "enabled" : "disabled", m_command_queue_depth);
+
         dmesgln("AHCI Port {}: Device found, Capacity={}, Bytes per logical sector={}, Bytes per physical sector={}", representative_port_index(), max_addressable_sector * logical_sector_size, logical_sector_size, physical_sector_size);
 
         // FIXME: We don't support ATAPI devices yet, so for now we don't "create" them
@@ -420,65 +476,173 @@ void AHCIPort::set_sleep_state() const
     m_port_registers.cmd = (m_port_registers.cmd & 0x0ffffff) | (0b1000 << 28);
 }
 
-size_t AHCIPort::calculate_descriptors_count(size_t block_count) const
-{
-    VERIFY(m_connected_device);
-    size_t needed_dma_regions_count = page_round_up((block_count * m_connected_device->block_size())) / PAGE_SIZE;
-    VERIFY(needed_dma_regions_count <= m_dma_buffers.size());
-    return needed_dma_regions_count;
+size_t AHCIPort::set_direct_scatter_list(u8 slot_index, AsyncBlockDeviceRequest& request, size_t max_block_count)
+{
+    auto& slot = m_command_slots[slot_index];
+    size_t block_size = m_connected_device->block_size();
+    auto base = VirtualAddress(request.buffer().user_or_kernel_ptr()).offset(slot.completed_block_count * block_size);
+    // Physical region descriptors have to start on a word boundary.
+    if (base.is_null() || (base.get() & 1))
+        return 0;
+
+    auto* space = request.buffer().is_kernel_buffer() ? nullptr : &request.process().space();
+    bool device_writes = request.request_type() == AsyncBlockDeviceRequest::Read;
+    auto& command_table = this->command_table(slot_index);
+    size_t transfer_size = max_block_count * block_size;
+    size_t mapped_size = 0;
+    size_t descriptors_count = 0;
+    FlatPtr descriptor_base = 0;
+    size_t descriptor_size = 0;
+    while (mapped_size < transfer_size) {
+        auto vaddr = base.offset(mapped_size);
+        auto page = MM.physical_page_for_device_access(space, vaddr.page_base(), device_writes);
+        if (!page)
+            break;
+        auto offset_in_page = vaddr.get() - vaddr.page_base().get();
+        size_t size = min(PAGE_SIZE - offset_in_page, transfer_size - mapped_size);
+        auto paddr = page->paddr().offset(offset_in_page).get();
+        if (descriptors_count > 0 && descriptor_base + descriptor_size == paddr && descriptor_size + size <= max_descriptor_byte_count) {
+            // Physically contiguous with the previous page, so they can share a descriptor.
+            descriptor_size += size;
+        } else {
+            if (descriptors_count == max_descriptors_per_command) {
+                if (device_writes)
+                    page->unpin_for_device_writes();
+                break;
+            }
+            descriptor_base = paddr;
+            descriptor_size = size;
+            descriptors_count++;
+            command_table.descriptors[descriptors_count - 1].base_high = 0;
+            command_table.descriptors[descriptors_count - 1].base_low = descriptor_base;
+            command_table.descriptors[descriptors_count - 1].reserved = 0;
+        }
+        command_table.descriptors[descriptors_count - 1].byte_count = descriptor_size - 1;
+        slot.pinned_pages.append(page.release_nonnull());
+        slot.pinned_pages_for_device_writes = device_writes;
+        mapped_size += size;
+    }
+
+    size_t block_count = mapped_size / block_size;
+    if (block_count == 0) {
+        release_pinned_pages(slot);
+        return 0;
+    }
+
+    // The command has to end on a block boundary, so drop whatever we mapped of the next block.
+    size_t excess = mapped_size - block_count * block_size;
+    while (excess > 0) {
+        size_t last_descriptor_size = (command_table.descriptors[descriptors_count - 1].byte_count & 0x3fffff) + 1;
+        if (last_descriptor_size > excess) {
+            command_table.descriptors[descriptors_count - 1].byte_count = last_descriptor_size - excess - 1;
+            break;
+        }
+        excess -= last_descriptor_size;
+        descriptors_count--;
+    }
+
+    slot.descriptors_count = descriptors_count;
+    return block_count;
 }
 
-Optional<AsyncDeviceRequest::RequestResult> AHCIPort::prepare_and_set_scatter_list(AsyncBlockDeviceRequest& request)
+Optional<AsyncDeviceRequest::RequestResult> AHCIPort::prepare_and_set_scatter_list(u8 slot_index, AsyncBlockDeviceRequest& request)
 {
     VERIFY(m_lock.is_locked());
-    VERIFY(request.block_count() > 0);
-
-    NonnullRefPtrVector<PhysicalPage> allocated_dma_regions;
-    for (size_t index = 0; index < calculate_descriptors_count(request.block_count()); index++) {
-        allocated_dma_regions.append(m_dma_buffers.at(index));
+    auto& slot = m_command_slots[slot_index];
+    VERIFY(slot.completed_block_count < request.block_count());
+    VERIFY(slot.pinned_pages.is_empty());
+
+    size_t block_size = m_connected_device->block_size();
+    size_t max_block_count = min(request.block_count() - slot.completed_block_count, max_blocks_per_command);
+
+    // Let the device access the request buffer directly whenever its pages are resident.
+    slot.command_block_count = set_direct_scatter_list(slot_index, request, max_block_count);
+    slot.uses_bounce_buffer = slot.command_block_count == 0;
+    if (!slot.uses_bounce_buffer) {
+        dbgln_if(AHCI_DEBUG, "AHCI Port {}: Direct transfer of {} blocks with {} descriptors", representative_port_index(), slot.command_block_count, slot.descriptors_count);
+        return {};
     }
 
-    m_current_scatter_list = ScatterList::create(request, allocated_dma_regions, m_connected_device->block_size());
+    // Otherwise, go through the slot's bounce page, one page worth of blocks at a time.
+    VERIFY(block_size <= PAGE_SIZE);
+    slot.command_block_count = min(max_block_count, PAGE_SIZE / block_size);
+    slot.descriptors_count = 1;
+    auto& command_table = this->command_table(slot_index);
+    command_table.descriptors[0].base_high = 0;
+    command_table.descriptors[0].base_low = m_dma_buffers[slot_index].paddr().get();
+    command_table.descriptors[0].reserved = 0;
+    command_table.descriptors[0].byte_count = slot.command_block_count * block_size - 1;
+    dbgln_if(AHCI_DEBUG, "AHCI Port {}: Bounced transfer of {} blocks @ {}", representative_port_index(), slot.command_block_count, m_dma_buffers[slot_index].paddr());
+
     if (request.request_type() == AsyncBlockDeviceRequest::Write) {
-        if (!request.read_from_buffer(request.buffer(), m_current_scatter_list->dma_region().as_ptr(), m_connected_device->block_size() * request.block_count())) {
+        if (!request.read_from_buffer(request.buffer(), dma_buffer(slot_index), slot.completed_block_count * block_size, slot.command_block_count * block_size)) {
             return AsyncDeviceRequest::MemoryFault;
         }
     }
     return {};
 }
 
+Optional<AsyncDeviceRequest::RequestResult> AHCIPort::issue_next_command(u8 slot_index)
+{
+    VERIFY(m_lock.is_locked());
+    auto& slot = m_command_slots[slot_index];
+    VERIFY(slot.request);
+    auto& request = *slot.request;
+
+    auto result = prepare_and_set_scatter_list(slot_index, request);
+    if (result.has_value())
+        return result;
+
+    if (!access_device(slot_index, request.request_type(), request.block_index() + slot.completed_block_count, slot.command_block_count))
+        return AsyncDeviceRequest::Failure;
+    return {};
+}
+
 void AHCIPort::start_request(AsyncBlockDeviceRequest& request)
 {
     Locker locker(m_lock);
     dbgln_if(AHCI_DEBUG, "AHCI Port {}: Request start", representative_port_index());
-    VERIFY(!m_current_request);
-    VERIFY(!m_current_scatter_list);
+    VERIFY(request.block_count() > 0);
 
-    m_current_request = request;
+    // The device never has more requests in flight than our queue depth, so there is always a free slot.
+    auto slot_index = try_to_find_unused_command_header();
+    VERIFY(slot_index.has_value());
+    auto& slot = m_command_slots[slot_index.value()];
+    VERIFY(!slot.request);
+    slot.request = request;
+    slot.completed_block_count = 0;
 
-    auto result = prepare_and_set_scatter_list(request);
+    auto result = issue_next_command(slot_index.value());
     if (result.has_value()) {
         dbgln_if(AHCI_DEBUG, "AHCI Port {}: Request failure.", representative_port_index());
-        m_lock.unlock();
-        complete_current_request(result.value());
+        complete_request(slot_index.value(), result.value());
         return;
     }
+}
 
-    auto success = access_device(request.request_type(), request.block_index(), request.block_count());
-    if (!success) {
-        dbgln_if(AHCI_DEBUG, "AHCI Port {}: Request failure.", representative_port_index());
-        m_lock.unlock();
-        complete_current_request(AsyncDeviceRequest::Failure);
-        return;
+void AHCIPort::release_pinned_pages(CommandSlot& slot)
+{
+    if (slot.pinned_pages_for_device_writes) {
+        for (auto& page : slot.pinned_pages)
+            page.unpin_for_device_writes();
     }
+    slot.pinned_pages.clear();
+    slot.pinned_pages_for_device_writes = false;
 }
 
-void AHCIPort::complete_current_request(AsyncDeviceRequest::RequestResult result)
+void AHCIPort::complete_request(u8 slot_index, AsyncDeviceRequest::RequestResult result)
 {
-    VERIFY(m_current_request);
-    auto current_request = m_current_request;
-    m_current_request.clear();
-    current_request->complete(result);
+    VERIFY(m_lock.is_locked());
+    auto& slot = m_command_slots[slot_index];
+    VERIFY(slot.request);
+    auto request = move(slot.request);
+    release_pinned_pages(slot);
+    {
+        ScopedSpinLock lock(m_hard_lock);
+        m_active_command_slots &= ~(1u << slot_index);
+        m_completing_command_slots &= ~(1u << slot_index);
+    }
+    request->complete(result);
 }
 
 bool AHCIPort::spin_until_ready() const
@@ -497,60 +661,43 @@ bool AHCIPort::spin_until_ready() const
     return true;
 }
 
-bool AHCIPort::access_device(AsyncBlockDeviceRequest::RequestType direction, u64 lba, u8 block_count)
+bool AHCIPort::access_device(u8 slot_index, AsyncBlockDeviceRequest::RequestType direction, u64 lba, u16 block_count)
 {
     VERIFY(m_connected_device);
     VERIFY(is_operable());
     VERIFY(m_lock.is_locked());
-    VERIFY(m_current_scatter_list);
+    VERIFY(block_count > 0);
+    auto& slot = m_command_slots[slot_index];
+    VERIFY(slot.descriptors_count > 0);
     ScopedSpinLock lock(m_hard_lock);
 
-    dbgln_if(AHCI_DEBUG, "AHCI Port {}: Do a {}, lba {}, block count {}", representative_port_index(), direction == AsyncBlockDeviceRequest::RequestType::Write ? "write" : "read", lba, block_count);
-    if (!spin_until_ready())
+    dbgln_if(AHCI_DEBUG, "AHCI Port {}: Do a {}, lba {}, block count {}, slot {}", representative_port_index(), direction == AsyncBlockDeviceRequest::RequestType::Write ? "write" : "read", lba, block_count, slot_index);
+    // Queued commands may be issued while others are still in flight, so only
+    // non-queued ones have to wait for the device to become idle.
+    if (!m_native_command_queuing_enabled && !spin_until_ready())
         return false;
 
-    auto unused_command_header = try_to_find_unused_command_header();
-    VERIFY(unused_command_header.has_value());
     auto* command_list_entries = (volatile AHCI::CommandHeader*)m_command_list_region->vaddr().as_ptr();
-    command_list_entries[unused_command_header.value()].ctba = m_command_table_pages[unused_command_header.value()].paddr().get();
-    command_list_entries[unused_command_header.value()].ctbau = 0;
-    command_list_entries[unused_command_header.value()].prdbc = 0;
-    command_list_entries[unused_command_header.value()].prdtl = m_current_scatter_list->scatters_count();
+    command_list_entries[slot_index].ctba = m_command_table_pages[slot_index].paddr().get();
+    command_list_entries[slot_index].ctbau = 0;
+    command_list_entries[slot_index].prdbc = 0;
+    command_list_entries[slot_index].prdtl = slot.descriptors_count;
 
     // Note: we must set the correct Dword count in this register. Real hardware
     // AHCI controllers do care about this field! QEMU doesn't care if we don't
     // set the correct CFL field in this register, real hardware will set an
     // handshake error bit in PxSERR register if CFL is incorrect.
-    command_list_entries[unused_command_header.value()].attributes = (size_t)FIS::DwordCount::RegisterHostToDevice | AHCI::CommandHeaderAttributes::P | AHCI::CommandHeaderAttributes::C | (is_atapi_attached() ? AHCI::CommandHeaderAttributes::A : 0) | (direction == AsyncBlockDeviceRequest::RequestType::Write ? AHCI::CommandHeaderAttributes::W : 0);
-
-    dbgln_if(AHCI_DEBUG, "AHCI Port {}: CLE: ctba=0x{:08x}, ctbau=0x{:08x}, prdbc=0x{:08x}, prdtl=0x{:04x}, attributes=0x{:04x}", representative_port_index(), (u32)command_list_entries[unused_command_header.value()].ctba, (u32)command_list_entries[unused_command_header.value()].ctbau, (u32)command_list_entries[unused_command_header.value()].prdbc, (u16)command_list_entries[unused_command_header.value()].prdtl, (u16)command_list_entries[unused_command_header.value()].attributes);
-
-    auto command_table_region = MM.allocate_kernel_region(m_command_table_pages[unused_command_header.value()].paddr().page_base(), page_round_up(sizeof(AHCI::CommandTable)), "AHCI Command Table", Region::Access::Read | Region::Access::Write, Region::Cacheable::No);
-    auto& command_table = *(volatile AHCI::CommandTable*)command_table_region->vaddr().as_ptr();
+    u16 attributes = (size_t)FIS::DwordCount::RegisterHostToDevice | AHCI::CommandHeaderAttributes::P | (is_atapi_attached() ? AHCI::CommandHeaderAttributes::A : 0) | (direction == AsyncBlockDeviceRequest::RequestType::Write ? AHCI::CommandHeaderAttributes::W : 0);
+    // Clearing BSY on R_OK is only meaningful for non-queued commands.
+    if (!m_native_command_queuing_enabled)
+        attributes |= AHCI::CommandHeaderAttributes::C;
+    command_list_entries[slot_index].attributes = attributes;
 
-    dbgln_if(AHCI_DEBUG, "AHCI Port {}: Allocated command table at {}", representative_port_index(), command_table_region->vaddr());
+    dbgln_if(AHCI_DEBUG, "AHCI Port {}: CLE: ctba=0x{:08x}, ctbau=0x{:08x}, prdbc=0x{:08x}, prdtl=0x{:04x}, attributes=0x{:04x}", representative_port_index(), (u32)command_list_entries[slot_index].ctba, (u32)command_list_entries[slot_index].ctbau, (u32)command_list_entries[slot_index].prdbc, (u16)command_list_entries[slot_index].prdtl, (u16)command_list_entries[slot_index].attributes);
 
+    // The physical region descriptors were already set up by prepare_and_set_scatter_list().
+    auto& command_table = this->command_table(slot_index);
     memset(const_cast<u8*>(command_table.command_fis), 0, 64);
-
-    size_t scatter_entry_index = 0;
-    size_t data_transfer_count = (block_count * m_connected_device->block_size());
-    for (auto scatter_page : m_current_scatter_list->vmobject().physical_pages()) {
-        VERIFY(data_transfer_count != 0);
-        VERIFY(scatter_page);
-        dbgln_if(AHCI_DEBUG, "AHCI Port {}: Add a transfer scatter entry @ {}", representative_port_index(), scatter_page->paddr());
-        command_table.descriptors[scatter_entry_index].base_high = 0;
-        command_table.descriptors[scatter_entry_index].base_low = scatter_page->paddr().get();
-        if (data_transfer_count <= PAGE_SIZE) {
-            command_table.descriptors[scatter_entry_index].byte_count = data_transfer_count - 1;
-            data_transfer_count = 0;
-        } else {
-            command_table.descriptors[scatter_entry_index].byte_count = PAGE_SIZE - 1;
-            data_transfer_count -= PAGE_SIZE;
-        }
-        scatter_entry_index++;
-    }
-    command_table.descriptors[scatter_entry_index].byte_count = (PAGE_SIZE - 1) | (1 << 31);
-
     memset(const_cast<u8*>(command_table.atapi_command), 0, 32);
 
     auto& fis = *(volatile FIS::HostToDevice::Register*)command_table.command_fis;
@@ -558,6 +705,11 @@ bool AHCIPort::access_device(AsyncBlockDeviceRequest::RequestType direction, u64
     if (is_atapi_attached()) {
         fis.command = ATA_CMD_PACKET;
         TODO();
+    } else if (m_native_command_queuing_enabled) {
+        if (direction == AsyncBlockDeviceRequest::RequestType::Write)
+            fis.command = ATA_CMD_WRITE_FPDMA_QUEUED;
+        else
+            fis.command = ATA_CMD_READ_FPDMA_QUEUED;
     } else {
         if (direction == AsyncBlockDeviceRequest::RequestType::Write)
             fis.command = ATA_CMD_WRITE_DMA_EXT;
@@ -576,17 +728,30 @@ bool AHCIPort::access_device(AsyncBlockDeviceRequest::RequestType direction, u64
     fis.lba_low[0] = lba & 0xff;
     fis.lba_low[1] = (lba >> 8) & 0xff;
     fis.lba_low[2] = (lba >> 16) & 0xff;
-    fis.count = (block_count);
+    if (m_native_command_queuing_enabled) {
+        // FPDMA QUEUED commands carry the sector count in the features register,
+        // and the command tag in bits 7:3 of the sector count register.
+        fis.features_low = block_count & 0xff;
+        fis.features_high = (block_count >> 8) & 0xff;
+        fis.count = slot_index << 3;
+    } else {
+        fis.count = (block_count);
+    }
 
     // The below loop waits until the port is no longer busy before issuing a new command
-    if (!spin_until_ready())
+    if (!m_native_command_queuing_enabled && !spin_until_ready())
         return false;
 
     full_memory_barrier();
-    mark_command_header_ready_to_process(unused_command_header.value());
+    // The slot has to become active together with being issued, otherwise the interrupt
+    // handler could mistake it for an already completed command.
+    m_active_command_slots |= 1u << slot_index;
+    if (m_native_command_queuing_enabled)
+        m_port_registers.sact = 1u << slot_index;
+    mark_command_header_ready_to_process(slot_index);
     full_memory_barrier();
 
-    dbgln_if(AHCI_DEBUG, "AHCI Port {}: Do a {}, lba {}, block count {} @ {}, ended", representative_port_index(), direction == AsyncBlockDeviceRequest::RequestType::Write ? "write" : "read", lba, block_count, m_dma_buffers[0].paddr());
+    dbgln_if(AHCI_DEBUG, "AHCI Port {}: Do a {}, lba {}, block count {}, slot {}, ended", representative_port_index(), direction == AsyncBlockDeviceRequest::RequestType::Write ? "write" : "read", lba, block_count, slot_index);
     return true;
 }
 
@@ -609,8 +774,7 @@ bool AHCIPort::identify_device(ScopedSpinLock<SpinLock<u8>>& main_lock)
     // QEMU doesn't care if we don't set the correct CFL field in this register, real hardware will set an handshake error bit in PxSERR register.
     command_list_entries[unused_command_header.value()].attributes = (size_t)FIS::DwordCount::RegisterHostToDevice | AHCI::CommandHeaderAttributes::P | AHCI::CommandHeaderAttributes::C;
 
-    auto command_table_region = MM.allocate_kernel_region(m_command_table_pages[unused_command_header.value()].paddr().page_base(), page_round_up(sizeof(AHCI::CommandTable)), "AHCI Command Table", Region::Access::Read | Region::Access::Write);
-    auto& command_table = *(volatile AHCI::CommandTable*)command_table_region->vaddr().as_ptr();
+    auto& command_table = this->command_table(unused_command_header.value());
     memset(const_cast<u8*>(command_table.command_fis), 0, 64);
     command_table.descriptors[0].base_high = 0;
     command_table.descriptors[0].base_low = m_parent_handler->get_identify_metadata_physical_region(m_port_index).get();
@@ -662,13 +826,13 @@ bool AHCIPort::shutdown()
 Optional<u8> AHCIPort::try_to_find_unused_command_header()
 {
     VERIFY(m_lock.is_locked());
-    u32 commands_issued = m_port_registers.ci;
-    for (size_t index = 0; index < 32; index++) {
-        if (!(commands_issued & 1)) {
+    // A slot stays taken until its request has been completed, even after the HBA is done with it.
+    u32 commands_issued = m_port_registers.ci | m_port_registers.sact;
+    for (size_t index = 0; index < m_command_queue_depth; index++) {
+        if (!m_command_slots[index].request && !(commands_issued & (1u << index))) {
             dbgln_if(AHCI_DEBUG, "AHCI Port {}: unused command header at index {}", representative_port_index(), index);
             return index;
         }
-        commands_issued >>= 1;
     }
     return {};
 }
@@ -687,10 +851,8 @@ void AHCIPort::mark_command_header_ready_to_process(u8 command_header_index) con
     VERIFY(m_lock.is_locked());
     VERIFY(m_hard_lock.is_locked());
     VERIFY(is_operable());
-    VERIFY(!m_wait_for_completion);
-    m_wait_for_completion = true;
     dbgln_if(AHCI_DEBUG, "AHCI Port {}: Marking command header at index {} as ready to process.", representative_port_index(), command_header_index);
-    m_port_registers.ci = 1 << command_header_index;
+    m_port_registers.ci = 1u << command_header_index;
 }
 
 void AHCIPort::stop_command_list_processing() const
@@ -1,6 +1,7 @@
 #pragma once
 
 // includes
+#include <AK/Array.h>
 #include <AK/OwnPtr.h>
 #include <AK/RefPtr.h>
 #include <Kernel/Devices/Device.h>
@@ -27,20 +28,6 @@ class AHCIPort : public RefCounted<AHCIPort> {
     friend class AHCIPortHandler;
     friend class SATADiskDevice;
 
-private:
-    class ScatterList : public RefCounted<ScatterList> {
-    public:
-        static NonnullRefPtr<ScatterList> create(AsyncBlockDeviceRequest&, NonnullRefPtrVector<PhysicalPage> allocated_pages, size_t device_block_size);
-        const VMObject& vmobject() const { return m_vm_object; }
-        VirtualAddress dma_region() const { return m_dma_region->vaddr(); }
-        size_t scatters_count() const { return m_vm_object->physical_pages().size(); }
-
-    private:
-        ScatterList(AsyncBlockDeviceRequest&, NonnullRefPtrVector<PhysicalPage> allocated_pages, size_t device_block_size);
-        NonnullRefPtr<AnonymousVMObject> m_vm_object;
-        OwnPtr<Region> m_dma_region;
-    };
-
 public:
     UNMAP_AFTER_INIT static NonnullRefPtr<AHCIPort> create(const AHCIPortHandler&, volatile AHCI::PortRegisters&, u32 port_index);
 
@@ -52,6 +39,9 @@ public:
 
     RefPtr<StorageDevice> connected_device() const { return m_connected_device; }
 
+    size_t command_queue_depth() const { return m_command_queue_depth; }
+    bool is_native_command_queuing_enabled() const { return m_native_command_queuing_enabled; }
+
     bool reset();
     UNMAP_AFTER_INIT bool initialize_without_reset();
     void handle_interrupt();
@@ -76,11 +66,36 @@ private:
     ALWAYS_INLINE void spin_up() const;
     ALWAYS_INLINE void power_on() const;
 
+    // A request is transferred with one or more commands, each covering as many
+    // blocks as fit into the physical region descriptors of the slot's command table.
+    static constexpr size_t max_descriptors_per_command = (PAGE_SIZE - sizeof(AHCI::CommandTable)) / sizeof(AHCI::PhysicalRegionDescriptor);
+    static constexpr size_t max_descriptor_byte_count = 4 * MiB;
+    static constexpr size_t max_blocks_per_command = 0xffff;
+
+    struct CommandSlot {
+        RefPtr<AsyncBlockDeviceRequest> request;
+        // Pages of the request buffer that the current command transfers to or from.
+        // Holding on to them keeps them from being freed while the device accesses them,
+        // and for reads they're also pinned against becoming copy-on-write.
+        NonnullRefPtrVector<PhysicalPage> pinned_pages;
+        bool pinned_pages_for_device_writes { false };
+        size_t completed_block_count { 0 };
+        size_t command_block_count { 0 };
+        size_t descriptors_count { 0 };
+        bool uses_bounce_buffer { false };
+    };
+
     void start_request(AsyncBlockDeviceRequest&);
-    void complete_current_request(AsyncDeviceRequest::RequestResult);
-    bool access_device(AsyncBlockDeviceRequest::RequestType, u64 lba, u8 block_count);
-    size_t calculate_descriptors_count(size_t block_count) const;
-    [[nodiscard]] Optional<AsyncDeviceRequest::RequestResult> prepare_and_set_scatter_list(AsyncBlockDeviceRequest& request);
+    void complete_request(u8 slot_index, AsyncDeviceRequest::RequestResult);
+    void process_completed_slots(u32 completed_slots);
+    void release_pinned_pages(CommandSlot&);
+    [[nodiscard]] Optional<AsyncDeviceRequest::RequestResult> issue_next_command(u8 slot_index);
+    bool access_device(u8 slot_index, AsyncBlockDeviceRequest::RequestType, u64 lba, u16 block_count);
+    [[nodiscard]] Optional<AsyncDeviceRequest::RequestResult> prepare_and_set_scatter_list(u8 slot_index, AsyncBlockDeviceRequest& request);
+    size_t set_direct_scatter_list(u8 slot_index, AsyncBlockDeviceRequest& request, size_t max_block_count);
+
+    volatile AHCI::CommandTable& command_table(u8 slot_index) const { return *(volatile AHCI::CommandTable*)m_command_tables_region->vaddr().offset(slot_index * PAGE_SIZE).as_ptr(); }
+    u8* dma_buffer(u8 slot_index) const { return m_dma_buffers_region->vaddr().offset(slot_index * PAGE_SIZE).as_ptr(); }
 
     ALWAYS_INLINE bool is_interrupts_enabled() const;
 
@@ -107,15 +122,25 @@ private:
     // Data members
 
     EntropySource m_entropy_source;
-    RefPtr<AsyncBlockDeviceRequest> m_current_request;
+    Array<CommandSlot, AHCI::Limits::MaxCommands> m_command_slots;
+    // Slots that were issued to the HBA, and the subset of those whose completion was
+    // already seen by the interrupt handler. Both are protected by m_hard_lock.
+    u32 m_active_command_slots { 0 };
+    u32 m_completing_command_slots { 0 };
+    size_t m_command_slots_count { 1 };
+    size_t m_command_queue_depth { 1 };
+    bool m_native_command_queuing_enabled { false };
     SpinLock<u8> m_hard_lock;
     Lock m_lock { "AHCIPort" };
 
     mutable bool m_wait_for_completion { false };
     bool m_wait_connect_for_completion { false };
 
+    // Bounce pages for buffers that can't be accessed by the device directly.
     NonnullRefPtrVector<PhysicalPage> m_dma_buffers;
+    OwnPtr<Region> m_dma_buffers_region;
     NonnullRefPtrVector<PhysicalPage> m_command_table_pages;
+    OwnPtr<Region> m_command_tables_region;
     RefPtr<PhysicalPage> m_command_list_page;
     OwnPtr<Region> m_command_list_region;
     RefPtr<PhysicalPage> m_fis_receive_page;
@@ -127,7 +152,6 @@ private:
     AHCI::PortInterruptStatusBitField m_interrupt_status;
     AHCI::PortInterruptEnableBitField m_interrupt_enable;
 
-    RefPtr<AHCIPort::ScatterList> m_current_scatter_list;
     bool m_disabled_by_firmware { false };
 };
 }
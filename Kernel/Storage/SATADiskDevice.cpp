@@ -33,6 +33,17 @@ void SATADiskDevice::start_request(AsyncBlockDeviceRequest& request)
     m_port->start_request(request);
 }
 
+size_t SATADiskDevice::max_request_size() const
+{
+    // The port splits requests into as many commands as it needs.
+    return 1 * MiB;
+}
+
+size_t SATADiskDevice::max_in_flight_requests() const
+{
+    return m_port->command_queue_depth();
+}
+
 String SATADiskDevice::device_name() const
 {
     return String::formatted("hd{:c}", 'a' + minor());
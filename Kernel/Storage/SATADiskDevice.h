@@ -23,10 +23,15 @@ public:
     virtual ~SATADiskDevice() override;
 
     // ^StorageDevice
+    virtual size_t max_request_size() const override;
+
     // ^BlockDevice
     virtual void start_request(AsyncBlockDeviceRequest&) override;
     virtual String device_name() const override;
 
+    // ^Device
+    virtual size_t max_in_flight_requests() const override;
+
 private:
     SATADiskDevice(const AHCIController&, const AHCIPort&, size_t sector_size, u64 max_addressable_block);
 
@@ -18,6 +18,10 @@ public:
 
     NonnullRefPtr<StorageController> controller() const;
 
+    // PATAChannel will chuck a wobbly if we try to transfer more than PAGE_SIZE
+    // at a time, because it uses a single page for its DMA buffer.
+    virtual size_t max_request_size() const { return PAGE_SIZE; }
+
     // ^BlockDevice
     virtual KResultOr<size_t> read(FileDescription&, u64, UserOrKernelBuffer&, size_t) override;
     virtual bool can_read(const FileDescription&, size_t) const override;
@@ -97,7 +97,7 @@ KResultOr<FlatPtr> handle(RegisterState& regs, FlatPtr function, FlatPtr arg1, F
         }
     }
 
-    if (function == SC_fork || function == SC_sigreturn) {
+    if (function == SC_fork || function == SC_vfork || function == SC_sigreturn) {
         // These syscalls want the RegisterState& rather than individual parameters.
         auto handler = (HandlerWithRegisterState)s_syscall_table[function];
         return (process.*(handler))(regs);
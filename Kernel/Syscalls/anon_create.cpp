@@ -42,7 +42,7 @@ KResultOr<int> Process::sys$anon_create(size_t size, int options)
     if (options & O_CLOEXEC)
         fd_flags |= FD_CLOEXEC;
 
-    m_fds[new_fd].set(move(description), fd_flags);
+    m_fds.set(new_fd, move(description), fd_flags);
     return new_fd;
 }
 
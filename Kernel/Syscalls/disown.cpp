@@ -16,8 +16,7 @@ KResultOr<int> Process::sys$disown(ProcessID pid)
         return ESRCH;
     if (process->ppid() != this->pid())
         return ECHILD;
-    ProtectedDataMutationScope scope(*process);
-    process->m_ppid = 0;
+    process->reparent(nullptr);
     process->disowned_by_waiter(*this);
     return 0;
 }
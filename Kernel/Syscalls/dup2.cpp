@@ -19,7 +19,7 @@ KResultOr<int> Process::sys$dup2(int old_fd, int new_fd)
         return 0;
     if (new_fd < 0 || new_fd >= m_max_open_file_descriptors)
         return EINVAL;
-    m_fds[new_fd].set(*description);
+    m_fds.set(new_fd, *description);
     return new_fd;
 }
 
@@ -0,0 +1,139 @@
+// includes
+#include <AK/ScopeGuard.h>
+#include <Kernel/Debug.h>
+#include <Kernel/FileSystem/EventPoll.h>
+#include <Kernel/FileSystem/FileDescription.h>
+#include <Kernel/Process.h>
+
+namespace Kernel {
+
+KResultOr<int> Process::sys$epoll_create(int flags)
+{
+    REQUIRE_PROMISE(stdio);
+    if (flags & ~EPOLL_CLOEXEC)
+        return EINVAL;
+
+    int fd = alloc_fd();
+    if (fd < 0)
+        return fd;
+
+    auto description = FileDescription::create(*EventPoll::create());
+    if (description.is_error())
+        return description.error();
+    description.value()->set_readable(true);
+
+    u32 fd_flags = 0;
+    if (flags & EPOLL_CLOEXEC)
+        fd_flags |= FD_CLOEXEC;
+
+    m_fds.set(fd, description.release_value(), fd_flags);
+    return fd;
+}
+
+KResultOr<int> Process::sys$epoll_ctl(Userspace<const Syscall::SC_epoll_ctl_params*> user_params)
+{
+    REQUIRE_PROMISE(stdio);
+    Syscall::SC_epoll_ctl_params params {};
+    if (!copy_from_user(&params, user_params))
+        return EFAULT;
+
+    auto epoll_description = file_description(params.epoll_fd);
+    if (!epoll_description)
+        return EBADF;
+    if (!epoll_description->file().is_event_poll())
+        return EINVAL;
+    auto& event_poll = static_cast<EventPoll&>(epoll_description->file());
+
+    auto description = file_description(params.fd);
+    if (!description)
+        return EBADF;
+
+    epoll_event event {};
+    if (params.op != EPOLL_CTL_DEL && !copy_from_user(&event, params.event))
+        return EFAULT;
+
+    KResult result = KSuccess;
+    switch (params.op) {
+    case EPOLL_CTL_ADD:
+        result = event_poll.add_interest(params.fd, *description, event.events, event.data);
+        break;
+    case EPOLL_CTL_MOD:
+        result = event_poll.modify_interest(params.fd, *description, event.events, event.data);
+        break;
+    case EPOLL_CTL_DEL:
+        result = event_poll.remove_interest(params.fd, *description);
+        break;
+    default:
+        return EINVAL;
+    }
+    if (result.is_error())
+        return result;
+    return 0;
+}
+
+KResultOr<int> Process::sys$epoll_wait(Userspace<const Syscall::SC_epoll_wait_params*> user_params)
+{
+    REQUIRE_PROMISE(stdio);
+    Syscall::SC_epoll_wait_params params {};
+    if (!copy_from_user(&params, user_params))
+        return EFAULT;
+
+    if (params.max_events <= 0)
+        return EINVAL;
+
+    auto epoll_description = file_description(params.epoll_fd);
+    if (!epoll_description)
+        return EBADF;
+    if (!epoll_description->file().is_event_poll())
+        return EINVAL;
+    auto& event_poll = static_cast<EventPoll&>(epoll_description->file());
+
+    Thread::BlockTimeout timeout;
+    if (params.timeout) {
+        auto timeout_time = copy_time_from_user(params.timeout);
+        if (!timeout_time.has_value())
+            return EFAULT;
+        timeout = Thread::BlockTimeout(false, &timeout_time.value());
+    }
+
+    auto current_thread = Thread::current();
+
+    u32 previous_signal_mask = 0;
+    if (params.sigmask) {
+        sigset_t sigmask_copy;
+        if (!copy_from_user(&sigmask_copy, params.sigmask))
+            return EFAULT;
+        previous_signal_mask = current_thread->update_signal_mask(sigmask_copy);
+    }
+    ScopeGuard rollback_signal_mask([&]() {
+        if (params.sigmask)
+            current_thread->update_signal_mask(previous_signal_mask);
+    });
+
+    Vector<epoll_event> events;
+    for (;;) {
+        auto result = event_poll.collect_ready_events(events, params.max_events);
+        if (result.is_error())
+            return result;
+        if (!events.is_empty() || !timeout.should_block())
+            break;
+
+        dbgln_if(POLL_SELECT_DEBUG, "epoll_wait: blocking, timeout={}", params.timeout);
+        Thread::FileBlocker::BlockFlags unblock_flags = Thread::FileBlocker::BlockFlags::None;
+        auto block_result = current_thread->block<Thread::ReadBlocker>(timeout, *epoll_description, unblock_flags);
+        if (block_result.was_interrupted())
+            return EINTR;
+        if (block_result.timed_out()) {
+            result = event_poll.collect_ready_events(events, params.max_events);
+            if (result.is_error())
+                return result;
+            break;
+        }
+    }
+
+    if (!events.is_empty() && !copy_to_user(params.events, events.data(), events.size() * sizeof(epoll_event)))
+        return EFAULT;
+    return events.size();
+}
+
+}
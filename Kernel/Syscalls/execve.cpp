@@ -529,6 +529,7 @@ KResult Process::do_exec(NonnullRefPtr<FileDescription> main_program_description
 
     m_space = load_result.space.release_nonnull();
     MemoryManager::enter_space(*m_space);
+    release_vfork_parent();
 
     auto signal_trampoline_region = m_space->allocate_region_with_vmobject(signal_trampoline_range.value(), g_signal_trampoline_region->vmobject(), 0, "Signal trampoline", PROT_READ | PROT_EXEC, true);
     if (signal_trampoline_region.is_error()) {
@@ -551,11 +552,11 @@ KResult Process::do_exec(NonnullRefPtr<FileDescription> main_program_description
 
     clear_futex_queues_on_exec();
 
-    for (size_t i = 0; i < m_fds.size(); ++i) {
-        auto& description_and_flags = m_fds[i];
-        if (description_and_flags.description() && description_and_flags.flags() & FD_CLOEXEC)
-            description_and_flags = {};
-    }
+    m_fds.for_each([&](int fd, auto&) {
+        if (m_fds.flags(fd) & FD_CLOEXEC)
+            m_fds.clear(fd);
+        return IterationDecision::Continue;
+    });
 
     int main_program_fd = -1;
     if (interpreter_description) {
@@ -564,7 +565,7 @@ KResult Process::do_exec(NonnullRefPtr<FileDescription> main_program_description
         auto seek_result = main_program_description->seek(0, SEEK_SET);
         VERIFY(!seek_result.is_error());
         main_program_description->set_readable(true);
-        m_fds[main_program_fd].set(move(main_program_description), FD_CLOEXEC);
+        m_fds.set(main_program_fd, move(main_program_description), FD_CLOEXEC);
     }
 
     new_main_thread = nullptr;
@@ -5,6 +5,7 @@
  */
 
 #include <Kernel/Debug.h>
+#include <Kernel/FileSystem/FIFO.h>
 #include <Kernel/FileSystem/FileDescription.h>
 #include <Kernel/Process.h>
 
@@ -27,13 +28,13 @@ KResultOr<int> Process::sys$fcntl(int fd, int cmd, u32 arg)
         int new_fd = alloc_fd(arg_fd);
         if (new_fd < 0)
             return new_fd;
-        m_fds[new_fd].set(*description);
+        m_fds.set(new_fd, *description);
         return new_fd;
     }
     case F_GETFD:
-        return m_fds[fd].flags();
+        return m_fds.flags(fd);
     case F_SETFD:
-        m_fds[fd].set_flags(arg);
+        m_fds.set_flags(fd, arg);
         break;
     case F_GETFL:
         return description->file_flags();
@@ -42,6 +43,17 @@ KResultOr<int> Process::sys$fcntl(int fd, int cmd, u32 arg)
         break;
     case F_ISTTY:
         return description->is_tty();
+    case F_GETPIPE_SZ:
+        if (!description->is_fifo())
+            return EBADF;
+        return description->fifo()->buffer_capacity();
+    case F_SETPIPE_SZ: {
+        if (!description->is_fifo())
+            return EBADF;
+        if (auto result = description->fifo()->set_buffer_capacity(arg); result.is_error())
+            return result;
+        return description->fifo()->buffer_capacity();
+    }
     default:
         return EINVAL;
     }
@@ -9,6 +9,7 @@
 #include <Kernel/FileSystem/FileDescription.h>
 #include <Kernel/PerformanceEventBuffer.h>
 #include <Kernel/Process.h>
+#include <Kernel/VM/MemoryManager.h>
 #include <Kernel/VM/Region.h>
 
 namespace Kernel {
@@ -16,6 +17,39 @@ namespace Kernel {
 KResultOr<pid_t> Process::sys$fork(RegisterState& regs)
 {
     REQUIRE_PROMISE(proc);
+    auto child_or_error = do_fork(regs, ForkMode::CopyAddressSpace);
+    if (child_or_error.is_error())
+        return child_or_error.error();
+    return child_or_error.value()->pid().value();
+}
+
+KResultOr<pid_t> Process::sys$vfork(RegisterState& regs)
+{
+    REQUIRE_PROMISE(proc);
+    auto child_or_error = do_fork(regs, ForkMode::ShareAddressSpace);
+    if (child_or_error.is_error())
+        return child_or_error.error();
+    auto child = child_or_error.release_value();
+
+    // The child is running on our memory, so we can't run until it's done with it.
+    while (child->m_vfork_parent_waiting) {
+        child->m_vfork_wait_queue.wait_forever("VFork");
+        if (Thread::current()->should_die())
+            break;
+    }
+    return child->pid().value();
+}
+
+void Process::release_vfork_parent()
+{
+    if (!m_vfork_parent_waiting.exchange(false))
+        return;
+    m_vfork_wait_queue.should_block(false);
+    m_vfork_wait_queue.wake_all();
+}
+
+KResultOr<NonnullRefPtr<Process>> Process::do_fork(RegisterState& regs, ForkMode mode)
+{
     RefPtr<Thread> child_first_thread;
     auto child = adopt_ref(*new Process(child_first_thread, m_name, uid(), gid(), pid(), m_is_kernel_process, m_cwd, m_executable, m_tty, this));
     if (!child_first_thread)
@@ -24,8 +58,8 @@ KResultOr<pid_t> Process::sys$fork(RegisterState& regs)
     child->m_root_directory_relative_to_global_root = m_root_directory_relative_to_global_root;
     child->m_veil_state = m_veil_state;
     child->m_unveiled_paths = m_unveiled_paths.deep_copy();
-    child->m_fds = m_fds;
-    child->m_pg = m_pg;
+    child->m_fds.copy_from(m_fds);
+    child->set_process_group(m_pg);
 
     {
         ProtectedDataMutationScope scope { *child };
@@ -64,41 +98,52 @@ KResultOr<pid_t> Process::sys$fork(RegisterState& regs)
     dbgln_if(FORK_DEBUG, "fork: child will begin executing at {:04x}:{:08x} with stack {:04x}:{:08x}, kstack {:04x}:{:08x}", child_tss.cs, child_tss.eip, child_tss.ss, child_tss.esp, child_tss.ss0, child_tss.esp0);
 
     {
+        // The page fault handler takes the MM lock before our space lock, and so must we:
+        // writes through the page tables we protect here fault until we're done.
+        ScopedSpinLock mm_lock(s_mm_lock);
         ScopedSpinLock lock(space().get_lock());
+        // Protect our page tables before cloning the VMObjects, so a write from another of
+        // our threads can't sneak in between the two and end up in the child's memory.
+        if (mode == ForkMode::CopyAddressSpace)
+            MM.write_protect_user_page_tables(space().page_directory());
+        auto share_vmobject = mode == ForkMode::ShareAddressSpace ? Region::ShareVMObject::Yes : Region::ShareVMObject::No;
         for (auto& region : space().regions()) {
             dbgln_if(FORK_DEBUG, "fork: cloning Region({}) '{}' @ {}", region, region->name(), region->vaddr());
-            auto region_clone = region->clone(*child);
+            auto region_clone = region->clone(*child, share_vmobject);
             if (!region_clone) {
                 dbgln("fork: Cannot clone region, insufficient memory");
                 // TODO: tear down new process?
                 return ENOMEM;
             }
 
+            // The child's pages get mapped as it touches them, see Region::handle_fault().
             auto& child_region = child->space().add_region(region_clone.release_nonnull());
-            child_region.map(child->space().page_directory(), ShouldFlushTLB::No);
+            child_region.set_page_directory(child->space().page_directory());
 
             if (region == m_master_tls_region.unsafe_ptr())
                 child->m_master_tls_region = child_region;
         }
-
-        ScopedSpinLock processes_lock(g_processes_lock);
-        g_processes->prepend(child);
     }
 
+    // Not while holding our space lock: /proc/all takes space locks while holding g_processes_lock.
+    register_new(*child);
+
     if (g_profiling_all_threads) {
         VERIFY(g_global_perf_events);
         g_global_perf_events->add_process(*child, ProcessEventType::Create);
     }
 
+    if (mode == ForkMode::ShareAddressSpace)
+        child->m_vfork_parent_waiting = true;
+
     ScopedSpinLock lock(g_scheduler_lock);
     child_first_thread->set_affinity(Thread::current()->affinity());
     child_first_thread->set_state(Thread::State::Runnable);
 
-    auto child_pid = child->pid().value();
     // We need to leak one reference so we don't destroy the Process,
     // which will be dropped by Process::reap
-    (void)child.leak_ref();
-    return child_pid;
+    child->ref();
+    return child;
 }
 
 }
@@ -408,6 +408,17 @@ KResultOr<int> Process::sys$madvise(Userspace<void*> address, size_t size, int a
             return EPERM;
         return region->is_volatile(VirtualAddress(address), size) ? 0 : 1;
     }
+    switch (advice) {
+    case MADV_NORMAL:
+        region->set_access_pattern(Region::AccessPattern::Normal);
+        return 0;
+    case MADV_RANDOM:
+        region->set_access_pattern(Region::AccessPattern::Random);
+        return 0;
+    case MADV_SEQUENTIAL:
+        region->set_access_pattern(Region::AccessPattern::Sequential);
+        return 0;
+    }
     return EINVAL;
 }
 
@@ -30,14 +30,14 @@ KResultOr<int> Process::sys$pipe(int pipefd[2], int flags)
         return open_writer_result.error();
 
     int reader_fd = alloc_fd();
-    m_fds[reader_fd].set(open_reader_result.release_value(), fd_flags);
-    m_fds[reader_fd].description()->set_readable(true);
+    open_reader_result.value()->set_readable(true);
+    m_fds.set(reader_fd, open_reader_result.release_value(), fd_flags);
     if (!copy_to_user(&pipefd[0], &reader_fd))
         return EFAULT;
 
     int writer_fd = alloc_fd();
-    m_fds[writer_fd].set(open_writer_result.release_value(), fd_flags);
-    m_fds[writer_fd].description()->set_writable(true);
+    open_writer_result.value()->set_writable(true);
+    m_fds.set(writer_fd, open_writer_result.release_value(), fd_flags);
     if (!copy_to_user(&pipefd[1], &writer_fd))
         return EFAULT;
 
@@ -9,6 +9,7 @@
 #include <Kernel/FileSystem/VirtualFileSystem.h>
 #include <Kernel/PerformanceEventBuffer.h>
 #include <Kernel/Process.h>
+#include <Kernel/SamplingProfiler.h>
 
 namespace Kernel {
 
@@ -27,6 +28,7 @@ KResultOr<int> Process::sys$profiling_enable(pid_t pid)
             g_global_perf_events->clear();
         else
             g_global_perf_events = PerformanceEventBuffer::try_create_with_size(32 * MiB).leak_ptr();
+        SamplingProfiler::reset_statistics();
         ScopedSpinLock lock(g_processes_lock);
         Process::for_each([](auto& process) {
             g_global_perf_events->add_process(process, ProcessEventType::Create);
@@ -46,6 +48,7 @@ KResultOr<int> Process::sys$profiling_enable(pid_t pid)
         return EPERM;
     if (!process->create_perf_events_buffer_if_needed())
         return ENOMEM;
+    SamplingProfiler::reset_statistics();
     process->set_profiling(true);
     return 0;
 }
@@ -85,7 +88,8 @@ KResultOr<int> Process::sys$profiling_free_buffer(pid_t pid)
         OwnPtr<PerformanceEventBuffer> perf_events;
 
         {
-            ScopedCritical critical;
+            // sys$profiling_map_buffer() looks at the buffer under g_processes_lock.
+            ScopedSpinLock lock(g_processes_lock);
 
             perf_events = g_global_perf_events;
             g_global_perf_events = nullptr;
@@ -105,4 +109,51 @@ KResultOr<int> Process::sys$profiling_free_buffer(pid_t pid)
     process->delete_perf_events_buffer();
     return 0;
 }
+
+KResultOr<FlatPtr> Process::sys$profiling_map_buffer(pid_t pid, u32 cpu)
+{
+    REQUIRE_NO_PROMISES;
+
+    if (pid == -1 && !is_superuser())
+        return EPERM;
+
+    // The buffer may be freed as soon as we let go of g_processes_lock, so only take
+    // a reference to the ring's memory here and map that afterwards.
+    RefPtr<AnonymousVMObject> ring_vmobject;
+    {
+        ScopedSpinLock lock(g_processes_lock);
+        PerformanceEventBuffer* perf_events = nullptr;
+        if (pid == -1) {
+            perf_events = g_global_perf_events;
+        } else {
+            auto process = Process::from_pid(pid);
+            if (!process)
+                return ESRCH;
+            if (!is_superuser() && process->uid() != euid())
+                return EPERM;
+            perf_events = process->perf_events();
+        }
+        if (!perf_events)
+            return ENOENT;
+        ring_vmobject = perf_events->ring_vmobject(cpu);
+    }
+    if (!ring_vmobject)
+        return EINVAL;
+
+    auto region_or_error = PerformanceEventBuffer::map_ring(*this, ring_vmobject.release_nonnull());
+    if (region_or_error.is_error())
+        return region_or_error.error();
+    return region_or_error.value()->vaddr().get();
+}
+
+KResultOr<int> Process::sys$profiling_configure(u32 sample_frequency, u32 flags)
+{
+    REQUIRE_NO_PROMISES;
+    if (!is_superuser())
+        return EPERM;
+    auto frequency_or_error = SamplingProfiler::configure(sample_frequency, flags);
+    if (frequency_or_error.is_error())
+        return frequency_or_error.error();
+    return frequency_or_error.value();
+}
 }
@@ -22,7 +22,8 @@ KResultOr<int> Process::sys$select(Userspace<const Syscall::SC_select_params*> u
     if (!copy_from_user(&params, user_params))
         return EFAULT;
 
-    if (params.nfds < 0)
+    // An fd_set can't name fds past FD_SETSIZE, even if the fd table goes further.
+    if (params.nfds < 0 || params.nfds > FD_SETSIZE)
         return EINVAL;
 
     Thread::BlockTimeout timeout;
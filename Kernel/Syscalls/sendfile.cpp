@@ -0,0 +1,141 @@
+// includes
+#include <AK/Optional.h>
+#include <Kernel/Debug.h>
+#include <Kernel/FileSystem/FileDescription.h>
+#include <Kernel/KBuffer.h>
+#include <Kernel/Process.h>
+
+namespace Kernel {
+
+using BlockFlags = Thread::FileBlocker::BlockFlags;
+
+// How much data sendfile() moves per step.
+static constexpr size_t sendfile_chunk_size = 64 * KiB;
+
+KResultOr<ssize_t> Process::sys$sendfile(Userspace<const Syscall::SC_sendfile_params*> user_params)
+{
+    REQUIRE_PROMISE(stdio);
+    Syscall::SC_sendfile_params params {};
+    if (!copy_from_user(&params, user_params))
+        return EFAULT;
+    if (params.count > NumericLimits<ssize_t>::max())
+        return EINVAL;
+
+    auto in_description = file_description(params.in_fd);
+    if (!in_description)
+        return EBADF;
+    if (!in_description->is_readable())
+        return EBADF;
+    if (in_description->is_directory())
+        return EISDIR;
+
+    auto out_description = file_description(params.out_fd);
+    if (!out_description)
+        return EBADF;
+    if (!out_description->is_writable())
+        return EBADF;
+
+    Optional<off_t> offset;
+    if (params.offset) {
+        off_t user_offset;
+        if (!copy_from_user(&user_offset, params.offset))
+            return EFAULT;
+        if (user_offset < 0)
+            return EINVAL;
+        if (!in_description->file().is_seekable())
+            return ESPIPE;
+        offset = user_offset;
+    }
+
+    dbgln_if(IO_DEBUG, "sys$sendfile({}, {}, {})", params.out_fd, params.in_fd, params.count);
+
+    // Reads from the input description, starting at the explicit offset if there is one.
+    // For inode-backed files this reads straight out of the file system's block cache.
+    SpliceSource read_input = [&](UserOrKernelBuffer& buffer, size_t size) -> KResultOr<size_t> {
+        if (!offset.has_value())
+            return in_description->read(buffer, size);
+        auto nread_or_error = in_description->file().read(*in_description, offset.value(), buffer, size);
+        if (!nread_or_error.is_error())
+            offset.value() += nread_or_error.value();
+        return nread_or_error;
+    };
+
+    // Used when the output can't be filled directly. Data read from the input is then
+    // copied once more into the output, so we must be able to rewind the input when
+    // the output doesn't take all of it.
+    OwnPtr<KBuffer> bounce_buffer;
+    auto write_through_bounce_buffer = [&](size_t size) -> KResultOr<size_t> {
+        if (!in_description->file().is_seekable())
+            return EINVAL;
+        if (!bounce_buffer) {
+            bounce_buffer = KBuffer::try_create_with_size(sendfile_chunk_size, Region::Access::Read | Region::Access::Write, "sendfile");
+            if (!bounce_buffer)
+                return ENOMEM;
+        }
+        auto buffer = UserOrKernelBuffer::for_kernel_buffer(bounce_buffer->data());
+        auto nread_or_error = read_input(buffer, size);
+        if (nread_or_error.is_error() || nread_or_error.value() == 0)
+            return nread_or_error;
+        auto nread = nread_or_error.value();
+
+        auto nwritten_or_error = do_write(*out_description, buffer, nread);
+        size_t nwritten = nwritten_or_error.is_error() ? 0 : nwritten_or_error.value();
+        if (nwritten < nread) {
+            if (offset.has_value()) {
+                offset.value() -= nread - nwritten;
+            } else {
+                auto seek_result = in_description->seek(-(off_t)(nread - nwritten), SEEK_CUR);
+                if (seek_result.is_error())
+                    return seek_result.error();
+            }
+        }
+        if (nwritten_or_error.is_error())
+            return nwritten_or_error.error();
+        return nwritten;
+    };
+
+    size_t total_nwritten = 0;
+    while (total_nwritten < params.count) {
+        if (!in_description->can_read()) {
+            if (total_nwritten)
+                break;
+            if (!in_description->is_blocking())
+                return EAGAIN;
+            auto unblock_flags = BlockFlags::None;
+            if (Thread::current()->block<Thread::ReadBlocker>({}, *in_description, unblock_flags).was_interrupted())
+                return EINTR;
+            if (!has_flag(unblock_flags, BlockFlags::Read))
+                return EAGAIN;
+        }
+        if (!out_description->can_write()) {
+            if (total_nwritten)
+                break;
+            if (!out_description->is_blocking())
+                return EAGAIN;
+            auto unblock_flags = BlockFlags::None;
+            if (Thread::current()->block<Thread::WriteBlocker>({}, *out_description, unblock_flags).was_interrupted())
+                return EINTR;
+            if (!has_flag(unblock_flags, BlockFlags::Write))
+                return EAGAIN;
+        }
+
+        size_t size = min(params.count - total_nwritten, sendfile_chunk_size);
+        auto nwritten_or_error = out_description->file().splice_from(*out_description, read_input, size);
+        if (nwritten_or_error.is_error() && nwritten_or_error.error() == -ENOTSUP)
+            nwritten_or_error = write_through_bounce_buffer(size);
+        if (nwritten_or_error.is_error()) {
+            if (total_nwritten)
+                break;
+            return nwritten_or_error.error();
+        }
+        if (nwritten_or_error.value() == 0)
+            break;
+        total_nwritten += nwritten_or_error.value();
+    }
+
+    if (params.offset && !copy_to_user(params.offset, &offset.value()))
+        return EFAULT;
+    return total_nwritten;
+}
+
+}
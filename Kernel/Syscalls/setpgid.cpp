@@ -35,7 +35,7 @@ KResultOr<pid_t> Process::sys$setsid()
     if (found_process_with_same_pgid_as_my_pid)
         return EPERM;
     // Create a new Session and a new ProcessGroup.
-    m_pg = ProcessGroup::create(ProcessGroupID(pid().value()));
+    set_process_group(ProcessGroup::create(ProcessGroupID(pid().value())));
     m_tty = nullptr;
     ProtectedDataMutationScope scope { *this };
     m_sid = pid().value();
@@ -115,7 +115,7 @@ KResultOr<int> Process::sys$setpgid(pid_t specified_pid, pid_t specified_pgid)
         return EPERM;
     }
     // FIXME: There are more EPERM conditions to check for here..
-    process->m_pg = ProcessGroup::find_or_create(new_pgid);
+    process->set_process_group(ProcessGroup::find_or_create(new_pgid));
     return 0;
 }
 
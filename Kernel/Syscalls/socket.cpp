@@ -29,7 +29,7 @@ void Process::setup_socket_fd(int fd, NonnullRefPtr<FileDescription> description
         flags |= FD_CLOEXEC;
     if (type & SOCK_NONBLOCK)
         description->set_blocking(false);
-    m_fds[fd].set(*description, flags);
+    m_fds.set(fd, *description, flags);
 }
 
 KResultOr<int> Process::sys$socket(int domain, int type, int protocol)
@@ -125,7 +125,7 @@ KResultOr<int> Process::sys$accept(int accepting_socket_fd, Userspace<sockaddr*>
 
     accepted_socket_description_result.value()->set_readable(true);
     accepted_socket_description_result.value()->set_writable(true);
-    m_fds[accepted_socket_fd].set(accepted_socket_description_result.release_value(), 0);
+    m_fds.set(accepted_socket_fd, accepted_socket_description_result.release_value(), 0);
 
     // NOTE: Moving this state to Completed is what causes connect() to unblock on the client side.
     accepted_socket->set_setup_state(Socket::SetupState::Completed);
@@ -36,8 +36,8 @@ KResultOr<int> Process::sys$watch_file(Userspace<const char*> user_path, size_t
     if (description.is_error())
         return description.error();
 
-    m_fds[fd].set(description.release_value());
-    m_fds[fd].description()->set_readable(true);
+    description.value()->set_readable(true);
+    m_fds.set(fd, description.release_value());
     return fd;
 }
 
@@ -0,0 +1,34 @@
+// includes
+#include <AK/Singleton.h>
+#include <Kernel/Process.h>
+#include <Kernel/Tasks/PageZeroingTask.h>
+#include <Kernel/VM/MemoryManager.h>
+#include <Kernel/WaitQueue.h>
+
+namespace Kernel {
+
+static AK::Singleton<WaitQueue> s_page_zeroing_wait_queue;
+static Atomic<bool> s_page_zeroing_task_running { false };
+
+void PageZeroingTask::spawn()
+{
+    RefPtr<Thread> page_zeroing_thread;
+    Process::create_kernel_process(page_zeroing_thread, "PageZeroingTask", [] {
+        Thread::current()->set_priority(THREAD_PRIORITY_LOW);
+        for (;;) {
+            MM.refill_zeroed_pages();
+            s_page_zeroing_wait_queue->wait_forever("PageZeroingTask");
+        }
+    });
+    s_page_zeroing_task_running.store(true, AK::MemoryOrder::memory_order_release);
+}
+
+void PageZeroingTask::request_refill()
+{
+    // Page allocations start long before the task (or even the scheduler) exists.
+    if (!s_page_zeroing_task_running.load(AK::MemoryOrder::memory_order_acquire))
+        return;
+    s_page_zeroing_wait_queue->wake_one();
+}
+
+}
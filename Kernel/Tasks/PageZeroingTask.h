@@ -0,0 +1,10 @@
+#pragma once
+
+namespace Kernel {
+
+class PageZeroingTask {
+public:
+	static void spawn();
+	static void request_refill();
+};
+}
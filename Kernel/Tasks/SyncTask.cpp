@@ -1,11 +1,16 @@
 // includes
+#include <AK/Singleton.h>
 #include <Kernel/FileSystem/VirtualFileSystem.h>
 #include <Kernel/Process.h>
 #include <Kernel/Tasks/SyncTask.h>
 #include <Kernel/Time/TimeManagement.h>
+#include <Kernel/VM/MemoryManager.h>
+#include <Kernel/WaitQueue.h>
 
 namespace Kernel {
 
+static AK::Singleton<WaitQueue> s_sync_wait_queue;
+
 void SyncTask::spawn()
 {
     RefPtr<Thread> syncd_thread;
@@ -13,9 +18,18 @@ void SyncTask::spawn()
         dbgln("SyncTask is running");
         for (;;) {
             VFS::the().sync();
-            (void)Thread::current()->sleep(Time::from_seconds(1));
+            if (MM.is_under_memory_pressure())
+                FS::shrink_caches();
+            // Sync once a second, or earlier if a block cache is filling up with dirty blocks.
+            auto timeout = Time::from_seconds(1);
+            (void)s_sync_wait_queue->wait_on(Thread::BlockTimeout(false, &timeout), "SyncTask");
         }
     });
 }
 
-}
\ No newline at end of file
+void SyncTask::request_writeback()
+{
+    s_sync_wait_queue->wake_one();
+}
+
+}
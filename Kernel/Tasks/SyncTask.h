@@ -5,5 +5,6 @@ namespace Kernel{
 class SyncTask {
 public:
 	static void spawn();
+	static void request_writeback();
 };
-}
\ No newline at end of file
+}
@@ -64,6 +64,7 @@ class Thread
     friend class ProtectedProcessBase;
     friend class Scheduler;
     friend class ThreadReadyQueue;
+    friend struct ProcessorReadyQueues;
 
     static SpinLock<u8> g_tid_map_lock;
     static HashMap<ThreadID, Thread*>* g_tid_map;
@@ -1105,7 +1106,9 @@ private:
     Thread(NonnullRefPtr<Process>, NonnullOwnPtr<Region> kernel_stack_region);
 
     IntrusiveListNode m_process_thread_list_node;
-    int m_runnable_priority { -1 };
+    // Both are written under the lock of the ready queue the thread sits on.
+    Atomic<int, AK::MemoryOrder::memory_order_relaxed> m_runnable_priority { -1 };
+    Atomic<u32, AK::MemoryOrder::memory_order_relaxed> m_runnable_cpu { 0 };
 
     friend class WaitQueue;
 
@@ -160,6 +160,11 @@ time_t TimeManagement::ticks_per_second() const
     return m_time_keeper_timer->ticks_per_second();
 }
 
+size_t TimeManagement::system_timer_ticks_per_second() const
+{
+    return m_system_timer->ticks_per_second();
+}
+
 time_t TimeManagement::boot_time() const
 {
     return RTC::boot_time();
@@ -39,6 +39,8 @@ public:
     Time epoch_time(TimePrecision = TimePrecision::Precise) const;
     void set_epoch_time(Time);
     time_t ticks_per_second() const;
+    // How often the system timer interrupts each processor, which may differ from ticks_per_second().
+    size_t system_timer_ticks_per_second() const;
     time_t boot_time() const;
 
     bool is_system_timer(const HardwareTimerBase&) const;
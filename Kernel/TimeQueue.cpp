@@ -42,6 +42,97 @@ Time Timer::now(bool is_firing) const
     return TimeManagement::the().current_time(clock_id).value();
 }
 
+void TimerWheel::add_timer_locked(Timer& timer)
+{
+    VERIFY(m_lock.is_locked());
+    VERIFY(!timer.m_list);
+
+    // Timers that are already due go into the slot of the tick we are about to process.
+    u64 expire_tick = max(timer.m_expire_tick, m_current_tick);
+    u64 delta = expire_tick - m_current_tick;
+    size_t level = 0;
+    while (level < levels_count - 1 && delta >= (u64)slots_per_level << (level * level_bits))
+        level++;
+    // Timers beyond the range of the wheel wait in the last slot of the top level,
+    // and get placed again once that slot comes up.
+    u64 wheel_range = (u64)1 << (levels_count * level_bits);
+    if (delta >= wheel_range)
+        expire_tick = m_current_tick + wheel_range - 1;
+
+    auto& slot = m_slots[level][(expire_tick >> (level * level_bits)) & (slots_per_level - 1)];
+    slot.append(&timer);
+    timer.m_list = &slot;
+    m_timers_count++;
+}
+
+void TimerWheel::remove_timer_locked(Timer& timer)
+{
+    VERIFY(m_lock.is_locked());
+    VERIFY(timer.m_list && timer.m_list != &m_timers_executing);
+    timer.m_list->remove(&timer);
+    timer.m_list = nullptr;
+    m_timers_count--;
+}
+
+void TimerWheel::cascade_locked()
+{
+    // Whenever the current tick crosses into the range of another slot of a higher
+    // level, the timers in there are spread out over the levels below.
+    for (size_t level = levels_count - 1; level > 0; level--) {
+        if (m_current_tick & (((u64)1 << (level * level_bits)) - 1))
+            continue;
+        auto& slot = m_slots[level][(m_current_tick >> (level * level_bits)) & (slots_per_level - 1)];
+        while (auto* timer = slot.remove_head()) {
+            timer->m_list = nullptr;
+            m_timers_count--;
+            add_timer_locked(*timer);
+        }
+    }
+}
+
+void TimerWheel::rebase_locked(u64 now_tick)
+{
+    // The clock jumped, or nobody fired this wheel for a while. Rather than walking
+    // every tick in between, place all timers again relative to the new tick.
+    InlineLinkedList<Timer> timers;
+    for (auto& level : m_slots) {
+        for (auto& slot : level) {
+            while (auto* timer = slot.remove_head()) {
+                timer->m_list = nullptr;
+                timers.append(timer);
+            }
+        }
+    }
+    m_timers_count = 0;
+    m_current_tick = now_tick;
+    while (auto* timer = timers.remove_head())
+        add_timer_locked(*timer);
+}
+
+Timer* TimerWheel::take_expired_timer_locked(u64 now_tick)
+{
+    VERIFY(m_lock.is_locked());
+    if (m_timers_count == 0) {
+        m_current_tick = max(m_current_tick, now_tick + 1);
+        return nullptr;
+    }
+    if (now_tick + 1 < m_current_tick || (now_tick >= m_current_tick && now_tick - m_current_tick > slots_per_level))
+        rebase_locked(now_tick);
+
+    while (m_current_tick <= now_tick) {
+        auto& slot = m_slots[0][m_current_tick & (slots_per_level - 1)];
+        if (auto* timer = slot.remove_head()) {
+            m_timers_count--;
+            m_timers_executing.append(timer);
+            timer->m_list = &m_timers_executing;
+            return timer;
+        }
+        m_current_tick++;
+        cascade_locked();
+    }
+    return nullptr;
+}
+
 TimerQueue& TimerQueue::the()
 {
     return *s_the;
@@ -50,6 +141,35 @@ TimerQueue& TimerQueue::the()
 UNMAP_AFTER_INIT TimerQueue::TimerQueue()
 {
     m_ticks_per_second = TimeManagement::the().ticks_per_second();
+    m_nanoseconds_per_tick = 1'000'000'000 / m_ticks_per_second;
+}
+
+u64 TimerQueue::tick_for_time(const Time& time) const
+{
+    auto nanoseconds = time.to_nanoseconds();
+    if (nanoseconds < 0)
+        return 0;
+    return (u64)nanoseconds / m_nanoseconds_per_tick;
+}
+
+u64 TimerQueue::current_tick(clockid_t clock_id) const
+{
+    return tick_for_time(TimeManagement::the().current_time(clock_id).value());
+}
+
+TimerQueue::ProcessorTimerWheels& TimerQueue::current_processor_wheels()
+{
+    auto& slot = m_processor_wheels[Processor::id()];
+    if (auto* wheels = slot.load(AK::MemoryOrder::memory_order_acquire))
+        return *wheels;
+    auto* new_wheels = new ProcessorTimerWheels(current_tick(CLOCK_MONOTONIC_COARSE), current_tick(CLOCK_REALTIME_COARSE));
+    ProcessorTimerWheels* expected = nullptr;
+    if (!slot.compare_exchange_strong(expected, new_wheels, AK::MemoryOrder::memory_order_acq_rel)) {
+        // We got moved to another processor, and lost the race against it.
+        delete new_wheels;
+        return *expected;
+    }
+    return *new_wheels;
 }
 
 RefPtr<Timer> TimerQueue::add_timer_without_id(clockid_t clock_id, const Time& deadline, Function<void()>&& callback)
@@ -63,51 +183,41 @@ RefPtr<Timer> TimerQueue::add_timer_without_id(clockid_t clock_id, const Time& d
     // inadvertently cancel another timer that has been created between
     // returning from the timer handler and a call to cancel_timer().
     auto timer = adopt(*new Timer(clock_id, deadline, move(callback)));
-
-    ScopedSpinLock lock(g_timerqueue_lock);
     timer->m_id = 0; // Don't generate a timer id
-    add_timer_locked(timer);
+
+    auto& wheel = wheel_for_timer(current_processor_wheels(), timer);
+    ScopedSpinLock lock(wheel.m_lock);
+    add_timer_locked(wheel, timer);
     return timer;
 }
 
 TimerId TimerQueue::add_timer(NonnullRefPtr<Timer>&& timer)
 {
-    ScopedSpinLock lock(g_timerqueue_lock);
+    {
+        ScopedSpinLock lock(g_timerqueue_lock);
+        timer->m_id = ++m_timer_id_count;
+        VERIFY(timer->m_id != 0); // wrapped
+        m_timers_by_id.set(timer->m_id, timer.ptr());
+    }
 
-    timer->m_id = ++m_timer_id_count;
-    VERIFY(timer->m_id != 0); // wrapped
-    add_timer_locked(move(timer));
+    auto& wheel = wheel_for_timer(current_processor_wheels(), timer);
+    ScopedSpinLock lock(wheel.m_lock);
+    add_timer_locked(wheel, timer);
     return timer->m_id;
 }
 
-void TimerQueue::add_timer_locked(NonnullRefPtr<Timer> timer)
+void TimerQueue::add_timer_locked(TimerWheel& wheel, Timer& timer)
 {
-    Time timer_expiration = timer->m_expires;
-
-    VERIFY(!timer->is_queued());
-
-    auto& queue = queue_for_timer(*timer);
-    if (queue.list.is_empty()) {
-        queue.list.append(&timer.leak_ref());
-        queue.next_timer_due = timer_expiration;
-    } else {
-        Timer* following_timer = nullptr;
-        queue.list.for_each([&](Timer& t) {
-            if (t.m_expires > timer_expiration) {
-                following_timer = &t;
-                return IterationDecision::Break;
-            }
-            return IterationDecision::Continue;
-        });
-        if (following_timer) {
-            bool next_timer_needs_update = queue.list.head() == following_timer;
-            queue.list.insert_before(following_timer, &timer.leak_ref());
-            if (next_timer_needs_update)
-                queue.next_timer_due = timer_expiration;
-        } else {
-            queue.list.append(&timer.leak_ref());
-        }
-    }
+    VERIFY(!timer.is_queued());
+    VERIFY(!timer.m_wheel);
+
+    // Round up, so that a timer never fires before its expiration time.
+    timer.m_expire_tick = tick_for_time(timer.m_expires) + 1;
+    timer.m_wheel = &wheel;
+    timer.set_queued(true);
+    // The wheel holds a reference to the timer until it was fired or cancelled.
+    timer.ref();
+    wheel.add_timer_locked(timer);
 }
 
 TimerId TimerQueue::add_timer(clockid_t clock_id, const Time& deadline, Function<void()>&& callback)
@@ -119,68 +229,30 @@ TimerId TimerQueue::add_timer(clockid_t clock_id, const Time& deadline, Function
 
 bool TimerQueue::cancel_timer(TimerId id)
 {
-    Timer* found_timer = nullptr;
-    Queue* timer_queue = nullptr;
-
-    ScopedSpinLock lock(g_timerqueue_lock);
-    if (m_timer_queue_monotonic.list.for_each([&](Timer& timer) {
-            if (timer.m_id == id) {
-                found_timer = &timer;
-                timer_queue = &m_timer_queue_monotonic;
-                return IterationDecision::Break;
-            }
-            return IterationDecision::Continue;
-        })
-        != IterationDecision::Break) {
-        m_timer_queue_realtime.list.for_each([&](Timer& timer) {
-            if (timer.m_id == id) {
-                found_timer = &timer;
-                timer_queue = &m_timer_queue_realtime;
-                return IterationDecision::Break;
-            }
-            return IterationDecision::Continue;
-        });
+    RefPtr<Timer> timer;
+    {
+        ScopedSpinLock lock(g_timerqueue_lock);
+        auto it = m_timers_by_id.find(id);
+        if (it == m_timers_by_id.end())
+            return false;
+        timer = it->value;
     }
-
-    if (!found_timer) {
-        // The timer may be executing right now, if it is then it should
-        // be in m_timers_executing. If it is then release the lock
-        // briefly to allow it to finish by removing itself
-        // NOTE: This can only happen with multiple processors!
-        while (m_timers_executing.for_each([&](Timer& timer) {
-            if (timer.m_id == id)
-                return IterationDecision::Break;
-            return IterationDecision::Continue;
-        }) == IterationDecision::Break) {
-            // NOTE: This isn't the most efficient way to wait, but
-            // it should only happen when multiple processors are used.
-            // Also, the timers should execute pretty quickly, so it
-            // should not loop here for very long. But we can't yield.
-            lock.unlock();
-            Processor::wait_check();
-            lock.lock();
-        }
-        // We were not able to cancel the timer, but at this point
-        // the handler should have completed if it was running!
-        return false;
-    }
-
-    VERIFY(found_timer);
-    VERIFY(timer_queue);
-    remove_timer_locked(*timer_queue, *found_timer);
-    return true;
+    return cancel_timer(*timer);
 }
 
 bool TimerQueue::cancel_timer(Timer& timer)
 {
-    auto& timer_queue = queue_for_timer(timer);
-    ScopedSpinLock lock(g_timerqueue_lock);
-    if (!timer_queue.list.contains_slow(&timer)) {
+    auto* wheel = timer.m_wheel;
+    if (!wheel)
+        return false;
+
+    ScopedSpinLock lock(wheel->m_lock);
+    if (!timer.m_list || timer.m_list == &wheel->m_timers_executing) {
         // The timer may be executing right now, if it is then it should
-        // be in m_timers_executing. If it is then release the lock
+        // be in the executing list. If it is then release the lock
         // briefly to allow it to finish by removing itself
         // NOTE: This can only happen with multiple processors!
-        while (m_timers_executing.contains_slow(&timer)) {
+        while (timer.m_list == &wheel->m_timers_executing) {
             // NOTE: This isn't the most efficient way to wait, but
             // it should only happen when multiple processors are used.
             // Also, the timers should execute pretty quickly, so it
@@ -195,74 +267,84 @@ bool TimerQueue::cancel_timer(Timer& timer)
     }
 
     VERIFY(timer.ref_count() > 1);
-    remove_timer_locked(timer_queue, timer);
-    return true;
-}
-
-void TimerQueue::remove_timer_locked(Queue& queue, Timer& timer)
-{
-    bool was_next_timer = (queue.list.head() == &timer);
-    queue.list.remove(&timer);
+    wheel->remove_timer_locked(timer);
     timer.set_queued(false);
     auto now = timer.now(false);
     if (timer.m_expires > now)
         timer.m_remaining = timer.m_expires - now;
+    lock.unlock();
 
-    if (was_next_timer)
-        update_next_timer_due(queue);
+    if (timer.m_id != 0) {
+        ScopedSpinLock lock(g_timerqueue_lock);
+        m_timers_by_id.remove(timer.m_id);
+    }
     // Whenever we remove a timer that was still queued (but hasn't been
     // fired) we added a reference to it. So, when removing it from the
     // queue we need to drop that reference.
     timer.unref();
+    return true;
 }
 
-void TimerQueue::fire()
+void TimerQueue::did_execute_timer(TimerWheel& wheel, Timer& timer)
 {
-    ScopedSpinLock lock(g_timerqueue_lock);
-
-    auto fire_timers = [&](Queue& queue) {
-        auto* timer = queue.list.head();
-        VERIFY(timer);
-        VERIFY(queue.next_timer_due == timer->m_expires);
-
-        while (timer && timer->now(true) > timer->m_expires) {
-            queue.list.remove(timer);
-            timer->set_queued(false);
-
-            m_timers_executing.append(timer);
-
-            update_next_timer_due(queue);
-
-            lock.unlock();
-
-            // Defer executing the timer outside of the irq handler
-            Processor::current().deferred_call_queue([this, timer]() {
-                timer->m_callback();
-                ScopedSpinLock lock(g_timerqueue_lock);
-                m_timers_executing.remove(timer);
-                // Drop the reference we added when queueing the timer
-                timer->unref();
-            });
+    {
+        ScopedSpinLock lock(wheel.m_lock);
+        VERIFY(timer.m_list == &wheel.m_timers_executing);
+        wheel.m_timers_executing.remove(&timer);
+        timer.m_list = nullptr;
+    }
+    if (timer.m_id != 0) {
+        ScopedSpinLock lock(g_timerqueue_lock);
+        m_timers_by_id.remove(timer.m_id);
+    }
+    // Drop the reference we added when queueing the timer
+    timer.unref();
+}
 
-            lock.lock();
-            timer = queue.list.head();
-        }
-    };
+void TimerQueue::fire_wheel(TimerWheel& wheel, u64 now_tick)
+{
+    ScopedSpinLock lock(wheel.m_lock);
+    while (auto* timer = wheel.take_expired_timer_locked(now_tick)) {
+        timer->set_queued(false);
+        lock.unlock();
+
+        // Defer executing the timer outside of the irq handler
+        Processor::current().deferred_call_queue([this, &wheel, timer]() {
+            timer->m_callback();
+            did_execute_timer(wheel, *timer);
+        });
 
-    if (!m_timer_queue_monotonic.list.is_empty())
-        fire_timers(m_timer_queue_monotonic);
-    if (!m_timer_queue_realtime.list.is_empty())
-        fire_timers(m_timer_queue_realtime);
+        lock.lock();
+    }
 }
 
-void TimerQueue::update_next_timer_due(Queue& queue)
+void TimerQueue::fire_wheels(ProcessorTimerWheels& wheels, u64 monotonic_tick, u64 realtime_tick)
 {
-    VERIFY(g_timerqueue_lock.is_locked());
+    wheels.last_fired_tick.store(monotonic_tick);
+    fire_wheel(wheels.monotonic, monotonic_tick);
+    fire_wheel(wheels.realtime, realtime_tick);
+}
 
-    if (auto* next_timer = queue.list.head())
-        queue.next_timer_due = next_timer->m_expires;
-    else
-        queue.next_timer_due = {};
+void TimerQueue::fire()
+{
+    // NOTE: We just updated the time in the interrupt handler, so coarse
+    // timestamps are precise enough here.
+    auto monotonic_tick = current_tick(CLOCK_MONOTONIC_COARSE);
+    auto realtime_tick = current_tick(CLOCK_REALTIME_COARSE);
+
+    auto cpu = Processor::id();
+    if (auto* wheels = m_processor_wheels[cpu].load(AK::MemoryOrder::memory_order_acquire))
+        fire_wheels(*wheels, monotonic_tick, realtime_tick);
+    if (cpu != 0)
+        return;
+
+    // Not every processor necessarily gets timer interrupts of its own, so the
+    // BSP takes care of the wheels that their processor didn't fire recently.
+    for (size_t other_cpu = 1; other_cpu < max_processors; other_cpu++) {
+        auto* wheels = m_processor_wheels[other_cpu].load(AK::MemoryOrder::memory_order_acquire);
+        if (wheels && wheels->last_fired_tick.load() + 2 < monotonic_tick)
+            fire_wheels(*wheels, monotonic_tick, realtime_tick);
+    }
 }
 
 }
@@ -1,21 +1,28 @@
 #pragma once
 
 // includes
+#include <AK/Array.h>
+#include <AK/Atomic.h>
 #include <AK/Function.h>
+#include <AK/HashMap.h>
 #include <AK/InlineLinkedList.h>
 #include <AK/NonnullRefPtr.h>
 #include <AK/OwnPtr.h>
 #include <AK/RefCounted.h>
 #include <AK/Time.h>
+#include <Kernel/SpinLock.h>
 #include <Kernel/Time/TimeManagement.h>
 
 namespace Kernel {
 
 TYPEDEF_DISTINCT_ORDERED_ID(u64, TimerId);
 
+class TimerWheel;
+
 class Timer : public RefCounted<Timer>
     , public InlineLinkedListNode<Timer> {
     friend class TimerQueue;
+    friend class TimerWheel;
     friend class InlineLinkedListNode<Timer>;
 
 public:
@@ -36,20 +43,17 @@ private:
     TimerId m_id;
     clockid_t m_clock_id;
     Time m_expires;
+    u64 m_expire_tick { 0 };
     Time m_remaining {};
     Function<void()> m_callback;
     Timer* m_next { nullptr };
     Timer* m_prev { nullptr };
+    // The wheel the timer was armed on, and the list it sits on in there:
+    // one of the wheel slots while pending, or the executing list while firing.
+    TimerWheel* m_wheel { nullptr };
+    InlineLinkedList<Timer>* m_list { nullptr };
     Atomic<bool, AK::MemoryOrder::memory_order_relaxed> m_queued { false };
 
-    bool operator<(const Timer& rhs) const
-    {
-        return m_expires < rhs.m_expires;
-    }
-    bool operator>(const Timer& rhs) const
-    {
-        return m_expires > rhs.m_expires;
-    }
     bool operator==(const Timer& rhs) const
     {
         return m_id == rhs.m_id;
@@ -59,6 +63,38 @@ private:
     Time now(bool) const;
 };
 
+// A hierarchical timing wheel. Each level has 64 slots, and every slot of a level
+// covers 64 times as many ticks as a slot of the level below. Arming and cancelling
+// a timer is O(1), and a tick only looks at the timers that are due, or whose slot
+// gets spread out over the level below.
+class TimerWheel {
+    friend class TimerQueue;
+
+public:
+    static constexpr size_t level_bits = 6;
+    static constexpr size_t slots_per_level = 1 << level_bits;
+    static constexpr size_t levels_count = 4;
+
+    explicit TimerWheel(u64 current_tick)
+        : m_current_tick(current_tick)
+    {
+    }
+
+private:
+    void add_timer_locked(Timer&);
+    void remove_timer_locked(Timer&);
+    Timer* take_expired_timer_locked(u64 now_tick);
+    void cascade_locked();
+    void rebase_locked(u64 now_tick);
+
+    SpinLock<u8> m_lock;
+    // Every timer due before this tick has been taken off the wheel.
+    u64 m_current_tick { 0 };
+    size_t m_timers_count { 0 };
+    InlineLinkedList<Timer> m_slots[levels_count][slots_per_level];
+    InlineLinkedList<Timer> m_timers_executing;
+};
+
 class TimerQueue {
     friend class Timer;
 
@@ -78,24 +114,40 @@ public:
     void fire();
 
 private:
-    struct Queue {
-        InlineLinkedList<Timer> list;
-        Time next_timer_due {};
+    // Timers are armed on, and fired by, the processor that created them.
+    struct ProcessorTimerWheels {
+        ProcessorTimerWheels(u64 monotonic_tick, u64 realtime_tick)
+            : monotonic(monotonic_tick)
+            , realtime(realtime_tick)
+        {
+        }
+
+        TimerWheel monotonic;
+        TimerWheel realtime;
+        Atomic<u64, AK::MemoryOrder::memory_order_relaxed> last_fired_tick { 0 };
     };
-    void remove_timer_locked(Queue&, Timer&);
-    void update_next_timer_due(Queue&);
-    void add_timer_locked(NonnullRefPtr<Timer>);
+    // Affinity masks are 32 bits wide, so there can't be more processors than that.
+    static constexpr size_t max_processors = sizeof(u32) * 8;
+
+    void add_timer_locked(TimerWheel&, Timer&);
+    void fire_wheels(ProcessorTimerWheels&, u64 monotonic_tick, u64 realtime_tick);
+    void fire_wheel(TimerWheel&, u64 now_tick);
+    void did_execute_timer(TimerWheel&, Timer&);
 
-    Queue& queue_for_timer(Timer& timer)
+    ProcessorTimerWheels& current_processor_wheels();
+    u64 current_tick(clockid_t) const;
+    u64 tick_for_time(const Time&) const;
+
+    static TimerWheel& wheel_for_timer(ProcessorTimerWheels& wheels, Timer& timer)
     {
         switch (timer.m_clock_id) {
         case CLOCK_MONOTONIC:
         case CLOCK_MONOTONIC_COARSE:
         case CLOCK_MONOTONIC_RAW:
-            return m_timer_queue_monotonic;
+            return wheels.monotonic;
         case CLOCK_REALTIME:
         case CLOCK_REALTIME_COARSE:
-            return m_timer_queue_realtime;
+            return wheels.realtime;
         default:
             VERIFY_NOT_REACHED();
         }
@@ -103,9 +155,10 @@ private:
 
     u64 m_timer_id_count { 0 };
     u64 m_ticks_per_second { 0 };
-    Queue m_timer_queue_monotonic;
-    Queue m_timer_queue_realtime;
-    InlineLinkedList<Timer> m_timers_executing;
+    u64 m_nanoseconds_per_tick { 0 };
+    // Timers that were added with an id, protected by g_timerqueue_lock.
+    HashMap<TimerId, Timer*> m_timers_by_id;
+    Array<Atomic<ProcessorTimerWheels*>, max_processors> m_processor_wheels;
 };
 
 }
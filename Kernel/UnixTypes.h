@@ -43,6 +43,10 @@ enum {
 #define PERF_EVENT_SAMPLE 0
 #define PERF_EVENT_MALLOC 1
 #define PERF_EVENT_FREE 2
+#define PERF_EVENT_THREAD_CREATE 3
+#define PERF_EVENT_THREAD_EXIT 4
+
+#define PROFILING_SAMPLE_IDLE 0x1
 
 #define WNOHANG 1
 #define WUNTRACED 2
@@ -78,6 +82,9 @@ enum {
 #define PROT_EXEC 0x4
 #define PROT_NONE 0x0
 
+#define MADV_NORMAL 0x0
+#define MADV_RANDOM 0x1
+#define MADV_SEQUENTIAL 0x2
 #define MADV_SET_VOLATILE 0x100
 #define MADV_SET_NONVOLATILE 0x200
 #define MADV_GET_VOLATILE 0x400
@@ -88,6 +95,8 @@ enum {
 #define F_GETFL 3
 #define F_SETFL 4
 #define F_ISTTY 5
+#define F_GETPIPE_SZ 6
+#define F_SETPIPE_SZ 7
 
 #define FD_CLOEXEC 1
 
@@ -455,6 +464,23 @@ struct pollfd {
     short revents;
 };
 
+#define EPOLLIN (1u << 0)
+#define EPOLLPRI (1u << 1)
+#define EPOLLOUT (1u << 2)
+#define EPOLLONESHOT (1u << 30)
+#define EPOLLET (1u << 31)
+
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+#define EPOLL_CLOEXEC O_CLOEXEC
+
+struct epoll_event {
+    u32 events;
+    u64 data;
+};
+
 #define AF_MASK 0xff
 #define AF_UNSPEC 0
 #define AF_LOCAL 1
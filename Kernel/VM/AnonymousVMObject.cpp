@@ -13,6 +13,24 @@ RefPtr<VMObject> AnonymousVMObject::clone()
     // We need to acquire our lock so we copy a sane state
     ScopedSpinLock lock(m_lock);
 
+    // Get the pages for copies of pinned pages (see below) before changing anything.
+    struct PinnedPageCopy {
+        size_t page_index { 0 };
+        RefPtr<PhysicalPage> copy;
+    };
+    Vector<PinnedPageCopy> pinned_page_copies;
+    for (size_t page_index = 0; page_index < page_count(); ++page_index) {
+        auto& page = m_physical_pages[page_index];
+        if (!page || !page->is_pinned_for_device_writes())
+            continue;
+        auto copy = MM.allocate_user_physical_page(MemoryManager::ShouldZeroFill::No);
+        if (!copy) {
+            dmesgln("MM: clone was unable to allocate a page to copy a pinned page into");
+            return {};
+        }
+        pinned_page_copies.append({ page_index, move(copy) });
+    }
+
     // We're the parent. Since we're about to become COW we need to
     // commit the number of pages that we need to potentially allocate
     // so that the parent is still guaranteed to be able to have all
@@ -42,7 +60,23 @@ RefPtr<VMObject> AnonymousVMObject::clone()
     // or reset all pages to be copied again if we were previously cloned
     ensure_or_reset_cow_map();
 
-    return adopt_ref(*new AnonymousVMObject(*this));
+    auto clone = adopt_ref(*new AnonymousVMObject(*this));
+
+    // A device is still writing into pinned pages, and those writes have to land in
+    // our copy. So rather than sharing them, give the clone its own copy right away.
+    for (auto& pinned_page : pinned_page_copies) {
+        auto& page = m_physical_pages[pinned_page.page_index];
+        u8 page_buffer[PAGE_SIZE];
+        memcpy(page_buffer, MM.quickmap_page(*page), PAGE_SIZE);
+        MM.unquickmap_page();
+        memcpy(MM.quickmap_page(*pinned_page.copy), page_buffer, PAGE_SIZE);
+        MM.unquickmap_page();
+        clone->m_physical_pages[pinned_page.page_index] = move(pinned_page.copy);
+        clone->set_should_cow(pinned_page.page_index, false);
+        set_should_cow(pinned_page.page_index, false);
+    }
+
+    return clone;
 }
 
 RefPtr<AnonymousVMObject> AnonymousVMObject::create_with_size(size_t size, AllocationStrategy commit)
@@ -412,6 +446,20 @@ bool AnonymousVMObject::should_cow(size_t page_index, bool is_shared) const
     return !m_cow_map.is_null() && m_cow_map.get(page_index);
 }
 
+RefPtr<PhysicalPage> AnonymousVMObject::pin_page_for_device_writes(size_t page_index, bool is_shared)
+{
+    // Checking and pinning under our lock means that clone() either sees the pin,
+    // or has already made the page copy-on-write and we refuse it here.
+    ScopedSpinLock lock(m_lock);
+    if (should_cow(page_index, is_shared))
+        return nullptr;
+    auto& page = physical_pages()[page_index];
+    if (!page || page->is_shared_zero_page() || page->is_lazy_committed_page())
+        return nullptr;
+    page->pin_for_device_writes();
+    return page;
+}
+
 void AnonymousVMObject::set_should_cow(size_t page_index, bool cow)
 {
     ensure_cow_map().set(page_index, cow);
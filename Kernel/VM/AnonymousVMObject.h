@@ -26,6 +26,7 @@ public:
     size_t cow_pages() const;
     bool should_cow(size_t page_index, bool) const;
     void set_should_cow(size_t page_index, bool);
+    RefPtr<PhysicalPage> pin_page_for_device_writes(size_t page_index, bool is_shared);
 
     void register_purgeable_page_ranges(PurgeablePageRanges&);
     void unregister_purgeable_page_ranges(PurgeablePageRanges&);
@@ -9,6 +9,7 @@
 #include <Kernel/Multiboot.h>
 #include <Kernel/Process.h>
 #include <Kernel/StdLib.h>
+#include <Kernel/Tasks/PageZeroingTask.h>
 #include <Kernel/VM/AnonymousVMObject.h>
 #include <Kernel/VM/ContiguousVMObject.h>
 #include <Kernel/VM/MemoryManager.h>
@@ -59,6 +60,10 @@ UNMAP_AFTER_INIT MemoryManager::MemoryManager()
     write_cr3(kernel_page_directory().cr3());
     protect_kernel_image();
 
+    // Keep up to 2 MiB of zeroed pages around, but never more than 1/64th of user memory.
+    m_zeroed_pages_target = min(static_cast<size_t>(512), static_cast<size_t>(m_user_physical_pages / 64));
+    m_zeroed_pages.ensure_capacity(m_zeroed_pages_target);
+
     // We're temporarily "committing" to two pages that we need to allocate below
     if (!commit_user_physical_pages(2))
         VERIFY_NOT_REACHED();
@@ -432,6 +437,34 @@ Region* MemoryManager::find_region_from_vaddr(VirtualAddress vaddr)
     return find_user_region_from_vaddr(*page_directory->space(), vaddr);
 }
 
+RefPtr<PhysicalPage> MemoryManager::physical_page_for_device_access(Space* space, VirtualAddress vaddr, bool device_writes)
+{
+    ScopedSpinLock lock(s_mm_lock);
+    auto resolve = [&](Region* region) -> RefPtr<PhysicalPage> {
+        // Only anonymous memory has pages that stay put for as long as we hold on to them.
+        if (!region || !region->vmobject().is_anonymous())
+            return nullptr;
+        auto page_index = region->page_index_from_address(vaddr);
+        if (device_writes) {
+            if (!region->is_writable())
+                return nullptr;
+            auto& vmobject = static_cast<AnonymousVMObject&>(region->vmobject());
+            return vmobject.pin_page_for_device_writes(region->first_page_index() + page_index, region->is_shared());
+        }
+        auto* page = region->physical_page(page_index);
+        if (!page || page->is_lazy_committed_page())
+            return nullptr;
+        return const_cast<PhysicalPage*>(page);
+    };
+
+    if (!is_user_address(vaddr))
+        return resolve(kernel_region_from_vaddr(vaddr));
+    if (!space)
+        return nullptr;
+    ScopedSpinLock space_lock(space->get_lock());
+    return resolve(space->find_region_containing({ vaddr, 1 }));
+}
+
 PageFaultResponse MemoryManager::handle_page_fault(const PageFault& fault)
 {
     VERIFY_INTERRUPTS_DISABLED();
@@ -443,6 +476,10 @@ PageFaultResponse MemoryManager::handle_page_fault(const PageFault& fault)
         return PageFaultResponse::ShouldCrash;
     }
     dbgln_if(PAGE_FAULT_DEBUG, "MM: CPU[{}] handle_page_fault({:#04x}) at {}", Processor::id(), fault.code(), fault.vaddr());
+    if (fault.type() == PageFault::Type::ProtectionViolation && fault.is_write() && is_user_address(fault.vaddr())) {
+        if (handle_write_to_protected_page_table(fault.vaddr()))
+            return PageFaultResponse::Continue;
+    }
     auto* region = find_region_from_vaddr(fault.vaddr());
     if (!region) {
         return PageFaultResponse::ShouldCrash;
@@ -451,6 +488,63 @@ PageFaultResponse MemoryManager::handle_page_fault(const PageFault& fault)
     return region->handle_fault(fault, lock);
 }
 
+void MemoryManager::write_protect_user_page_tables(PageDirectory& page_directory)
+{
+    ScopedSpinLock lock(s_mm_lock);
+    ScopedSpinLock page_lock(page_directory.get_lock());
+    FlatPtr first_protected = 0xffffffff;
+    FlatPtr end_of_protected = 0;
+    for (auto& it : page_directory.m_page_tables) {
+        VirtualAddress table_base { it.key };
+        if (!is_user_address(table_base))
+            continue;
+        auto& pde = quickmap_pd(page_directory, (table_base.get() >> 30) & 0x3)[(table_base.get() >> 21) & 0x1ff];
+        VERIFY(pde.is_present());
+        if (!pde.is_writable())
+            continue;
+        pde.set_writable(false);
+        pde.set_copy_on_write(true);
+        first_protected = min(first_protected, table_base.get());
+        end_of_protected = max(end_of_protected, table_base.get() + 512 * PAGE_SIZE);
+    }
+    if (first_protected < end_of_protected)
+        flush_tlb(&page_directory, VirtualAddress(first_protected), (end_of_protected - first_protected) / PAGE_SIZE);
+}
+
+bool MemoryManager::handle_write_to_protected_page_table(VirtualAddress vaddr)
+{
+    VERIFY(s_mm_lock.own_lock());
+    auto page_directory = PageDirectory::find_by_cr3(read_cr3());
+    if (!page_directory || !page_directory->space())
+        return false;
+    auto& space = *page_directory->space();
+    ScopedSpinLock space_lock(space.get_lock());
+    ScopedSpinLock page_lock(page_directory->get_lock());
+
+    auto& pde = quickmap_pd(*page_directory, (vaddr.get() >> 30) & 0x3)[(vaddr.get() >> 21) & 0x1ff];
+    if (!pde.is_present() || !pde.is_copy_on_write())
+        return false;
+
+    dbgln_if(PAGE_FAULT_DEBUG, "MM: Write to protected page table at {}", vaddr);
+    VirtualAddress table_base { vaddr.get() & ~0x1fffff };
+    auto* page_table = quickmap_pt(PhysicalAddress((FlatPtr)pde.page_table_base()));
+    Region* region = nullptr;
+    for (size_t i = 0; i < 512; ++i) {
+        auto& pte = page_table[i];
+        if (!pte.is_present() || !pte.is_writable())
+            continue;
+        auto page_vaddr = table_base.offset(i * PAGE_SIZE);
+        if (!region || !region->contains(page_vaddr))
+            region = space.find_region_containing({ page_vaddr, PAGE_SIZE });
+        if (region && region->should_cow(region->page_index_from_address(page_vaddr)))
+            pte.set_writable(false);
+    }
+    pde.set_writable(true);
+    pde.set_copy_on_write(false);
+    flush_tlb(page_directory.ptr(), table_base, 512);
+    return true;
+}
+
 OwnPtr<Region> MemoryManager::allocate_contiguous_kernel_region(size_t size, String name, Region::Access access, size_t physical_alignment, Region::Cacheable cacheable)
 {
     VERIFY(!(size % PAGE_SIZE));
@@ -520,14 +614,24 @@ OwnPtr<Region> MemoryManager::allocate_kernel_region_with_vmobject(VMObject& vmo
     return allocate_kernel_region_with_vmobject(range.value(), vmobject, move(name), access, cacheable);
 }
 
+bool MemoryManager::try_take_uncommitted_pages(size_t page_count)
+{
+    // This runs without s_mm_lock on the allocation fast path, so check and update the counter in one step.
+    auto uncommitted = m_user_physical_pages_uncommitted.load();
+    do {
+        if (uncommitted < page_count)
+            return false;
+    } while (!m_user_physical_pages_uncommitted.compare_exchange_strong(uncommitted, uncommitted - page_count));
+    return true;
+}
+
 bool MemoryManager::commit_user_physical_pages(size_t page_count)
 {
     VERIFY(page_count > 0);
     ScopedSpinLock lock(s_mm_lock);
-    if (m_user_physical_pages_uncommitted < page_count)
+    if (!try_take_uncommitted_pages(page_count))
         return false;
 
-    m_user_physical_pages_uncommitted -= page_count;
     m_user_physical_pages_committed += page_count;
     return true;
 }
@@ -542,101 +646,261 @@ void MemoryManager::uncommit_user_physical_pages(size_t page_count)
     m_user_physical_pages_committed -= page_count;
 }
 
-void MemoryManager::deallocate_user_physical_page(const PhysicalPage& page)
+Optional<PhysicalAddress> MemoryManager::take_page_from_regions()
 {
-    ScopedSpinLock lock(s_mm_lock);
+    VERIFY(s_mm_lock.own_lock());
     for (auto& region : m_user_physical_regions) {
-        if (!region.contains(page))
-            continue;
-
-        region.return_page(page);
-        --m_user_physical_pages_used;
+        if (auto paddr = region.take_free_page_address(); paddr.has_value())
+            return paddr;
+    }
+    return {};
+}
 
-        // Always return pages to the uncommitted pool. Pages that were
-        // committed and allocated are only freed upon request. Once
-        // returned there is no guarantee being able to get them back.
-        ++m_user_physical_pages_uncommitted;
+void MemoryManager::return_page_to_regions(PhysicalAddress paddr)
+{
+    VERIFY(s_mm_lock.own_lock());
+    for (auto& region : m_user_physical_regions) {
+        if (!region.contains(paddr))
+            continue;
+        region.return_page(paddr);
         return;
     }
 
-    dmesgln("MM: deallocate_user_physical_page couldn't figure out region for user page @ {}", page.paddr());
+    dmesgln("MM: deallocate_user_physical_page couldn't figure out region for user page @ {}", paddr);
     VERIFY_NOT_REACHED();
 }
 
-RefPtr<PhysicalPage> MemoryManager::find_free_user_physical_page(bool committed)
+void MemoryManager::deallocate_user_physical_page(const PhysicalPage& page)
 {
-    VERIFY(s_mm_lock.is_locked());
-    RefPtr<PhysicalPage> page;
-    if (committed) {
-        // Draw from the committed pages pool. We should always have these pages available
-        VERIFY(m_user_physical_pages_committed > 0);
-        m_user_physical_pages_committed--;
-    } else {
-        // We need to make sure we don't touch pages that we have committed to
-        if (m_user_physical_pages_uncommitted == 0)
-            return {};
-        m_user_physical_pages_uncommitted--;
+    ScopedCritical critical;
+    auto& mm_data = get_data();
+    auto try_cache_page = [&] {
+        ScopedSpinLock cache_lock(mm_data.m_page_cache_lock);
+        if (mm_data.m_page_cache.size() == MemoryManagerData::page_cache_capacity)
+            return false;
+        mm_data.m_page_cache.unchecked_append(page.paddr());
+        return true;
+    };
+
+    if (!try_cache_page()) {
+        // The cache is full, hand a batch back to the regions so that we
+        // don't end up draining and refilling on every other call.
+        // NOTE: s_mm_lock is always taken before a page cache lock, never after.
+        ScopedSpinLock lock(s_mm_lock);
+        ScopedSpinLock cache_lock(mm_data.m_page_cache_lock);
+        ++mm_data.m_page_cache_statistics.drains;
+        while (mm_data.m_page_cache.size() > MemoryManagerData::page_cache_batch_size)
+            return_page_to_regions(mm_data.m_page_cache.take_last());
+        mm_data.m_page_cache.unchecked_append(page.paddr());
     }
-    for (auto& region : m_user_physical_regions) {
-        page = region.take_free_page(false);
-        if (!page.is_null()) {
-            ++m_user_physical_pages_used;
-            break;
+
+    --m_user_physical_pages_used;
+
+    // Always return pages to the uncommitted pool. Pages that were
+    // committed and allocated are only freed upon request. Once
+    // returned there is no guarantee being able to get them back.
+    // NOTE: This has to happen after the page is back on a free list, since
+    //       whoever takes it out of the uncommitted pool expects to find it.
+    ++m_user_physical_pages_uncommitted;
+}
+
+Optional<PhysicalAddress> MemoryManager::take_zeroed_page()
+{
+    ScopedSpinLock lock(m_zeroed_pages_lock);
+    if (m_zeroed_pages.is_empty())
+        return {};
+    return m_zeroed_pages.take_last();
+}
+
+Optional<PhysicalAddress> MemoryManager::take_free_user_page(ShouldZeroFill should_zero_fill, bool& is_zeroed)
+{
+    VERIFY(Processor::current().in_critical());
+    auto& mm_data = get_data();
+    auto& statistics = mm_data.m_page_cache_statistics;
+
+    is_zeroed = false;
+    if (should_zero_fill == ShouldZeroFill::Yes) {
+        if (auto paddr = take_zeroed_page(); paddr.has_value()) {
+            ++statistics.zeroed_hits;
+            is_zeroed = true;
+            return paddr;
         }
+        ++statistics.zeroed_misses;
     }
-    VERIFY(!committed || !page.is_null());
-    return page;
+
+    {
+        ScopedSpinLock cache_lock(mm_data.m_page_cache_lock);
+        if (!mm_data.m_page_cache.is_empty()) {
+            ++statistics.hits;
+            return mm_data.m_page_cache.take_last();
+        }
+    }
+
+    // The caller has already taken a page out of the committed or uncommitted pool,
+    // so there is a free page somewhere. The only question is whose free list it's on.
+    // NOTE: s_mm_lock is always taken before a page cache lock, never after.
+    ++statistics.misses;
+    ScopedSpinLock lock(s_mm_lock);
+    {
+        // Refill a whole batch at once, so that the next few allocations don't need s_mm_lock.
+        ScopedSpinLock cache_lock(mm_data.m_page_cache_lock);
+        while (mm_data.m_page_cache.size() < MemoryManagerData::page_cache_batch_size) {
+            auto paddr = take_page_from_regions();
+            if (!paddr.has_value())
+                break;
+            mm_data.m_page_cache.unchecked_append(paddr.value());
+        }
+        if (!mm_data.m_page_cache.is_empty())
+            return mm_data.m_page_cache.take_last();
+    }
+
+    // The regions ran dry, but other processors may still have free pages cached.
+    Optional<PhysicalAddress> stolen_paddr;
+    Processor::for_each([&](Processor& processor) {
+        auto& other_mm_data = processor.get_mm_data();
+        ScopedSpinLock cache_lock(other_mm_data.m_page_cache_lock);
+        if (other_mm_data.m_page_cache.is_empty())
+            return IterationDecision::Continue;
+        stolen_paddr = other_mm_data.m_page_cache.take_last();
+        return IterationDecision::Break;
+    });
+    if (stolen_paddr.has_value())
+        return stolen_paddr;
+
+    if (auto paddr = take_zeroed_page(); paddr.has_value()) {
+        is_zeroed = true;
+        return paddr;
+    }
+    return {};
+}
+
+void MemoryManager::zero_page(PhysicalAddress paddr)
+{
+    auto* ptr = quickmap_page(paddr);
+    memset(ptr, 0, PAGE_SIZE);
+    unquickmap_page();
 }
 
 NonnullRefPtr<PhysicalPage> MemoryManager::allocate_committed_user_physical_page(ShouldZeroFill should_zero_fill)
 {
-    ScopedSpinLock lock(s_mm_lock);
-    auto page = find_free_user_physical_page(true);
+    ScopedCritical critical;
+    // Draw from the committed pages pool. We should always have these pages available
+    auto previously_committed = m_user_physical_pages_committed.fetch_sub(1);
+    VERIFY(previously_committed > 0);
+
+    bool is_zeroed = false;
+    auto paddr = take_free_user_page(should_zero_fill, is_zeroed);
+    VERIFY(paddr.has_value());
+    ++m_user_physical_pages_used;
+
     if (should_zero_fill == ShouldZeroFill::Yes) {
-        auto* ptr = quickmap_page(*page);
-        memset(ptr, 0, PAGE_SIZE);
-        unquickmap_page();
+        if (!is_zeroed)
+            zero_page(paddr.value());
+        if (needs_zeroed_pages())
+            PageZeroingTask::request_refill();
     }
-    return page.release_nonnull();
+    return PhysicalPage::create(paddr.value(), false);
 }
 
 RefPtr<PhysicalPage> MemoryManager::allocate_user_physical_page(ShouldZeroFill should_zero_fill, bool* did_purge)
 {
-    ScopedSpinLock lock(s_mm_lock);
-    auto page = find_free_user_physical_page(false);
+    ScopedCritical critical;
     bool purged_pages = false;
 
-    if (!page) {
+    // We need to make sure we don't touch pages that we have committed to
+    if (!try_take_uncommitted_pages(1)) {
         // We didn't have a single free physical page. Let's try to free something up!
         // First, we look for a purgeable VMObject in the volatile state.
+        ScopedSpinLock lock(s_mm_lock);
         for_each_vmobject([&](auto& vmobject) {
             if (!vmobject.is_anonymous())
                 return IterationDecision::Continue;
             int purged_page_count = static_cast<AnonymousVMObject&>(vmobject).purge_with_interrupts_disabled({});
             if (purged_page_count) {
                 dbgln("MM: Purge saved the day! Purged {} pages from AnonymousVMObject", purged_page_count);
-                page = find_free_user_physical_page(false);
-                purged_pages = true;
-                VERIFY(page);
+                purged_pages = try_take_uncommitted_pages(1);
+                VERIFY(purged_pages);
                 return IterationDecision::Break;
             }
             return IterationDecision::Continue;
         });
-        if (!page) {
+        if (!purged_pages) {
             dmesgln("MM: no user physical pages available");
             return {};
         }
     }
 
+    bool is_zeroed = false;
+    auto paddr = take_free_user_page(should_zero_fill, is_zeroed);
+    VERIFY(paddr.has_value());
+    ++m_user_physical_pages_used;
+
     if (should_zero_fill == ShouldZeroFill::Yes) {
-        auto* ptr = quickmap_page(*page);
-        memset(ptr, 0, PAGE_SIZE);
-        unquickmap_page();
+        if (!is_zeroed)
+            zero_page(paddr.value());
+        if (needs_zeroed_pages())
+            PageZeroingTask::request_refill();
     }
 
     if (did_purge)
         *did_purge = purged_pages;
-    return page;
+    return PhysicalPage::create(paddr.value(), false);
+}
+
+size_t MemoryManager::refill_zeroed_pages()
+{
+    size_t zeroed_count = 0;
+    for (;;) {
+        {
+            ScopedSpinLock lock(m_zeroed_pages_lock);
+            if (m_zeroed_pages.size() >= m_zeroed_pages_target)
+                break;
+        }
+        // Zeroing ahead of time is only worth it while there is memory to spare.
+        if (is_under_memory_pressure())
+            break;
+
+        ScopedCritical critical;
+        // Keep the page accounted for while it's off the free lists, since
+        // allocators count on finding a free page for every one they reserved.
+        if (!try_take_uncommitted_pages(1))
+            break;
+        Optional<PhysicalAddress> paddr;
+        {
+            ScopedSpinLock lock(s_mm_lock);
+            paddr = take_page_from_regions();
+        }
+        if (!paddr.has_value()) {
+            ++m_user_physical_pages_uncommitted;
+            break;
+        }
+
+        zero_page(paddr.value());
+        {
+            ScopedSpinLock lock(m_zeroed_pages_lock);
+            m_zeroed_pages.unchecked_append(paddr.value());
+        }
+        ++m_user_physical_pages_uncommitted;
+        ++zeroed_count;
+    }
+    return zeroed_count;
+}
+
+MemoryManager::PageCacheState MemoryManager::page_cache_state() const
+{
+    PageCacheState state;
+    Processor::for_each([&](Processor& processor) {
+        auto& mm_data = processor.get_mm_data();
+        state.cached_pages += mm_data.m_page_cache.size();
+        state.hits += mm_data.m_page_cache_statistics.hits;
+        state.misses += mm_data.m_page_cache_statistics.misses;
+        state.drains += mm_data.m_page_cache_statistics.drains;
+        state.zeroed_hits += mm_data.m_page_cache_statistics.zeroed_hits;
+        state.zeroed_misses += mm_data.m_page_cache_statistics.zeroed_misses;
+        return IterationDecision::Continue;
+    });
+    state.zeroed_pages = m_zeroed_pages.size();
+    return state;
 }
 
 void MemoryManager::deallocate_supervisor_physical_page(const PhysicalPage& page)
@@ -667,7 +931,7 @@ NonnullRefPtrVector<PhysicalPage> MemoryManager::allocate_contiguous_supervisor_
     for (auto& region : m_super_physical_regions) {
         physical_pages = region.take_contiguous_free_pages(count, true, physical_alignment);
         if (!physical_pages.is_empty())
-            continue;
+            break;
     }
 
     if (physical_pages.is_empty()) {
@@ -790,7 +1054,7 @@ PageTableEntry* MemoryManager::quickmap_pt(PhysicalAddress pt_paddr)
     return (PageTableEntry*)0xffe00000;
 }
 
-u8* MemoryManager::quickmap_page(PhysicalPage& physical_page)
+u8* MemoryManager::quickmap_page(PhysicalAddress paddr)
 {
     VERIFY_INTERRUPTS_DISABLED();
     auto& mm_data = get_data();
@@ -801,8 +1065,8 @@ u8* MemoryManager::quickmap_page(PhysicalPage& physical_page)
     VirtualAddress vaddr(0xffe00000 + pte_idx * PAGE_SIZE);
 
     auto& pte = boot_pd3_pt1023[pte_idx];
-    if (pte.physical_page_base() != physical_page.paddr().as_ptr()) {
-        pte.set_physical_page_base(physical_page.paddr().get());
+    if (pte.physical_page_base() != paddr.as_ptr()) {
+        pte.set_physical_page_base(paddr.get());
         pte.set_present(true);
         pte.set_writable(true);
         pte.set_user_allowed(false);
@@ -82,12 +82,29 @@ struct PhysicalMemoryRange {
 
 #define MM Kernel::MemoryManager::the()
 
+struct PageCacheStatistics {
+    Atomic<u64, AK::MemoryOrder::memory_order_relaxed> hits { 0 };
+    Atomic<u64, AK::MemoryOrder::memory_order_relaxed> misses { 0 };
+    Atomic<u64, AK::MemoryOrder::memory_order_relaxed> drains { 0 };
+    Atomic<u64, AK::MemoryOrder::memory_order_relaxed> zeroed_hits { 0 };
+    Atomic<u64, AK::MemoryOrder::memory_order_relaxed> zeroed_misses { 0 };
+};
+
 struct MemoryManagerData {
+    static constexpr size_t page_cache_capacity = 64;
+    static constexpr size_t page_cache_batch_size = page_cache_capacity / 2;
+
     SpinLock<u8> m_quickmap_in_use;
     u32 m_quickmap_prev_flags;
 
     PhysicalAddress m_last_quickmap_pd;
     PhysicalAddress m_last_quickmap_pt;
+
+    // Free user pages kept by this processor, so that most allocations and frees
+    // don't have to take s_mm_lock. Other processors only ever take pages out of it.
+    SpinLock<u8> m_page_cache_lock;
+    Vector<PhysicalAddress, page_cache_capacity> m_page_cache;
+    PageCacheStatistics m_page_cache_statistics;
 };
 
 extern RecursiveSpinLock s_mm_lock;
@@ -125,6 +142,11 @@ public:
 
     bool validate_user_stack(const Process&, VirtualAddress) const;
 
+    // Write-protects the user page tables themselves instead of the pages in them, so that
+    // fork() doesn't have to visit every PTE of the parent. The first write through such a
+    // table faults, and only then are the copy-on-write pages in that table write-protected.
+    void write_protect_user_page_tables(PageDirectory&);
+
     enum class ShouldZeroFill {
         No,
         Yes
@@ -150,9 +172,26 @@ public:
     unsigned user_physical_pages_used() const { return m_user_physical_pages_used; }
     unsigned user_physical_pages_committed() const { return m_user_physical_pages_committed; }
     unsigned user_physical_pages_uncommitted() const { return m_user_physical_pages_uncommitted; }
+    // Less than 1/16th of user physical memory is left to hand out.
+    bool is_under_memory_pressure() const { return m_user_physical_pages_uncommitted < m_user_physical_pages / 16; }
+
     unsigned super_physical_pages() const { return m_super_physical_pages; }
     unsigned super_physical_pages_used() const { return m_super_physical_pages_used; }
 
+    struct PageCacheState {
+        unsigned cached_pages { 0 };
+        unsigned zeroed_pages { 0 };
+        u64 hits { 0 };
+        u64 misses { 0 };
+        u64 drains { 0 };
+        u64 zeroed_hits { 0 };
+        u64 zeroed_misses { 0 };
+    };
+    PageCacheState page_cache_state() const;
+
+    bool needs_zeroed_pages() const { return m_zeroed_pages.size() < m_zeroed_pages_target / 2; }
+    size_t refill_zeroed_pages();
+
     template<typename Callback>
     static void for_each_vmobject(Callback callback)
     {
@@ -162,9 +201,25 @@ public:
         }
     }
 
+    template<typename Callback>
+    void for_each_physical_region(Callback callback) const
+    {
+        for (auto& region : m_super_physical_regions)
+            callback(region, true);
+        for (auto& region : m_user_physical_regions)
+            callback(region, false);
+    }
+
     static Region* find_region_from_vaddr(Space&, VirtualAddress);
     static Region* find_user_region_from_vaddr(Space&, VirtualAddress);
 
+    // Returns the resident physical page behind the given address, so that a device can
+    // access it directly. The returned reference keeps the page alive while the device
+    // uses it. Returns null if the page has to be faulted in or copied on write first.
+    // For device writes the page is also pinned, and the caller has to unpin it once
+    // the device is done with it.
+    RefPtr<PhysicalPage> physical_page_for_device_access(Space*, VirtualAddress, bool device_writes);
+
     void dump_kernel_regions();
 
     PhysicalPage& shared_zero_page() { return *m_shared_zero_page; }
@@ -195,8 +250,16 @@ private:
 
     static Region* find_region_from_vaddr(VirtualAddress);
 
-    RefPtr<PhysicalPage> find_free_user_physical_page(bool);
-    u8* quickmap_page(PhysicalPage&);
+    bool handle_write_to_protected_page_table(VirtualAddress);
+
+    bool try_take_uncommitted_pages(size_t);
+    Optional<PhysicalAddress> take_page_from_regions();
+    void return_page_to_regions(PhysicalAddress);
+    Optional<PhysicalAddress> take_free_user_page(ShouldZeroFill, bool& is_zeroed);
+    Optional<PhysicalAddress> take_zeroed_page();
+    void zero_page(PhysicalAddress);
+    u8* quickmap_page(PhysicalPage& physical_page) { return quickmap_page(physical_page.paddr()); }
+    u8* quickmap_page(PhysicalAddress);
     void unquickmap_page();
 
     PageDirectoryEntry* quickmap_pd(PageDirectory&, size_t pdpt_index);
@@ -221,6 +284,11 @@ private:
     NonnullRefPtrVector<PhysicalRegion> m_user_physical_regions;
     NonnullRefPtrVector<PhysicalRegion> m_super_physical_regions;
 
+    // Free user pages that have already been zeroed by the PageZeroingTask.
+    SpinLock<u8> m_zeroed_pages_lock;
+    Vector<PhysicalAddress> m_zeroed_pages;
+    size_t m_zeroed_pages_target { 0 };
+
     InlineLinkedList<Region> m_user_regions;
     InlineLinkedList<Region> m_kernel_regions;
     Vector<UsedMemoryRange> m_used_memory_ranges;
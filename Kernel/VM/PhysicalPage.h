@@ -41,6 +41,16 @@ public:
     bool is_shared_zero_page() const;
     bool is_lazy_committed_page() const;
 
+    // A device is writing into this page. It must not become shared copy-on-write
+    // until the device is done, see AnonymousVMObject::clone().
+    void pin_for_device_writes() { m_device_write_pin_count.fetch_add(1, AK::memory_order_acq_rel); }
+    void unpin_for_device_writes()
+    {
+        auto previous_count = m_device_write_pin_count.fetch_sub(1, AK::memory_order_acq_rel);
+        VERIFY(previous_count > 0);
+    }
+    bool is_pinned_for_device_writes() const { return m_device_write_pin_count.load(AK::memory_order_acquire) > 0; }
+
 private:
     PhysicalPage(PhysicalAddress paddr, bool supervisor, bool may_return_to_freelist = true);
     ~PhysicalPage() = default;
@@ -48,6 +58,7 @@ private:
     void return_to_freelist() const;
 
     Atomic<u32> m_ref_count { 1 };
+    Atomic<u32> m_device_write_pin_count { 0 };
     bool m_may_return_to_freelist { true };
     bool m_supervisor { false };
     PhysicalAddress m_paddr;
@@ -4,7 +4,6 @@
 #include <AK/RefPtr.h>
 #include <AK/Vector.h>
 #include <Kernel/Assertions.h>
-#include <Kernel/Random.h>
 #include <Kernel/VM/PhysicalPage.h>
 #include <Kernel/VM/PhysicalRegion.h>
 
@@ -34,133 +33,174 @@ unsigned PhysicalRegion::finalize_capacity()
     VERIFY(!m_pages);
 
     m_pages = (m_upper.get() - m_lower.get()) / PAGE_SIZE;
-    m_bitmap.grow(m_pages, false);
+    if (!m_pages)
+        return 0;
+
+    m_first_pfn = m_lower.get() / PAGE_SIZE;
+    FlatPtr last_pfn = m_first_pfn + m_pages - 1;
+    for (unsigned order = 0; order <= max_order; ++order) {
+        // Bitmap searches only look at whole bytes, so round up; the padding bits never get set.
+        size_t block_count = (last_pfn >> order) - (m_first_pfn >> order) + 1;
+        m_free_blocks[order] = Bitmap(round_up_to_power_of_two(block_count, 64), false);
+    }
+
+    // Seed the free lists with the largest aligned blocks that fit, which also takes
+    // care of regions that don't start on, or aren't sized in, powers of two.
+    free_range(m_first_pfn, m_pages);
 
     return size();
 }
 
-NonnullRefPtrVector<PhysicalPage> PhysicalRegion::take_contiguous_free_pages(size_t count, bool supervisor, size_t physical_alignment)
+unsigned PhysicalRegion::order_for_page_count(size_t count)
 {
-    VERIFY(m_pages);
-    VERIFY(m_used != m_pages);
-
-    NonnullRefPtrVector<PhysicalPage> physical_pages;
-    physical_pages.ensure_capacity(count);
-
-    auto first_contiguous_page = find_contiguous_free_pages(count, physical_alignment);
+    unsigned order = 0;
+    while (((size_t)1 << order) < count)
+        ++order;
+    return order;
+}
 
-    for (size_t index = 0; index < count; index++)
-        physical_pages.append(PhysicalPage::create(m_lower.offset(PAGE_SIZE * (index + first_contiguous_page)), supervisor));
-    return physical_pages;
+Optional<unsigned> PhysicalRegion::largest_free_order() const
+{
+    for (int order = max_order; order >= 0; --order) {
+        if (m_free_block_count[order])
+            return order;
+    }
+    return {};
 }
 
-unsigned PhysicalRegion::find_contiguous_free_pages(size_t count, size_t physical_alignment)
+void PhysicalRegion::set_block_free(FlatPtr pfn, unsigned order, bool free)
 {
-    VERIFY(count != 0);
-    VERIFY(physical_alignment % PAGE_SIZE == 0);
-    // search from the last page we allocated
-    auto range = find_and_allocate_contiguous_range(count, physical_alignment / PAGE_SIZE);
-    VERIFY(range.has_value());
-    return range.value();
+    VERIFY(is_block_in_region(pfn, order));
+    auto index = block_index(pfn, order);
+    VERIFY(m_free_blocks[order].get(index) != free);
+    m_free_blocks[order].set(index, free);
+    if (free) {
+        ++m_free_block_count[order];
+        m_free_block_hint[order] = index;
+    } else {
+        --m_free_block_count[order];
+        m_free_block_hint[order] = index + 1 < m_free_blocks[order].size() ? index + 1 : 0;
+    }
 }
 
-Optional<unsigned> PhysicalRegion::find_one_free_page()
+Optional<FlatPtr> PhysicalRegion::allocate_block(unsigned order)
 {
-    if (m_used == m_pages) {
-        // We know we don't have any free pages, no need to check the bitmap
-        // Check if we can draw one from the return queue
-        if (m_recently_returned.size() > 0) {
-            u8 index = get_fast_random<u8>() % m_recently_returned.size();
-            Checked<FlatPtr> local_offset = m_recently_returned[index].get();
-            local_offset -= m_lower.get();
-            m_recently_returned.remove(index);
-            VERIFY(!local_offset.has_overflow());
-            VERIFY(local_offset.value() < (FlatPtr)(m_pages * PAGE_SIZE));
-            return local_offset.value() / PAGE_SIZE;
+    VERIFY(order <= max_order);
+
+    for (unsigned current_order = order; current_order <= max_order; ++current_order) {
+        if (!m_free_block_count[current_order])
+            continue;
+
+        auto index = m_free_blocks[current_order].find_one_anywhere_set(m_free_block_hint[current_order]);
+        VERIFY(index.has_value());
+        FlatPtr pfn = ((m_first_pfn >> current_order) + index.value()) << current_order;
+        set_block_free(pfn, current_order, false);
+
+        // Split the block, putting the upper half back on the next lower order each time.
+        while (current_order > order) {
+            --current_order;
+            set_block_free(pfn + ((FlatPtr)1 << current_order), current_order, true);
         }
-        return {};
+        return pfn;
     }
-    auto free_index = m_bitmap.find_one_anywhere_unset(m_free_hint);
-    if (!free_index.has_value())
-        return {};
+    return {};
+}
 
-    auto page_index = free_index.value();
-    m_bitmap.set(page_index, true);
-    m_used++;
-    m_free_hint = free_index.value() + 1; // Just a guess
-    if (m_free_hint >= m_bitmap.size())
-        m_free_hint = 0;
-    return page_index;
+void PhysicalRegion::free_block(FlatPtr pfn, unsigned order)
+{
+    VERIFY(order <= max_order);
+    VERIFY(!(pfn & (((FlatPtr)1 << order) - 1)));
+
+    while (order < max_order) {
+        FlatPtr buddy_pfn = pfn ^ ((FlatPtr)1 << order);
+        if (!is_block_in_region(buddy_pfn, order) || !m_free_blocks[order].get(block_index(buddy_pfn, order)))
+            break;
+        set_block_free(buddy_pfn, order, false);
+        pfn &= ~((FlatPtr)1 << order);
+        ++order;
+    }
+    set_block_free(pfn, order, true);
 }
 
-Optional<unsigned> PhysicalRegion::find_and_allocate_contiguous_range(size_t count, unsigned alignment)
+void PhysicalRegion::free_range(FlatPtr pfn, size_t count)
 {
+    while (count) {
+        unsigned order = 0;
+        while (order < max_order && !(pfn & ((FlatPtr)1 << order)) && ((size_t)2 << order) <= count)
+            ++order;
+        free_block(pfn, order);
+        pfn += (FlatPtr)1 << order;
+        count -= (size_t)1 << order;
+    }
+}
+
+NonnullRefPtrVector<PhysicalPage> PhysicalRegion::take_contiguous_free_pages(size_t count, bool supervisor, size_t physical_alignment)
+{
+    VERIFY(m_pages);
     VERIFY(count != 0);
-    size_t found_pages_count = 0;
-    // TODO: Improve how we deal with alignment != 1
-    auto first_index = m_bitmap.find_longest_range_of_unset_bits(count + alignment - 1, found_pages_count);
-    if (!first_index.has_value())
+    VERIFY(physical_alignment % PAGE_SIZE == 0);
+    VERIFY(!(physical_alignment & (physical_alignment - 1)));
+
+    // Buddy blocks are naturally aligned, so asking for a large enough order also
+    // satisfies the alignment.
+    auto order = max(order_for_page_count(count), order_for_page_count(physical_alignment / PAGE_SIZE));
+    if (order > max_order)
         return {};
 
-    auto page = first_index.value();
-    if (alignment != 1) {
-        auto lower_page = m_lower.get() / PAGE_SIZE;
-        page = ((lower_page + page + alignment - 1) & ~(alignment - 1)) - lower_page;
-    }
-    if (found_pages_count >= count) {
-        m_bitmap.set_range<true>(page, count);
-        m_used += count;
-        m_free_hint = first_index.value() + count + 1; // Just a guess
-        if (m_free_hint >= m_bitmap.size())
-            m_free_hint = 0;
-        return page;
-    }
-    return {};
+    auto first_pfn = allocate_block(order);
+    if (!first_pfn.has_value())
+        return {};
+
+    size_t block_pages = (size_t)1 << order;
+    if (count < block_pages)
+        free_range(first_pfn.value() + count, block_pages - count);
+    m_used += count;
+
+    NonnullRefPtrVector<PhysicalPage> physical_pages;
+    physical_pages.ensure_capacity(count);
+    for (size_t index = 0; index < count; index++)
+        physical_pages.append(PhysicalPage::create(PhysicalAddress((first_pfn.value() + index) * PAGE_SIZE), supervisor));
+    return physical_pages;
 }
 
 RefPtr<PhysicalPage> PhysicalRegion::take_free_page(bool supervisor)
 {
-    VERIFY(m_pages);
-
-    auto free_index = find_one_free_page();
-    if (!free_index.has_value())
+    auto paddr = take_free_page_address();
+    if (!paddr.has_value())
         return nullptr;
 
-    return PhysicalPage::create(m_lower.offset(free_index.value() * PAGE_SIZE), supervisor);
+    return PhysicalPage::create(paddr.value(), supervisor);
 }
 
-void PhysicalRegion::free_page_at(PhysicalAddress addr)
+Optional<PhysicalAddress> PhysicalRegion::take_free_page_address()
 {
     VERIFY(m_pages);
 
-    if (m_used == 0) {
-        VERIFY_NOT_REACHED();
-    }
-
-    Checked<FlatPtr> local_offset = addr.get();
-    local_offset -= m_lower.get();
-    VERIFY(!local_offset.has_overflow());
-    VERIFY(local_offset.value() < (FlatPtr)(m_pages * PAGE_SIZE));
+    auto pfn = allocate_block(0);
+    if (!pfn.has_value())
+        return {};
 
-    auto page = local_offset.value() / PAGE_SIZE;
-    m_bitmap.set(page, false);
-    m_free_hint = page; // We know we can find one here for sure
-    m_used--;
+    ++m_used;
+    return PhysicalAddress(pfn.value() * PAGE_SIZE);
 }
 
-void PhysicalRegion::return_page(const PhysicalPage& page)
+void PhysicalRegion::return_page(PhysicalAddress paddr)
 {
-    auto returned_count = m_recently_returned.size();
-    if (returned_count >= m_recently_returned.capacity()) {
-        // Return queue is full, pick a random entry and free that page
-        // and replace the entry with this page
-        auto& entry = m_recently_returned[get_fast_random<u8>()];
-        free_page_at(entry);
-        entry = page.paddr();
-    } else {
-        // Still filling the return queue, just append it
-        m_recently_returned.append(page.paddr());
+    VERIFY(m_pages);
+    VERIFY(m_used);
+
+    FlatPtr pfn = paddr.get() / PAGE_SIZE;
+    VERIFY(is_block_in_region(pfn, 0));
+
+    // Catch double frees: the page must not be part of any free block already.
+    for (unsigned order = 0; order <= max_order; ++order) {
+        FlatPtr block_pfn = pfn & ~(((FlatPtr)1 << order) - 1);
+        if (is_block_in_region(block_pfn, order))
+            VERIFY(!m_free_blocks[order].get(block_index(block_pfn, order)));
     }
+
+    free_block(pfn, 0);
+    --m_used;
 }
 
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 // includes
+#include <AK/Array.h>
 #include <AK/Bitmap.h>
 #include <AK/NonnullRefPtrVector.h>
 #include <AK/Optional.h>
@@ -9,10 +10,16 @@
 
 namespace Kernel {
 
+// Pages are handed out by a binary buddy allocator: every free block of 2^order pages
+// is naturally aligned and has one bit set in the bitmap for its order. Splitting and
+// coalescing walk at most max_order levels.
 class PhysicalRegion : public RefCounted<PhysicalRegion> {
     AK_MAKE_ETERNAL
 
 public:
+    // The largest block the allocator keeps track of is 2^max_order pages (4 MiB).
+    static constexpr unsigned max_order = 10;
+
     static NonnullRefPtr<PhysicalRegion> create(PhysicalAddress lower, PhysicalAddress upper);
     ~PhysicalRegion() = default;
 
@@ -22,29 +29,41 @@ public:
     PhysicalAddress lower() const { return m_lower; }
     PhysicalAddress upper() const { return m_upper; }
     unsigned size() const { return m_pages; }
-    unsigned used() const { return m_used - m_recently_returned.size(); }
-    unsigned free() const { return m_pages - m_used + m_recently_returned.size(); }
-    bool contains(const PhysicalPage& page) const { return page.paddr() >= m_lower && page.paddr() <= m_upper; }
+    unsigned used() const { return m_used; }
+    unsigned free() const { return m_pages - m_used; }
+    bool contains(const PhysicalPage& page) const { return contains(page.paddr()); }
+    bool contains(PhysicalAddress paddr) const { return paddr >= m_lower && paddr <= m_upper; }
+
+    size_t free_blocks_of_order(unsigned order) const { return m_free_block_count[order]; }
+    Optional<unsigned> largest_free_order() const;
 
     RefPtr<PhysicalPage> take_free_page(bool supervisor);
+    Optional<PhysicalAddress> take_free_page_address();
     NonnullRefPtrVector<PhysicalPage> take_contiguous_free_pages(size_t count, bool supervisor, size_t physical_alignment = PAGE_SIZE);
-    void return_page(const PhysicalPage& page);
+    void return_page(const PhysicalPage& page) { return_page(page.paddr()); }
+    void return_page(PhysicalAddress);
 
 private:
-    unsigned find_contiguous_free_pages(size_t count, size_t physical_alignment = PAGE_SIZE);
-    Optional<unsigned> find_and_allocate_contiguous_range(size_t count, unsigned alignment = 1);
-    Optional<unsigned> find_one_free_page();
-    void free_page_at(PhysicalAddress addr);
+    static unsigned order_for_page_count(size_t);
+
+    size_t block_index(FlatPtr pfn, unsigned order) const { return (pfn >> order) - (m_first_pfn >> order); }
+    bool is_block_in_region(FlatPtr pfn, unsigned order) const { return pfn >= m_first_pfn && pfn + (1u << order) <= m_first_pfn + m_pages; }
+    void set_block_free(FlatPtr pfn, unsigned order, bool);
+
+    Optional<FlatPtr> allocate_block(unsigned order);
+    void free_block(FlatPtr pfn, unsigned order);
+    void free_range(FlatPtr pfn, size_t count);
 
     PhysicalRegion(PhysicalAddress lower, PhysicalAddress upper);
 
     PhysicalAddress m_lower;
     PhysicalAddress m_upper;
+    FlatPtr m_first_pfn { 0 };
     unsigned m_pages { 0 };
     unsigned m_used { 0 };
-    Bitmap m_bitmap;
-    size_t m_free_hint { 0 };
-    Vector<PhysicalAddress, 256> m_recently_returned;
+    Array<Bitmap, max_order + 1> m_free_blocks;
+    Array<size_t, max_order + 1> m_free_block_count {};
+    Array<size_t, max_order + 1> m_free_block_hint {};
 };
 
 }
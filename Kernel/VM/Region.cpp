@@ -1,4 +1,5 @@
 // includes
+#include <AK/ByteBuffer.h>
 #include <AK/Memory.h>
 #include <AK/StringView.h>
 #include <Kernel/Debug.h>
@@ -66,16 +67,18 @@ void Region::unregister_purgeable_page_ranges()
     }
 }
 
-OwnPtr<Region> Region::clone(Process& new_owner)
+OwnPtr<Region> Region::clone(Process& new_owner, ShareVMObject share_vmobject)
 {
     VERIFY(Process::current());
 
     ScopedSpinLock lock(s_mm_lock);
 
-    if (m_shared) {
-        VERIFY(!m_stack);
-        if (vmobject().is_inode())
-            VERIFY(vmobject().is_shared_inode());
+    if (m_shared || share_vmobject == ShareVMObject::Yes) {
+        if (m_shared) {
+            VERIFY(!m_stack);
+            if (vmobject().is_inode())
+                VERIFY(vmobject().is_shared_inode());
+        }
 
         // Create a new region backed by the same VMObject.
         auto region = Region::create_user_accessible(
@@ -84,7 +87,9 @@ OwnPtr<Region> Region::clone(Process& new_owner)
             region->copy_purgeable_page_ranges(*this);
         region->set_mmap(m_mmap);
         region->set_shared(m_shared);
+        region->set_stack(m_stack);
         region->set_syscall_region(is_syscall_region());
+        region->set_access_pattern(m_access_pattern);
         return region;
     }
 
@@ -96,7 +101,6 @@ OwnPtr<Region> Region::clone(Process& new_owner)
         return {};
 
     // Set up a COW region. The parent (this) region becomes COW as well!
-    remap();
     auto clone_region = Region::create_user_accessible(
         &new_owner, m_range, vmobject_clone.release_nonnull(), m_offset_in_vmobject, m_name, access(), m_cacheable ? Cacheable::Yes : Cacheable::No, m_shared);
     if (m_vmobject->is_anonymous())
@@ -108,6 +112,7 @@ OwnPtr<Region> Region::clone(Process& new_owner)
         clone_region->set_stack(true);
     }
     clone_region->set_syscall_region(is_syscall_region());
+    clone_region->set_access_pattern(m_access_pattern);
     clone_region->set_mmap(m_mmap);
     return clone_region;
 }
@@ -413,6 +418,21 @@ PageFaultResponse Region::handle_fault(const PageFault& fault, ScopedSpinLock<Re
             auto page_index_in_vmobject = translate_to_vmobject_page(page_index_in_region);
             page_slot = static_cast<AnonymousVMObject&>(*m_vmobject).allocate_committed_page(page_index_in_vmobject);
             remap_vmobject_page(page_index_in_vmobject);
+            populate_committed_pages_ahead(page_index_in_region);
+            return PageFaultResponse::Continue;
+        }
+        if (!page_slot.is_null()) {
+            // fork() doesn't map the child's regions, so its first touch of a page lands here.
+            dbgln_if(PAGE_FAULT_DEBUG, "NP(resident) fault in Region({})[{}] at {}", this, page_index_in_region, fault.vaddr());
+            if (fault.is_write() && should_cow(page_index_in_region)) {
+                if (page_slot->is_shared_zero_page())
+                    return handle_zero_fault(page_index_in_region);
+                return handle_cow_fault(page_index_in_region);
+            }
+            if (!remap_vmobject_page(translate_to_vmobject_page(page_index_in_region)))
+                return PageFaultResponse::OutOfMemory;
+            auto fault_around_start = page_index_in_region & ~(fault_around_pages - 1);
+            map_resident_pages(fault_around_start, min(fault_around_start + fault_around_pages, page_count()));
             return PageFaultResponse::Continue;
         }
 #ifdef MAP_SHARED_ZERO_PAGE_LAZILY
@@ -478,6 +498,7 @@ PageFaultResponse Region::handle_zero_fault(size_t page_index_in_region)
         dmesgln("MM: handle_zero_fault was unable to allocate a page table to map {}", page_slot);
         return PageFaultResponse::OutOfMemory;
     }
+    populate_committed_pages_ahead(page_index_in_region);
     return PageFaultResponse::Continue;
 }
 
@@ -518,10 +539,14 @@ PageFaultResponse Region::handle_inode_fault(size_t page_index_in_region, Scoped
 
     dbgln_if(PAGE_FAULT_DEBUG, "Inode fault in {} page index: {}", name(), page_index_in_region);
 
+    auto fault_around_start = page_index_in_region & ~(fault_around_pages - 1);
+    auto fault_around_end = min(fault_around_start + fault_around_pages, page_count());
+
     if (!vmobject_physical_page_entry.is_null()) {
         dbgln_if(PAGE_FAULT_DEBUG, "MM: page_in_from_inode() but page already present. Fine with me!");
         if (!remap_vmobject_page(page_index_in_vmobject))
             return PageFaultResponse::OutOfMemory;
+        map_resident_pages(fault_around_start, fault_around_end);
         return PageFaultResponse::Continue;
     }
 
@@ -529,13 +554,23 @@ PageFaultResponse Region::handle_inode_fault(size_t page_index_in_region, Scoped
     if (current_thread)
         current_thread->did_inode_fault();
 
+    auto page_count_to_read = page_count_to_read_for_inode_fault(page_index_in_region);
+    m_next_sequential_fault_page = page_index_in_region + page_count_to_read;
+
     u8 page_buffer[PAGE_SIZE];
     auto& inode = inode_vmobject.inode();
 
-    // Reading the page may block, so release the MM lock temporarily
+    // Reading the pages may block, so release the MM lock temporarily
     mm_lock.unlock();
-    auto buffer = UserOrKernelBuffer::for_kernel_buffer(page_buffer);
-    auto result = inode.read_bytes(page_index_in_vmobject * PAGE_SIZE, PAGE_SIZE, buffer, nullptr);
+    ByteBuffer read_ahead_buffer;
+    if (page_count_to_read > 1) {
+        read_ahead_buffer = ByteBuffer::create_uninitialized(page_count_to_read * PAGE_SIZE);
+        if (read_ahead_buffer.is_null())
+            page_count_to_read = 1;
+    }
+    u8* data = page_count_to_read > 1 ? read_ahead_buffer.data() : page_buffer;
+    auto buffer = UserOrKernelBuffer::for_kernel_buffer(data);
+    auto result = inode.read_bytes(page_index_in_vmobject * PAGE_SIZE, page_count_to_read * PAGE_SIZE, buffer, nullptr);
     mm_lock.lock();
 
     if (result.is_error()) {
@@ -543,36 +578,123 @@ PageFaultResponse Region::handle_inode_fault(size_t page_index_in_region, Scoped
         return PageFaultResponse::ShouldCrash;
     }
     auto nread = result.value();
-    if (nread < PAGE_SIZE) {
-        // If we read less than a page, zero out the rest to avoid leaking uninitialized data.
-        memset(page_buffer + nread, 0, PAGE_SIZE - nread);
+    if (nread < page_count_to_read * PAGE_SIZE) {
+        // If we read less than we asked for, zero out the rest to avoid leaking uninitialized data.
+        memset(data + nread, 0, page_count_to_read * PAGE_SIZE - nread);
     }
 
-    vmobject_physical_page_entry = MM.allocate_user_physical_page(MemoryManager::ShouldZeroFill::No);
-    if (vmobject_physical_page_entry.is_null()) {
-        dmesgln("MM: handle_inode_fault was unable to allocate a physical page");
-        return PageFaultResponse::OutOfMemory;
-    }
+    for (size_t i = 0; i < page_count_to_read; ++i) {
+        auto& physical_page_entry = inode_vmobject.physical_pages()[page_index_in_vmobject + i];
+        if (!physical_page_entry.is_null())
+            continue;
+
+        physical_page_entry = MM.allocate_user_physical_page(MemoryManager::ShouldZeroFill::No);
+        if (physical_page_entry.is_null()) {
+            // Pages past the faulting one are only read ahead, so running out there is fine.
+            if (i != 0)
+                break;
+            dmesgln("MM: handle_inode_fault was unable to allocate a physical page");
+            return PageFaultResponse::OutOfMemory;
+        }
 
-    u8* dest_ptr = MM.quickmap_page(*vmobject_physical_page_entry);
-    {
-        void* fault_at;
-        if (!safe_memcpy(dest_ptr, page_buffer, PAGE_SIZE, fault_at)) {
-            if ((u8*)fault_at >= dest_ptr && (u8*)fault_at <= dest_ptr + PAGE_SIZE)
-                dbgln("      >> inode fault: error copying data to {}/{}, failed at {}",
-                    vmobject_physical_page_entry->paddr(),
-                    VirtualAddress(dest_ptr),
-                    VirtualAddress(fault_at));
-            else
-                VERIFY_NOT_REACHED();
+        u8* dest_ptr = MM.quickmap_page(*physical_page_entry);
+        {
+            void* fault_at;
+            if (!safe_memcpy(dest_ptr, data + i * PAGE_SIZE, PAGE_SIZE, fault_at)) {
+                if ((u8*)fault_at >= dest_ptr && (u8*)fault_at <= dest_ptr + PAGE_SIZE)
+                    dbgln("      >> inode fault: error copying data to {}/{}, failed at {}",
+                        physical_page_entry->paddr(),
+                        VirtualAddress(dest_ptr),
+                        VirtualAddress(fault_at));
+                else
+                    VERIFY_NOT_REACHED();
+            }
         }
+        MM.unquickmap_page();
     }
-    MM.unquickmap_page();
 
     remap_vmobject_page(page_index_in_vmobject);
+    map_resident_pages(fault_around_start, max(fault_around_end, page_index_in_region + page_count_to_read));
     return PageFaultResponse::Continue;
 }
 
+size_t Region::page_count_to_read_for_inode_fault(size_t page_index_in_region)
+{
+    size_t read_ahead_pages = 0;
+    switch (m_access_pattern) {
+    case AccessPattern::Random:
+        break;
+    case AccessPattern::Sequential:
+        read_ahead_pages = max_read_ahead_pages;
+        break;
+    case AccessPattern::Normal:
+        // Grow the read-ahead window while faults keep landing right after the pages
+        // we read last time, and drop it as soon as one doesn't.
+        if (page_index_in_region != 0 && page_index_in_region == m_next_sequential_fault_page)
+            m_read_ahead_pages = m_read_ahead_pages ? min<size_t>(m_read_ahead_pages * 2, max_read_ahead_pages) : 4;
+        else
+            m_read_ahead_pages = 0;
+        read_ahead_pages = m_read_ahead_pages;
+        break;
+    }
+
+    // Stop at the end of the region and the inode, and at the first page that is already resident.
+    auto& inode_vmobject = static_cast<InodeVMObject&>(vmobject());
+    auto page_index_in_vmobject = translate_to_vmobject_page(page_index_in_region);
+    auto inode_page_count = ceil_div(static_cast<size_t>(inode_vmobject.inode().size()), static_cast<size_t>(PAGE_SIZE));
+    size_t count = 1;
+    while (count <= read_ahead_pages && page_index_in_region + count < page_count()) {
+        auto index = page_index_in_vmobject + count;
+        if (index >= inode_page_count || index >= inode_vmobject.page_count() || !inode_vmobject.physical_pages()[index].is_null())
+            break;
+        ++count;
+    }
+    return count;
+}
+
+void Region::map_resident_pages(size_t first_page_index, size_t end_page_index)
+{
+    if (m_access_pattern == AccessPattern::Random)
+        return;
+
+    ScopedSpinLock lock(s_mm_lock);
+    if (!m_page_directory)
+        return;
+    end_page_index = min(end_page_index, page_count());
+    if (first_page_index >= end_page_index)
+        return;
+
+    ScopedSpinLock page_lock(m_page_directory->get_lock());
+    for (size_t index = first_page_index; index < end_page_index; ++index) {
+        if (!physical_page(index))
+            continue;
+        if (!map_individual_page_impl(index))
+            break;
+    }
+    MM.flush_tlb(m_page_directory, vaddr_from_page_index(first_page_index), end_page_index - first_page_index);
+}
+
+void Region::populate_committed_pages_ahead(size_t page_index_in_region)
+{
+    // Regions that are known to be walked front to back get the committed pages after
+    // the faulting one right away, mapped in one go, instead of one fault per page.
+    if (m_access_pattern != AccessPattern::Sequential || !vmobject().is_anonymous())
+        return;
+
+    auto& anonymous_vmobject = static_cast<AnonymousVMObject&>(vmobject());
+    size_t first_page_index = page_index_in_region + 1;
+    size_t count = 0;
+    while (count < max_read_ahead_pages && first_page_index + count < page_count()) {
+        auto& page_slot = physical_page_slot(first_page_index + count);
+        if (page_slot.is_null() || !page_slot->is_lazy_committed_page())
+            break;
+        page_slot = anonymous_vmobject.allocate_committed_page(translate_to_vmobject_page(first_page_index + count));
+        ++count;
+    }
+    if (count)
+        remap_vmobject_page_range(translate_to_vmobject_page(first_page_index), count);
+}
+
 RefPtr<Process> Region::get_owner()
 {
     return m_owner.strong_ref();
@@ -46,6 +46,17 @@ public:
         Yes,
     };
 
+    enum class AccessPattern : u8 {
+        Normal,
+        Random,
+        Sequential,
+    };
+
+    // Pages mapped from the resident neighbourhood of an inode fault.
+    static constexpr size_t fault_around_pages = 16;
+    // Upper bound on the pages read in one go after a page fault.
+    static constexpr size_t max_read_ahead_pages = 16;
+
     static NonnullOwnPtr<Region> create_user_accessible(Process*, const Range&, NonnullRefPtr<VMObject>, size_t offset_in_vmobject, String name, Region::Access access, Cacheable, bool shared);
     static NonnullOwnPtr<Region> create_kernel_only(const Range&, NonnullRefPtr<VMObject>, size_t offset_in_vmobject, String name, Region::Access access, Cacheable = Cacheable::Yes);
 
@@ -86,7 +97,13 @@ public:
 
     PageFaultResponse handle_fault(const PageFault&, ScopedSpinLock<RecursiveSpinLock>&);
 
-    OwnPtr<Region> clone(Process&);
+    enum class ShareVMObject {
+        No,
+        Yes,
+    };
+    // Without ShareVMObject::Yes, private regions get a copy-on-write clone of the VMObject.
+    // The caller has to write-protect this region's pages, see MemoryManager::write_protect_user_page_tables().
+    OwnPtr<Region> clone(Process&, ShareVMObject = ShareVMObject::No);
 
     bool contains(VirtualAddress vaddr) const
     {
@@ -225,6 +242,13 @@ public:
     bool is_syscall_region() const { return m_syscall_region; }
     void set_syscall_region(bool b) { m_syscall_region = b; }
 
+    AccessPattern access_pattern() const { return m_access_pattern; }
+    void set_access_pattern(AccessPattern access_pattern)
+    {
+        m_access_pattern = access_pattern;
+        m_read_ahead_pages = 0;
+    }
+
 private:
     Region(const Range&, NonnullRefPtr<VMObject>, size_t offset_in_vmobject, String, Region::Access access, Cacheable, bool shared);
 
@@ -245,6 +269,10 @@ private:
     PageFaultResponse handle_inode_fault(size_t page_index, ScopedSpinLock<RecursiveSpinLock>&);
     PageFaultResponse handle_zero_fault(size_t page_index);
 
+    size_t page_count_to_read_for_inode_fault(size_t page_index);
+    void map_resident_pages(size_t first_page_index, size_t end_page_index);
+    void populate_committed_pages_ahead(size_t page_index);
+
     bool map_individual_page_impl(size_t page_index);
 
     void register_purgeable_page_ranges();
@@ -261,6 +289,9 @@ private:
     bool m_stack : 1 { false };
     bool m_mmap : 1 { false };
     bool m_syscall_region : 1 { false };
+    AccessPattern m_access_pattern { AccessPattern::Normal };
+    u8 m_read_ahead_pages { 0 };
+    size_t m_next_sequential_fault_page { 0 };
     WeakPtr<Process> m_owner;
 };
 
@@ -6,10 +6,14 @@
 namespace Kernel {
 
 WorkQueue* g_io_work;
+WorkQueue* g_read_ahead_work;
 
 void WorkQueue::initialize()
 {
     g_io_work = new WorkQueue("IO WorkQueue");
+    // Read-ahead blocks on device requests, which may need g_io_work to complete,
+    // so it must not run on that queue.
+    g_read_ahead_work = new WorkQueue("ReadAhead WorkQueue");
 }
 
 WorkQueue::WorkQueue(const char* name)
@@ -6,6 +6,7 @@
 namespace Kernel {
 
 extern WorkQueue* g_io_work;
+extern WorkQueue* g_read_ahead_work;
 
 class WorkQueue {
     AK_MAKE_NONCOPYABLE(WorkQueue);
@@ -49,7 +50,7 @@ public:
 
 private:
     struct WorkItem {
-        IntrusiveListNode m_node;
+        IntrusiveListNode<WorkItem> m_node;
         void (*function)(void*);
         void* data;
         void (*free_data)(void*);
@@ -60,7 +61,7 @@ private:
 
     RefPtr<Thread> m_thread;
     WaitQueue m_wait_queue;
-    IntrusiveList<WorkItem, &WorkItem::m_node> m_items;
+    IntrusiveList<WorkItem, RawPtr<WorkItem>, &WorkItem::m_node> m_items;
     SpinLock<u8> m_lock;
 };
 